@@ -0,0 +1,2 @@
+const char g_GitVersion[] = "f055cd60b650cb89ec0c1faf88ebe8c61c958749";
+const char g_GitBranch[] ="master";
@@ -201,6 +201,22 @@ function _G.Build(args)
     end
   end
 
+  -- Resolve pass barriers to the pass tables they refer to
+  for id, data in pairs(passes) do
+    for i, dep_id in util.nil_ipairs(data.Depends) do
+      local dep = passes[dep_id]
+      if type(dep_id) == "table" then
+        dep = dep_id
+      elseif not dep then
+        croak("Pass %s depends on unknown pass %s", id, tostring(dep_id))
+      end
+      if dep.BuildOrder >= data.BuildOrder then
+        croak("Pass %s depends on pass %s, which does not build before it", id, dep.Name)
+      end
+      data.Depends[i] = dep
+    end
+  end
+
   -- Assume syntax for C and DotNet is always needed
   -- for now. Could possible make an option for which generator sets to load
   -- in the future.
@@ -102,10 +102,21 @@ local function get_scanners(nodes)
   return scanners, scanner_to_index
 end
 
-local function save_passes(w, passes)
+local function save_passes(w, passes, pass_to_index)
   w:begin_array("Passes")
   for _, s in ipairs(passes) do
-    w:write_string(s.Name)
+    w:begin_object()
+    w:write_string(s.Name, "Name")
+    w:begin_array("Depends")
+    for _, dep in util.nil_ipairs(s.Depends) do
+      -- Passes without any nodes are trivially done.
+      local dep_index = pass_to_index[dep]
+      if dep_index then
+        w:write_number(dep_index)
+      end
+    end
+    w:end_array()
+    w:end_object()
   end
   w:end_array()
 end
@@ -125,6 +136,7 @@ local function save_scanners(w, scanners)
       w:write_bool(s.RequireWhitespace, 'RequireWhitespace')
       w:write_bool(s.UseSeparators, 'UseSeparators')
       w:write_bool(s.BareMeansSystem, 'BareMeansSystem')
+      w:write_bool(s.StopAfterPreamble, 'StopAfterPreamble')
       w:begin_array('Keywords')
       for _, kw in util.nil_ipairs(s.Keywords) do
         w:write_string(kw)
@@ -211,6 +223,10 @@ local function save_nodes(w, nodes, pass_to_index, scanner_to_index)
       w:write_bool(true, "Expensive")
     end
 
+    if node.digest_outputs then
+      w:write_bool(true, "ContentDigestOutputs")
+    end
+
     w:end_object()
   end
   w:end_array()
@@ -351,6 +367,12 @@ function save_dag_data(bindings, default_variant, default_subvariant, content_di
 
   misc_options = misc_options or {}
   local max_expensive_jobs = misc_options.MaxExpensiveJobs or -1
+  local overlap_passes = misc_options.OverlapPasses and 1 or 0
+  local action_cache_dir = misc_options.ActionCacheDir
+  local action_cache_size = misc_options.ActionCacheSizeMB or 4096
+  local remote_cache_url = misc_options.RemoteCacheUrl
+  local remote_cache_upload = (misc_options.RemoteCacheUpload == false) and 0 or 1
+  local sign_by_content = misc_options.SignByContent and 1 or 0
 
   printf("save_dag_data: %d bindings, %d accessed files", #bindings, #accessed_lua_files)
 
@@ -376,7 +398,7 @@ function save_dag_data(bindings, default_variant, default_subvariant, content_di
 
   w:begin_object()
   save_configs(w, bindings, default_variant, default_subvariant)
-  save_passes(w, passes)
+  save_passes(w, passes, pass_to_index)
   save_scanners(w, scanners)
   save_nodes(w, nodes, pass_to_index, scanner_to_index)
   save_signatures(w, accessed_lua_files)
@@ -390,6 +412,18 @@ function save_dag_data(bindings, default_variant, default_subvariant, content_di
   end
 
   w:write_number(max_expensive_jobs, "MaxExpensiveCount")
+  w:write_number(overlap_passes, "OverlapPasses")
+  w:write_number(action_cache_size, "ActionCacheSizeMB")
+  w:write_number(remote_cache_upload, "RemoteCacheUpload")
+  w:write_number(sign_by_content, "SignByContent")
+
+  if action_cache_dir then
+    w:write_string(action_cache_dir, "ActionCacheDir")
+  end
+
+  if remote_cache_url then
+    w:write_string(remote_cache_url, "RemoteCacheUrl")
+  end
 
   w:end_object()
 
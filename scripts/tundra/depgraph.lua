@@ -94,6 +94,7 @@ function make_node(data_)
     outputs           = outputs_sorted,
     is_precious       = data_.Precious,
     expensive         = data_.Expensive,
+    digest_outputs    = data_.ContentDigestOutputs,
     overwrite_outputs = overwrite,
     src_env           = env_,
     env               = env_.external_vars,
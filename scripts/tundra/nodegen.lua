@@ -863,6 +863,7 @@ function _G.DefRule(ruledef)
       ImplicitInputs = ruledef.ImplicitInputs,
       Scanner        = scanner,
       Dependencies   = deps,
+      ContentDigestOutputs = ruledef.ContentDigestOutputs,
     }
   end
 
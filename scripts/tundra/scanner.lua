@@ -35,6 +35,7 @@ function make_generic_scanner(data)
   mashup[#mashup + 1] = data.RequireWhitespace and 'y' or 'n'
   mashup[#mashup + 1] = data.UseSeparators and 'y' or 'n'
   mashup[#mashup + 1] = data.BareMeansSystem and 'y' or 'n'
+  mashup[#mashup + 1] = data.StopAfterPreamble and 'y' or 'n'
   local key_str = table.concat(mashup, '\001')
   local key = native.digest_guid(key_str)
   local value = generic_scanner_cache[key]
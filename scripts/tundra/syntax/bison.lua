@@ -6,6 +6,7 @@ DefRule {
   Name = "Bison",
   Command = "", -- Replaced on a per-instance basis.
   ConfigInvariant = true,
+  ContentDigestOutputs = true,
 
   Blueprint = {
     Source       = { Required = true, Type  = "string" },
@@ -8,6 +8,7 @@ DefRule {
   Name = "Flex",
   Command = "flex --outfile=$(@:[1]) --header-file=$(@:[2]) $(<)",
   ConfigInvariant = true,
+  ContentDigestOutputs = true,
 
   Blueprint = {
     Source           = { Required = true, Type = "string" },
@@ -8,6 +8,7 @@ DefRule {
   Name = "Lemon",
   Command = "lemon -d$(OUTDIR) $(<)",
   ConfigInvariant = true,
+  ContentDigestOutputs = true,
 
   Blueprint = {
     Source = { Required = true, Type = "string" },
@@ -27,6 +27,7 @@ local function get_asm_scanner(env, fn)
       RequireWhitespace = test_bool("ASMINC_REQUIRE_WHITESPACE", "yes"),
       UseSeparators = test_bool("ASMINC_USE_SEPARATORS", "yes"),
       BareMeansSystem = test_bool("ASMINC_BARE_MEANS_SYSTEM", "no"),
+      StopAfterPreamble = test_bool("ASMINC_STOP_AFTER_PREAMBLE", "no") == 1,
     }
     return scanner.make_generic_scanner(data)
   end
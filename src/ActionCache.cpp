@@ -0,0 +1,623 @@
+#include "ActionCache.hpp"
+#include "DagData.hpp"
+#include "BinaryWriter.hpp"
+#include "MemoryMappedFile.hpp"
+#include "MemAllocHeap.hpp"
+#include "FileInfo.hpp"
+#include "Atomic.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(TUNDRA_UNIX)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(TUNDRA_LINUX)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#if defined(TUNDRA_WIN32)
+#include <windows.h>
+#endif
+
+namespace t2
+{
+
+// An action record on disk is this header followed by one ActionCacheOutput
+// per output file of the node, in output file order.
+struct ActionCacheEntryHeader
+{
+  static const uint32_t MagicNumber = 0x2c0be1a8 ^ kTundraHashMagic;
+
+  uint32_t m_MagicNumber;
+  uint32_t m_OutputCount;
+};
+
+struct ActionCacheOutput
+{
+  uint64_t   m_Size;
+  HashDigest m_ContentDigest;
+  uint32_t   m_Mode;
+};
+
+static const char* const s_KindDirs[] = { "objects", "actions" };
+
+// Longer than the name of anything the cache keeps in its directory, such as
+// "/actions/ab/<digest>" or "/index.actioncache.<pid>.tmp".
+static const size_t kMaxCacheNameLength = 64;
+static_assert(sizeof "/actions/ab/" + kDigestStringSize <= kMaxCacheNameLength, "digest too long");
+
+// Format the path of a file in the cache directory. ActionCacheInit() makes
+// sure the directory leaves room for all of them, so they can't be truncated.
+static void CachePath(char (&path)[kMaxPathLength], const ActionCache* self, const char* fmt, ...)
+{
+  size_t dir_len = strlen(self->m_Dir);
+  memcpy(path, self->m_Dir, dir_len);
+
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(path + dir_len, kMaxCacheNameLength, fmt, args);
+  va_end(args);
+
+  if (len < 0 || size_t(len) >= kMaxCacheNameLength)
+    Croak("action cache: path too long in %s", self->m_Dir);
+}
+
+void ActionCachePath(const ActionCache* self, uint32_t kind, const HashDigest& digest, char (&path)[kMaxPathLength])
+{
+  char digest_str[kDigestStringSize];
+  DigestToString(digest_str, digest);
+  CachePath(path, self, "/%s/%.2s/%s", s_KindDirs[kind], digest_str, digest_str);
+}
+
+void ActionCacheTempPath(ActionCache* self, char (&path)[kMaxPathLength])
+{
+  uint32_t serial = AtomicIncrement(&self->m_TempCounter);
+  CachePath(path, self, "/tmp/%u-%u", self->m_ProcessId, serial);
+}
+
+static void ActionCacheTouch(ActionCache* self, uint32_t kind, const HashDigest& digest, uint64_t size)
+{
+  ActionCacheRecord r;
+  memset(&r, 0, sizeof r);
+  r.m_Size       = size;
+  r.m_AccessTime = self->m_AccessTime;
+  r.m_Digest     = digest;
+  r.m_Kind       = kind;
+
+  MutexLock(&self->m_Lock);
+  BufferAppendOne(&self->m_Touched, self->m_Heap, r);
+  MutexUnlock(&self->m_Lock);
+}
+
+// Move a finished temporary file into place. The fan-out directories are
+// created the first time something is stored in them.
+static bool ActionCacheCommit(const char* tmp_path, const char* path)
+{
+  if (RenameFile(tmp_path, path))
+    return true;
+
+  char dir[kMaxPathLength];
+  strncpy(dir, path, sizeof dir);
+  dir[sizeof(dir) - 1] = '\0';
+
+  if (char* slash = strrchr(dir, '/'))
+  {
+    *slash = '\0';
+    if (MakeDirectory(dir) && RenameFile(tmp_path, path))
+      return true;
+  }
+
+  remove(tmp_path);
+  return false;
+}
+
+static uint32_t GetFileMode(const char* filename)
+{
+#if defined(TUNDRA_UNIX)
+  struct stat s;
+  if (0 == stat(filename, &s))
+    return uint32_t(s.st_mode & 0777);
+#endif
+  return 0;
+}
+
+// Copy an output file into the object store, named by the digest of its
+// contents. Identical outputs of different actions are only stored once.
+static bool StoreObject(ActionCache* self, const char* filename, ActionCacheOutput* output)
+{
+  char tmp_path[kMaxPathLength];
+  ActionCacheTempPath(self, tmp_path);
+
+  FILE* src = fopen(filename, "rb");
+  if (!src)
+    return false;
+
+  FILE* dst = fopen(tmp_path, "wb");
+  if (!dst)
+  {
+    fclose(src);
+    return false;
+  }
+
+  HashState h;
+  HashInit(&h);
+
+  bool     success = true;
+  uint64_t size    = 0;
+  char     buffer[65536];
+
+  while (size_t nbytes = fread(buffer, 1, sizeof buffer, src))
+  {
+    HashUpdate(&h, buffer, nbytes);
+    size += nbytes;
+
+    if (nbytes != fwrite(buffer, 1, nbytes, dst))
+    {
+      success = false;
+      break;
+    }
+  }
+
+  success = success && !ferror(src);
+  fclose(src);
+
+  if (0 != fclose(dst) || !success)
+  {
+    remove(tmp_path);
+    return false;
+  }
+
+  memset(output, 0, sizeof *output);
+  HashFinalize(&h, &output->m_ContentDigest);
+  output->m_Size = size;
+  output->m_Mode = GetFileMode(filename);
+
+  char path[kMaxPathLength];
+  ActionCachePath(self, ActionCacheRecord::kKindObject, output->m_ContentDigest, path);
+
+  if (GetFileInfo(path).Exists())
+  {
+    remove(tmp_path);
+  }
+  else if (!ActionCacheCommit(tmp_path, path))
+  {
+    return false;
+  }
+
+  ActionCacheTouch(self, ActionCacheRecord::kKindObject, output->m_ContentDigest, size);
+  return true;
+}
+
+// Copy an object back out to a new file, sharing the data blocks with the
+// store when the file system supports it. The file is renamed over the output
+// afterwards, so an old hard link to the output is never written through.
+static bool RestoreObject(const char* object_path, const char* filename, uint32_t mode)
+{
+  FILE* src = fopen(object_path, "rb");
+  if (!src)
+    return false;
+
+  FILE* dst = fopen(filename, "wb");
+  if (!dst)
+  {
+    fclose(src);
+    return false;
+  }
+
+  bool success = false;
+
+#if defined(TUNDRA_LINUX) && defined(FICLONE)
+  success = 0 == ioctl(fileno(dst), FICLONE, fileno(src));
+#endif
+
+  if (!success)
+  {
+    success = true;
+
+    char buffer[65536];
+    while (size_t nbytes = fread(buffer, 1, sizeof buffer, src))
+    {
+      if (nbytes != fwrite(buffer, 1, nbytes, dst))
+      {
+        success = false;
+        break;
+      }
+    }
+
+    success = success && !ferror(src);
+  }
+
+  fclose(src);
+
+  if (0 != fclose(dst))
+    success = false;
+
+#if defined(TUNDRA_UNIX)
+  if (success && mode)
+    chmod(filename, mode);
+#endif
+
+  if (!success)
+    remove(filename);
+
+  return success;
+}
+
+bool ActionCacheInit(ActionCache* self, MemAllocHeap* heap, const char* dir, uint64_t max_size)
+{
+  // Truncated paths could name the wrong file, so don't use a directory that
+  // doesn't leave room for every name in it.
+  if (strlen(dir) + kMaxCacheNameLength > sizeof self->m_Dir)
+  {
+    Log(kWarning, "action cache directory name too long; not using %s", dir);
+    return false;
+  }
+
+  strcpy(self->m_Dir, dir);
+
+  self->m_MaxSize     = max_size;
+  self->m_AccessTime  = time(nullptr);
+#if defined(TUNDRA_WIN32)
+  self->m_ProcessId   = (uint32_t) GetCurrentProcessId();
+#else
+  self->m_ProcessId   = (uint32_t) getpid();
+#endif
+  self->m_TempCounter = 0;
+  self->m_Heap        = heap;
+
+  MutexInit(&self->m_Lock);
+  BufferInit(&self->m_Touched);
+
+  char path[kMaxPathLength];
+
+  bool success = MakeDirectory(self->m_Dir);
+
+  for (const char* subdir : s_KindDirs)
+  {
+    CachePath(path, self, "/%s", subdir);
+    success = success && MakeDirectory(path);
+  }
+
+  CachePath(path, self, "/tmp");
+  success = success && MakeDirectory(path);
+
+  if (!success)
+    Log(kWarning, "couldn't create action cache directory %s", self->m_Dir);
+
+  return true;
+}
+
+void ActionCacheDestroy(ActionCache* self)
+{
+  BufferDestroy(&self->m_Touched, self->m_Heap);
+  MutexDestroy(&self->m_Lock);
+}
+
+bool ActionCacheRestore(ActionCache* self, const HashDigest& key, const NodeData* node_data)
+{
+  TimingScope timing_scope(nullptr, &g_Stats.m_ActionCacheRestoreTimeCycles);
+
+  const int          output_count = node_data->m_OutputFiles.GetCount();
+  ActionCacheOutput* outputs      = (ActionCacheOutput*) alloca(output_count * sizeof(ActionCacheOutput));
+
+  char path[kMaxPathLength];
+  ActionCachePath(self, ActionCacheRecord::kKindAction, key, path);
+
+  bool valid = false;
+
+  if (FILE* f = fopen(path, "rb"))
+  {
+    ActionCacheEntryHeader header;
+    valid = 1 == fread(&header, sizeof header, 1, f) &&
+            ActionCacheEntryHeader::MagicNumber == header.m_MagicNumber &&
+            uint32_t(output_count) == header.m_OutputCount &&
+            size_t(output_count) == fread(outputs, sizeof(ActionCacheOutput), output_count, f);
+    fclose(f);
+  }
+
+  if (!valid)
+  {
+    AtomicIncrement(&g_Stats.m_ActionCacheMisses);
+    return false;
+  }
+
+  // Copy every object out next to its output first, and only replace the
+  // outputs once all of them are there. An object that's gone (most likely
+  // evicted) then leaves the outputs as they were, and the action runs and
+  // stores it again.
+  typedef char TempPath[kMaxPathLength];
+  TempPath* tmp_paths    = HeapAllocateArray<TempPath>(self->m_Heap, output_count);
+  int       copied_count = 0;
+
+  for (; copied_count < output_count; ++copied_count)
+  {
+    const int   i        = copied_count;
+    const char* filename = node_data->m_OutputFiles[i].m_Filename;
+    uint32_t    serial   = AtomicIncrement(&self->m_TempCounter);
+    int         len      = snprintf(tmp_paths[i], sizeof tmp_paths[i], "%s.%u-%u.restore", filename, self->m_ProcessId, serial);
+
+    ActionCachePath(self, ActionCacheRecord::kKindObject, outputs[i].m_ContentDigest, path);
+
+    if (len < 0 || size_t(len) >= sizeof tmp_paths[i] || !RestoreObject(path, tmp_paths[i], outputs[i].m_Mode))
+    {
+      Log(kDebug, "action cache: couldn't restore %s from %s", filename, path);
+      break;
+    }
+  }
+
+  int moved_count = 0;
+
+  if (copied_count == output_count)
+  {
+    for (; moved_count < output_count; ++moved_count)
+    {
+      const char* filename = node_data->m_OutputFiles[moved_count].m_Filename;
+
+      if (!RenameFile(tmp_paths[moved_count], filename))
+      {
+        Log(kDebug, "action cache: couldn't move %s into place", filename);
+        break;
+      }
+    }
+  }
+
+  for (int i = moved_count; i < copied_count; ++i)
+    remove(tmp_paths[i]);
+
+  HeapFree(self->m_Heap, tmp_paths);
+
+  if (moved_count != output_count)
+  {
+    AtomicIncrement(&g_Stats.m_ActionCacheMisses);
+    return false;
+  }
+
+  ActionCacheTouch(self, ActionCacheRecord::kKindAction, key, sizeof(ActionCacheEntryHeader) + output_count * sizeof(ActionCacheOutput));
+
+  for (int i = 0; i < output_count; ++i)
+    ActionCacheTouch(self, ActionCacheRecord::kKindObject, outputs[i].m_ContentDigest, outputs[i].m_Size);
+
+  AtomicIncrement(&g_Stats.m_ActionCacheHits);
+  return true;
+}
+
+bool ActionCacheStore(ActionCache* self, const HashDigest& key, const NodeData* node_data)
+{
+  TimingScope timing_scope(nullptr, &g_Stats.m_ActionCacheStoreTimeCycles);
+
+  const int          output_count = node_data->m_OutputFiles.GetCount();
+  ActionCacheOutput* outputs      = (ActionCacheOutput*) alloca(output_count * sizeof(ActionCacheOutput));
+
+  for (int i = 0; i < output_count; ++i)
+  {
+    const char* filename = node_data->m_OutputFiles[i].m_Filename;
+
+    if (!StoreObject(self, filename, &outputs[i]))
+    {
+      Log(kDebug, "action cache: couldn't store %s", filename);
+      return false;
+    }
+  }
+
+  ActionCacheEntryHeader header;
+  header.m_MagicNumber = ActionCacheEntryHeader::MagicNumber;
+  header.m_OutputCount = uint32_t(output_count);
+
+  char tmp_path[kMaxPathLength];
+  ActionCacheTempPath(self, tmp_path);
+
+  FILE* f = fopen(tmp_path, "wb");
+  if (!f)
+    return false;
+
+  bool success = 1 == fwrite(&header, sizeof header, 1, f) &&
+                 size_t(output_count) == fwrite(outputs, sizeof(ActionCacheOutput), output_count, f);
+
+  if (0 != fclose(f) || !success)
+  {
+    remove(tmp_path);
+    return false;
+  }
+
+  char path[kMaxPathLength];
+  ActionCachePath(self, ActionCacheRecord::kKindAction, key, path);
+
+  if (!ActionCacheCommit(tmp_path, path))
+    return false;
+
+  ActionCacheTouch(self, ActionCacheRecord::kKindAction, key, sizeof header + output_count * sizeof(ActionCacheOutput));
+  AtomicIncrement(&g_Stats.m_ActionCacheStores);
+  return true;
+}
+
+bool ActionCacheHasEntry(const ActionCache* self, const HashDigest& key)
+{
+  char path[kMaxPathLength];
+  ActionCachePath(self, ActionCacheRecord::kKindAction, key, path);
+  return GetFileInfo(path).Exists();
+}
+
+int ActionCacheParseEntry(const void* data, size_t size, HashDigest* digests_out, int max_count)
+{
+  const ActionCacheEntryHeader* header = (const ActionCacheEntryHeader*) data;
+
+  if (size < sizeof *header || ActionCacheEntryHeader::MagicNumber != header->m_MagicNumber)
+    return -1;
+
+  const int count = int(header->m_OutputCount);
+
+  if (size != sizeof *header + count * sizeof(ActionCacheOutput))
+    return -1;
+
+  const ActionCacheOutput* outputs = (const ActionCacheOutput*) (header + 1);
+
+  for (int i = 0; i < count && i < max_count; ++i)
+    digests_out[i] = outputs[i].m_ContentDigest;
+
+  return count;
+}
+
+bool ActionCacheImport(ActionCache* self, uint32_t kind, const HashDigest& digest, const char* tmp_path, uint64_t size)
+{
+  char path[kMaxPathLength];
+  ActionCachePath(self, kind, digest, path);
+
+  if (!ActionCacheCommit(tmp_path, path))
+    return false;
+
+  ActionCacheTouch(self, kind, digest, size);
+  return true;
+}
+
+bool ActionCacheSave(ActionCache* self, MemAllocHeap* serialization_heap)
+{
+  char index_path[kMaxPathLength];
+  char tmp_path[kMaxPathLength];
+  CachePath(index_path, self, "/index.actioncache");
+  CachePath(tmp_path, self, "/index.actioncache.%u.tmp", self->m_ProcessId);
+
+  // Other build directories may share the cache, so re-read the index now
+  // and merge into it rather than overwriting what they recorded.
+  MemoryMappedFile index_file;
+  MmapFileInit(&index_file);
+  MmapFileMap(&index_file, index_path);
+
+  const ActionCacheState* old_state = nullptr;
+
+  if (MmapFileValid(&index_file) && index_file.m_Size >= sizeof(ActionCacheState))
+  {
+    const ActionCacheState* state = (const ActionCacheState*) index_file.m_Address;
+    if (ActionCacheState::MagicNumber == state->m_MagicNumber)
+      old_state = state;
+  }
+
+  Buffer<ActionCacheRecord> records;
+  BufferInit(&records);
+
+  if (old_state)
+    BufferAppend(&records, serialization_heap, old_state->m_Records.GetArray(), old_state->m_Records.GetCount());
+
+  MutexLock(&self->m_Lock);
+  const size_t touched_count = self->m_Touched.m_Size;
+  BufferAppend(&records, serialization_heap, self->m_Touched.m_Storage, touched_count);
+  MutexUnlock(&self->m_Lock);
+
+  // Fold duplicates, keeping the most recent use of each file.
+  std::sort(records.begin(), records.end(), [](const ActionCacheRecord& l, const ActionCacheRecord& r) {
+    if (l.m_Kind != r.m_Kind)
+      return l.m_Kind < r.m_Kind;
+    return l.m_Digest < r.m_Digest;
+  });
+
+  size_t   unique_count = 0;
+  uint64_t total_size   = 0;
+
+  for (const ActionCacheRecord& r : records)
+  {
+    ActionCacheRecord* last = unique_count ? &records[unique_count - 1] : nullptr;
+
+    if (last && last->m_Kind == r.m_Kind && last->m_Digest == r.m_Digest)
+    {
+      last->m_AccessTime = std::max(last->m_AccessTime, r.m_AccessTime);
+      continue;
+    }
+
+    records[unique_count++] = r;
+    total_size += r.m_Size;
+  }
+
+  records.m_Size = unique_count;
+
+  // Evict least recently used files until the cache is below 90% of its
+  // size bound, so it isn't trimmed again by the very next build.
+  ActionCacheRecord* first_kept = records.begin();
+  uint32_t           evicted    = 0;
+
+  if (total_size > self->m_MaxSize)
+  {
+    // Among files last used by the same build, drop the entries first so
+    // none is left pointing at an evicted object, then the big objects.
+    std::sort(records.begin(), records.end(), [](const ActionCacheRecord& l, const ActionCacheRecord& r) {
+      if (l.m_AccessTime != r.m_AccessTime)
+        return l.m_AccessTime < r.m_AccessTime;
+      if (l.m_Kind != r.m_Kind)
+        return l.m_Kind == ActionCacheRecord::kKindAction;
+      return l.m_Size > r.m_Size;
+    });
+
+    const uint64_t target_size = self->m_MaxSize / 10 * 9;
+
+    while (first_kept != records.end() && total_size > target_size)
+    {
+      char path[kMaxPathLength];
+      ActionCachePath(self, first_kept->m_Kind, first_kept->m_Digest, path);
+      remove(path);
+      total_size -= first_kept->m_Size;
+      ++first_kept;
+      ++evicted;
+    }
+
+    Log(kDebug, "action cache: evicted %u files", evicted);
+  }
+
+  g_Stats.m_ActionCacheEvictions += evicted;
+
+  BinaryWriter writer;
+  BinaryWriterInit(&writer, serialization_heap);
+
+  BinarySegment *main_seg  = BinaryWriterAddSegment(&writer);
+  BinarySegment *array_seg = BinaryWriterAddSegment(&writer);
+  BinaryLocator  array_ptr = BinarySegmentPosition(array_seg);
+
+  BinarySegmentWrite(array_seg, first_kept, (records.end() - first_kept) * sizeof(ActionCacheRecord));
+
+  BinarySegmentWriteUint32(main_seg, ActionCacheState::MagicNumber);
+  BinarySegmentWriteUint32(main_seg, 0); // m_Padding
+  BinarySegmentWriteUint64(main_seg, (old_state ? old_state->m_HitCount : 0) + g_Stats.m_ActionCacheHits);
+  BinarySegmentWriteUint64(main_seg, (old_state ? old_state->m_MissCount : 0) + g_Stats.m_ActionCacheMisses);
+  BinarySegmentWriteUint64(main_seg, (old_state ? old_state->m_StoreCount : 0) + g_Stats.m_ActionCacheStores);
+  BinarySegmentWriteUint64(main_seg, (old_state ? old_state->m_EvictCount : 0) + evicted);
+  BinarySegmentWriteInt32(main_seg, int32_t(records.end() - first_kept));
+  BinarySegmentWritePointer(main_seg, array_ptr);
+
+  // Unmap old index to avoid sharing conflicts on Windows.
+  MmapFileUnmap(&index_file);
+
+  bool success = BinaryWriterFlush(&writer, tmp_path);
+
+  if (success)
+  {
+    success = RenameFile(tmp_path, index_path);
+  }
+  else
+  {
+    remove(tmp_path);
+  }
+
+  // The index has these now. A build server saves again after every build,
+  // so don't carry them over into the next save.
+  if (success)
+  {
+    MutexLock(&self->m_Lock);
+    Buffer<ActionCacheRecord>* touched = &self->m_Touched;
+    memmove(touched->m_Storage, touched->m_Storage + touched_count, (touched->m_Size - touched_count) * sizeof(ActionCacheRecord));
+    touched->m_Size -= touched_count;
+    MutexUnlock(&self->m_Lock);
+  }
+
+  BinaryWriterDestroy(&writer);
+  BufferDestroy(&records, serialization_heap);
+  MmapFileDestroy(&index_file);
+
+  return success;
+}
+
+}
@@ -0,0 +1,103 @@
+#ifndef ACTIONCACHE_HPP
+#define ACTIONCACHE_HPP
+
+#include "Common.hpp"
+#include "BinaryData.hpp"
+#include "Buffer.hpp"
+#include "Hash.hpp"
+#include "Mutex.hpp"
+#include "PathUtil.hpp"
+
+namespace t2
+{
+  struct MemAllocHeap;
+  struct NodeData;
+
+  // Size and last use of one file in the action cache directory. Used both
+  // for the frozen index and to track what a build touched.
+  struct ActionCacheRecord
+  {
+    enum
+    {
+      kKindObject = 0,  // Output file contents, named by content digest
+      kKindAction = 1   // Output digests of one action, named by action key
+    };
+
+    uint64_t   m_Size;
+    uint64_t   m_AccessTime;
+    HashDigest m_Digest;
+    uint32_t   m_Kind;
+#if ENABLED(USE_128BIT_DIGEST)
+    uint32_t   m_Padding;
+#endif
+  };
+  static_assert(sizeof(ActionCacheRecord) == 40, "struct size");
+
+  struct ActionCacheState
+  {
+    static const uint32_t          MagicNumber = 0x2c0be1a7 ^ kTundraHashMagic;
+
+    uint32_t                       m_MagicNumber;
+    uint32_t                       m_Padding;
+
+    // Totals over every build that has used the cache.
+    uint64_t                       m_HitCount;
+    uint64_t                       m_MissCount;
+    uint64_t                       m_StoreCount;
+    uint64_t                       m_EvictCount;
+
+    FrozenArray<ActionCacheRecord> m_Records;
+  };
+
+  // Content addressed store of action outputs, keyed by a digest of the
+  // action and the contents of everything it reads. Lives in a directory
+  // that can be shared between build directories and survives cleans.
+  struct ActionCache
+  {
+    char                       m_Dir[kMaxPathLength];
+    uint64_t                   m_MaxSize;
+    uint64_t                   m_AccessTime;
+    uint32_t                   m_ProcessId;
+    uint32_t                   m_TempCounter;
+    MemAllocHeap*              m_Heap;
+
+    // Protects m_Touched.
+    Mutex                      m_Lock;
+    Buffer<ActionCacheRecord>  m_Touched;
+  };
+
+  // Returns false, and leaves the cache uninitialised, if the directory name
+  // is too long to build paths of the files in it from.
+  bool ActionCacheInit(ActionCache* self, MemAllocHeap* heap, const char* dir, uint64_t max_size);
+
+  void ActionCacheDestroy(ActionCache* self);
+
+  // Restore the output files of a node from the cache. Returns false if the
+  // key isn't cached or any output couldn't be restored, in which case none
+  // of the outputs have been touched.
+  bool ActionCacheRestore(ActionCache* self, const HashDigest& key, const NodeData* node_data);
+
+  // Copy the output files of a node that just built into the cache. Returns
+  // true if the node's entry was written.
+  bool ActionCacheStore(ActionCache* self, const HashDigest& key, const NodeData* node_data);
+
+  bool ActionCacheHasEntry(const ActionCache* self, const HashDigest& key);
+
+  // Lower level access for the remote cache, which moves whole cache files.
+  void ActionCachePath(const ActionCache* self, uint32_t kind, const HashDigest& digest, char (&path)[kMaxPathLength]);
+
+  void ActionCacheTempPath(ActionCache* self, char (&path)[kMaxPathLength]);
+
+  // Validate the contents of an action file. Returns the number of outputs
+  // and stores up to `max_count` of their content digests, or returns -1.
+  int ActionCacheParseEntry(const void* data, size_t size, HashDigest* digests_out, int max_count);
+
+  // Move a completed temporary file into the cache under the given digest.
+  bool ActionCacheImport(ActionCache* self, uint32_t kind, const HashDigest& digest, const char* tmp_path, uint64_t size);
+
+  // Merge this build's activity into the on-disk index and evict the least
+  // recently used files until the cache fits its size bound again.
+  bool ActionCacheSave(ActionCache* self, MemAllocHeap* serialization_heap);
+}
+
+#endif
@@ -9,12 +9,31 @@
 
 namespace t2
 {
+  // AtomicLoadAcquire() and AtomicStoreRelease() publish pointers and flags
+  // for data filled in before the store, so other threads can read it
+  // without locking.
+
 #if defined(TUNDRA_WIN32)
   inline uint32_t AtomicIncrement(uint32_t* value)
   {
     return InterlockedIncrement((long*)value);
   }
 
+  inline int32_t AtomicIncrement(int32_t* value)
+  {
+    return InterlockedIncrement((long*)value);
+  }
+
+  inline int32_t AtomicDecrement(int32_t* value)
+  {
+    return InterlockedDecrement((long*)value);
+  }
+
+  inline int32_t AtomicAdd(int32_t* ptr, int32_t value)
+  {
+    return InterlockedExchangeAdd((long*)ptr, value) + value;
+  }
+
   inline uint64_t AtomicAdd(uint64_t* ptr, uint64_t value)
   {
 #if defined(TUNDRA_WIN32_MINGW)
@@ -41,11 +60,51 @@ namespace t2
 #endif // TUNDRA_WIN32_MINGW
   }
 
+  template <typename T>
+  inline T* AtomicLoadAcquire(T* const* ptr)
+  {
+    T* value = *(T* const volatile*) ptr;
+    MemoryBarrier();
+    return value;
+  }
+
+  template <typename T>
+  inline void AtomicStoreRelease(T** ptr, T* value)
+  {
+    MemoryBarrier();
+    *(T* volatile*) ptr = value;
+  }
+
+  inline int32_t AtomicLoadAcquire(const int32_t* ptr)
+  {
+    int32_t value = *(const volatile int32_t*) ptr;
+    MemoryBarrier();
+    return value;
+  }
+
+  inline void AtomicStoreRelease(int32_t* ptr, int32_t value)
+  {
+    MemoryBarrier();
+    *(volatile int32_t*) ptr = value;
+  }
+
 #elif defined(__GNUC__)
   inline uint32_t AtomicIncrement(uint32_t* value)
   {
     return __sync_add_and_fetch(value, 1);
   }
+  inline int32_t AtomicIncrement(int32_t* value)
+  {
+    return __sync_add_and_fetch(value, 1);
+  }
+  inline int32_t AtomicDecrement(int32_t* value)
+  {
+    return __sync_sub_and_fetch(value, 1);
+  }
+  inline int32_t AtomicAdd(int32_t* ptr, int32_t value)
+  {
+    return __sync_add_and_fetch(ptr, value);
+  }
   inline uint64_t AtomicAdd(uint64_t* ptr, uint64_t value)
   {
 #if defined(__powerpc__)
@@ -56,6 +115,28 @@ namespace t2
     return __sync_add_and_fetch(ptr, value);
 #endif
   }
+
+  template <typename T>
+  inline T* AtomicLoadAcquire(T* const* ptr)
+  {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+  }
+
+  template <typename T>
+  inline void AtomicStoreRelease(T** ptr, T* value)
+  {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+  }
+
+  inline int32_t AtomicLoadAcquire(const int32_t* ptr)
+  {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+  }
+
+  inline void AtomicStoreRelease(int32_t* ptr, int32_t value)
+  {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+  }
 #endif // __GNUC__
 
 }
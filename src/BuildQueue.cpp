@@ -13,8 +13,13 @@
 #include "FileSign.hpp"
 #include "Hash.hpp"
 #include "Profiler.hpp"
+#include "Atomic.hpp"
+#include "ActionCache.hpp"
+#include "RemoteCache.hpp"
+#include "TerminalIo.hpp"
 
 #include <stdio.h>
+#include <algorithm>
 
 namespace t2
 {
@@ -30,27 +35,118 @@ namespace t2
   }
 
 
+  static bool IsWorkStealing(const BuildQueue* queue)
+  {
+    return 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagWorkStealing);
+  }
+
   static void ThreadStateInit(ThreadState* self, BuildQueue* queue, size_t scratch_size, int index)
   {
     HeapInit(&self->m_LocalHeap);
     LinearAllocInit(&self->m_ScratchAlloc, &self->m_LocalHeap, scratch_size, "thread-local scratch");
     self->m_ThreadIndex = index;
     self->m_Queue       = queue;
+
+    if (IsWorkStealing(queue))
+    {
+      MutexInit(&self->m_DequeLock);
+      self->m_Deque         = HeapAllocateArray<int32_t>(queue->m_Config.m_Heap, queue->m_QueueCapacity);
+      self->m_DequeHead     = 0;
+      self->m_DequeTail     = 0;
+
+      MutexInit(&self->m_WakeLock);
+      CondInit(&self->m_WakeCond);
+      self->m_WakeSignalled = false;
+    }
   }
 
   static void ThreadStateDestroy(ThreadState* self)
   {
+    BuildQueue* queue = self->m_Queue;
+
+    if (IsWorkStealing(queue))
+    {
+      CondDestroy(&self->m_WakeCond);
+      MutexDestroy(&self->m_WakeLock);
+      HeapFree(queue->m_Config.m_Heap, self->m_Deque);
+      MutexDestroy(&self->m_DequeLock);
+    }
+
     LinearAllocDestroy(&self->m_ScratchAlloc);
     HeapDestroy(&self->m_LocalHeap);
   }
 
-  static int AvailableNodeCount(BuildQueue* queue)
+  // Returns true if the node at state index `a` should be dispatched before
+  // the one at `b`. Nodes with the longest critical path go first; ties keep
+  // the DAG order.
+  static bool HasPriority(const BuildQueue* queue, int32_t a, int32_t b)
+  {
+    const NodeState* node_states = queue->m_Config.m_NodeState;
+    uint64_t         path_a      = node_states[a].m_CriticalPathMs;
+    uint64_t         path_b      = node_states[b].m_CriticalPathMs;
+
+    if (path_a != path_b)
+      return path_a > path_b;
+
+    return a < b;
+  }
+
+  // The shared ready queue is a binary heap ordered by HasPriority().
+  static void ReadyHeapPush(BuildQueue* queue, int32_t state_index)
+  {
+    int32_t* heap = queue->m_Queue;
+    uint32_t pos  = queue->m_QueueCount++;
+
+    CHECK(queue->m_QueueCount <= queue->m_QueueCapacity);
+
+    while (pos > 0)
+    {
+      uint32_t parent = (pos - 1) / 2;
+
+      if (!HasPriority(queue, state_index, heap[parent]))
+        break;
+
+      heap[pos] = heap[parent];
+      pos       = parent;
+    }
+
+    heap[pos] = state_index;
+  }
+
+  static int32_t ReadyHeapPop(BuildQueue* queue)
   {
-    const uint32_t queue_mask  = queue->m_QueueCapacity - 1;
-    uint32_t       read_index  = queue->m_QueueReadIndex;
-    uint32_t       write_index = queue->m_QueueWriteIndex;
+    int32_t* heap   = queue->m_Queue;
+    int32_t  result = heap[0];
+    int32_t  last   = heap[--queue->m_QueueCount];
+    uint32_t count  = queue->m_QueueCount;
+    uint32_t pos    = 0;
+
+    for (;;)
+    {
+      uint32_t child = pos * 2 + 1;
+
+      if (child >= count)
+        break;
+
+      if (child + 1 < count && HasPriority(queue, heap[child + 1], heap[child]))
+        ++child;
+
+      if (!HasPriority(queue, heap[child], last))
+        break;
+
+      heap[pos] = heap[child];
+      pos       = child;
+    }
+
+    heap[pos] = last;
+    return result;
+  }
 
-    return (write_index - read_index) & queue_mask;
+  // Order a batch of state indices so that pushing them onto a deque in turn
+  // leaves the most important one at the tail, where the owner pops from.
+  static void SortForDeque(const BuildQueue* queue, int32_t* indices, int count)
+  {
+    std::sort(indices, indices + count, [=](int32_t a, int32_t b) { return HasPriority(queue, b, a); });
   }
 
   static NodeState* GetStateForNode(BuildQueue* queue, int32_t src_index)
@@ -68,120 +164,247 @@ namespace t2
   }
 
 
-  static bool AllDependenciesReady(BuildQueue* queue, const NodeState* state)
+  static void WakeThread(ThreadState* thread_state)
   {
-    const NodeData *src_node      = state->m_MmapData;
+    MutexLock(&thread_state->m_WakeLock);
+    thread_state->m_WakeSignalled = true;
+    CondSignal(&thread_state->m_WakeCond);
+    MutexUnlock(&thread_state->m_WakeLock);
+  }
 
-    for (int32_t dep_index : src_node->m_Dependencies)
+  // Wake up to `count` parked threads. Work stealing mode only.
+  static void WakeIdleThreads(BuildQueue* queue, int count)
+  {
+    while (count-- > 0)
     {
-      NodeState* state = GetStateForNode(queue, dep_index);
+      int32_t thread_index = -1;
 
-      CHECK(state != nullptr);
+      MutexLock(&queue->m_IdleLock);
+      if (queue->m_IdleCount > 0)
+        thread_index = queue->m_IdleThreads[--queue->m_IdleCount];
+      MutexUnlock(&queue->m_IdleLock);
 
-      if (!NodeStateIsCompleted(state))
-      {
-        return false;
-      }
+      if (thread_index < 0)
+        break;
+
+      WakeThread(&queue->m_ThreadState[thread_index]);
     }
+  }
 
-    return true;
+  // Wake every build thread so they can reevaluate whether to keep building.
+  static void WakeAllThreads(BuildQueue* queue)
+  {
+    if (IsWorkStealing(queue))
+    {
+      for (int i = 0, count = queue->m_Config.m_ThreadCount; i < count; ++i)
+        WakeThread(&queue->m_ThreadState[i]);
+    }
+    else
+    {
+      CondBroadcast(&queue->m_WorkAvailable);
+    }
   }
 
+  static void SignalWakeAllThreads(void* user_data)
+  {
+    WakeAllThreads(static_cast<BuildQueue*>(user_data));
+  }
 
   static void WakeWaiters(BuildQueue* queue, int count)
   {
-    if (count > 1)
+    if (IsWorkStealing(queue))
+    {
+      // The enqueuing thread will pick up one of the nodes itself when it
+      // returns to its build loop.
+      WakeIdleThreads(queue, count - 1);
+    }
+    else if (count > 1)
       CondBroadcast(&queue->m_WorkAvailable);
     else
       CondSignal(&queue->m_WorkAvailable);
   }
 
-  static void Enqueue(BuildQueue* queue, NodeState* state)
+  static void DequePush(BuildQueue* queue, ThreadState* thread_state, int32_t state_index)
+  {
+    const uint32_t queue_mask = queue->m_QueueCapacity - 1;
+
+    MutexLock(&thread_state->m_DequeLock);
+    CHECK(thread_state->m_DequeTail - thread_state->m_DequeHead < queue->m_QueueCapacity);
+    thread_state->m_Deque[thread_state->m_DequeTail & queue_mask] = state_index;
+    thread_state->m_DequeTail++;
+    MutexUnlock(&thread_state->m_DequeLock);
+  }
+
+  static int32_t DequePopTail(BuildQueue* queue, ThreadState* thread_state)
+  {
+    const uint32_t queue_mask = queue->m_QueueCapacity - 1;
+    int32_t        result     = -1;
+
+    MutexLock(&thread_state->m_DequeLock);
+    if (thread_state->m_DequeHead != thread_state->m_DequeTail)
+    {
+      thread_state->m_DequeTail--;
+      result = thread_state->m_Deque[thread_state->m_DequeTail & queue_mask];
+    }
+    MutexUnlock(&thread_state->m_DequeLock);
+
+    return result;
+  }
+
+  static int32_t DequePopHead(BuildQueue* queue, ThreadState* thread_state)
   {
-    uint32_t       write_index = queue->m_QueueWriteIndex;
-    const uint32_t queue_mask  = queue->m_QueueCapacity - 1;
-    int32_t*       build_queue = queue->m_Queue;
+    const uint32_t queue_mask = queue->m_QueueCapacity - 1;
+    int32_t        result     = -1;
+
+    MutexLock(&thread_state->m_DequeLock);
+    if (thread_state->m_DequeHead != thread_state->m_DequeTail)
+    {
+      result = thread_state->m_Deque[thread_state->m_DequeHead & queue_mask];
+      thread_state->m_DequeHead++;
+    }
+    MutexUnlock(&thread_state->m_DequeLock);
 
+    return result;
+  }
+
+  static bool DequeIsEmpty(ThreadState* thread_state)
+  {
+    MutexLock(&thread_state->m_DequeLock);
+    bool result = thread_state->m_DequeHead == thread_state->m_DequeTail;
+    MutexUnlock(&thread_state->m_DequeLock);
+    return result;
+  }
 
-    CHECK(AllDependenciesReady(queue, state));
+  static void Enqueue(BuildQueue* queue, ThreadState* thread_state, NodeState* state)
+  {
+    CHECK(0 == state->m_PendingDependencyCount);
     CHECK(!NodeStateIsQueued(state));
     CHECK(!NodeStateIsActive(state));
     CHECK(!NodeStateIsCompleted(state));
-    CHECK(state->m_MmapData->m_PassIndex == queue->m_CurrentPassIndex);
-
-#if ENABLED(CHECKED_BUILD)
-    const int avail_init = AvailableNodeCount(queue);
-#endif
+    CHECK(queue->m_OverlapPasses || state->m_MmapData->m_PassIndex == queue->m_CurrentPassIndex);
 
     int state_index = int(state - queue->m_Config.m_NodeState);
 
-    build_queue[write_index] = state_index;
-    write_index              = (write_index + 1) & queue_mask;
-    queue->m_QueueWriteIndex = write_index;
-
     NodeStateFlagQueued(state);
 
-    CHECK(AvailableNodeCount(queue) == 1 + avail_init);
+    if (IsWorkStealing(queue))
+    {
+      // Keep newly ready nodes local to this thread; they are likely to touch
+      // the same files as the node that made them ready.
+      DequePush(queue, thread_state, state_index);
+      return;
+    }
+
+    ReadyHeapPush(queue, state_index);
   }
 
-  static void ParkExpensiveNode(BuildQueue* queue, NodeState* state)
+  static void ParkNode(BuildQueue* queue, NodeState** wait_list, int32_t* wait_count, NodeState* state)
   {
     NodeStateFlagQueued(state);
-    CHECK(queue->m_ExpensiveWaitCount < (int) queue->m_QueueCapacity);
-    queue->m_ExpensiveWaitList[queue->m_ExpensiveWaitCount++] = state;
+    CHECK(*wait_count < (int) queue->m_QueueCapacity);
+    wait_list[(*wait_count)++] = state;
   }
 
-  static void UnparkExpensiveNode(BuildQueue* queue)
+  static void UnparkNode(BuildQueue* queue, ThreadState* thread_state, NodeState** wait_list, int32_t* wait_count)
   {
-    if (queue->m_ExpensiveWaitCount > 0)
+    if (*wait_count > 0)
     {
-      NodeState* node = queue->m_ExpensiveWaitList[--queue->m_ExpensiveWaitCount];
+      NodeState* node = wait_list[--(*wait_count)];
       CHECK(NodeStateIsQueued(node));
       // Really only to avoid tripping up checks in Enqueue()
       NodeStateFlagUnqueued(node);
       NodeStateFlagInactive(node);
-      Enqueue(queue, node);
-      CondSignal(&queue->m_WorkAvailable);
+      Enqueue(queue, thread_state, node);
+      WakeWaiters(queue, 1);
     }
   }
 
-  static BuildProgress::Enum SetupDependencies(BuildQueue* queue, NodeState* node)
+  // Expensive job bookkeeping is guarded by the queue lock. Threads in work
+  // stealing mode advance nodes without holding it, so take it here.
+  static bool AcquireExpensiveSlot(BuildQueue* queue, NodeState* node, Mutex* queue_lock)
   {
-    const NodeData *src_node         = node->m_MmapData;
-    int             dep_waits_needed = 0;
-    int             enqueue_count    = 0;
+    if (!queue_lock)
+      MutexLock(&queue->m_Lock);
 
-    // Go through all dependencies and see how those nodes are doing.  If any
-    // of them are not finished, we'll have to wait before this node can continue
-    // to advance its state machine.
-    for (int32_t dep_index : src_node->m_Dependencies)
-    {
-      NodeState* state = GetStateForNode(queue, dep_index);
+    bool acquired = queue->m_ExpensiveRunning < queue->m_Config.m_MaxExpensiveCount;
 
-      CHECK(state != nullptr);
+    if (acquired)
+      ++queue->m_ExpensiveRunning;
+    else
+      ParkNode(queue, queue->m_ExpensiveWaitList, &queue->m_ExpensiveWaitCount, node);
 
-      CHECK(state->m_MmapData->m_PassIndex <= src_node->m_PassIndex);
+    if (!queue_lock)
+      MutexUnlock(&queue->m_Lock);
 
-      if (NodeStateIsCompleted(state))
-        continue;
+    return acquired;
+  }
 
-      ++dep_waits_needed;
+  static void ReleaseExpensiveSlot(BuildQueue* queue, ThreadState* thread_state, Mutex* queue_lock)
+  {
+    if (!queue_lock)
+      MutexLock(&queue->m_Lock);
 
-      if (!NodeStateIsQueued(state) && !NodeStateIsActive(state) && !NodeStateIsBlocked(state))
-      {
-        Enqueue(queue, state);
-        ++enqueue_count;
-      }
-    }
+    --queue->m_ExpensiveRunning;
+    CHECK(queue->m_ExpensiveRunning >= 0);
 
-    if (enqueue_count > 0)
-      WakeWaiters(queue, enqueue_count);
+    // We were an expensive job. We can unpark another expensive job if
+    // anything is waiting.
+    UnparkNode(queue, thread_state, queue->m_ExpensiveWaitList, &queue->m_ExpensiveWaitCount);
+
+    if (!queue_lock)
+      MutexUnlock(&queue->m_Lock);
+  }
+
+  static bool UsesActionSlot(const BuildQueue* queue, const NodeState* node)
+  {
+    const char* cmd_line = node->m_MmapData->m_Action;
+    return queue->m_Config.m_MaxRunningActions > 0 && cmd_line && cmd_line[0] != '\0';
+  }
+
+  // Build threads don't wait on asynchronously started actions, so they no
+  // longer bound how many run at once. Action slots do, in the same way as
+  // expensive slots.
+  static bool AcquireActionSlot(BuildQueue* queue, NodeState* node, Mutex* queue_lock)
+  {
+    if (!queue_lock)
+      MutexLock(&queue->m_Lock);
 
-    // We're waiting on dependencies to be ready.
-    if (dep_waits_needed > 0)
-      return BuildProgress::kBlocked;
+    bool acquired = queue->m_ActionsRunning < queue->m_Config.m_MaxRunningActions;
 
-    return BuildProgress::kUnblocked;
+    if (acquired)
+      ++queue->m_ActionsRunning;
+    else
+      ParkNode(queue, queue->m_ActionWaitList, &queue->m_ActionWaitCount, node);
+
+    if (!queue_lock)
+      MutexUnlock(&queue->m_Lock);
+
+    return acquired;
+  }
+
+  static void ReleaseActionSlot(BuildQueue* queue, ThreadState* thread_state, Mutex* queue_lock)
+  {
+    if (!queue_lock)
+      MutexLock(&queue->m_Lock);
+
+    --queue->m_ActionsRunning;
+    CHECK(queue->m_ActionsRunning >= 0);
+
+    UnparkNode(queue, thread_state, queue->m_ActionWaitList, &queue->m_ActionWaitCount);
+
+    if (!queue_lock)
+      MutexUnlock(&queue->m_Lock);
+  }
+
+  // Once a node's action is done with, let other expensive nodes on to the
+  // cores, and other actions run.
+  static void ReleaseActionSlots(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  {
+    if (node->m_MmapData->m_Flags & NodeData::kFlagExpensive)
+      ReleaseExpensiveSlot(queue, thread_state, queue_lock);
+
+    if (UsesActionSlot(queue, node))
+      ReleaseActionSlot(queue, thread_state, queue_lock);
   }
 
   static bool OutputFilesDiffer(const NodeData* node_data, const NodeStateData* prev_state)
@@ -252,15 +475,224 @@ namespace t2
     return MakeDirectoriesRecursive(stat_cache, path);
   }
 
-  static BuildProgress::Enum CheckInputSignature(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  // Hash a string with the build's working directory replaced by a fixed
+  // token, so the same action in checkouts at different paths (another
+  // build directory, or another machine) gets the same key.
+  static void HashAddRelocatable(const BuildQueue* queue, HashState* h, const char* s)
+  {
+    const char*  root     = queue->m_RootDir;
+    const size_t root_len = queue->m_RootDirLength;
+
+    while (const char* p = root_len > 1 ? strstr(s, root) : nullptr)
+    {
+      HashUpdate(h, s, p - s);
+      HashAddString(h, "$(ROOT)");
+      s = p + root_len;
+    }
+
+    HashAddString(h, s);
+  }
+
+  // Hash the stat data of a node's inputs and the files they include.
+  static void ComputeImplicitDepsFingerprint(StatCache* stat_cache, const NodeData* node_data, const FileAndHash* deps, int32_t dep_count, HashDigest* out)
+  {
+    HashState h;
+    HashInit(&h);
+    const ScannerData* scanner = node_data->m_Scanner;
+    HashUpdate(&h, &scanner->m_ScannerGuid, sizeof(HashDigest));
+
+    auto add_stat = [&](const char* filename, uint32_t filename_hash) -> void
+    {
+      FileInfo info = StatCacheStat(stat_cache, filename, filename_hash);
+      HashAddInteger(&h, info.Exists() ? info.m_Timestamp : ~0ull);
+      HashAddInteger(&h, info.m_Size);
+    };
+
+    for (const FrozenFileAndHash& input : node_data->m_InputFiles)
+      add_stat(input.m_Filename, input.m_FilenameHash);
+
+    for (int32_t i = 0; i < dep_count; ++i)
+      add_stat(deps[i].m_Filename, deps[i].m_FilenameHash);
+
+    HashFinalize(&h, out);
+  }
+
+  // Find the files a node's inputs include, directly or not. If none of the
+  // files the last build found have changed since, its list is used without
+  // scanning anything.
+  static void GetImplicitDeps(BuildQueue* queue, ThreadState* thread_state, NodeState* node)
   {
-    CHECK(AllDependenciesReady(queue, node));
+    const NodeData* node_data   = node->m_MmapData;
+    const int32_t   input_count = node_data->m_InputFiles.GetCount();
+
+    if (!node_data->m_Scanner || node->m_ImplicitDepCounts || 0 == input_count)
+      return;
+
+    const BuildQueueConfig& config     = queue->m_Config;
+    StatCache*              stat_cache = config.m_StatCache;
+    MemAllocHeap*           heap       = config.m_Heap;
+
+    int32_t* counts = HeapAllocateArray<int32_t>(heap, input_count);
+
+    const NodeStateData* prev_state = node->m_MmapState;
+
+    if (prev_state && prev_state->m_ImplicitDepCounts.GetCount() == input_count)
+    {
+      int32_t      dep_count = prev_state->m_ImplicitDeps.GetCount();
+      FileAndHash* deps      = HeapAllocateArray<FileAndHash>(heap, dep_count);
+
+      for (int32_t i = 0; i < dep_count; ++i)
+      {
+        deps[i].m_Filename     = prev_state->m_ImplicitDeps[i].m_Filename;
+        deps[i].m_FilenameHash = prev_state->m_ImplicitDeps[i].m_FilenameHash;
+      }
+
+      HashDigest fingerprint;
+      ComputeImplicitDepsFingerprint(stat_cache, node_data, deps, dep_count, &fingerprint);
+
+      if (fingerprint == prev_state->m_ImplicitDepsFingerprint)
+      {
+        memcpy(counts, prev_state->m_ImplicitDepCounts.GetArray(), input_count * sizeof counts[0]);
+
+        node->m_ImplicitDepCount        = dep_count;
+        node->m_ImplicitDeps            = deps;
+        node->m_ImplicitDepCounts       = counts;
+        node->m_ImplicitDepsFingerprint = fingerprint;
+
+        AtomicIncrement(&g_Stats.m_ImplicitDepsReused);
+        return;
+      }
+
+      HeapFree(heap, deps);
+    }
+
+    // Roll back scratch allocator after scanning only - filenames are being retained between scans
+    MemAllocLinearScope alloc_scope(&thread_state->m_ScratchAlloc);
+
+    Buffer<FileAndHash> deps;
+    BufferInit(&deps);
+
+    for (int32_t i = 0; i < input_count; ++i)
+    {
+      ScanInput scan_input;
+      scan_input.m_ScannerConfig = node_data->m_Scanner;
+      scan_input.m_ScratchAlloc  = &thread_state->m_ScratchAlloc;
+      scan_input.m_ScratchHeap   = &thread_state->m_LocalHeap;
+      scan_input.m_FileName      = node_data->m_InputFiles[i].m_Filename;
+      scan_input.m_ScanCache     = config.m_ScanCache;
+
+      ScanOutput scan_output;
+      counts[i] = 0;
+
+      if (ScanImplicitDeps(stat_cache, &scan_input, &scan_output))
+      {
+        BufferAppend(&deps, heap, scan_output.m_IncludedFiles, scan_output.m_IncludedFileCount);
+        counts[i] = scan_output.m_IncludedFileCount;
+      }
+    }
 
-    MutexUnlock(queue_lock);
+    node->m_ImplicitDepCount  = (int32_t) deps.m_Size;
+    node->m_ImplicitDeps      = deps.m_Storage;
+    node->m_ImplicitDepCounts = counts;
+    ComputeImplicitDepsFingerprint(stat_cache, node_data, deps.m_Storage, (int32_t) deps.m_Size, &node->m_ImplicitDepsFingerprint);
+
+    AtomicIncrement(&g_Stats.m_ImplicitDepsScanned);
+  }
 
+  // Add the path and signature of every direct input file and every file it
+  // includes. Content digests are used for all files if content_only is set,
+  // otherwise only for files configured to be signed by content.
+  static void AddInputSignatures(BuildQueue* queue, ThreadState* thread_state, NodeState* node, HashState* sighash, bool content_only)
+  {
     const BuildQueueConfig& config = queue->m_Config;
     StatCache* stat_cache = config.m_StatCache;
     DigestCache* digest_cache = config.m_DigestCache;
+    const NodeData* node_data = node->m_MmapData;
+
+    auto add_file = [&](const char* filename, uint32_t filename_hash) -> void
+    {
+      if (!content_only)
+      {
+        HashAddPath(sighash, filename);
+        ComputeFileSignature(sighash, stat_cache, digest_cache, filename, filename_hash, config.m_ShaDigestExtensions, config.m_ShaDigestExtensionCount, config.m_ContentDigestFiles, config.m_SignByContent);
+        return;
+      }
+
+      HashAddRelocatable(queue, sighash, filename);
+
+      HashDigest digest;
+      if (ComputeFileContentDigest(stat_cache, digest_cache, filename, filename_hash, &digest))
+        HashUpdate(sighash, &digest, sizeof digest);
+      else
+        HashAddInteger(sighash, ~0ull);
+    };
+
+    GetImplicitDeps(queue, thread_state, node);
+
+    const FileAndHash* deps   = node->m_ImplicitDeps;
+    const int32_t*     counts = node->m_ImplicitDepCounts;
+
+    for (int32_t i = 0, count = node_data->m_InputFiles.GetCount(); i < count; ++i)
+    {
+      // Add path and timestamp of every direct input file.
+      const FrozenFileAndHash& input = node_data->m_InputFiles[i];
+      add_file(input.m_Filename, input.m_FilenameHash);
+
+      if (counts)
+      {
+        // Add path and timestamp of every indirect input file (#includes)
+        for (int32_t j = 0; j < counts[i]; ++j, ++deps)
+          add_file(deps->m_Filename, deps->m_FilenameHash);
+      }
+    }
+  }
+
+  // The action cache key is signed by content only, as timestamps change
+  // whenever files are restored, checked out or rebuilt. It also covers the
+  // environment and output paths, which the input signature leaves out.
+  static void ComputeActionCacheKey(BuildQueue* queue, ThreadState* thread_state, NodeState* node, HashDigest* key_out)
+  {
+    const NodeData* node_data = node->m_MmapData;
+
+    HashState h;
+    HashInit(&h);
+
+    HashAddRelocatable(queue, &h, node_data->m_Action);
+    HashAddSeparator(&h);
+
+    if (const char* pre_action = node_data->m_PreAction)
+    {
+      HashAddRelocatable(queue, &h, pre_action);
+      HashAddSeparator(&h);
+    }
+
+    for (const EnvVarData& env_var : node_data->m_EnvVars)
+    {
+      HashAddString(&h, env_var.m_Name);
+      HashAddRelocatable(queue, &h, env_var.m_Value);
+      HashAddSeparator(&h);
+    }
+
+    for (const FrozenFileAndHash& output : node_data->m_OutputFiles)
+    {
+      HashAddRelocatable(queue, &h, output.m_Filename);
+      HashAddSeparator(&h);
+    }
+
+    AddInputSignatures(queue, thread_state, node, &h, true);
+
+    HashFinalize(&h, key_out);
+  }
+
+  static BuildProgress::Enum CheckInputSignature(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  {
+    CHECK(0 == node->m_PendingDependencyCount);
+
+    if (queue_lock)
+      MutexUnlock(queue_lock);
+
+    const BuildQueueConfig& config = queue->m_Config;
+    StatCache* stat_cache = config.m_StatCache;
 
     const NodeData* node_data = node->m_MmapData;
 
@@ -288,40 +720,7 @@ namespace t2
       HashAddSeparator(&sighash);
     }
 
-    // Roll back scratch allocator after scanning only - filenames are being retained between scans
-    MemAllocLinearScope alloc_scope(&thread_state->m_ScratchAlloc);
-
-    const ScannerData* scanner = node_data->m_Scanner;
-
-    for (const FrozenFileAndHash& input : node_data->m_InputFiles)
-    {
-      // Add path and timestamp of every direct input file.
-      HashAddPath(&sighash, input.m_Filename);
-      ComputeFileSignature(&sighash, stat_cache, digest_cache, input.m_Filename, input.m_FilenameHash, config.m_ShaDigestExtensions, config.m_ShaDigestExtensionCount);
-
-      if (scanner)
-      {
-        ScanInput scan_input;
-        scan_input.m_ScannerConfig = scanner;
-        scan_input.m_ScratchAlloc  = &thread_state->m_ScratchAlloc;
-        scan_input.m_ScratchHeap   = &thread_state->m_LocalHeap;
-        scan_input.m_FileName      = input.m_Filename;
-        scan_input.m_ScanCache     = queue->m_Config.m_ScanCache;
-
-        ScanOutput scan_output;
-
-        if (ScanImplicitDeps(stat_cache, &scan_input, &scan_output))
-        {
-          for (int i = 0, count = scan_output.m_IncludedFileCount; i < count; ++i)
-          {
-            // Add path and timestamp of every indirect input file (#includes)
-            const FileAndHash& path = scan_output.m_IncludedFiles[i];
-            HashAddPath(&sighash, path.m_Filename);
-            ComputeFileSignature(&sighash, stat_cache, digest_cache, path.m_Filename, path.m_FilenameHash, config.m_ShaDigestExtensions, config.m_ShaDigestExtensionCount);
-          }
-        }
-      }
-    }
+    AddInputSignatures(queue, thread_state, node, &sighash, false);
 
     HashFinalize(&sighash, &node->m_InputSignature);
 
@@ -381,64 +780,297 @@ namespace t2
       next_state = BuildProgress::kUpToDate;
     }
 
-    MutexLock(queue_lock);
+    if (queue_lock)
+      MutexLock(queue_lock);
 
     return next_state;
   }
 
-  static BuildProgress::Enum RunAction(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  static void DigestOutputFiles(BuildQueue* queue, ThreadState* thread_state, NodeState* node)
   {
-    const NodeData    *node_data    = node->m_MmapData;
-    const char        *cmd_line     = node_data->m_Action;
-    const char        *pre_cmd_line = node_data->m_PreAction;
+    const BuildQueueConfig& config    = queue->m_Config;
+    const NodeData*         node_data = node->m_MmapData;
+    const int               count     = node_data->m_OutputFiles.GetCount();
 
-    if (!cmd_line || cmd_line[0] == '\0')
-      return BuildProgress::kSucceeded;
+    HeapFree(config.m_Heap, node->m_OutputDigests);
+    HashDigest* digests = HeapAllocateArray<HashDigest>(config.m_Heap, count);
 
-    if (node->m_MmapData->m_Flags & NodeData::kFlagExpensive)
+    for (int i = 0; i < count; ++i)
     {
-      if (queue->m_ExpensiveRunning == queue->m_Config.m_MaxExpensiveCount)
-      {
-        ParkExpensiveNode(queue, node);
-        return BuildProgress::kRunAction;
-      }
-      else
-      {
-        ++queue->m_ExpensiveRunning;
-      }
+      const FrozenFileAndHash& output = node_data->m_OutputFiles[i];
+
+      // Missing outputs get an all-zero digest so they never match a real file.
+      if (!ComputeFileContentDigest(config.m_StatCache, config.m_DigestCache, output.m_Filename, output.m_FilenameHash, &digests[i]))
+        memset(&digests[i], 0, sizeof(HashDigest));
     }
 
-    MutexUnlock(queue_lock);
+    node->m_OutputDigests = digests;
 
-    StatCache         *stat_cache   = queue->m_Config.m_StatCache;
-    const char        *annotation   = node_data->m_Annotation;
-    int                job_id       = thread_state->m_ThreadIndex;
-    int                echo_annotations = 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagEchoAnnotations);
-    int                echo_cmdline = 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagEchoCommandLines);
+    const NodeStateData* prev_state = node->m_MmapState;
 
-    // Repack frozen env to pointers on the stack.
-    int                env_count    = node_data->m_EnvVars.GetCount();
-    EnvVariable*       env_vars     = (EnvVariable*) alloca(env_count * sizeof(EnvVariable));
-    for (int i = 0; i < env_count; ++i)
+    if (prev_state && prev_state->m_OutputDigests.GetCount() == count &&
+        0 == memcmp(prev_state->m_OutputDigests.GetArray(), digests, count * sizeof(HashDigest)))
     {
-      env_vars[i].m_Name  = node_data->m_EnvVars[i].m_Name;
-      env_vars[i].m_Value = node_data->m_EnvVars[i].m_Value;
+      Log(kDebug, "T=%d: %s - outputs unchanged", thread_state->m_ThreadIndex, node_data->m_Annotation.Get());
+      AtomicIncrement(&g_Stats.m_OutputDigestsUnchanged);
     }
+  }
 
-    for (const FrozenFileAndHash& output_file : node_data->m_OutputFiles)
-    {
-      PathBuffer output;
-      PathInit(&output, output_file.m_Filename);
+  // Put a node back on the queue once the remote cache has looked for it.
+  // Called on a remote cache thread.
+  static void RemoteFetchDone(void* context, int32_t state_index, bool hit)
+  {
+    BuildQueue* queue = static_cast<BuildQueue*>(context);
+    NodeState*  node  = queue->m_Config.m_NodeState + state_index;
+
+    Log(kSpam, "%s - remote cache %s", node->m_MmapData->m_Annotation.Get(), hit ? "hit" : "miss");
+
+    MutexLock(&queue->m_Lock);
+
+    CHECK(NodeStateIsQueued(node));
+    NodeStateFlagUnqueued(node);
+    NodeStateFlagInactive(node);
+
+    // This isn't a build thread, so spread the nodes over the deques and wake
+    // someone to pick them up.
+    Enqueue(queue, &queue->m_ThreadState[state_index % queue->m_Config.m_ThreadCount], node);
+
+    if (IsWorkStealing(queue))
+      WakeIdleThreads(queue, 1);
+    else
+      CondSignal(&queue->m_WorkAvailable);
+
+    MutexUnlock(&queue->m_Lock);
+  }
+
+  // Ask the remote cache for a node's outputs before running it, unless the
+  // local action cache already has them. The lookup happens on the remote
+  // cache's threads while the node is parked. Returns true if the node was
+  // parked, in which case the caller must not touch it any more.
+  static bool FetchFromRemoteCache(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  {
+    RemoteCache*    remote    = queue->m_Config.m_RemoteCache;
+    const NodeData* node_data = node->m_MmapData;
+    const char*     cmd_line  = node_data->m_Action;
+
+    if (!remote || (node->m_Flags & NodeStateFlags::kCacheKeyValid))
+      return false;
+
+    if (!cmd_line || cmd_line[0] == '\0' || 0 == node_data->m_OutputFiles.GetCount())
+      return false;
+
+    if (queue_lock)
+      MutexUnlock(queue_lock);
+
+    ComputeActionCacheKey(queue, thread_state, node, &node->m_ActionCacheKey);
+
+    bool fetch = RemoteCacheIsOnline(remote) && !ActionCacheHasEntry(queue->m_Config.m_ActionCache, node->m_ActionCacheKey);
+
+    if (queue_lock)
+      MutexLock(queue_lock);
+
+    node->m_Flags |= NodeStateFlags::kCacheKeyValid;
+
+    if (fetch)
+    {
+      // Flag the node before handing it over, as the lookup may finish right away.
+      NodeStateFlagQueued(node);
+      RemoteCacheFetch(remote, node->m_ActionCacheKey, RemoteFetchDone, queue, int32_t(node - queue->m_Config.m_NodeState));
+    }
+
+    return fetch;
+  }
+
+  // Put a node back to work once its action's process has exited, so a
+  // build thread can finish it. Called on the exec reactor thread.
+  static void ActionExited(void* context, int32_t state_index, int slot)
+  {
+    BuildQueue* queue = static_cast<BuildQueue*>(context);
+    NodeState*  node  = queue->m_Config.m_NodeState + state_index;
+
+    Log(kSpam, "%s - process exited", node->m_MmapData->m_Annotation.Get());
+
+    MutexLock(&queue->m_Lock);
+
+    CHECK(NodeStateIsQueued(node));
+    CHECK(queue->m_ExitedActionCount < queue->m_Config.m_MaxRunningActions);
+
+    node->m_ExecSlot = slot;
+    queue->m_ExitedActions[queue->m_ExitedActionCount++] = state_index;
+
+    CondBroadcast(&queue->m_ActionExited);
+
+    if (IsWorkStealing(queue))
+      WakeIdleThreads(queue, 1);
+    else
+      CondSignal(&queue->m_WorkAvailable);
+
+    MutexUnlock(&queue->m_Lock);
+  }
+
+  // Everything that happens once an action's process has exited, however it
+  // was run. Called with the queue lock released, and returns with it held.
+  static BuildProgress::Enum CompleteAction(BuildQueue* queue, ThreadState* thread_state, NodeState* node, const ExecResult& result, uint64_t start_time, ActionCache* action_cache, const HashDigest& cache_key, Mutex* queue_lock)
+  {
+    const NodeData    *node_data    = node->m_MmapData;
+    StatCache         *stat_cache   = queue->m_Config.m_StatCache;
+
+    // Remember how long this took for critical path estimates in later builds.
+    node->m_ActionTimeMs = uint32_t(TimerDiffSeconds(start_time, TimerGet()) * 1000.0);
+
+    for (const FrozenFileAndHash& output : node_data->m_OutputFiles)
+    {
+      StatCacheMarkDirty(stat_cache, output.m_Filename, output.m_FilenameHash);
+    }
+
+    if (0 == result.m_ReturnCode && 0 != (node_data->m_Flags & NodeData::kFlagContentDigestOutputs))
+    {
+      DigestOutputFiles(queue, thread_state, node);
+    }
+
+    if (0 == result.m_ReturnCode && action_cache)
+    {
+      if (ActionCacheStore(action_cache, cache_key, node_data) && queue->m_Config.m_RemoteCache)
+        RemoteCacheUpload(queue->m_Config.m_RemoteCache, cache_key);
+    }
+
+    if (queue_lock)
+      MutexLock(queue_lock);
+
+    if (result.m_WasSignalled)
+    {
+      SignalSet("child processes signalled");
+    }
+
+    if (0 == result.m_ReturnCode)
+    {
+      return BuildProgress::kSucceeded;
+    }
+    else
+    {
+      // Clean up output files after a failed build unless they are precious.
+      if (0 == (NodeData::kFlagPreciousOutputs & node_data->m_Flags))
+      {
+        for (const FrozenFileAndHash& output : node_data->m_OutputFiles)
+        {
+          Log(kDebug, "Removing output file %s from failed build", output.m_Filename.Get());
+          remove(output.m_Filename);
+          StatCacheMarkDirty(stat_cache, output.m_Filename, output.m_FilenameHash);
+        }
+      }
+
+      return BuildProgress::kFailed;
+    }
+  }
+
+  // Returns kRunningAction if the action was started asynchronously, in which
+  // case the node is parked until its process has exited and the caller must
+  // not touch it any more.
+  static BuildProgress::Enum RunAction(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  {
+    const NodeData    *node_data    = node->m_MmapData;
+    const char        *cmd_line     = node_data->m_Action;
+    const char        *pre_cmd_line = node_data->m_PreAction;
+
+    if (!cmd_line || cmd_line[0] == '\0')
+      return BuildProgress::kSucceeded;
+
+    if (queue_lock)
+      MutexUnlock(queue_lock);
+
+    StatCache         *stat_cache   = queue->m_Config.m_StatCache;
+    const char        *annotation   = node_data->m_Annotation;
+    int                job_id       = thread_state->m_ThreadIndex;
+    int                echo_annotations = 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagEchoAnnotations);
+    int                echo_cmdline = 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagEchoCommandLines);
+
+    // Repack frozen env to pointers on the stack.
+    int                env_count    = node_data->m_EnvVars.GetCount();
+    EnvVariable*       env_vars     = (EnvVariable*) alloca(env_count * sizeof(EnvVariable));
+    for (int i = 0; i < env_count; ++i)
+    {
+      env_vars[i].m_Name  = node_data->m_EnvVars[i].m_Name;
+      env_vars[i].m_Value = node_data->m_EnvVars[i].m_Value;
+    }
+
+    // Same for the argument vectors of commands that don't need a shell.
+    const char**       args         = nullptr;
+    const char**       pre_args     = nullptr;
+
+    if (int arg_count = node_data->m_ActionArgs.GetCount())
+    {
+      args = (const char**) alloca((arg_count + 1) * sizeof(const char*));
+      for (int i = 0; i < arg_count; ++i)
+        args[i] = node_data->m_ActionArgs[i];
+      args[arg_count] = nullptr;
+    }
+
+    if (int arg_count = node_data->m_PreActionArgs.GetCount())
+    {
+      pre_args = (const char**) alloca((arg_count + 1) * sizeof(const char*));
+      for (int i = 0; i < arg_count; ++i)
+        pre_args[i] = node_data->m_PreActionArgs[i];
+      pre_args[arg_count] = nullptr;
+    }
+
+    for (const FrozenFileAndHash& output_file : node_data->m_OutputFiles)
+    {
+      PathBuffer output;
+      PathInit(&output, output_file.m_Filename);
 
       if (!MakeDirectoriesForFile(stat_cache, output))
       {
         Log(kError, "failed to create output directories for %s", output_file.m_Filename.Get());
-        MutexLock(queue_lock);
+        if (queue_lock)
+          MutexLock(queue_lock);
         return BuildProgress::kFailed;
       }
     }
 
+    // Try to restore the outputs from the action cache before running anything.
+    ActionCache*       action_cache = queue->m_Config.m_ActionCache;
+    HashDigest         cache_key;
+
+    if (action_cache && node_data->m_OutputFiles.GetCount() > 0)
+    {
+      if (node->m_Flags & NodeStateFlags::kCacheKeyValid)
+        cache_key = node->m_ActionCacheKey;
+      else
+        ComputeActionCacheKey(queue, thread_state, node, &cache_key);
+
+      bool restored = ActionCacheRestore(action_cache, cache_key, node_data);
+
+      for (const FrozenFileAndHash& output : node_data->m_OutputFiles)
+      {
+        StatCacheMarkDirty(stat_cache, output.m_Filename, output.m_FilenameHash);
+      }
+
+      if (restored)
+      {
+        Log(kSpam, "T=%d: %s - restored from action cache", job_id, annotation);
+
+        if (echo_annotations)
+        {
+          TerminalIoPrintf(job_id, -200, "%s (cached)\n", annotation);
+          TerminalIoJobExit(job_id);
+        }
+
+        if (0 != (node_data->m_Flags & NodeData::kFlagContentDigestOutputs))
+          DigestOutputFiles(queue, thread_state, node);
+
+        if (queue_lock)
+          MutexLock(queue_lock);
+
+        return BuildProgress::kSucceeded;
+      }
+    }
+    else
+    {
+      action_cache = nullptr;
+    }
+
     ExecResult result = { 0, false };
+    uint64_t   start_time = TimerGet();
 
     // See if we need to remove the output files before running anything.
     if (0 == (node_data->m_Flags & NodeData::kFlagOverwriteOutputs))
@@ -451,12 +1083,45 @@ namespace t2
       }
     }
 
+    // Let the exec reactor look after the process, so this thread can get on
+    // with other nodes meanwhile. Pre-actions have to run first, so nodes
+    // with one run on this thread.
+    if (!pre_cmd_line && queue->m_Config.m_MaxRunningActions > 0)
+    {
+      if (action_cache)
+      {
+        node->m_ActionCacheKey = cache_key;
+        node->m_Flags         |= NodeStateFlags::kCacheKeyValid;
+      }
+
+      node->m_ActionStartTime = start_time;
+      node->m_Progress        = BuildProgress::kRunningAction;
+
+      // Flag the node before handing it over, as the process may exit right away.
+      NodeStateFlagQueued(node);
+      AtomicIncrement(&queue->m_AsyncActionCount);
+
+      Log(kSpam, "Launching process asynchronously");
+
+      if (ExecuteProcessAsync(cmd_line, args, env_count, env_vars, ActionExited, queue, int32_t(node - queue->m_Config.m_NodeState)) >= 0)
+      {
+        if (queue_lock)
+          MutexLock(queue_lock);
+
+        return BuildProgress::kRunningAction;
+      }
+
+      // No room; run it here after all.
+      AtomicDecrement(&queue->m_AsyncActionCount);
+      NodeStateFlagUnqueued(node);
+    }
+
     if (pre_cmd_line)
     {
       Log(kSpam, "Launching pre-action process");
       TimingScope timing_scope(&g_Stats.m_ExecCount, &g_Stats.m_ExecTimeCycles);
       ProfilerScope prof_scope("Pre-build", job_id);
-      result = ExecuteProcess(pre_cmd_line, env_count, env_vars, job_id, echo_cmdline, echo_annotations ? "(pre-build command)" : nullptr);
+      result = ExecuteProcess(pre_cmd_line, pre_args, env_count, env_vars, job_id, echo_cmdline, echo_annotations ? "(pre-build command)" : nullptr);
       Log(kSpam, "Process return code %d", result.m_ReturnCode);
     }
 
@@ -465,74 +1130,145 @@ namespace t2
       Log(kSpam, "Launching process");
       TimingScope timing_scope(&g_Stats.m_ExecCount, &g_Stats.m_ExecTimeCycles);
       ProfilerScope prof_scope(annotation, job_id);
-      result = ExecuteProcess(cmd_line, env_count, env_vars, job_id, echo_cmdline, echo_annotations ? annotation : nullptr);
+      result = ExecuteProcess(cmd_line, args, env_count, env_vars, job_id, echo_cmdline, echo_annotations ? annotation : nullptr);
       Log(kSpam, "Process return code %d", result.m_ReturnCode);
     }
 
-    for (const FrozenFileAndHash& output : node_data->m_OutputFiles)
-    {
-      StatCacheMarkDirty(stat_cache, output.m_Filename, output.m_FilenameHash);
-    }
+    return CompleteAction(queue, thread_state, node, result, start_time, action_cache, cache_key, queue_lock);
+  }
 
-    MutexLock(queue_lock);
+  // Pick up an action started asynchronously once its process has exited.
+  static BuildProgress::Enum FinishAction(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
+  {
+    const NodeData    *node_data    = node->m_MmapData;
+    const char        *annotation   = node_data->m_Annotation;
+    int                echo_annotations = 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagEchoAnnotations);
+    int                echo_cmdline = 0 != (queue->m_Config.m_Flags & BuildQueueConfig::kFlagEchoCommandLines);
+    ActionCache       *action_cache = queue->m_Config.m_ActionCache;
 
-    if (result.m_WasSignalled)
-    {
-      SignalSet("child processes signalled");
-    }
+    if (0 == node_data->m_OutputFiles.GetCount())
+      action_cache = nullptr;
 
-    if (0 == result.m_ReturnCode)
-    {
-      return BuildProgress::kSucceeded;
-    }
-    else
-    {
-      // Clean up output files after a failed build unless they are precious.
-      if (0 == (NodeData::kFlagPreciousOutputs & node_data->m_Flags))
-      {
-        for (const FrozenFileAndHash& output : node_data->m_OutputFiles)
-        {
-          Log(kDebug, "Removing output file %s from failed build", output.m_Filename.Get());
-          remove(output.m_Filename);
-          StatCacheMarkDirty(stat_cache, output.m_Filename, output.m_FilenameHash);
-        }
-      }
+    if (queue_lock)
+      MutexUnlock(queue_lock);
 
-      return BuildProgress::kFailed;
-    }
+    ExecResult result = ExecFinishAsync(node->m_ExecSlot, node_data->m_Action, echo_cmdline, echo_annotations ? annotation : nullptr);
+    Log(kSpam, "T=%d: %s - process return code %d", thread_state->m_ThreadIndex, annotation, result.m_ReturnCode);
+
+    AtomicIncrement(&g_Stats.m_ExecCount);
+    AtomicAdd(&g_Stats.m_ExecTimeCycles, TimerGet() - node->m_ActionStartTime);
+    AtomicDecrement(&queue->m_AsyncActionCount);
+
+    return CompleteAction(queue, thread_state, node, result, node->m_ActionStartTime, action_cache, node->m_ActionCacheKey, queue_lock);
   }
 
-  static void UnblockWaiters(BuildQueue* queue, NodeState* node)
+  static void UnblockWaiters(BuildQueue* queue, ThreadState* thread_state, NodeState* node)
   {
     const NodeData *src_node       = node->m_MmapData;
     int             enqueue_count  = 0;
 
+    MemAllocLinearScope alloc_scope(&thread_state->m_ScratchAlloc);
+    int32_t* ready = LinearAllocateArray<int32_t>(&thread_state->m_ScratchAlloc, src_node->m_BackLinks.GetCount());
+
     for (int32_t link : src_node->m_BackLinks)
     {
       if (NodeState* waiter = GetStateForNode(queue, link))
       {
-        // Only wake nodes in our current pass
-        if (waiter->m_MmapData->m_PassIndex != queue->m_CurrentPassIndex)
+        // Only the thread completing the last dependency gets to queue the node.
+        if (0 != AtomicDecrement(&waiter->m_PendingDependencyCount))
           continue;
 
-        // If the node isn't ready, skip it.
-        if (!AllDependenciesReady(queue, waiter))
+        // Nodes in later passes are queued when their pass starts. Overlapped
+        // passes hold back their nodes with an extra pending count instead.
+        if (!queue->m_OverlapPasses && waiter->m_MmapData->m_PassIndex != queue->m_CurrentPassIndex)
           continue;
 
-        // Did someone else get to the node first?
-        if (NodeStateIsQueued(waiter) || NodeStateIsActive(waiter))
+        ready[enqueue_count++] = int32_t(waiter - queue->m_Config.m_NodeState);
+      }
+    }
+
+    if (IsWorkStealing(queue))
+      SortForDeque(queue, ready, enqueue_count);
+
+    for (int i = 0; i < enqueue_count; ++i)
+      Enqueue(queue, thread_state, queue->m_Config.m_NodeState + ready[i]);
+
+    if (enqueue_count > 0)
+      WakeWaiters(queue, enqueue_count);
+  }
+
+  static void ReleasePass(BuildQueue* queue, ThreadState* thread_state, int pass_index);
+
+  // Called once every node in a pass has completed, or when the pass is
+  // skipped. Releases the passes that were waiting for it.
+  static void CompletePass(BuildQueue* queue, ThreadState* thread_state, int pass_index)
+  {
+    Log(kDebug, "pass %s done", queue->m_Passes[pass_index].m_PassName.Get());
+
+    for (int i = pass_index + 1; i < queue->m_PassCount; ++i)
+    {
+      for (int32_t dep : queue->m_Passes[i].m_Dependencies)
+      {
+        if (dep != pass_index)
           continue;
 
-        //printf("%s is ready to go\n", GetSourceNode(queue, waiter)->m_Annotation);
-        Enqueue(queue, waiter);
-        ++enqueue_count;
+        if (AtomicLoadAcquire(&queue->m_PassFailed[pass_index]))
+          AtomicStoreRelease(&queue->m_PassFailed[i], 1);
+
+        if (0 == AtomicDecrement(&queue->m_PassBarrierCount[i]))
+          ReleasePass(queue, thread_state, i);
       }
     }
+  }
+
+  // Let the nodes in a pass go once all passes it waits for are done. Each
+  // node in a waiting pass carries one extra pending dependency until then.
+  static void ReleasePass(BuildQueue* queue, ThreadState* thread_state, int pass_index)
+  {
+    const int start = queue->m_PassStart[pass_index];
+    const int count = queue->m_PassNodeCount[pass_index];
+
+    // If something this pass waits for failed, its nodes are still released
+    // as usual, but complete as skipped once their dependencies are done. That
+    // way nodes in other passes depending on them are let go too.
+    if (AtomicLoadAcquire(&queue->m_PassFailed[pass_index]))
+    {
+      Log(kDebug, "skipping pass %s", queue->m_Passes[pass_index].m_PassName.Get());
+      AtomicStoreRelease(&queue->m_PassSkipped[pass_index], 1);
+    }
+    else
+    {
+      Log(kDebug, "releasing pass %s", queue->m_Passes[pass_index].m_PassName.Get());
+    }
+
+    MemAllocLinearScope alloc_scope(&thread_state->m_ScratchAlloc);
+    int32_t* ready = LinearAllocateArray<int32_t>(&thread_state->m_ScratchAlloc, count);
+    int enqueue_count = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+      NodeState* state = queue->m_Config.m_NodeState + start + i;
+
+      if (0 == AtomicDecrement(&state->m_PendingDependencyCount))
+        ready[enqueue_count++] = start + i;
+    }
+
+    if (IsWorkStealing(queue))
+      SortForDeque(queue, ready, enqueue_count);
+
+    for (int i = 0; i < enqueue_count; ++i)
+      Enqueue(queue, thread_state, queue->m_Config.m_NodeState + ready[i]);
 
     if (enqueue_count > 0)
       WakeWaiters(queue, enqueue_count);
+
+    if (0 == count)
+      CompletePass(queue, thread_state, pass_index);
   }
 
+  // `queue_lock` is the queue lock held by the caller, which is released around
+  // slow operations. It is null in work stealing mode, where nodes are
+  // advanced without holding it.
   static void AdvanceNode(BuildQueue* queue, ThreadState* thread_state, NodeState* node, Mutex* queue_lock)
   {
     Log(kSpam, "T=%d, [%d] Advancing %s\n",
@@ -547,19 +1283,19 @@ namespace t2
       switch (node->m_Progress)
       {
         case BuildProgress::kInitial:
-          node->m_Progress = SetupDependencies(queue, node);
+          // Nodes are only queued once all their dependencies have completed.
+          CHECK(0 == node->m_PendingDependencyCount);
 
-          if (BuildProgress::kBlocked == node->m_Progress)
+          // Set before the pass is released, so before any of its nodes get here.
+          if (queue->m_OverlapPasses && AtomicLoadAcquire(&queue->m_PassSkipped[node->m_MmapData->m_PassIndex]))
           {
-            // Set ourselves as inactive until our dependencies are ready.
-            NodeStateFlagInactive(node);
-            return;
-          }
-          else
+            Log(kSpam, "T=%d: skipping %s - pass skipped", thread_state->m_ThreadIndex, node->m_MmapData->m_Annotation.Get());
+            node->m_Flags      |= NodeStateFlags::kSkipped;
+            node->m_BuildResult = 1;
+            node->m_Progress    = BuildProgress::kCompleted;
             break;
+          }
 
-        case BuildProgress::kBlocked:
-          CHECK(AllDependenciesReady(queue, node));
           node->m_Progress = BuildProgress::kUnblocked;
           break;
 
@@ -568,27 +1304,46 @@ namespace t2
           break;
 
         case BuildProgress::kRunAction:
-          node->m_Progress = RunAction(queue, thread_state, node, queue_lock);
-
-          // If we couldn't make progress, we're a parked expensive node.
-          // Another expensive job will put us back on the queue later when it
-          // has finshed.
-          if (BuildProgress::kRunAction == node->m_Progress)
+          // If the remote cache is looking for our outputs, we're parked
+          // until it's done. Don't touch the node after this point.
+          if (FetchFromRemoteCache(queue, thread_state, node, queue_lock))
             return;
 
-          // Otherwise, we just ran our action. If we were an expensive node,
-          // make sure to let other expensive nodes on to the cores now.
-          if (node->m_MmapData->m_Flags & NodeData::kFlagExpensive)
           {
-            --queue->m_ExpensiveRunning;
-            CHECK(queue->m_ExpensiveRunning >= 0);
-
-            // We were an expensive job. We can unpark another expensive job if
-            // anything is waiting.
-            UnparkExpensiveNode(queue);
+            // Likewise if too many actions are running; one of them will put
+            // us back on the queue when it's done.
+            const bool counted = UsesActionSlot(queue, node);
+
+            if (counted && !AcquireActionSlot(queue, node, queue_lock))
+              return;
+
+            // If we couldn't get a slot, we're now a parked expensive node.
+            // Another expensive job will put us back on the queue later when
+            // it has finished. Don't touch the node after this point.
+            if ((node->m_MmapData->m_Flags & NodeData::kFlagExpensive) && !AcquireExpensiveSlot(queue, node, queue_lock))
+            {
+              if (counted)
+                ReleaseActionSlot(queue, thread_state, queue_lock);
+              return;
+            }
+
+            BuildProgress::Enum progress = RunAction(queue, thread_state, node, queue_lock);
+
+            // The action is running without us, and its node is parked until
+            // the process exits. Don't touch the node after this point.
+            if (BuildProgress::kRunningAction == progress)
+              return;
+
+            node->m_Progress = progress;
+            ReleaseActionSlots(queue, thread_state, node, queue_lock);
           }
           break;
 
+        case BuildProgress::kRunningAction:
+          node->m_Progress = FinishAction(queue, thread_state, node, queue_lock);
+          ReleaseActionSlots(queue, thread_state, node, queue_lock);
+          break;
+
         case BuildProgress::kSucceeded:
         case BuildProgress::kUpToDate:
           node->m_BuildResult = 0;
@@ -596,20 +1351,34 @@ namespace t2
           break;
 
         case BuildProgress::kFailed:
-          queue->m_FailedNodeCount++;
+          AtomicIncrement(&queue->m_FailedNodeCount);
+
+          if (queue->m_OverlapPasses)
+            AtomicStoreRelease(&queue->m_PassFailed[node->m_MmapData->m_PassIndex], 1);
 
-          CondBroadcast(&queue->m_WorkAvailable);
+          WakeAllThreads(queue);
 
           node->m_BuildResult = 1;
           node->m_Progress    = BuildProgress::kCompleted;
           break;
 
         case BuildProgress::kCompleted:
-          queue->m_PendingNodeCount--;
+          // Unblock before counting ourselves done, so the pass can't end
+          // while we're still updating our waiters.
+          UnblockWaiters(queue, thread_state, node);
 
-          UnblockWaiters(queue, node);
+          if (queue->m_OverlapPasses)
+          {
+            int pass_index = node->m_MmapData->m_PassIndex;
+            if (0 == AtomicDecrement(&queue->m_PassPendingCount[pass_index]))
+              CompletePass(queue, thread_state, pass_index);
+          }
+
+          if (0 == AtomicDecrement(&queue->m_PendingNodeCount) && IsWorkStealing(queue))
+            WakeThread(&queue->m_ThreadState[0]); // Let the main thread move on to the next pass.
 
-          CondBroadcast(&queue->m_WorkAvailable);
+          if (!IsWorkStealing(queue))
+            CondBroadcast(&queue->m_WorkAvailable);
           return;
 
         default:
@@ -619,19 +1388,34 @@ namespace t2
     }
   }
 
-  static NodeState* NextNode(BuildQueue* queue)
+  // Take a node whose action's process has exited, to finish it. Called with
+  // the queue lock held.
+  static NodeState* NextExitedAction(BuildQueue* queue)
   {
-    int avail_count = AvailableNodeCount(queue);
-
-    if (0 == avail_count)
+    if (0 == queue->m_ExitedActionCount)
       return nullptr;
 
-    uint32_t read_index = queue->m_QueueReadIndex;
+    NodeState* state = queue->m_Config.m_NodeState + queue->m_ExitedActions[--queue->m_ExitedActionCount];
+
+    // Still active from when the action was started.
+    CHECK(NodeStateIsQueued(state));
+    CHECK(NodeStateIsActive(state));
+
+    NodeStateFlagUnqueued(state);
+
+    return state;
+  }
+
+  static NodeState* NextNode(BuildQueue* queue)
+  {
+    // Finish actions first, as that frees up slots for other actions.
+    if (NodeState* state = NextExitedAction(queue))
+      return state;
 
-    int32_t node_index = queue->m_Queue[read_index];
+    if (0 == queue->m_QueueCount)
+      return nullptr;
 
-    // Update read index
-    queue->m_QueueReadIndex = (read_index + 1) & (queue->m_QueueCapacity - 1);
+    int32_t node_index = ReadyHeapPop(queue);
 
     NodeState* state = queue->m_Config.m_NodeState + node_index;
 
@@ -671,8 +1455,121 @@ namespace t2
     return queue->m_PendingNodeCount > 0;
   }
 
+  // Pop a node from our own deque, or steal one from another thread.
+  static int32_t NextNodeIndexStealing(BuildQueue* queue, ThreadState* thread_state)
+  {
+    int32_t state_index = DequePopTail(queue, thread_state);
+
+    if (state_index >= 0)
+      return state_index;
+
+    const int thread_count = queue->m_Config.m_ThreadCount;
+
+    for (int i = 1; i < thread_count; ++i)
+    {
+      ThreadState* victim = &queue->m_ThreadState[(thread_state->m_ThreadIndex + i) % thread_count];
+
+      state_index = DequePopHead(queue, victim);
+
+      if (state_index >= 0)
+      {
+        AtomicIncrement(&g_Stats.m_StealCount);
+        return state_index;
+      }
+    }
+
+    return -1;
+  }
+
+  static void ParkThread(BuildQueue* queue, ThreadState* thread_state)
+  {
+    // Advertise ourselves as idle first, so that anyone pushing work after
+    // this point will wake us.
+    MutexLock(&queue->m_IdleLock);
+    queue->m_IdleThreads[queue->m_IdleCount++] = thread_state->m_ThreadIndex;
+    MutexUnlock(&queue->m_IdleLock);
+
+    // Work pushed before we became visible won't wake us, so look again.
+    bool work_available = AtomicLoadAcquire(&queue->m_ExitedActionCount) > 0;
+    for (int i = 0, count = queue->m_Config.m_ThreadCount; !work_available && i < count; ++i)
+      work_available = !DequeIsEmpty(&queue->m_ThreadState[i]);
+
+    if (!work_available)
+    {
+      MutexLock(&thread_state->m_WakeLock);
+      while (!thread_state->m_WakeSignalled)
+        CondWait(&thread_state->m_WakeCond, &thread_state->m_WakeLock);
+      thread_state->m_WakeSignalled = false;
+      MutexUnlock(&thread_state->m_WakeLock);
+    }
+
+    // We may have been woken by something other than WakeIdleThreads(), so
+    // make sure we're no longer on the idle stack.
+    MutexLock(&queue->m_IdleLock);
+    for (int i = 0, count = queue->m_IdleCount; i < count; ++i)
+    {
+      if (queue->m_IdleThreads[i] == thread_state->m_ThreadIndex)
+      {
+        queue->m_IdleThreads[i] = queue->m_IdleThreads[--queue->m_IdleCount];
+        break;
+      }
+    }
+    MutexUnlock(&queue->m_IdleLock);
+  }
+
+  // Nodes are advanced without holding the queue lock in this mode. A node is
+  // only ever queued by the thread that completes its last dependency, and
+  // only advanced by the thread that pops it.
+  static void BuildLoopStealing(ThreadState* thread_state)
+  {
+    BuildQueue *queue = thread_state->m_Queue;
+
+    while (ShouldKeepBuilding(queue, thread_state->m_ThreadIndex))
+    {
+      // Finish actions first, as that frees up slots for other actions.
+      if (AtomicLoadAcquire(&queue->m_ExitedActionCount) > 0)
+      {
+        MutexLock(&queue->m_Lock);
+        NodeState* node = NextExitedAction(queue);
+        MutexUnlock(&queue->m_Lock);
+
+        if (node)
+        {
+          AdvanceNode(queue, thread_state, node, nullptr);
+          continue;
+        }
+      }
+
+      int32_t state_index = NextNodeIndexStealing(queue, thread_state);
+
+      if (state_index < 0)
+      {
+        ParkThread(queue, thread_state);
+        continue;
+      }
+
+      NodeState* node = queue->m_Config.m_NodeState + state_index;
+
+      CHECK(NodeStateIsQueued(node));
+      CHECK(!NodeStateIsActive(node));
+
+      NodeStateFlagUnqueued(node);
+      NodeStateFlagActive(node);
+
+      AdvanceNode(queue, thread_state, node, nullptr);
+    }
+
+    Log(kSpam, "build thread %d exiting\n", thread_state->m_ThreadIndex);
+  }
+
   static void BuildLoop(ThreadState* thread_state)
   {
+    if (IsWorkStealing(thread_state->m_Queue))
+    {
+      BuildLoopStealing(thread_state);
+      return;
+    }
+
     BuildQueue        *queue = thread_state->m_Queue;
     ConditionVariable *cv    = &queue->m_WorkAvailable;
     Mutex             *mutex = &queue->m_Lock;
@@ -711,48 +1608,92 @@ namespace t2
   {
     ProfilerScope prof_scope("Tundra BuildQueueInit", 0);
     CHECK(config->m_MaxExpensiveCount > 0 && config->m_MaxExpensiveCount <= config->m_ThreadCount);
+    CHECK(config->m_MaxRunningActions >= 0);
 
     MutexInit(&queue->m_Lock);
     CondInit(&queue->m_WorkAvailable);
 
     // Compute queue capacity. Allocate space for a power of two number of
     // indices that's at least one larger than the max number of nodes. Because
-    // the queue is treated as a ring buffer, we want W=R to mean an empty
-    // buffer.
+    // the work stealing deques are treated as ring buffers, we want W=R to
+    // mean an empty buffer.
     uint32_t capacity = NextPowerOfTwo(config->m_MaxNodes + 1);
 
     MemAllocHeap* heap = config->m_Heap;
 
-    queue->m_Queue              = HeapAllocateArray<int32_t>(heap, capacity);
-    queue->m_QueueReadIndex     = 0;
-    queue->m_QueueWriteIndex    = 0;
-    queue->m_QueueCapacity      = capacity;
     queue->m_Config             = *config;
+    queue->m_QueueCapacity      = capacity;
+    queue->m_QueueCount         = 0;
+
+    if (IsWorkStealing(queue))
+    {
+      // Ready nodes live in the per-thread deques instead.
+      queue->m_Queue            = nullptr;
+      MutexInit(&queue->m_IdleLock);
+      queue->m_IdleThreads      = HeapAllocateArray<int32_t>(heap, config->m_ThreadCount);
+      queue->m_IdleCount        = 0;
+    }
+    else
+    {
+      queue->m_Queue            = HeapAllocateArray<int32_t>(heap, capacity);
+      queue->m_IdleThreads      = nullptr;
+      queue->m_IdleCount        = 0;
+      CHECK(queue->m_Queue);
+    }
+
     queue->m_PendingNodeCount   = 0;
     queue->m_FailedNodeCount    = 0;
     queue->m_QuitSignalled      = false;
     queue->m_ExpensiveRunning   = 0;
     queue->m_ExpensiveWaitCount = 0;
     queue->m_ExpensiveWaitList  = HeapAllocateArray<NodeState*>(heap, capacity);
+    queue->m_ActionsRunning     = 0;
+    queue->m_ActionWaitCount    = 0;
+    queue->m_ActionWaitList     = HeapAllocateArray<NodeState*>(heap, capacity);
+    queue->m_AsyncActionCount   = 0;
+    queue->m_ExitedActionCount  = 0;
+    queue->m_ExitedActions      = HeapAllocateArray<int32_t>(heap, std::max(config->m_MaxRunningActions, 1));
+    CondInit(&queue->m_ActionExited);
+
+    queue->m_OverlapPasses      = false;
+    queue->m_Passes             = nullptr;
+    queue->m_PassCount          = 0;
+    queue->m_PassStart          = nullptr;
+    queue->m_PassNodeCount      = nullptr;
+    queue->m_PassPendingCount   = nullptr;
+    queue->m_PassBarrierCount   = nullptr;
+    queue->m_PassFailed         = nullptr;
+    queue->m_PassSkipped        = nullptr;
+
+    GetCwd(queue->m_RootDir, sizeof queue->m_RootDir);
+    queue->m_RootDirLength      = strlen(queue->m_RootDir);
 
     queue->m_Threads = HeapAllocateArrayZeroed<ThreadId>(config->m_Heap, config->m_ThreadCount);
     queue->m_ThreadState = HeapAllocateArrayZeroed<ThreadState>(config->m_Heap, config->m_ThreadCount);
 
-    CHECK(queue->m_Queue);
-
-    Log(kDebug, "build queue initialized; ring buffer capacity = %u", queue->m_QueueCapacity);
+    Log(kDebug, "build queue initialized; queue capacity = %u", queue->m_QueueCapacity);
 
     // Block all signals on the main thread.
     SignalBlockThread(true);
     SignalHandlerSetCondition(&queue->m_WorkAvailable);
 
+    // All thread states must be initialized before any thread starts, as
+    // threads may try to steal from each other right away.
+    for (int i = 0, thread_count = config->m_ThreadCount; i < thread_count; ++i)
+    {
+      ThreadStateInit(&queue->m_ThreadState[i], queue, MB(32), i);
+    }
+
+    if (IsWorkStealing(queue))
+    {
+      SignalHandlerSetCallback(SignalWakeAllThreads, queue);
+    }
+
     // Create build threads.
     for (int i = 0, thread_count = config->m_ThreadCount; i < thread_count; ++i)
     {
       ThreadState* thread_state = &queue->m_ThreadState[i];
 
-      ThreadStateInit(thread_state, queue, MB(32), i);
-
       if (i > 0)
       {
         Log(kDebug, "starting build thread %d", i);
@@ -761,33 +1702,100 @@ namespace t2
     }
   }
 
+  // The build can stop with actions still running, after an error or an
+  // interrupt. Wait for them, and finish their nodes so their results are
+  // kept, before the queue goes away. Called once the build threads have
+  // exited, so no more actions can start.
+  static void FinishRunningActions(BuildQueue* queue)
+  {
+    ThreadState *thread_state = &queue->m_ThreadState[0];
+    Mutex       *queue_lock   = IsWorkStealing(queue) ? nullptr : &queue->m_Lock;
+
+    MutexLock(&queue->m_Lock);
+
+    while (queue->m_AsyncActionCount > 0)
+    {
+      NodeState* node = NextExitedAction(queue);
+
+      if (!node)
+      {
+        CondWait(&queue->m_ActionExited, &queue->m_Lock);
+        continue;
+      }
+
+      if (!queue_lock)
+        MutexUnlock(&queue->m_Lock);
+
+      AdvanceNode(queue, thread_state, node, queue_lock);
+
+      if (!queue_lock)
+        MutexLock(&queue->m_Lock);
+    }
+
+    MutexUnlock(&queue->m_Lock);
+  }
+
   void BuildQueueDestroy(BuildQueue* queue)
   {
     ProfilerScope prof_scope("Tundra BuildQueueDestroy", 0);
     Log(kDebug, "destroying build queue");
     const BuildQueueConfig* config = &queue->m_Config;
 
+    // Stop signals from reaching into the queue before any of it goes away.
+    // Build threads are woken below regardless.
+    SignalHandlerSetCallback(nullptr, nullptr);
+    SignalHandlerSetCondition(nullptr);
+
+    // Parked nodes are put back on the queue by the remote cache threads, so
+    // let them finish before tearing anything down.
+    if (config->m_RemoteCache)
+      RemoteCacheWaitForLookups(config->m_RemoteCache);
+
     MutexLock(&queue->m_Lock);
     queue->m_QuitSignalled = true;
     MutexUnlock(&queue->m_Lock);
 
-    CondBroadcast(&queue->m_WorkAvailable);
+    WakeAllThreads(queue);
 
-    for (int i = 0, thread_count = config->m_ThreadCount; i < thread_count; ++i)
+    for (int i = 1, thread_count = config->m_ThreadCount; i < thread_count; ++i)
     {
-      if (i > 0)
-      {
-        Log(kDebug, "joining with build thread %d", i);
-        ThreadJoin(queue->m_Threads[i]);
-      }
+      Log(kDebug, "joining with build thread %d", i);
+      ThreadJoin(queue->m_Threads[i]);
+    }
 
+    FinishRunningActions(queue);
+
+    // Only tear down thread state once every thread has exited, as threads
+    // may look at each other's deques until then.
+    for (int i = 0, thread_count = config->m_ThreadCount; i < thread_count; ++i)
+    {
       ThreadStateDestroy(&queue->m_ThreadState[i]);
     }
 
     // Deallocate storage.
     MemAllocHeap* heap = queue->m_Config.m_Heap;
     HeapFree(heap, queue->m_ExpensiveWaitList);
-    HeapFree(heap, queue->m_Queue);
+    HeapFree(heap, queue->m_ActionWaitList);
+    HeapFree(heap, queue->m_ExitedActions);
+    CondDestroy(&queue->m_ActionExited);
+
+    // Build threads may still have been looking at these until they exited.
+    HeapFree(heap, queue->m_PassStart);
+    HeapFree(heap, queue->m_PassNodeCount);
+    HeapFree(heap, queue->m_PassPendingCount);
+    HeapFree(heap, queue->m_PassBarrierCount);
+    HeapFree(heap, queue->m_PassFailed);
+    HeapFree(heap, queue->m_PassSkipped);
+
+    if (IsWorkStealing(queue))
+    {
+      HeapFree(heap, queue->m_IdleThreads);
+      MutexDestroy(&queue->m_IdleLock);
+    }
+    else
+    {
+      HeapFree(heap, queue->m_Queue);
+    }
 
     CondDestroy(&queue->m_WorkAvailable);
     MutexDestroy(&queue->m_Lock);
@@ -796,10 +1804,63 @@ namespace t2
     HeapFree(config->m_Heap, queue->m_Threads);
 
     // Unblock all signals on the main thread.
-    SignalHandlerSetCondition(nullptr);
     SignalBlockThread(false);
   }
 
+  // Queue up the nodes in a range that are ready to go. Called with the queue
+  // lock held, before the build threads are let loose on the range.
+  static void SeedReadyNodes(BuildQueue* queue, int start_index, int count)
+  {
+    NodeState   *node_states  = queue->m_Config.m_NodeState;
+    ThreadState *main_thread  = &queue->m_ThreadState[0];
+    const int    thread_count = queue->m_Config.m_ThreadCount;
+
+    MemAllocLinearScope alloc_scope(&main_thread->m_ScratchAlloc);
+    int32_t* ready = LinearAllocateArray<int32_t>(&main_thread->m_ScratchAlloc, count);
+    int ready_count = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+      NodeState* state = node_states + start_index + i;
+
+      // Verify node hasn't been touched already
+      CHECK(state->m_Progress == BuildProgress::kInitial);
+
+      // Nodes with outstanding dependencies are queued as those complete.
+      if (state->m_PendingDependencyCount > 0)
+        continue;
+
+      NodeStateFlagQueued(state);
+      ready[ready_count++] = start_index + i;
+    }
+
+    queue->m_QueueCount = 0;
+
+    if (IsWorkStealing(queue))
+    {
+      // Deal the ready nodes out evenly; threads will steal to even out the rest.
+      SortForDeque(queue, ready, ready_count);
+
+      for (int i = 0; i < ready_count; ++i)
+        DequePush(queue, &queue->m_ThreadState[i % thread_count], ready[i]);
+    }
+    else
+    {
+      for (int i = 0; i < ready_count; ++i)
+        ReadyHeapPush(queue, ready[i]);
+    }
+  }
+
+  static BuildResult::Enum GetBuildResult(BuildQueue* queue)
+  {
+    if (SignalGetReason())
+      return BuildResult::kInterrupted;
+    else if (queue->m_FailedNodeCount)
+      return BuildResult::kBuildError;
+    else
+      return BuildResult::kOk;
+  }
+
   BuildResult::Enum BuildQueueBuildNodeRange(BuildQueue* queue, int start_index, int count, int pass_index)
   {
     // Make sure none of the build threads see in-progress state due to a spurious wakeup.
@@ -809,40 +1870,85 @@ namespace t2
 
     queue->m_CurrentPassIndex = pass_index;
 
-    // Initialize build queue with index range to build
-    int32_t   *build_queue = queue->m_Queue;
-    NodeState *node_states = queue->m_Config.m_NodeState;
+    SeedReadyNodes(queue, start_index, count);
 
-    for (int i = 0; i < count; ++i)
+    queue->m_PendingNodeCount = count;
+    queue->m_FailedNodeCount  = 0;
+
+    MutexUnlock(&queue->m_Lock);
+
+    WakeAllThreads(queue);
+
+    // This thread is thread 0.
+    BuildLoop(&queue->m_ThreadState[0]);
+
+    return GetBuildResult(queue);
+  }
+
+  BuildResult::Enum BuildQueueBuildPassesOverlapped(BuildQueue* queue, const PassData* passes, int pass_count, const int32_t* pass_node_counts)
+  {
+    MemAllocHeap* heap = queue->m_Config.m_Heap;
+
+    // Make sure none of the build threads see in-progress state due to a spurious wakeup.
+    MutexLock(&queue->m_Lock);
+
+    CHECK(nullptr == queue->m_PassStart);
+
+    queue->m_Passes           = passes;
+    queue->m_PassCount        = pass_count;
+    queue->m_PassStart        = HeapAllocateArray<int32_t>(heap, pass_count);
+    queue->m_PassNodeCount    = HeapAllocateArray<int32_t>(heap, pass_count);
+    queue->m_PassPendingCount = HeapAllocateArray<int32_t>(heap, pass_count);
+    queue->m_PassBarrierCount = HeapAllocateArray<int32_t>(heap, pass_count);
+    queue->m_PassFailed       = HeapAllocateArrayZeroed<int32_t>(heap, pass_count);
+    queue->m_PassSkipped      = HeapAllocateArrayZeroed<int32_t>(heap, pass_count);
+
+    NodeState* node_states = queue->m_Config.m_NodeState;
+    int        node_count  = 0;
+
+    for (int pass = 0; pass < pass_count; ++pass)
     {
-      NodeState* state = node_states + start_index + i;
+      const int count   = pass_node_counts[pass];
+      const int barrier = passes[pass].m_Dependencies.GetCount();
 
-      NodeStateFlagQueued(state);
+      queue->m_PassStart[pass]        = node_count;
+      queue->m_PassNodeCount[pass]    = count;
+      queue->m_PassPendingCount[pass] = count;
+      queue->m_PassBarrierCount[pass] = barrier;
 
-      // Verify node hasn't been touched already
-      CHECK(state->m_Progress == BuildProgress::kInitial);
+      // Hold back nodes in passes that wait for other passes.
+      if (barrier > 0)
+      {
+        for (int i = 0; i < count; ++i)
+          node_states[node_count + i].m_PendingDependencyCount++;
+      }
 
-      build_queue[i] = start_index + i;
+      node_count += count;
     }
 
-    queue->m_PendingNodeCount = count;
+    CHECK(node_count <= queue->m_Config.m_MaxNodes);
+
+    queue->m_OverlapPasses = true;
+
+    SeedReadyNodes(queue, 0, node_count);
+
+    queue->m_PendingNodeCount = node_count;
     queue->m_FailedNodeCount  = 0;
-    queue->m_QueueWriteIndex  = count;
-    queue->m_QueueReadIndex   = 0;
+
+    // Passes that have nothing to build are done already.
+    for (int pass = 0; pass < pass_count; ++pass)
+    {
+      if (0 == queue->m_PassNodeCount[pass] && 0 == queue->m_PassBarrierCount[pass])
+        CompletePass(queue, &queue->m_ThreadState[0], pass);
+    }
 
     MutexUnlock(&queue->m_Lock);
 
-    CondBroadcast(&queue->m_WorkAvailable);
+    WakeAllThreads(queue);
 
     // This thread is thread 0.
     BuildLoop(&queue->m_ThreadState[0]);
 
-    if (SignalGetReason())
-      return BuildResult::kInterrupted;
-    else if (queue->m_FailedNodeCount)
-      return BuildResult::kBuildError;
-    else
-      return BuildResult::kOk;
+    return GetBuildResult(queue);
   }
 }
-
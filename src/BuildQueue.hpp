@@ -7,6 +7,8 @@
 #include "Thread.hpp"
 #include "MemAllocLinear.hpp"
 #include "MemAllocHeap.hpp"
+#include "HashTable.hpp"
+#include "PathUtil.hpp"
 
 namespace t2
 {
@@ -16,6 +18,9 @@ namespace t2
   struct ScanCache;
   struct StatCache;
   struct DigestCache;
+  struct ActionCache;
+  struct RemoteCache;
+  struct PassData;
 
   struct BuildQueueConfig
   {
@@ -26,7 +31,10 @@ namespace t2
       // Print annotations to the TTY as actions are executed
       kFlagEchoAnnotations    = 1 << 1,
       // Continue building even if there are errors.
-      kFlagContinueOnError    = 1 << 2
+      kFlagContinueOnError    = 1 << 2,
+      // Give every build thread its own deque of ready nodes and let idle
+      // threads steal from each other, rather than sharing one ring buffer.
+      kFlagWorkStealing       = 1 << 3
     };
 
     uint32_t        m_Flags;
@@ -41,9 +49,16 @@ namespace t2
     DigestCache    *m_DigestCache;
     int             m_ShaDigestExtensionCount;
     const uint32_t* m_ShaDigestExtensions;
+    HashSet<kFlagPathStrings>* m_ContentDigestFiles;
+    bool            m_SignByContent;
+    ActionCache*    m_ActionCache;
+    RemoteCache*    m_RemoteCache;
     void*           m_FileSigningLog;
     Mutex*          m_FileSigningLogMutex;
     int32_t         m_MaxExpensiveCount;
+    // Actions that can run at once, started asynchronously so build threads
+    // don't wait on them. Zero to run every action on its build thread.
+    int32_t         m_MaxRunningActions;
   };
 
   struct BuildQueue;
@@ -54,6 +69,19 @@ namespace t2
     MemAllocLinear    m_ScratchAlloc;
     int               m_ThreadIndex;
     BuildQueue*       m_Queue;
+
+    // Work stealing mode only. Ready node state indices; the owning thread
+    // pushes and pops at the tail, other threads steal from the head.
+    Mutex             m_DequeLock;
+    int32_t          *m_Deque;
+    uint32_t          m_DequeHead;
+    uint32_t          m_DequeTail;
+
+    // Work stealing mode only. Each thread sleeps on its own condition
+    // variable so wakeups can be targeted instead of broadcast.
+    Mutex             m_WakeLock;
+    ConditionVariable m_WakeCond;
+    bool              m_WakeSignalled;
   };
 
   struct BuildQueue
@@ -62,8 +90,7 @@ namespace t2
     ConditionVariable  m_WorkAvailable;
     int32_t           *m_Queue;
     uint32_t           m_QueueCapacity;
-    uint32_t           m_QueueReadIndex;
-    uint32_t           m_QueueWriteIndex;
+    uint32_t           m_QueueCount;
     BuildQueueConfig   m_Config;
     int32_t            m_PendingNodeCount;
     int32_t            m_FailedNodeCount;
@@ -74,6 +101,40 @@ namespace t2
     int32_t            m_ExpensiveWaitCount;
     NodeState        **m_ExpensiveWaitList;
     bool               m_QuitSignalled;
+
+    // Running actions, bounded by m_MaxRunningActions. Nodes waiting for one
+    // to finish are parked like expensive nodes. Guarded by m_Lock.
+    int32_t            m_ActionsRunning;
+    int32_t            m_ActionWaitCount;
+    NodeState        **m_ActionWaitList;
+
+    // Actions started asynchronously that haven't been finished yet, updated
+    // atomically, and the state indices of those whose process has exited,
+    // guarded by m_Lock.
+    int32_t            m_AsyncActionCount;
+    int32_t            m_ExitedActionCount;
+    int32_t           *m_ExitedActions;
+    ConditionVariable  m_ActionExited;
+
+    // Work stealing mode only. Stack of thread indices parked waiting for work.
+    Mutex              m_IdleLock;
+    int32_t           *m_IdleThreads;
+    int32_t            m_IdleCount;
+
+    // Overlapped passes only. Per pass bookkeeping, indexed by pass index.
+    bool               m_OverlapPasses;
+    const PassData    *m_Passes;
+    int32_t            m_PassCount;
+    int32_t           *m_PassStart;         // State index of the first node in the pass
+    int32_t           *m_PassNodeCount;     // Number of nodes in the pass
+    int32_t           *m_PassPendingCount;  // Nodes in the pass that haven't completed
+    int32_t           *m_PassBarrierCount;  // Passes this pass waits for that aren't done
+    int32_t           *m_PassFailed;        // Non-zero if the pass or a pass it waits for failed
+    int32_t           *m_PassSkipped;       // Non-zero if a pass it waits for failed, so its nodes don't run
+
+    // Working directory of the build, left out of action cache keys.
+    char               m_RootDir[kMaxPathLength];
+    size_t             m_RootDirLength;
   };
 
   namespace BuildResult
@@ -94,6 +155,10 @@ namespace t2
 
   BuildResult::Enum BuildQueueBuildNodeRange(BuildQueue* queue, int start_index, int count, int pass_index);
 
+  // Build all passes at once. A node starts as soon as its dependencies have
+  // completed and every pass its own pass depends on is done.
+  BuildResult::Enum BuildQueueBuildPassesOverlapped(BuildQueue* queue, const PassData* passes, int pass_count, const int32_t* pass_node_counts);
+
   void BuildQueueDestroy(BuildQueue* queue);
 
 }
@@ -0,0 +1,986 @@
+#include "BuildServer.hpp"
+#include "FileInfo.hpp"
+#include "PathUtil.hpp"
+#include "SignalHandler.hpp"
+#include "Thread.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace t2
+{
+
+enum
+{
+  kBuildRequestMagic    = 0x1b5e7a03,
+
+  // Arguments and environment; anything bigger isn't from a real client.
+  kMaxPayloadSize       = 16 * 1024 * 1024,
+
+  // Servers exit after this long without a request.
+  kIdleTimeoutSeconds   = 3 * 60 * 60,
+
+  // How long to wait for a server that's being started, or for an old one
+  // to make way for a new one.
+  kStartTimeoutMs       = 10000,
+};
+
+namespace BuildRequest
+{
+  enum Enum
+  {
+    kBuild,
+    kStop
+  };
+}
+
+// Sent by the server once it has taken on a request, or to tell the client
+// to start a new server. After kReplyAccepted comes the exit code, once the
+// build is done. If the connection closes before either, the server was
+// going away and the client tries again.
+static const char kReplyAccepted = 'A';
+static const char kReplyRestart  = 'R';
+
+// Sent by the client when it's interrupted.
+static const char kRequestInterrupt = 'I';
+
+struct BuildRequestHeader
+{
+  uint32_t m_Magic;
+  uint32_t m_Command;
+  uint32_t m_ThreadCount;
+  uint32_t m_ActionCount;
+  uint32_t m_ArgCount;
+  uint32_t m_EnvCount;
+  uint32_t m_PayloadSize;
+  uint64_t m_ExeTimestamp;
+};
+
+// The header is followed by a payload of null terminated strings: the
+// client's working directory and executable, its arguments, and its
+// environment. The client's stdin, stdout and stderr come along with the
+// header.
+
+#if defined(MSG_NOSIGNAL)
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+static void ServerFilePath(char (&path)[kMaxPathLength], const char* dag_filename, const char* suffix)
+{
+  snprintf(path, sizeof path, "%s.%s", dag_filename, suffix);
+}
+
+static void SetCloseOnExec(int fd)
+{
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static bool MakeSocketAddress(struct sockaddr_un* sa, const char* path)
+{
+  memset(sa, 0, sizeof *sa);
+  sa->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof sa->sun_path)
+    return false;
+
+  strcpy(sa->sun_path, path);
+  return true;
+}
+
+// Whether the other end of a connection runs as the same user as we do.
+// The server runs whatever it's sent, and the client hands over its output
+// streams, so neither talks to anyone else.
+static bool PeerIsSameUser(int fd)
+{
+#if defined(TUNDRA_LINUX)
+  struct ucred cred;
+  socklen_t    len = sizeof cred;
+
+  if (0 != getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+    return false;
+
+  return cred.uid == geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+
+  if (0 != getpeereid(fd, &uid, &gid))
+    return false;
+
+  return uid == geteuid();
+#endif
+}
+
+static bool SendAll(int fd, const void* data, size_t size)
+{
+  const char* p = (const char*) data;
+
+  while (size > 0)
+  {
+    ssize_t n = send(fd, p, size, kSendFlags);
+
+    if (n < 0 && EINTR == errno)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    p    += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+static bool RecvAll(int fd, void* data, size_t size)
+{
+  char* p = (char*) data;
+
+  while (size > 0)
+  {
+    ssize_t n = recv(fd, p, size, 0);
+
+    if (n < 0 && EINTR == errno)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    p    += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Client
+//-----------------------------------------------------------------------------
+
+static volatile sig_atomic_t s_ClientInterrupted;
+
+static void ClientSignalHandler(int sig)
+{
+  s_ClientInterrupted = 1;
+}
+
+static int ConnectToServer(const char* socket_path)
+{
+  struct sockaddr_un sa;
+  if (!MakeSocketAddress(&sa, socket_path))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  SetCloseOnExec(fd);
+
+#if defined(SO_NOSIGPIPE)
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof one);
+#endif
+
+  if (0 != connect(fd, (struct sockaddr*) &sa, sizeof sa))
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (!PeerIsSameUser(fd))
+  {
+    Log(kWarning, "build server at %s runs as a different user; not using it", socket_path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Start a server in the background. It detaches from our session, so
+// terminal signals and hangups meant for us don't reach it.
+static bool StartServer(const char* dag_filename, int thread_count, int action_count)
+{
+  const char* exe_path = GetExePath();
+
+  char log_path[kMaxPathLength];
+  ServerFilePath(log_path, dag_filename, "server.log");
+
+  char thread_arg[16];
+  snprintf(thread_arg, sizeof thread_arg, "%d", thread_count);
+
+  char action_arg[16];
+  snprintf(action_arg, sizeof action_arg, "%d", action_count);
+
+  pid_t pid = fork();
+
+  if (pid < 0)
+    return false;
+
+  if (0 == pid)
+  {
+    setsid();
+
+    int null_fd = open("/dev/null", O_RDONLY);
+    int log_fd  = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (null_fd < 0 || log_fd < 0)
+      _exit(127);
+
+    dup2(null_fd, STDIN_FILENO);
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+
+    // Don't hold on to anything else we inherited, like a pipe someone is
+    // waiting to see closed.
+    for (int fd = STDERR_FILENO + 1; fd < 1024; ++fd)
+      close(fd);
+
+    execl(exe_path, exe_path, "--build-server", "-j", thread_arg, "-a", action_arg, "-R", dag_filename, (char*) nullptr);
+    _exit(127);
+  }
+
+  return true;
+}
+
+static bool SendRequest(int fd, BuildRequest::Enum command, int thread_count, int action_count, int argc, char** argv)
+{
+  char cwd[kMaxPathLength];
+  GetCwd(cwd, sizeof cwd);
+
+  const char* exe_path = GetExePath();
+
+  int env_count = 0;
+  while (environ[env_count])
+    ++env_count;
+
+  size_t payload_size = strlen(cwd) + strlen(exe_path) + 2;
+
+  for (int i = 0; i < argc; ++i)
+    payload_size += strlen(argv[i]) + 1;
+
+  for (int i = 0; i < env_count; ++i)
+    payload_size += strlen(environ[i]) + 1;
+
+  if (payload_size > kMaxPayloadSize)
+    return false;
+
+  char* payload = (char*) malloc(payload_size);
+  char* cursor  = payload;
+
+  auto add_string = [&cursor](const char* s) -> void
+  {
+    size_t len = strlen(s) + 1;
+    memcpy(cursor, s, len);
+    cursor += len;
+  };
+
+  add_string(cwd);
+  add_string(exe_path);
+
+  for (int i = 0; i < argc; ++i)
+    add_string(argv[i]);
+
+  for (int i = 0; i < env_count; ++i)
+    add_string(environ[i]);
+
+  BuildRequestHeader header;
+  header.m_Magic        = kBuildRequestMagic;
+  header.m_Command      = command;
+  header.m_ThreadCount  = uint32_t(thread_count);
+  header.m_ActionCount  = uint32_t(action_count);
+  header.m_ArgCount     = uint32_t(argc);
+  header.m_EnvCount     = uint32_t(env_count);
+  header.m_PayloadSize  = uint32_t(payload_size);
+  header.m_ExeTimestamp = GetFileInfo(exe_path).m_Timestamp;
+
+  // The server writes the build's output straight to our stdout and
+  // stderr, so pass them along with the header.
+  const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+  union
+  {
+    struct cmsghdr m_Align;
+    char           m_Data[CMSG_SPACE(sizeof fds)];
+  } control;
+
+  struct iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len  = sizeof header;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.m_Data;
+  msg.msg_controllen = sizeof control.m_Data;
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+  ssize_t sent;
+  do
+  {
+    sent = sendmsg(fd, &msg, kSendFlags);
+  } while (sent < 0 && EINTR == errno);
+
+  bool success = sent > 0 &&
+                 SendAll(fd, (const char*) &header + sent, sizeof header - sent) &&
+                 SendAll(fd, payload, payload_size);
+
+  free(payload);
+  return success;
+}
+
+// Wait for the server to send something. Interrupts are passed on to the
+// server, which stops the build and replies as usual.
+static bool ClientReceive(int fd, void* data, size_t size)
+{
+  char* p = (char*) data;
+
+  while (size > 0)
+  {
+    ssize_t n = recv(fd, p, size, 0);
+
+    if (n < 0 && EINTR == errno)
+    {
+      if (s_ClientInterrupted)
+      {
+        s_ClientInterrupted = 0;
+        send(fd, &kRequestInterrupt, 1, kSendFlags);
+      }
+      continue;
+    }
+
+    if (n <= 0)
+      return false;
+
+    p    += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+bool BuildClientRun(const char* dag_filename, int thread_count, int action_count, int argc, char** argv, int* exit_code_out)
+{
+  char socket_path[kMaxPathLength];
+  ServerFilePath(socket_path, dag_filename, "server");
+
+  // Catch interrupts without restarting system calls, so the wait for the
+  // server can pass them on.
+  static const int s_Signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+  struct sigaction old_actions[ARRAY_SIZE(s_Signals)];
+  struct sigaction action;
+  memset(&action, 0, sizeof action);
+  action.sa_handler = ClientSignalHandler;
+  sigemptyset(&action.sa_mask);
+
+  for (size_t i = 0; i < ARRAY_SIZE(s_Signals); ++i)
+    sigaction(s_Signals[i], &action, &old_actions[i]);
+
+  bool done = false;
+
+  // A server that's on its way out, or that was started by a different
+  // tundra2, makes way for a new one; try again once when that happens.
+  for (int attempt = 0; !done && attempt < 2; ++attempt)
+  {
+    int fd = ConnectToServer(socket_path);
+
+    if (fd < 0)
+    {
+      Log(kDebug, "starting a build server for %s", dag_filename);
+
+      if (!StartServer(dag_filename, thread_count, action_count))
+        break;
+
+      for (int waited = 0; fd < 0 && waited < kStartTimeoutMs; waited += 20)
+      {
+        usleep(20 * 1000);
+        fd = ConnectToServer(socket_path);
+      }
+
+      if (fd < 0)
+        break;
+    }
+
+    char reply = 0;
+
+    if (SendRequest(fd, BuildRequest::kBuild, thread_count, action_count, argc, argv) && ClientReceive(fd, &reply, 1))
+    {
+      if (kReplyAccepted == reply)
+      {
+        int32_t exit_code;
+
+        if (!ClientReceive(fd, &exit_code, sizeof exit_code))
+        {
+          Log(kError, "the build server went away during the build");
+          exit_code = 1;
+        }
+
+        *exit_code_out = exit_code;
+        done           = true;
+      }
+      else if (kReplyRestart == reply)
+      {
+        Log(kDebug, "build server asked to be restarted");
+      }
+    }
+
+    close(fd);
+  }
+
+  for (size_t i = 0; i < ARRAY_SIZE(s_Signals); ++i)
+    sigaction(s_Signals[i], &old_actions[i], nullptr);
+
+  if (!done)
+    Log(kWarning, "couldn't use a build server; building without one");
+
+  return done;
+}
+
+bool BuildClientStop(const char* dag_filename)
+{
+  char socket_path[kMaxPathLength];
+  ServerFilePath(socket_path, dag_filename, "server");
+
+  int fd = ConnectToServer(socket_path);
+
+  if (fd < 0)
+    return false;
+
+  char reply   = 0;
+  bool success = SendRequest(fd, BuildRequest::kStop, 0, 0, 0, nullptr) && RecvAll(fd, &reply, 1);
+
+  close(fd);
+  return success;
+}
+
+//-----------------------------------------------------------------------------
+// Server
+//-----------------------------------------------------------------------------
+
+struct BuildServer
+{
+  char               m_SocketPath[kMaxPathLength];
+  int                m_ListenSocket;
+  int                m_ThreadCount;
+  int                m_ActionCount;
+  bool               m_Quit;
+
+  // What clients must match to be served by us rather than a new server.
+  char               m_Cwd[kMaxPathLength];
+  const char*        m_ExePath;
+  uint64_t           m_ExeTimestamp;
+
+  // Our own stdin, stdout and stderr, while a client's are in their place.
+  int                m_SavedFds[3];
+
+  BuildServerHandler m_Handler;
+  void*              m_UserData;
+
+  // The current request's strings.
+  char*              m_Payload;
+  char**             m_Argv;
+
+  // The environment we're running with, from the last client whose
+  // environment differed. It's kept as is for as long as clients agree, as
+  // what the handler looked up in it may still be in use.
+  char*              m_Env;
+  size_t             m_EnvSize;
+  char**             m_Envp;
+};
+
+struct ClientWatch
+{
+  int  m_Socket;
+  int  m_WakePipe[2];
+  bool m_Interrupted;
+};
+
+static void StopListening(BuildServer* server)
+{
+  if (server->m_ListenSocket < 0)
+    return;
+
+  // Unlink before closing, so no client connects to a socket nobody will
+  // ever accept on.
+  unlink(server->m_SocketPath);
+  close(server->m_ListenSocket);
+  server->m_ListenSocket = -1;
+}
+
+static bool StartListening(BuildServer* server)
+{
+  struct sockaddr_un sa;
+  if (!MakeSocketAddress(&sa, server->m_SocketPath))
+    return false;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+
+  SetCloseOnExec(fd);
+
+  // We hold the lock, so anything at the path is left over from a server
+  // that died.
+  unlink(server->m_SocketPath);
+
+  // Only our own user gets to connect. The socket is created with the
+  // permissions bind() finds in the umask, so it's never open to others,
+  // not even briefly.
+  mode_t old_umask = umask(077);
+  int    bound     = bind(fd, (struct sockaddr*) &sa, sizeof sa);
+  umask(old_umask);
+
+  if (0 != bound || 0 != listen(fd, 16))
+  {
+    close(fd);
+    return false;
+  }
+
+  server->m_ListenSocket = fd;
+  return true;
+}
+
+// Take the lock that makes us the one server for this DAG file. An old
+// server that asked to be replaced may still be exiting, so give it time.
+static int LockServer(const char* dag_filename)
+{
+  char lock_path[kMaxPathLength];
+  ServerFilePath(lock_path, dag_filename, "server.lock");
+
+  int fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return -1;
+
+  SetCloseOnExec(fd);
+
+  for (int waited = 0; waited < kStartTimeoutMs; waited += 50)
+  {
+    if (0 == flock(fd, LOCK_EX | LOCK_NB))
+      return fd;
+
+    usleep(50 * 1000);
+  }
+
+  close(fd);
+  return -1;
+}
+
+static bool ReceiveHeader(int fd, BuildRequestHeader* header, int (&client_fds)[3], int* fd_count_out)
+{
+  union
+  {
+    struct cmsghdr m_Align;
+    char           m_Data[CMSG_SPACE(sizeof client_fds)];
+  } control;
+
+  struct iovec iov;
+  iov.iov_base = header;
+  iov.iov_len  = sizeof *header;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.m_Data;
+  msg.msg_controllen = sizeof control.m_Data;
+
+  ssize_t received;
+  do
+  {
+    received = recvmsg(fd, &msg, 0);
+  } while (received < 0 && EINTR == errno);
+
+  if (received <= 0)
+    return false;
+
+  *fd_count_out = 0;
+
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+      continue;
+
+    int count = int((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    for (int i = 0; i < count; ++i)
+    {
+      int client_fd;
+      memcpy(&client_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof client_fd);
+
+      if (*fd_count_out < 3)
+        client_fds[(*fd_count_out)++] = client_fd;
+      else
+        close(client_fd);
+    }
+  }
+
+  return RecvAll(fd, (char*) header + received, sizeof *header - received);
+}
+
+// Split the payload into strings, if `out` is set. Returns false if it
+// doesn't hold as many as the header says.
+static bool SplitStrings(char* data, const char* end, char** out, uint32_t count, char** next_out)
+{
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    char* terminator = (char*) memchr(data, '\0', end - data);
+
+    if (!terminator)
+      return false;
+
+    if (out)
+      out[i] = data;
+
+    data = terminator + 1;
+  }
+
+  *next_out = data;
+  return true;
+}
+
+// Adopt the client's environment if it differs from ours. Returns true if
+// it did.
+static bool SetEnvironment(BuildServer* server, const char* env, size_t env_size, uint32_t env_count)
+{
+  if (server->m_Env && env_size == server->m_EnvSize && 0 == memcmp(env, server->m_Env, env_size))
+    return false;
+
+  char*  new_env  = (char*) malloc(env_size);
+  char** new_envp = (char**) malloc((env_count + 1) * sizeof(char*));
+  char*  end;
+
+  memcpy(new_env, env, env_size);
+  SplitStrings(new_env, new_env + env_size, new_envp, env_count, &end);
+  new_envp[env_count] = nullptr;
+
+  environ = new_envp;
+
+  free(server->m_Envp);
+  free(server->m_Env);
+
+  server->m_Env     = new_env;
+  server->m_EnvSize = env_size;
+  server->m_Envp    = new_envp;
+  return true;
+}
+
+static void Reply(int fd, const void* data, size_t size)
+{
+  SendAll(fd, data, size);
+}
+
+static ThreadRoutineReturnType TUNDRA_STDCALL WatchClientRoutine(void* param)
+{
+  ClientWatch* watch = static_cast<ClientWatch*>(param);
+
+  SignalBlockThread(true);
+
+  struct pollfd fds[2];
+  fds[0].fd     = watch->m_WakePipe[0];
+  fds[0].events = POLLIN;
+  fds[1].fd     = watch->m_Socket;
+  fds[1].events = POLLIN;
+
+  int fd_count = 2;
+
+  for (;;)
+  {
+    fds[0].revents = fds[1].revents = 0;
+
+    if (poll(fds, fd_count, -1) < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      break;
+    }
+
+    if (fds[0].revents)
+      break;
+
+    if (0 == fds[1].revents)
+      continue;
+
+    char    request;
+    ssize_t n = recv(watch->m_Socket, &request, 1, 0);
+
+    if (n < 0 && EINTR == errno)
+      continue;
+
+    // The client was interrupted, or has gone away. Stop the build either
+    // way.
+    if (n <= 0)
+      fd_count = 1;
+
+    watch->m_Interrupted = true;
+    SignalSet(n > 0 ? "SIGINT" : "client went away");
+
+    // Interrupt the build's processes the way the terminal would have. We
+    // ignore SIGINT ourselves.
+    kill(0, SIGINT);
+  }
+
+  return 0;
+}
+
+static void ServeClient(BuildServer* server, int fd)
+{
+  BuildRequestHeader header;
+  int                client_fds[3];
+  int                fd_count = 0;
+
+  if (!ReceiveHeader(fd, &header, client_fds, &fd_count) ||
+      kBuildRequestMagic != header.m_Magic ||
+      header.m_PayloadSize > kMaxPayloadSize ||
+      header.m_ArgCount > kMaxPayloadSize ||
+      3 != fd_count)
+  {
+    for (int i = 0; i < fd_count; ++i)
+      close(client_fds[i]);
+    return;
+  }
+
+  free(server->m_Payload);
+  free(server->m_Argv);
+
+  server->m_Payload = (char*) malloc(header.m_PayloadSize);
+  server->m_Argv    = (char**) malloc((header.m_ArgCount + 1) * sizeof(char*));
+
+  char* const payload_end = server->m_Payload + header.m_PayloadSize;
+  char*       strings[2];
+  char*       env_start;
+  char*       env_end;
+
+  if (!RecvAll(fd, server->m_Payload, header.m_PayloadSize) ||
+      !SplitStrings(server->m_Payload, payload_end, strings, 2, &env_start) ||
+      !SplitStrings(env_start, payload_end, server->m_Argv, header.m_ArgCount, &env_start) ||
+      !SplitStrings(env_start, payload_end, nullptr, header.m_EnvCount, &env_end))
+  {
+    for (int i = 0; i < fd_count; ++i)
+      close(client_fds[i]);
+    return;
+  }
+
+  if (BuildRequest::kStop == header.m_Command)
+  {
+    printf("stop requested\n");
+    StopListening(server);
+    Reply(fd, &kReplyAccepted, 1);
+    server->m_Quit = true;
+
+    for (int i = 0; i < fd_count; ++i)
+      close(client_fds[i]);
+    return;
+  }
+
+  const char* cwd      = strings[0];
+  const char* exe_path = strings[1];
+
+  // Let a new server take over if we can't serve this client, or if
+  // tundra2 has been rebuilt since we started.
+  if (0 != strcmp(cwd, server->m_Cwd) ||
+      0 != strcmp(exe_path, server->m_ExePath) ||
+      header.m_ExeTimestamp != server->m_ExeTimestamp ||
+      GetFileInfo(server->m_ExePath).m_Timestamp != server->m_ExeTimestamp ||
+      int(header.m_ThreadCount) > server->m_ThreadCount ||
+      int(header.m_ActionCount) > server->m_ActionCount)
+  {
+    printf("can't serve a client with %d threads and %d actions from %s in %s; making way for a new server\n",
+        int(header.m_ThreadCount), int(header.m_ActionCount), exe_path, cwd);
+    StopListening(server);
+    Reply(fd, &kReplyRestart, 1);
+    server->m_Quit = true;
+
+    for (int i = 0; i < fd_count; ++i)
+      close(client_fds[i]);
+    return;
+  }
+
+  server->m_Argv[header.m_ArgCount] = nullptr;
+
+  bool env_changed = SetEnvironment(server, env_start, env_end - env_start, header.m_EnvCount);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (int i = 0; i < 3; ++i)
+  {
+    dup2(client_fds[i], i);
+    close(client_fds[i]);
+  }
+
+  Reply(fd, &kReplyAccepted, 1);
+
+  ClientWatch watch;
+  watch.m_Socket      = fd;
+  watch.m_Interrupted = false;
+
+  if (0 != pipe(watch.m_WakePipe))
+    CroakErrno("pipe() failed");
+
+  SetCloseOnExec(watch.m_WakePipe[0]);
+  SetCloseOnExec(watch.m_WakePipe[1]);
+
+  SignalReset();
+
+  ThreadId watch_thread = ThreadStart(WatchClientRoutine, &watch);
+
+  int32_t exit_code = server->m_Handler(server->m_UserData, int(header.m_ArgCount), server->m_Argv, env_changed);
+
+  if (1 != write(watch.m_WakePipe[1], "", 1))
+    CroakErrno("couldn't wake client watch thread");
+
+  ThreadJoin(watch_thread);
+
+  close(watch.m_WakePipe[0]);
+  close(watch.m_WakePipe[1]);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (int i = 0; i < 3; ++i)
+    dup2(server->m_SavedFds[i], i);
+
+  Reply(fd, &exit_code, sizeof exit_code);
+
+  // Interrupts from clients only stop their own build. Any other signal
+  // stops the server.
+  if (SignalGetReason())
+  {
+    if (watch.m_Interrupted)
+      SignalReset();
+    else
+      server->m_Quit = true;
+  }
+}
+
+int BuildServerRun(const char* dag_filename, int thread_count, int action_count, BuildServerHandler handler, void* user_data)
+{
+  BuildServer server;
+  memset(&server, 0, sizeof server);
+
+  server.m_ListenSocket = -1;
+  server.m_ThreadCount  = thread_count;
+  server.m_ActionCount  = action_count;
+  server.m_Handler      = handler;
+  server.m_UserData     = user_data;
+  server.m_ExePath      = GetExePath();
+  server.m_ExeTimestamp = GetFileInfo(server.m_ExePath).m_Timestamp;
+
+  GetCwd(server.m_Cwd, sizeof server.m_Cwd);
+  ServerFilePath(server.m_SocketPath, dag_filename, "server");
+
+  int lock_fd = LockServer(dag_filename);
+
+  if (lock_fd < 0)
+  {
+    fprintf(stderr, "another build server is running for %s\n", dag_filename);
+    return 1;
+  }
+
+  if (!StartListening(&server))
+  {
+    fprintf(stderr, "couldn't listen on %s\n", server.m_SocketPath);
+    close(lock_fd);
+    return 1;
+  }
+
+  // Clients pass their interrupts on through the socket, and we pass them
+  // on to the build's processes with SIGINT to our process group. Clients
+  // may also go away, or stop reading their output.
+  signal(SIGINT, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (int i = 0; i < 3; ++i)
+    server.m_SavedFds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+
+  // Behave like we would on a terminal when writing to a client's.
+  setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+
+  printf("build server %d serving %s in %s with %d threads and %d actions\n", int(getpid()), dag_filename, server.m_Cwd, thread_count, action_count);
+
+  time_t last_request = time(nullptr);
+
+  while (!server.m_Quit)
+  {
+    struct pollfd p;
+    p.fd      = server.m_ListenSocket;
+    p.events  = POLLIN;
+    p.revents = 0;
+
+    int ready = poll(&p, 1, 1000);
+
+    if (const char* reason = SignalGetReason())
+    {
+      printf("%s; exiting\n", reason);
+      break;
+    }
+
+    if (ready < 0 && EINTR != errno)
+      CroakErrno("poll() failed");
+
+    if (ready <= 0)
+    {
+      if (time(nullptr) - last_request > kIdleTimeoutSeconds)
+      {
+        printf("idle for %d seconds; exiting\n", kIdleTimeoutSeconds);
+        break;
+      }
+      continue;
+    }
+
+    int fd = accept(server.m_ListenSocket, nullptr, nullptr);
+
+    if (fd < 0)
+      continue;
+
+    SetCloseOnExec(fd);
+
+    if (PeerIsSameUser(fd))
+      ServeClient(&server, fd);
+    else
+      printf("refusing a client running as a different user\n");
+
+    close(fd);
+
+    last_request = time(nullptr);
+  }
+
+  StopListening(&server);
+
+  // The adopted environment stays in place, as the caller may still look
+  // things up in it.
+  for (int i = 0; i < 3; ++i)
+    close(server.m_SavedFds[i]);
+
+  free(server.m_Payload);
+  free(server.m_Argv);
+
+  close(lock_fd);
+  return 0;
+}
+
+}
+
+#endif
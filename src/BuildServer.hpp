@@ -0,0 +1,36 @@
+#ifndef BUILDSERVER_HPP
+#define BUILDSERVER_HPP
+
+#include "Common.hpp"
+
+namespace t2
+{
+  // A build server is a tundra2 process that stays around in a build
+  // directory and runs builds on behalf of clients, so it can keep the DAG
+  // and caches loaded from one build to the next. Clients hand over their
+  // command line, environment and output streams through a unix socket
+  // next to the DAG file, and get the exit code back. A server serves one
+  // client at a time; others wait their turn.
+
+  // Called once per request with the client's full command line, once its
+  // environment and output streams are in place. `env_changed` is set if
+  // the environment differs from the previous request's.
+  typedef int (*BuildServerHandler)(void* user_data, int argc, char** argv, bool env_changed);
+
+  // Hand a command line over to the build server for the DAG file in the
+  // current directory, starting a server if there isn't one. Returns false
+  // if no server could be used, in which case the caller builds by itself.
+  // A server that can't run as many threads or actions at once as asked
+  // for makes way for a new one.
+  bool BuildClientRun(const char* dag_filename, int thread_count, int action_count, int argc, char** argv, int* exit_code_out);
+
+  // Ask the build server for the DAG file in the current directory to exit.
+  // Returns false if there was none.
+  bool BuildClientStop(const char* dag_filename);
+
+  // Serve requests until stopped, idle for too long, or signalled. Returns
+  // the process exit code.
+  int BuildServerRun(const char* dag_filename, int thread_count, int action_count, BuildServerHandler handler, void* user_data);
+}
+
+#endif
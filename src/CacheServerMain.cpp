@@ -0,0 +1,369 @@
+// Reference server for the remote action cache.
+//
+// Stores whatever is PUT to /ac/<digest> and /cas/<digest> as files under a
+// directory, and serves them back with GET and HEAD. Objects in /cas are
+// checked against their digest on upload. There is no eviction; clear the
+// directory out by other means if it grows too big.
+
+#include "Common.hpp"
+#include "Hash.hpp"
+#include "HttpIo.hpp"
+#include "PathUtil.hpp"
+#include "Thread.hpp"
+#include "Atomic.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(TUNDRA_UNIX)
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+using namespace t2;
+
+struct CacheServer
+{
+  const char* m_Dir;
+  int         m_ListenSocket;
+  bool        m_Verbose;
+  uint32_t    m_ProcessId;
+  uint32_t    m_TempCounter;
+};
+
+static bool SendResponse(HttpConnection* conn, int status, const char* reason, uint64_t content_length)
+{
+  char head[256];
+  int  len = snprintf(head, sizeof head, "HTTP/1.1 %d %s\r\nContent-Length: %llu\r\n\r\n",
+                      status, reason, (unsigned long long) content_length);
+  return HttpWrite(conn, head, len);
+}
+
+static bool SkipBody(HttpConnection* conn, int64_t size)
+{
+  char buffer[4096];
+
+  while (size > 0)
+  {
+    size_t chunk = size < int64_t(sizeof buffer) ? size_t(size) : sizeof buffer;
+    if (!HttpRead(conn, buffer, chunk))
+      return false;
+    size -= chunk;
+  }
+
+  return true;
+}
+
+// Accept "<anything>/ac/<digest>" and "<anything>/cas/<digest>", so the server
+// works behind a client configured with a base path.
+static bool ParsePath(const char* path, const char** kind_out, char (&digest_out)[kDigestStringSize])
+{
+  const char* digest = strrchr(path, '/');
+  if (!digest || digest == path)
+    return false;
+
+  const char* kind = digest - 1;
+  while (kind > path && '/' != kind[-1])
+    --kind;
+
+  if (0 == strncmp(kind, "ac/", 3))
+    *kind_out = "ac";
+  else if (0 == strncmp(kind, "cas/", 4))
+    *kind_out = "cas";
+  else
+    return false;
+
+  ++digest;
+
+  // Only lowercase hex digests of the right length, which also keeps
+  // requests from naming anything outside the storage directory.
+  if (strlen(digest) != kDigestStringSize - 1 || strspn(digest, "0123456789abcdef") != kDigestStringSize - 1)
+    return false;
+
+  strcpy(digest_out, digest);
+  return true;
+}
+
+static void ServeGet(CacheServer* server, HttpConnection* conn, const char* path, bool send_body, int* status_out)
+{
+  FILE* f = fopen(path, "rb");
+
+  if (!f)
+  {
+    *status_out = 404;
+    SendResponse(conn, 404, "Not Found", 0);
+    return;
+  }
+
+  fseek(f, 0, SEEK_END);
+  uint64_t size = uint64_t(ftell(f));
+  fseek(f, 0, SEEK_SET);
+
+  *status_out = 200;
+
+  if (SendResponse(conn, 200, "OK", size) && send_body)
+  {
+    char buffer[65536];
+    while (size_t nbytes = fread(buffer, 1, sizeof buffer, f))
+    {
+      if (!HttpWrite(conn, buffer, nbytes))
+        break;
+    }
+  }
+
+  fclose(f);
+}
+
+static bool ServePut(CacheServer* server, HttpConnection* conn, const char* path, const char* kind,
+                     const char* digest, int64_t size, int* status_out)
+{
+  char tmp_path[kMaxPathLength];
+  snprintf(tmp_path, sizeof tmp_path, "%s/tmp/%u-%u", server->m_Dir, server->m_ProcessId, AtomicIncrement(&server->m_TempCounter));
+
+  FILE* f = fopen(tmp_path, "wb");
+
+  HashState h;
+  HashInit(&h);
+
+  bool    received  = true;
+  bool    written   = nullptr != f;
+  int64_t remaining = size;
+  char    buffer[65536];
+
+  while (remaining > 0)
+  {
+    size_t chunk = remaining < int64_t(sizeof buffer) ? size_t(remaining) : sizeof buffer;
+
+    if (!HttpRead(conn, buffer, chunk))
+    {
+      received = false;
+      break;
+    }
+
+    HashUpdate(&h, buffer, chunk);
+
+    if (written && chunk != fwrite(buffer, 1, chunk, f))
+      written = false;
+
+    remaining -= chunk;
+  }
+
+  if (f && 0 != fclose(f))
+    written = false;
+
+  if (!received)
+  {
+    remove(tmp_path);
+    return false;
+  }
+
+  bool valid = true;
+
+  if (0 == strcmp(kind, "cas"))
+  {
+    HashDigest actual;
+    HashFinalize(&h, &actual);
+
+    char actual_str[kDigestStringSize];
+    DigestToString(actual_str, actual);
+    valid = 0 == strcmp(actual_str, digest);
+  }
+
+  if (valid && written && !RenameFile(tmp_path, path))
+  {
+    // Create the fan-out directory and try again.
+    char dir[kMaxPathLength];
+    snprintf(dir, sizeof dir, "%s/%s/%.2s", server->m_Dir, kind, digest);
+    written = MakeDirectory(dir) && RenameFile(tmp_path, path);
+  }
+
+  if (!valid)
+  {
+    remove(tmp_path);
+    *status_out = 400;
+    return SendResponse(conn, 400, "Digest Mismatch", 0);
+  }
+
+  if (!written)
+  {
+    remove(tmp_path);
+    *status_out = 500;
+    return SendResponse(conn, 500, "Internal Server Error", 0);
+  }
+
+  *status_out = 201;
+  return SendResponse(conn, 201, "Created", 0);
+}
+
+// Serve one request. Returns false if the connection should be closed.
+static bool ServeRequest(CacheServer* server, HttpConnection* conn)
+{
+  char head[4096];
+  char method[16];
+  char request_path[1024];
+
+  if (!HttpReadHead(conn, head, sizeof head))
+    return false;
+
+  if (!HttpParseRequest(head, method, sizeof method, request_path, sizeof request_path))
+  {
+    SendResponse(conn, 400, "Bad Request", 0);
+    return false;
+  }
+
+  int64_t     content_length = HttpGetContentLength(head);
+  const char* kind           = nullptr;
+  char        digest[kDigestStringSize];
+  int         status         = 0;
+  bool        keep_alive     = true;
+
+  if (content_length < 0)
+    content_length = 0;
+
+  if (!ParsePath(request_path, &kind, digest))
+  {
+    status     = 400;
+    keep_alive = SkipBody(conn, content_length) && SendResponse(conn, 400, "Bad Request", 0);
+  }
+  else
+  {
+    char path[kMaxPathLength];
+    snprintf(path, sizeof path, "%s/%s/%.2s/%s", server->m_Dir, kind, digest, digest);
+
+    if (0 == strcmp(method, "GET") || 0 == strcmp(method, "HEAD"))
+    {
+      keep_alive = SkipBody(conn, content_length);
+      if (keep_alive)
+        ServeGet(server, conn, path, 0 == strcmp(method, "GET"), &status);
+    }
+    else if (0 == strcmp(method, "PUT"))
+    {
+      keep_alive = ServePut(server, conn, path, kind, digest, content_length, &status);
+    }
+    else
+    {
+      status     = 405;
+      keep_alive = SkipBody(conn, content_length) && SendResponse(conn, 405, "Method Not Allowed", 0);
+    }
+  }
+
+  if (server->m_Verbose)
+  {
+    printf("%s %s %d\n", method, request_path, status);
+    fflush(stdout);
+  }
+
+  return keep_alive;
+}
+
+static ThreadRoutineReturnType TUNDRA_STDCALL ServerThreadRoutine(void* param)
+{
+  CacheServer*   server = static_cast<CacheServer*>(param);
+  HttpConnection conn;
+
+  for (;;)
+  {
+    int socket = HttpAccept(server->m_ListenSocket);
+    if (socket < 0)
+      continue;
+
+    HttpConnectionInit(&conn, socket);
+
+    while (ServeRequest(server, &conn))
+    {
+    }
+
+    HttpConnectionClose(&conn);
+  }
+
+  return 0;
+}
+
+static void Usage()
+{
+  fprintf(stderr,
+      "usage: t2-cache-server [-v] [-j <threads>] <address> <directory>\n"
+      "\n"
+      "  <address>    unix:<socket path>, or [<host>]:<port> to listen for HTTP\n"
+      "  <directory>  where cached files are stored\n"
+      "  -j           number of connections served at once (default 16)\n"
+      "  -v           print every request\n");
+  exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+  CacheServer server;
+  server.m_Verbose     = false;
+  server.m_TempCounter = 0;
+#if defined(TUNDRA_UNIX)
+  server.m_ProcessId   = uint32_t(getpid());
+#else
+  server.m_ProcessId   = 0;
+#endif
+
+  int thread_count = 16;
+  int arg          = 1;
+
+  for (; arg < argc && '-' == argv[arg][0]; ++arg)
+  {
+    if (0 == strcmp(argv[arg], "-v"))
+      server.m_Verbose = true;
+    else if (0 == strcmp(argv[arg], "-j") && arg + 1 < argc)
+      thread_count = atoi(argv[++arg]);
+    else
+      Usage();
+  }
+
+  if (argc - arg != 2 || thread_count < 1)
+    Usage();
+
+  const char* address_str = argv[arg];
+  server.m_Dir            = argv[arg + 1];
+
+  HttpAddress address;
+  if (!HttpParseAddress(&address, address_str))
+  {
+    fprintf(stderr, "bad address: %s\n", address_str);
+    return 1;
+  }
+
+  char path[kMaxPathLength];
+  bool success = MakeDirectory(server.m_Dir);
+
+  static const char* const s_Subdirs[] = { "ac", "cas", "tmp" };
+
+  for (const char* subdir : s_Subdirs)
+  {
+    snprintf(path, sizeof path, "%s/%s", server.m_Dir, subdir);
+    success = success && MakeDirectory(path);
+  }
+
+  if (!success)
+  {
+    fprintf(stderr, "couldn't create %s\n", server.m_Dir);
+    return 1;
+  }
+
+#if defined(TUNDRA_UNIX)
+  // Clients hanging up are dealt with where writes fail.
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
+  server.m_ListenSocket = HttpListen(&address);
+  if (server.m_ListenSocket < 0)
+  {
+    fprintf(stderr, "couldn't listen on %s\n", address_str);
+    return 1;
+  }
+
+  printf("serving %s on %s\n", server.m_Dir, address_str);
+  fflush(stdout);
+
+  for (int i = 1; i < thread_count; ++i)
+    ThreadStart(ServerThreadRoutine, &server);
+
+  ServerThreadRoutine(&server);
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "CommandLine.hpp"
+#include "MemAllocLinear.hpp"
+#include "Common.hpp"
+
+#include <string.h>
+
+namespace t2
+{
+
+static bool IsBlank(char ch)
+{
+  return ' ' == ch || '\t' == ch;
+}
+
+// Characters the shell treats as ordinary in any position of a word. Notably
+// missing are quotes, backslashes, `$`, backticks, globs, operators and
+// `~`, `#` and `!`, which are special at the start of a word.
+static bool IsPlainChar(char ch)
+{
+  if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'))
+    return true;
+
+  switch (ch)
+  {
+    case '-': case '_': case '.': case '/': case ',':
+    case ':': case '@': case '%': case '+': case '=':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Commands that are shell builtins or keywords, which either can't be
+// executed at all or behave differently from the program of the same name.
+static const char* const s_ShellCommands[] =
+{
+  ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue", "do",
+  "done", "echo", "elif", "else", "esac", "eval", "exec", "exit", "export",
+  "fc", "fg", "fi", "for", "function", "getopts", "hash", "if", "in", "jobs",
+  "local", "printf", "pwd", "read", "readonly", "return", "select", "set",
+  "shift", "source", "then", "times", "trap", "type", "ulimit", "umask",
+  "unalias", "unset", "until", "wait", "while"
+};
+
+bool CommandLineSplit(const char* cmd_line, MemAllocLinear* alloc, const char*** argv_out, int* argc_out)
+{
+  int argc = 0;
+
+  // Validate and count words.
+  for (const char* p = cmd_line; *p; )
+  {
+    if (IsBlank(*p))
+    {
+      ++p;
+      continue;
+    }
+
+    ++argc;
+
+    while (*p && !IsBlank(*p))
+    {
+      if (!IsPlainChar(*p))
+        return false;
+      ++p;
+    }
+  }
+
+  if (0 == argc)
+    return false;
+
+  const char** argv = LinearAllocateArray<const char*>(alloc, argc + 1);
+
+  int i = 0;
+  for (const char* p = cmd_line; *p; )
+  {
+    if (IsBlank(*p))
+    {
+      ++p;
+      continue;
+    }
+
+    const char* start = p;
+    while (*p && !IsBlank(*p))
+      ++p;
+
+    argv[i++] = StrDupN(alloc, start, size_t(p - start));
+  }
+
+  argv[argc] = nullptr;
+
+  // `FOO=bar cmd` sets a variable for the command.
+  if (strchr(argv[0], '='))
+    return false;
+
+  for (const char* builtin : s_ShellCommands)
+  {
+    if (0 == strcmp(argv[0], builtin))
+      return false;
+  }
+
+  *argv_out = argv;
+  *argc_out = argc;
+  return true;
+}
+
+}
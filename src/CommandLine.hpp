@@ -0,0 +1,18 @@
+#ifndef COMMANDLINE_HPP
+#define COMMANDLINE_HPP
+
+namespace t2
+{
+  struct MemAllocLinear;
+
+  // Split a command line into a null-terminated argument vector, if running it
+  // directly gives the same result as running it through `/bin/sh -c`. That is
+  // the case for a plain command followed by arguments separated by blanks,
+  // with no quoting, expansions, redirections, globs or control operators.
+  //
+  // Returns false if the command line needs a shell. The argument vector and
+  // strings are allocated from `alloc`.
+  bool CommandLineSplit(const char* cmd_line, MemAllocLinear* alloc, const char*** argv_out, int* argc_out);
+}
+
+#endif
@@ -27,12 +27,19 @@
 #if defined(TUNDRA_WIN32)
 #include <windows.h>
 #include <ctype.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 #endif
 
 #if defined(TUNDRA_APPLE)
 #include <mach-o/dyld.h>
 #endif
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#endif
+
 namespace t2
 {
 
@@ -349,6 +356,60 @@ int GetCpuCount()
 #endif
 }
 
+static uint32_t FindCpuFeatures()
+{
+  uint32_t result = 0;
+
+#if defined(__x86_64__) || defined(_M_X64)
+  result |= kCpuSse2;
+
+  unsigned int regs1[4] = { 0, 0, 0, 0 };
+  unsigned int regs7[4] = { 0, 0, 0, 0 };
+
+#if defined(_MSC_VER)
+  __cpuid((int*) regs1, 0);
+  if (regs1[0] < 7)
+    return result;
+  __cpuid((int*) regs1, 1);
+  __cpuidex((int*) regs7, 7, 0);
+#else
+  if (__get_cpuid_max(0, nullptr) < 7)
+    return result;
+  if (!__get_cpuid(1, &regs1[0], &regs1[1], &regs1[2], &regs1[3]))
+    return result;
+  __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+#endif
+
+  const unsigned int kSsse3 = 1 << 9, kSse41 = 1 << 19, kOsXsave = 1 << 27, kAvx = 1 << 28;
+  const unsigned int kAvx2 = 1 << 5, kSha = 1 << 29;
+
+  // The OS must save the YMM registers too.
+  if ((regs1[2] & (kOsXsave | kAvx)) == (kOsXsave | kAvx) && (regs7[1] & kAvx2))
+  {
+#if defined(_MSC_VER)
+    uint64_t xcr0 = _xgetbv(0);
+#else
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    uint64_t xcr0 = uint64_t(xcr0_hi) << 32 | xcr0_lo;
+#endif
+    if ((xcr0 & 6) == 6)
+      result |= kCpuAvx2;
+  }
+
+  if ((regs1[2] & (kSsse3 | kSse41)) == (kSsse3 | kSse41) && (regs7[1] & kSha))
+    result |= kCpuShaNi;
+#endif
+
+  return result;
+}
+
+uint32_t CpuGetFeatures()
+{
+  static const uint32_t features = FindCpuFeatures();
+  return features;
+}
+
 int CountTrailingZeroes(uint32_t v)
 {
   v &= -int32_t(v);
@@ -137,6 +137,18 @@ double TimerDiffSeconds(uint64_t start, uint64_t end);
 
 int GetCpuCount();
 
+// Instruction set extensions the CPU and OS support, for code with its own
+// paths using them. Only x86-64 ones are looked for, where SSE2 is always
+// there. See CpuKernels.hpp for picking between such paths.
+enum
+{
+  kCpuSse2  = 1 << 0,
+  kCpuAvx2  = 1 << 1,
+  kCpuShaNi = 1 << 2
+};
+
+uint32_t CpuGetFeatures();
+
 int CountTrailingZeroes(uint32_t word);
 
 #if ENABLED(USE_LITTLE_ENDIAN)
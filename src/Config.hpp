@@ -10,8 +10,28 @@
 
 // Set up build features
 
+// The content hash is the fast hash unless the build picks another with
+// -DTUNDRA_SHA1_HASH or -DTUNDRA_VECTOR_HASH. Changing it changes every
+// digest, so all state files and caches are rebuilt.
+#if defined(TUNDRA_SHA1_HASH)
+#define USE_SHA1_HASH YES
+#define USE_FAST_HASH NO
+#define USE_VECTOR_HASH NO
+#elif defined(TUNDRA_VECTOR_HASH)
+#define USE_SHA1_HASH NO
+#define USE_FAST_HASH NO
+#define USE_VECTOR_HASH YES
+#else
 #define USE_SHA1_HASH NO
 #define USE_FAST_HASH YES
+#define USE_VECTOR_HASH NO
+#endif
+
+#if ENABLED(USE_SHA1_HASH)
+#define USE_128BIT_DIGEST NO
+#else
+#define USE_128BIT_DIGEST YES
+#endif
 
 #if defined(_DEBUG)
 #define CHECKED_BUILD YES
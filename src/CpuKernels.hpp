@@ -0,0 +1,50 @@
+#ifndef CPUKERNELS_HPP
+#define CPUKERNELS_HPP
+
+#include "Common.hpp"
+
+// Picking between kernels that do the same thing with different instruction
+// set extensions. All of them are built, and the CPU decides at run time
+// which ones can be used.
+
+namespace t2
+{
+  enum
+  {
+    kMaxCpuKernels = 4
+  };
+
+  template <typename Kernel>
+  struct CpuKernelOption
+  {
+    const Kernel* m_Kernel;
+    uint32_t      m_CpuFeatures;  // kCpu* flags the kernel needs
+  };
+
+  // The kernels this CPU can run, out of options listed from the portable one
+  // to the fastest, in the same order. Keep one in a function-local static so
+  // it's only put together once.
+  template <typename Kernel>
+  struct CpuKernels
+  {
+    int           m_Count;
+    const Kernel* m_Kernels[kMaxCpuKernels];
+
+    template <size_t kCount>
+    explicit CpuKernels(const CpuKernelOption<Kernel> (&options)[kCount])
+    {
+      static_assert(kCount <= kMaxCpuKernels, "too many kernels");
+
+      uint32_t features = CpuGetFeatures();
+
+      m_Count = 0;
+      for (const CpuKernelOption<Kernel>& option : options)
+      {
+        if ((option.m_CpuFeatures & features) == option.m_CpuFeatures)
+          m_Kernels[m_Count++] = option.m_Kernel;
+      }
+    }
+  };
+}
+
+#endif
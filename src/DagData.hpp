@@ -39,7 +39,9 @@ struct GenericScannerData : ScannerData
   {
     kFlagRequireWhitespace      = 1 << 0,
     kFlagUseSeparators          = 1 << 1,
-    kFlagBareMeansSystem        = 1 << 2
+    kFlagBareMeansSystem        = 1 << 2,
+    // Stop scanning at the first line that isn't blank or an include.
+    kFlagStopAfterPreamble      = 1 << 3
   };
 
   uint32_t                 m_Flags;
@@ -99,7 +101,12 @@ struct NodeData
     // for incremental linking.
     kFlagPreciousOutputs    = 1 << 1,
 
-    kFlagExpensive          = 1 << 2
+    kFlagExpensive          = 1 << 2,
+
+    // Compute content digests of the output files after the action runs.
+    // Dependents sign these files by content, so regenerating identical
+    // outputs doesn't cause them to rebuild.
+    kFlagContentDigestOutputs = 1 << 3
   };
 
   FrozenString                    m_Action;
@@ -114,16 +121,23 @@ struct NodeData
   FrozenArray<EnvVarData>         m_EnvVars;
   FrozenPtr<ScannerData>          m_Scanner;
   uint32_t                        m_Flags;
+  // Arguments to run the action and pre-action with directly rather than
+  // through the shell. Empty if they need a shell.
+  FrozenArray<FrozenString>       m_ActionArgs;
+  FrozenArray<FrozenString>       m_PreActionArgs;
 };
 
 struct PassData
 {
-  FrozenString m_PassName;
+  FrozenString         m_PassName;
+  // Indices of earlier passes that must finish before any node in this pass
+  // may start, when passes are allowed to overlap.
+  FrozenArray<int32_t> m_Dependencies;
 };
 
 struct DagData
 {
-  static const uint32_t         MagicNumber   = 0x1589010d ^ kTundraHashMagic;
+  static const uint32_t         MagicNumber   = 0x15890113 ^ kTundraHashMagic;
 
   uint32_t                      m_MagicNumber;
 
@@ -159,12 +173,33 @@ struct DagData
 
   int32_t                       m_MaxExpensiveCount;
 
+  // Non-zero to let nodes in later passes start as soon as their own
+  // dependencies and the passes they declare are done.
+  int32_t                       m_OverlapPasses;
+
+  // Size bound of the action cache in megabytes.
+  int32_t                       m_ActionCacheSizeMb;
+
+  // Non-zero if actions that ran are uploaded to the remote cache.
+  int32_t                       m_RemoteCacheUpload;
+
+  // Non-zero to sign every file by content, whatever its extension.
+  int32_t                       m_SignByContent;
+
   FrozenString                  m_StateFileName;
   FrozenString                  m_StateFileNameTmp;
   FrozenString                  m_ScanCacheFileName;
   FrozenString                  m_ScanCacheFileNameTmp;
   FrozenString                  m_DigestCacheFileName;
   FrozenString                  m_DigestCacheFileNameTmp;
+  FrozenString                  m_StatCacheFileName;
+  FrozenString                  m_StatCacheFileNameTmp;
+
+  // Directory of the action cache shared between builds, or null if disabled.
+  FrozenString                  m_ActionCacheDir;
+
+  // Address of the shared remote cache server, or null if disabled.
+  FrozenString                  m_RemoteCacheUrl;
 };
 
 }
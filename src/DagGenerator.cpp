@@ -10,6 +10,7 @@
 #include "DagData.hpp"
 #include "HashTable.hpp"
 #include "FileSign.hpp"
+#include "CommandLine.hpp"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -176,6 +177,51 @@ static uint32_t GetNodeFlag(const JsonObjectValue* node, const char* name, uint3
   return result;
 }
 
+// Write the argument vector for an action that can run without a shell.
+// Arguments that haven't been seen before are copied to `arg_strings`, as
+// the shared string table keeps pointers to them.
+static void WriteActionArgs(
+    BinarySegment* seg,
+    BinarySegment* array_seg,
+    BinarySegment* str_seg,
+    const char* action,
+    HashTable<CommonStringRecord, kFlagCaseSensitive>* shared_strings,
+    MemAllocLinear* arg_strings,
+    MemAllocLinear* scratch)
+{
+  MemAllocLinearScope scratch_scope(scratch);
+
+  const char** argv = nullptr;
+  int          argc = 0;
+
+  // Windows passes command lines straight to CreateProcess() anyway.
+#if defined(TUNDRA_UNIX)
+  if (!action || !CommandLineSplit(action, scratch, &argv, &argc))
+    argc = 0;
+#endif
+
+  if (0 == argc)
+  {
+    BinarySegmentWriteInt32(seg, 0);
+    BinarySegmentWriteNullPointer(seg);
+    return;
+  }
+
+  BinarySegmentAlign(array_seg, 4);
+  BinarySegmentWriteInt32(seg, argc);
+  BinarySegmentWritePointer(seg, BinarySegmentPosition(array_seg));
+
+  for (int i = 0; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+
+    if (nullptr == HashTableLookup(shared_strings, Djb2Hash(arg), arg))
+      arg = StrDup(arg_strings, arg);
+
+    WriteCommonStringPtr(array_seg, str_seg, arg, shared_strings, scratch);
+  }
+}
+
 static bool WriteNodes(
     const JsonArrayValue* nodes,
     BinarySegment* main_seg,
@@ -185,6 +231,7 @@ static bool WriteNodes(
     BinaryLocator scanner_ptrs[],
     MemAllocHeap* heap,
     HashTable<CommonStringRecord, kFlagCaseSensitive>* shared_strings,
+    MemAllocLinear* arg_strings,
     MemAllocLinear* scratch,
     const TempNodeGuid* order,
     const int32_t* remap_table)
@@ -334,8 +381,12 @@ static bool WriteNodes(
     flags |= GetNodeFlag(node, "OverwriteOutputs", NodeData::kFlagOverwriteOutputs);
     flags |= GetNodeFlag(node, "PreciousOutputs",  NodeData::kFlagPreciousOutputs);
     flags |= GetNodeFlag(node, "Expensive",        NodeData::kFlagExpensive);
+    flags |= GetNodeFlag(node, "ContentDigestOutputs", NodeData::kFlagContentDigestOutputs);
 
     BinarySegmentWriteUint32(node_data_seg, flags);
+
+    WriteActionArgs(node_data_seg, array2_seg, str_seg, action, shared_strings, arg_strings, scratch);
+    WriteActionArgs(node_data_seg, array2_seg, str_seg, preaction, shared_strings, arg_strings, scratch);
   }
 
   for (size_t i = 0; i < node_count; ++i)
@@ -455,6 +506,11 @@ static bool WriteScanner(BinaryLocator* ptr_out, BinarySegment* seg, BinarySegme
       flags |= GenericScannerData::kFlagUseSeparators;
     if (GetBoolean(data, "BareMeansSystem"))
       flags |= GenericScannerData::kFlagBareMeansSystem;
+    if (GetBoolean(data, "StopAfterPreamble"))
+      flags |= GenericScannerData::kFlagStopAfterPreamble;
+
+    // Scanners finding different includes in the same file mustn't share scan cache entries.
+    HashAddInteger(&h, flags);
 
     BinarySegmentWriteUint32(seg, flags);
 
@@ -644,7 +700,24 @@ static bool CompileDag(const JsonObjectValue* root, BinaryWriter* writer, MemAll
   }
 
   // Write nodes.
-  if (!WriteNodes(nodes, main_seg, node_data_seg, aux_seg, str_seg, scanner_ptrs, heap, &shared_strings, scratch, guid_table, remap_table))
+  // Action arguments can't take up more than twice the action text, counting
+  // terminators. They must outlive the shared string table.
+  size_t action_text_size = 0;
+  for (size_t i = 0, count = nodes->m_Count; i < count; ++i)
+  {
+    const JsonObjectValue* node = nodes->m_Values[i]->AsObject();
+    if (!node)
+      return false;
+    if (const char* action = FindStringValue(node, "Action"))
+      action_text_size += 2 * (strlen(action) + 1);
+    if (const char* preaction = FindStringValue(node, "PreAction"))
+      action_text_size += 2 * (strlen(preaction) + 1);
+  }
+
+  MemAllocLinear arg_strings;
+  LinearAllocInit(&arg_strings, heap, action_text_size + 1, "action arguments");
+
+  if (!WriteNodes(nodes, main_seg, node_data_seg, aux_seg, str_seg, scanner_ptrs, heap, &shared_strings, &arg_strings, scratch, guid_table, remap_table))
     return false;
 
   // Write passes
@@ -652,10 +725,35 @@ static bool CompileDag(const JsonObjectValue* root, BinaryWriter* writer, MemAll
   BinarySegmentWritePointer(main_seg, BinarySegmentPosition(aux_seg));
   for (size_t i = 0, count = passes->m_Count; i < count; ++i)
   {
-    const char* pass_name = passes->m_Values[i]->GetString();
+    const JsonObjectValue* pass = passes->m_Values[i]->AsObject();
+    if (!pass)
+      return false;
+
+    const char* pass_name = FindStringValue(pass, "Name");
     if (!pass_name)
       return false;
     WriteStringPtr(aux_seg, str_seg, pass_name);
+
+    const JsonArrayValue* pass_deps = FindArrayValue(pass, "Depends");
+    if (pass_deps && pass_deps->m_Count > 0)
+    {
+      BinarySegmentAlign(aux2_seg, 4);
+      BinarySegmentWriteInt32(aux_seg, (int) pass_deps->m_Count);
+      BinarySegmentWritePointer(aux_seg, BinarySegmentPosition(aux2_seg));
+      for (size_t d = 0, dep_count = pass_deps->m_Count; d < dep_count; ++d)
+      {
+        const JsonNumberValue* dep_index = pass_deps->m_Values[d]->AsNumber();
+        // Passes may only wait for passes that build before them.
+        if (!dep_index || dep_index->m_Number < 0 || dep_index->m_Number >= double(i))
+          return false;
+        BinarySegmentWriteInt32(aux2_seg, (int) dep_index->m_Number);
+      }
+    }
+    else
+    {
+      BinarySegmentWriteInt32(aux_seg, 0);
+      BinarySegmentWriteNullPointer(aux_seg);
+    }
   }
 
   // Write configs
@@ -873,6 +971,10 @@ static bool CompileDag(const JsonObjectValue* root, BinaryWriter* writer, MemAll
   }
 
   BinarySegmentWriteInt32(main_seg, (int) FindIntValue(root, "MaxExpensiveCount", -1));
+  BinarySegmentWriteInt32(main_seg, (int) FindIntValue(root, "OverlapPasses", 0));
+  BinarySegmentWriteInt32(main_seg, (int) FindIntValue(root, "ActionCacheSizeMB", 4096));
+  BinarySegmentWriteInt32(main_seg, (int) FindIntValue(root, "RemoteCacheUpload", 1));
+  BinarySegmentWriteInt32(main_seg, (int) FindIntValue(root, "SignByContent", 0));
 
   WriteStringPtr(main_seg, str_seg, FindStringValue(root, "StateFileName", ".tundra2.state"));
   WriteStringPtr(main_seg, str_seg, FindStringValue(root, "StateFileNameTmp", ".tundra2.state.tmp"));
@@ -882,8 +984,14 @@ static bool CompileDag(const JsonObjectValue* root, BinaryWriter* writer, MemAll
 
   WriteStringPtr(main_seg, str_seg, FindStringValue(root, "DigestCacheFileName", ".tundra2.digestcache"));
   WriteStringPtr(main_seg, str_seg, FindStringValue(root, "DigestCacheFileNameTmp", ".tundra2.digestcache.tmp"));
+  WriteStringPtr(main_seg, str_seg, FindStringValue(root, "StatCacheFileName", ".tundra2.statcache"));
+  WriteStringPtr(main_seg, str_seg, FindStringValue(root, "StatCacheFileNameTmp", ".tundra2.statcache.tmp"));
+
+  WriteStringPtr(main_seg, str_seg, FindStringValue(root, "ActionCacheDir"));
+  WriteStringPtr(main_seg, str_seg, FindStringValue(root, "RemoteCacheUrl"));
 
   HashTableDestroy(&shared_strings);
+  LinearAllocDestroy(&arg_strings);
 
   HeapFree(heap, guid_table);
   HeapFree(heap, remap_table);
@@ -990,7 +1098,7 @@ static bool RunExternalTool(const char* options, ...)
 
   const bool echo = (GetLogFlags() & kDebug) ? true : false;
 
-  ExecResult result = ExecuteProcess(cmdline_to_use, 1, &env_var, 0, echo, nullptr);
+  ExecResult result = ExecuteProcess(cmdline_to_use, nullptr, 1, &env_var, 0, echo, nullptr);
 
   if (0 != result.m_ReturnCode)
   {
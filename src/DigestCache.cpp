@@ -1,10 +1,13 @@
 #include "DigestCache.hpp"
+#include "Atomic.hpp"
 #include "BinaryWriter.hpp"
+#include "Buffer.hpp"
 #include "Stats.hpp"
 
 #include <algorithm>
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 
 namespace t2
 {
@@ -13,7 +16,8 @@ void DigestCacheInit(DigestCache* self, size_t heap_size)
 {
   ReadWriteLockInit(&self->m_Lock);
 
-  self->m_State = nullptr;
+  self->m_State        = nullptr;
+  self->m_FrozenAccess = nullptr;
 
   HeapInit(&self->m_Heap);
   LinearAllocInit(&self->m_Allocator, &self->m_Heap, heap_size / 2, "digest allocator");
@@ -21,6 +25,10 @@ void DigestCacheInit(DigestCache* self, size_t heap_size)
   HashTableInit(&self->m_Table, &self->m_Heap);
 
   self->m_AccessTime = time(nullptr);
+
+  MutexInit(&self->m_HashingLock);
+  CondInit(&self->m_HashingDone);
+  BufferInit(&self->m_Hashing);
 }
 
 void DigestCacheOpen(DigestCache* self, const char* filename)
@@ -31,26 +39,10 @@ void DigestCacheOpen(DigestCache* self, const char* filename)
     const DigestCacheState* state = (const DigestCacheState*) self->m_StateFile.m_Address;
     if (DigestCacheState::MagicNumber == state->m_MagicNumber)
     {
-      const uint64_t time_now = time(nullptr);
-
-      // Throw out records that haven't been accessed in a week.
-      const uint64_t cutoff_time = time_now - 7 * 24 * 60 * 60;
-
-      self->m_State = state;
-
-      //HashTablePrepareBulkInsert(&self->m_Table, state->m_Records.GetCount());
-
-      for (const FrozenDigestRecord& record : state->m_Records)
-      {
-        if (record.m_AccessTime < cutoff_time)
-          continue;
-
-        DigestCacheRecord r;
-        r.m_ContentDigest = record.m_ContentDigest;
-        r.m_Timestamp     = record.m_Timestamp;
-        r.m_AccessTime    = record.m_AccessTime;
-        HashTableInsert(&self->m_Table, record.m_FilenameHash, record.m_Filename.Get(), r);
-      }
+      // Records are looked up through the saved index, so there is nothing to
+      // insert up front.
+      self->m_State        = state;
+      self->m_FrozenAccess = HeapAllocateArrayZeroed<uint8_t>(&self->m_Heap, state->m_Records.GetCount());
       Log(kDebug, "digest cache initialized -- %d entries", state->m_Records.GetCount());
     }
     else
@@ -62,13 +54,81 @@ void DigestCacheOpen(DigestCache* self, const char* filename)
 
 void DigestCacheDestroy(DigestCache* self)
 {
+  BufferDestroy(&self->m_Hashing, &self->m_Heap);
+  CondDestroy(&self->m_HashingDone);
+  MutexDestroy(&self->m_HashingLock);
   HashTableDestroy(&self->m_Table);
+  HeapFree(&self->m_Heap, self->m_FrozenAccess);
   MmapFileDestroy(&self->m_StateFile);
   LinearAllocDestroy(&self->m_Allocator);
   HeapDestroy(&self->m_Heap);
   ReadWriteLockDestroy(&self->m_Lock);
 }
 
+static bool PathsEqual(const char* a, const char* b)
+{
+  if (kFlagPathStrings & kFlagCaseInsensitive)
+    return 0 == FastCompareNoCase(a, b);
+  else
+    return 0 == strcmp(a, b);
+}
+
+// Index of a saved record, or -1.
+static int32_t FrozenRecordLookup(const DigestCacheState* state, const char* filename, uint32_t hash)
+{
+  uint32_t size = state->m_Index.GetCount();
+
+  if (0 == size)
+    return -1;
+
+  const FrozenDigestRecord* records = state->m_Records.GetArray();
+  uint32_t                  mask    = size - 1;
+
+  for (uint32_t i = hash & mask; ; i = (i + 1) & mask)
+  {
+    const FrozenDigestSlot& slot = state->m_Index[i];
+
+    if (slot.m_Index < 0)
+      return -1;
+
+    if (slot.m_FilenameHash == hash && PathsEqual(records[slot.m_Index].m_Filename.Get(), filename))
+      return slot.m_Index;
+  }
+}
+
+// Saved records that are still wanted: not replaced since, and either used by
+// this build or accessed within the last week.
+template <typename Callback>
+static void WalkLiveFrozenRecords(DigestCache* self, Callback callback)
+{
+  const DigestCacheState* state = self->m_State;
+
+  if (!state)
+    return;
+
+  const uint64_t cutoff_time = time(nullptr) - 7 * 24 * 60 * 60;
+
+  for (int32_t i = 0, count = state->m_Records.GetCount(); i < count; ++i)
+  {
+    const FrozenDigestRecord& record = state->m_Records[i];
+
+    DigestCacheRecord r;
+    r.m_ContentDigest = record.m_ContentDigest;
+    r.m_Timestamp     = record.m_Timestamp;
+    r.m_Size          = record.m_Size;
+    r.m_ChangeStamp   = record.m_ChangeStamp;
+    r.m_AccessTime    = self->m_FrozenAccess[i] ? self->m_AccessTime : record.m_AccessTime;
+
+    if (r.m_AccessTime < cutoff_time)
+      continue;
+
+    if (HashTableLookup(&self->m_Table, record.m_FilenameHash, record.m_Filename.Get()))
+      continue;
+
+    callback(record.m_FilenameHash, record.m_Filename.Get(), r);
+  }
+}
+
 bool DigestCacheSave(DigestCache* self, MemAllocHeap* serialization_heap, const char* filename, const char* tmp_filename)
 {
   TimingScope timing_scope(nullptr, &g_Stats.m_DigestCacheSaveTimeCycles);
@@ -78,32 +138,85 @@ bool DigestCacheSave(DigestCache* self, MemAllocHeap* serialization_heap, const
 
   BinarySegment *main_seg   = BinaryWriterAddSegment(&writer);
   BinarySegment *array_seg  = BinaryWriterAddSegment(&writer);
+  BinarySegment *index_seg  = BinaryWriterAddSegment(&writer);
   BinarySegment *string_seg = BinaryWriterAddSegment(&writer);
   BinaryLocator  array_ptr  = BinarySegmentPosition(array_seg);
+  BinaryLocator  index_ptr  = BinarySegmentPosition(index_seg);
+
+  Buffer<uint32_t> hashes;
+  BufferInit(&hashes);
 
-  auto save_record = [=](size_t index, uint32_t hash, const char* path, const DigestCacheRecord& r)
+  auto save_record = [&](uint32_t hash, const char* path, const DigestCacheRecord& r)
   {
     BinarySegmentWriteUint64(array_seg, r.m_Timestamp);
     BinarySegmentWriteUint64(array_seg, r.m_AccessTime);
+    BinarySegmentWriteUint64(array_seg, r.m_Size);
+    BinarySegmentWriteUint64(array_seg, r.m_ChangeStamp);
     BinarySegmentWriteUint32(array_seg, hash);
     BinarySegmentWrite(array_seg, &r.m_ContentDigest, sizeof(r.m_ContentDigest));
     BinarySegmentWritePointer(array_seg, BinarySegmentPosition(string_seg));
     BinarySegmentWriteStringData(string_seg, path);
     BinarySegmentWriteUint32(array_seg, 0); // m_Padding
-#if ENABLED(USE_FAST_HASH)
+#if ENABLED(USE_128BIT_DIGEST)
     BinarySegmentWriteUint32(array_seg, 0); // m_Padding
 #endif
+    BufferAppendOne(&hashes, serialization_heap, hash);
   };
 
-  HashTableWalk(&self->m_Table, save_record);
+  HashTableWalk(&self->m_Table, [&](size_t index, uint32_t hash, const char* path, const DigestCacheRecord& r)
+  {
+    save_record(hash, path, r);
+  });
+
+  WalkLiveFrozenRecords(self, save_record);
+
+  uint32_t count = uint32_t(hashes.m_Size);
+  uint32_t size  = count ? NextPowerOfTwo(2 * count) : 0;
+  uint32_t mask  = size - 1;
+
+  FrozenDigestSlot* slots = HeapAllocateArray<FrozenDigestSlot>(serialization_heap, size);
+
+  for (uint32_t i = 0; i < size; ++i)
+  {
+    slots[i].m_FilenameHash = 0;
+    slots[i].m_Index        = -1;
+  }
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    uint32_t slot = hashes[i] & mask;
+
+    while (slots[slot].m_Index >= 0)
+      slot = (slot + 1) & mask;
+
+    slots[slot].m_FilenameHash = hashes[i];
+    slots[slot].m_Index        = int32_t(i);
+  }
+
+  BinarySegmentWrite(index_seg, slots, size * sizeof(FrozenDigestSlot));
 
   BinarySegmentWriteUint32(main_seg, DigestCacheState::MagicNumber);
-  BinarySegmentWriteInt32(main_seg, (int) self->m_Table.m_RecordCount);
+  BinarySegmentWriteInt32(main_seg, int32_t(count));
   BinarySegmentWritePointer(main_seg, array_ptr);
+  BinarySegmentWriteInt32(main_seg, int32_t(size));
+  BinarySegmentWritePointer(main_seg, index_ptr);
+
+  HeapFree(serialization_heap, slots);
+  BufferDestroy(&hashes, serialization_heap);
 
-  // Unmap old state to avoid sharing conflicts on Windows.
+  // Unmap old state to avoid sharing conflicts on Windows, keeping what's in
+  // it for a build server that goes on using the cache. Elsewhere keep it
+  // mapped and use it as before.
+#if defined(TUNDRA_WIN32)
+  WalkLiveFrozenRecords(self, [&](uint32_t hash, const char* path, const DigestCacheRecord& r)
+  {
+    HashTableInsert(&self->m_Table, hash, StrDup(&self->m_Allocator, path), r);
+  });
+  HeapFree(&self->m_Heap, self->m_FrozenAccess);
+  self->m_FrozenAccess = nullptr;
   MmapFileUnmap(&self->m_StateFile);
   self->m_State = nullptr;
+#endif
 
   bool success = BinaryWriterFlush(&writer, tmp_filename);
 
@@ -121,15 +234,24 @@ bool DigestCacheSave(DigestCache* self, MemAllocHeap* serialization_heap, const
   return success;
 }
 
-bool DigestCacheGet(DigestCache* self, const char* filename, uint32_t hash, uint64_t timestamp, HashDigest* digest_out)
+template <typename Record>
+static bool RecordMatches(const Record& r, const FileInfo& info)
+{
+  return r.m_Timestamp == info.m_Timestamp && r.m_Size == info.m_Size && r.m_ChangeStamp == info.m_ChangeStamp;
+}
+
+bool DigestCacheGet(DigestCache* self, const char* filename, uint32_t hash, const FileInfo& info, HashDigest* digest_out)
 {
   bool result = false;
+  bool found  = false;
 
   ReadWriteLockRead(&self->m_Lock);
 
   if (DigestCacheRecord* r = (DigestCacheRecord*) HashTableLookup(&self->m_Table, hash, filename))
   {
-    if (r->m_Timestamp == timestamp)
+    found = true;
+
+    if (RecordMatches(*r, info))
     {
       // Technically violates r/w lock - doesn't matter
       r->m_AccessTime = self->m_AccessTime;
@@ -140,10 +262,28 @@ bool DigestCacheGet(DigestCache* self, const char* filename, uint32_t hash, uint
 
   ReadWriteUnlockRead(&self->m_Lock);
 
+  // The saved state never changes, so it can be read without locking.
+  if (!found && self->m_State)
+  {
+    int32_t index = FrozenRecordLookup(self->m_State, filename, hash);
+
+    if (index >= 0)
+    {
+      const FrozenDigestRecord& record = self->m_State->m_Records[index];
+
+      if (RecordMatches(record, info))
+      {
+        self->m_FrozenAccess[index] = 1;
+        *digest_out                 = record.m_ContentDigest;
+        result                      = true;
+      }
+    }
+  }
+
   return result;
 }
 
-void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, uint64_t timestamp, const HashDigest& digest)
+void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, const FileInfo& info, const HashDigest& digest)
 {
   ReadWriteLockWrite(&self->m_Lock);
 
@@ -151,7 +291,9 @@ void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, uint
 
   if (nullptr != (r = (DigestCacheRecord*) HashTableLookup(&self->m_Table, hash, filename)))
   {
-    r->m_Timestamp     = timestamp;
+    r->m_Timestamp     = info.m_Timestamp;
+    r->m_Size          = info.m_Size;
+    r->m_ChangeStamp   = info.m_ChangeStamp;
     r->m_ContentDigest = digest;
     r->m_AccessTime    = self->m_AccessTime;
   }
@@ -159,7 +301,9 @@ void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, uint
   {
     DigestCacheRecord r;
     r.m_ContentDigest = digest;
-    r.m_Timestamp     = timestamp;
+    r.m_Timestamp     = info.m_Timestamp;
+    r.m_Size          = info.m_Size;
+    r.m_ChangeStamp   = info.m_ChangeStamp;
     r.m_AccessTime    = self->m_AccessTime;
     HashTableInsert(&self->m_Table, hash, StrDup(&self->m_Allocator, filename), r);
   }
@@ -167,4 +311,66 @@ void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, uint
   ReadWriteUnlockWrite(&self->m_Lock);
 }
 
+static bool IsBeingHashed(DigestCache* self, const char* filename, uint32_t hash, size_t* index_out)
+{
+  for (size_t i = 0, count = self->m_Hashing.m_Size; i < count; ++i)
+  {
+    const FileAndHash& f = self->m_Hashing[i];
+
+    if (f.m_FilenameHash == hash && PathsEqual(f.m_Filename, filename))
+    {
+      *index_out = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool DigestCacheBeginHashing(DigestCache* self, const char* filename, uint32_t hash)
+{
+  bool   waited = false;
+  size_t index;
+
+  MutexLock(&self->m_HashingLock);
+
+  // There are never more files in here than threads hashing them.
+  while (IsBeingHashed(self, filename, hash, &index))
+  {
+    if (!waited)
+      AtomicIncrement(&g_Stats.m_FileDigestWaits);
+
+    waited = true;
+    CondWait(&self->m_HashingDone, &self->m_HashingLock);
+  }
+
+  if (!waited)
+  {
+    FileAndHash f;
+    f.m_Filename     = filename;
+    f.m_FilenameHash = hash;
+    BufferAppendOne(&self->m_Hashing, &self->m_Heap, f);
+  }
+
+  MutexUnlock(&self->m_HashingLock);
+
+  return !waited;
+}
+
+void DigestCacheEndHashing(DigestCache* self, const char* filename, uint32_t hash)
+{
+  size_t index;
+
+  MutexLock(&self->m_HashingLock);
+
+  if (IsBeingHashed(self, filename, hash, &index))
+  {
+    self->m_Hashing[index] = self->m_Hashing[self->m_Hashing.m_Size - 1];
+    BufferPopOne(&self->m_Hashing);
+  }
+
+  CondBroadcast(&self->m_HashingDone);
+  MutexUnlock(&self->m_HashingLock);
+}
+
 }
@@ -3,11 +3,15 @@
 
 #include "Common.hpp"
 #include "BinaryData.hpp"
+#include "Buffer.hpp"
+#include "ConditionVar.hpp"
+#include "FileInfo.hpp"
 #include "Hash.hpp"
 #include "HashTable.hpp"
 #include "MemoryMappedFile.hpp"
 #include "MemAllocLinear.hpp"
 #include "MemAllocHeap.hpp"
+#include "Mutex.hpp"
 #include "ReadWriteLock.hpp"
 
 namespace t2
@@ -20,29 +24,42 @@ namespace t2
   {
     uint64_t                       m_Timestamp;
     uint64_t                       m_AccessTime;
+    uint64_t                       m_Size;
+    uint64_t                       m_ChangeStamp;
     uint32_t                       m_FilenameHash;
     HashDigest                     m_ContentDigest;
     FrozenString                   m_Filename;
 #if ENABLED(USE_SHA1_HASH)
     uint32_t                       m_Padding;
-#elif ENABLED(USE_FAST_HASH)
+#elif ENABLED(USE_128BIT_DIGEST)
     uint32_t                       m_Padding[2];
 #endif
   };
-  static_assert(sizeof(FrozenDigestRecord) == 48, "struct size");
+  static_assert(sizeof(FrozenDigestRecord) == 64, "struct size");
+
+  // Slot in an open-addressed index of the records, probed linearly from the
+  // filename hash, so a saved cache can be used straight from the mapping.
+  struct FrozenDigestSlot
+  {
+    uint32_t                       m_FilenameHash;
+    int32_t                        m_Index;    // into the records, or -1 if the slot is empty
+  };
 
   struct DigestCacheState
   {
-    static const uint32_t           MagicNumber   = 0x12781fa6 ^ kTundraHashMagic;
+    static const uint32_t           MagicNumber   = 0x12781fa8 ^ kTundraHashMagic;
 
     uint32_t                        m_MagicNumber;
     FrozenArray<FrozenDigestRecord> m_Records;
+    FrozenArray<FrozenDigestSlot>   m_Index;
   };
 
   struct DigestCacheRecord
   {
     HashDigest m_ContentDigest;
     uint64_t   m_Timestamp;
+    uint64_t   m_Size;
+    uint64_t   m_ChangeStamp;
     uint64_t   m_AccessTime;
   };
 
@@ -54,8 +71,17 @@ namespace t2
     MemAllocHeap            m_Heap;
     MemAllocLinear          m_Allocator;
     MemoryMappedFile        m_StateFile;
+    // Saved records that have been used, so they aren't thrown out.
+    uint8_t*                m_FrozenAccess;
+    // Records added or updated since the state was saved.
     HashTable<DigestCacheRecord, kFlagPathStrings> m_Table;
     uint64_t                m_AccessTime;
+
+    // Files being hashed right now, so other threads wait for their digests
+    // instead of hashing them as well.
+    Mutex                   m_HashingLock;
+    ConditionVariable       m_HashingDone;
+    Buffer<FileAndHash>     m_Hashing;
   };
 
   void DigestCacheInit(DigestCache* self, size_t heap_size);
@@ -65,9 +91,17 @@ namespace t2
 
   bool DigestCacheSave(DigestCache* self, MemAllocHeap* serialization_heap, const char* filename, const char* tmp_filename);
 
-  bool DigestCacheGet(DigestCache* self, const char* filename, uint32_t hash, uint64_t timestamp, HashDigest* digest_out);
+  // Digests are only used while the file's timestamp, size and change stamp
+  // are all as they were when it was hashed.
+  bool DigestCacheGet(DigestCache* self, const char* filename, uint32_t hash, const FileInfo& info, HashDigest* digest_out);
+
+  void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, const FileInfo& info, const HashDigest& digest);
+
+  // Claim a file for hashing. If another thread is hashing it already, waits
+  // for that to finish and returns false, so the digest can be looked up.
+  bool DigestCacheBeginHashing(DigestCache* self, const char* filename, uint32_t hash);
 
-  void DigestCacheSet(DigestCache* self, const char* filename, uint32_t hash, uint64_t timestamp, const HashDigest& digest);
+  void DigestCacheEndHashing(DigestCache* self, const char* filename, uint32_t hash);
 }
 
 #endif
@@ -0,0 +1,102 @@
+#include "DigestPrefetch.hpp"
+#include "FileSign.hpp"
+#include "MemAllocHeap.hpp"
+#include "SignalHandler.hpp"
+#include "Stats.hpp"
+
+namespace t2
+{
+
+static ThreadRoutineReturnType TUNDRA_STDCALL DigestPrefetchThreadRoutine(void* param)
+{
+  DigestPrefetchWorker* self     = static_cast<DigestPrefetchWorker*>(param);
+  DigestPrefetch*       prefetch = self->m_Prefetch;
+
+  for (;;)
+  {
+    MutexLock(&prefetch->m_Lock);
+
+    bool        done = prefetch->m_Quit || prefetch->m_Next == prefetch->m_Files.m_Size || nullptr != SignalGetReason();
+    FileAndHash file;
+
+    if (!done)
+      file = prefetch->m_Files[prefetch->m_Next++];
+
+    MutexUnlock(&prefetch->m_Lock);
+
+    if (done)
+      break;
+
+    HashDigest digest;
+    ComputeFileContentDigest(prefetch->m_StatCache, prefetch->m_DigestCache, file.m_Filename, file.m_FilenameHash, &digest);
+  }
+
+  return 0;
+}
+
+void DigestPrefetchInit(DigestPrefetch* self, MemAllocHeap* heap, StatCache* stat_cache, DigestCache* digest_cache)
+{
+  self->m_Heap        = heap;
+  self->m_StatCache   = stat_cache;
+  self->m_DigestCache = digest_cache;
+
+  BufferInit(&self->m_Files);
+  HashSetInit(&self->m_Added, heap);
+
+  MutexInit(&self->m_Lock);
+  self->m_Next        = 0;
+  self->m_Quit        = false;
+
+  self->m_WorkerCount = 0;
+  self->m_Workers     = nullptr;
+}
+
+void DigestPrefetchDestroy(DigestPrefetch* self)
+{
+  MutexLock(&self->m_Lock);
+  if (self->m_Next < self->m_Files.m_Size)
+    Log(kDebug, "digest prefetch: skipping %d files", int(self->m_Files.m_Size - self->m_Next));
+  self->m_Quit = true;
+  MutexUnlock(&self->m_Lock);
+
+  for (int i = 0; i < self->m_WorkerCount; ++i)
+    ThreadJoin(self->m_Workers[i].m_Thread);
+
+  HeapFree(self->m_Heap, self->m_Workers);
+  MutexDestroy(&self->m_Lock);
+  HashSetDestroy(&self->m_Added);
+  BufferDestroy(&self->m_Files, self->m_Heap);
+}
+
+void DigestPrefetchAdd(DigestPrefetch* self, const char* filename, uint32_t hash)
+{
+  if (HashSetLookup(&self->m_Added, hash, filename))
+    return;
+
+  HashSetInsert(&self->m_Added, hash, filename);
+
+  FileAndHash file;
+  file.m_Filename     = filename;
+  file.m_FilenameHash = hash;
+  BufferAppendOne(&self->m_Files, self->m_Heap, file);
+}
+
+void DigestPrefetchStart(DigestPrefetch* self, int thread_count)
+{
+  if (0 == self->m_Files.m_Size)
+    return;
+
+  g_Stats.m_FileDigestPrefetches = uint32_t(self->m_Files.m_Size);
+
+  self->m_WorkerCount = thread_count;
+  self->m_Workers     = HeapAllocateArray<DigestPrefetchWorker>(self->m_Heap, thread_count);
+
+  for (int i = 0; i < thread_count; ++i)
+  {
+    DigestPrefetchWorker* worker = &self->m_Workers[i];
+    worker->m_Prefetch = self;
+    worker->m_Thread   = ThreadStart(DigestPrefetchThreadRoutine, worker);
+  }
+}
+
+}
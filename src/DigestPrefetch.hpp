@@ -0,0 +1,57 @@
+#ifndef DIGESTPREFETCH_HPP
+#define DIGESTPREFETCH_HPP
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "HashTable.hpp"
+#include "Mutex.hpp"
+#include "Thread.hpp"
+
+namespace t2
+{
+  struct DigestCache;
+  struct MemAllocHeap;
+  struct StatCache;
+  struct DigestPrefetch;
+
+  struct DigestPrefetchWorker
+  {
+    DigestPrefetch*            m_Prefetch;
+    ThreadId                   m_Thread;
+  };
+
+  // Hashes files the build is going to need content digests of on threads of
+  // its own, starting as the build starts. Build threads signing nodes then
+  // mostly find digests in the digest cache, or wait for the file they want
+  // to finish hashing, rather than hashing inputs one at a time as they go.
+  // Only files no node in the build writes may be added, as they're hashed
+  // while the build runs.
+  struct DigestPrefetch
+  {
+    MemAllocHeap*              m_Heap;
+    StatCache*                 m_StatCache;
+    DigestCache*               m_DigestCache;
+
+    Buffer<FileAndHash>        m_Files;
+    HashSet<kFlagPathStrings>  m_Added;
+
+    Mutex                      m_Lock;
+    size_t                     m_Next;
+    bool                       m_Quit;
+
+    int                        m_WorkerCount;
+    DigestPrefetchWorker*      m_Workers;
+  };
+
+  void DigestPrefetchInit(DigestPrefetch* self, MemAllocHeap* heap, StatCache* stat_cache, DigestCache* digest_cache);
+
+  // Stops hashing files that haven't been started on, and waits for the rest.
+  void DigestPrefetchDestroy(DigestPrefetch* self);
+
+  // Add a file to hash. The filename must stay valid until the prefetch is destroyed.
+  void DigestPrefetchAdd(DigestPrefetch* self, const char* filename, uint32_t hash);
+
+  void DigestPrefetchStart(DigestPrefetch* self, int thread_count);
+}
+
+#endif
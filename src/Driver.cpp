@@ -5,6 +5,8 @@
 #include "Common.hpp"
 #include "DagData.hpp"
 #include "DagGenerator.hpp"
+#include "DigestPrefetch.hpp"
+#include "Exec.hpp"
 #include "FileInfo.hpp"
 #include "MemAllocLinear.hpp"
 #include "MemoryMappedFile.hpp"
@@ -22,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #if ENABLED(TUNDRA_CASE_INSENSITIVE_FILESYSTEM)
 #if defined(_MSC_VER) || defined(TUNDRA_WIN32_MINGW)
@@ -70,8 +73,13 @@ void DriverOptionsInit(DriverOptions* self)
   self->m_Rebuild         = false;
   self->m_DebugSigning    = false;
   self->m_ContinueOnError = false;
+  self->m_WorkStealing    = false;
+  self->m_UseBuildServer  = false;
+  self->m_StopBuildServer = false;
+  self->m_RunBuildServer  = false;
   self->m_QuickstartGen   = false;
   self->m_ThreadCount     = GetCpuCount();
+  self->m_ActionCount     = 0;
   self->m_WorkingDir      = nullptr;
   self->m_DAGFileName     = ".tundra2.dag";
   self->m_ProfileOutput   = nullptr;
@@ -80,6 +88,11 @@ void DriverOptionsInit(DriverOptions* self)
 #endif
 }
 
+int DriverActionCount(const DriverOptions* self)
+{
+  return self->m_ActionCount > 0 ? self->m_ActionCount : self->m_ThreadCount;
+}
+
 // Helper routine to load frozen data into RAM via memory mapping
 template <typename FrozenType>
 static bool LoadFrozenData(const char* fn, MemoryMappedFile* result, const FrozenType** ptr)
@@ -176,6 +189,28 @@ bool DriverInitData(Driver* self)
     return false;
 
   DigestCacheOpen(&self->m_DigestCache, self->m_DagData->m_DigestCacheFileName);
+  StatCacheOpen(&self->m_StatCache, self->m_DagData->m_StatCacheFileName);
+
+  if (const char* action_cache_dir = self->m_DagData->m_ActionCacheDir)
+  {
+    uint64_t max_size = uint64_t(std::max(self->m_DagData->m_ActionCacheSizeMb, 1)) * MB(1);
+    self->m_UseActionCache = ActionCacheInit(&self->m_ActionCache, &self->m_Heap, action_cache_dir, max_size);
+  }
+
+  // The server usually differs between sites, so let the environment pick
+  // one (or turn it off with an empty value) regardless of the build files.
+  const char* remote_cache_url = self->m_DagData->m_RemoteCacheUrl;
+
+  if (const char* env_url = getenv("TUNDRA_REMOTE_CACHE"))
+    remote_cache_url = env_url[0] ? env_url : nullptr;
+
+  if (remote_cache_url)
+  {
+    if (!self->m_UseActionCache)
+      Log(kWarning, "the remote cache needs ActionCacheDir to be set; not using %s", remote_cache_url);
+    else if (RemoteCacheInit(&self->m_RemoteCache, &self->m_Heap, &self->m_ActionCache, remote_cache_url, 0 != self->m_DagData->m_RemoteCacheUpload))
+      self->m_UseRemoteCache = true;
+  }
 
   LoadFrozenData<StateData>(self->m_DagData->m_StateFileName, &self->m_StateFile, &self->m_StateData);
 
@@ -186,6 +221,76 @@ bool DriverInitData(Driver* self)
   return true;
 }
 
+bool DriverReuseData(Driver* self, const DriverOptions* options)
+{
+  ProfilerScope prof_scope("Tundra ReuseData", 0);
+
+  self->m_Options = *options;
+
+  LinearAllocReset(&self->m_Allocator);
+
+  if (options->m_ForceDagRegen)
+    return false;
+
+  // Catch up with what changed since the last build first, so the file
+  // watcher can vouch for glob directories instead of listing them again.
+  if (!self->m_UseFileWatcher)
+    self->m_UseFileWatcher = FileWatcherInit(&self->m_FileWatcher, &self->m_Heap);
+
+  if (self->m_UseFileWatcher)
+    FileWatcherCollect(&self->m_FileWatcher, &self->m_StatCache);
+
+  if (!DriverCheckDagSignatures(self))
+    return false;
+
+  for (NodeState& node : self->m_Nodes)
+  {
+    HeapFree(&self->m_Heap, node.m_OutputDigests);
+    HeapFree(&self->m_Heap, node.m_ImplicitDeps);
+    HeapFree(&self->m_Heap, node.m_ImplicitDepCounts);
+  }
+
+  BufferClear(&self->m_Nodes);
+  BufferClear(&self->m_NodeRemap);
+  memset(&self->m_PassNodeCount, 0, sizeof self->m_PassNodeCount);
+
+  // Start over with the stat cache, keeping only what the file watcher
+  // knows hasn't changed.
+  StatCacheDestroy(&self->m_StatCache);
+  LinearAllocReset(&self->m_StatCacheAllocator);
+  StatCacheInit(&self->m_StatCache, &self->m_StatCacheAllocator, &self->m_Heap);
+  StatCacheOpen(&self->m_StatCache, self->m_DagData->m_StatCacheFileName);
+
+  if (self->m_UseFileWatcher)
+    FileWatcherSeed(&self->m_FileWatcher, &self->m_StatCache);
+
+  // The last build saved new state and scan cache files, and another tundra
+  // may have run since. Map in whatever is there now.
+  MmapFileUnmap(&self->m_StateFile);
+  self->m_StateData = nullptr;
+
+  ScanCacheDestroy(&self->m_ScanCache);
+  LinearAllocReset(&self->m_ScanCacheAllocator);
+  ScanCacheInit(&self->m_ScanCache, &self->m_Heap, &self->m_ScanCacheAllocator);
+
+  MmapFileUnmap(&self->m_ScanFile);
+  self->m_ScanData = nullptr;
+
+  LoadFrozenData<StateData>(self->m_DagData->m_StateFileName, &self->m_StateFile, &self->m_StateData);
+
+  LoadFrozenData<ScanData>(self->m_DagData->m_ScanCacheFileName, &self->m_ScanFile, &self->m_ScanData);
+
+  ScanCacheSetCache(&self->m_ScanCache, self->m_ScanData);
+
+  // Records used by this build count as used now, not when the server started.
+  self->m_DigestCache.m_AccessTime = time(nullptr);
+
+  if (self->m_UseActionCache)
+    self->m_ActionCache.m_AccessTime = time(nullptr);
+
+  return true;
+}
+
 static bool DriverPrepareDag(Driver* self, const char* dag_fn)
 {
   // Try to use an existing DAG
@@ -258,6 +363,11 @@ static bool DriverCheckDagSignatures(Driver* self)
   // The digests computed there are stored in the signature block by Lua code.
   for (const DagGlobSignature& sig : dag_data->m_GlobSignatures)
   {
+    // A build server checked the directory last time, and can tell if it's
+    // been changed since.
+    if (self->m_UseFileWatcher && FileWatcherListingUnchanged(&self->m_FileWatcher, sig.m_Path))
+      continue;
+
     HashDigest digest = CalculateGlobSignatureFor(sig.m_Path, &self->m_Heap, &self->m_Allocator);
 
     // Compare digest with the one stored in the signature block
@@ -484,6 +594,64 @@ static void DriverSelectNodes(const DagData* dag, const char** targets, int targ
   BufferDestroy(&target_specs, heap);
 }
 
+// Estimate the critical path of every node: its own action time plus the
+// longest path through the nodes waiting on it. Nodes are visited in reverse
+// topological order, found with Kahn's algorithm over the dependency counts.
+static void DriverComputeCriticalPaths(Driver* self)
+{
+  NodeState     *nodes      = self->m_Nodes.m_Storage;
+  const int      node_count = (int) self->m_Nodes.m_Size;
+  const int32_t *node_remap = self->m_NodeRemap.m_Storage;
+  MemAllocHeap  *heap       = &self->m_Heap;
+
+  int32_t *dep_counts  = HeapAllocateArray<int32_t>(heap, node_count);
+  int32_t *order       = HeapAllocateArray<int32_t>(heap, node_count);
+  int      order_count = 0;
+
+  for (int i = 0; i < node_count; ++i)
+  {
+    dep_counts[i] = nodes[i].m_PendingDependencyCount;
+
+    if (0 == dep_counts[i])
+      order[order_count++] = i;
+  }
+
+  // The order array doubles as the work queue.
+  for (int read_index = 0; read_index < order_count; ++read_index)
+  {
+    for (int32_t link : nodes[order[read_index]].m_MmapData->m_BackLinks)
+    {
+      int32_t waiter = node_remap[link];
+
+      if (-1 != waiter && 0 == --dep_counts[waiter])
+        order[order_count++] = waiter;
+    }
+  }
+
+  CHECK(order_count == node_count);
+
+  for (int i = order_count - 1; i >= 0; --i)
+  {
+    NodeState *node           = nodes + order[i];
+    uint64_t   longest_waiter = 0;
+
+    for (int32_t link : node->m_MmapData->m_BackLinks)
+    {
+      int32_t waiter = node_remap[link];
+
+      if (-1 != waiter)
+        longest_waiter = std::max(longest_waiter, nodes[waiter].m_CriticalPathMs);
+    }
+
+    // Count every node as at least a millisecond so that without any recorded
+    // history, the deepest chain of nodes goes first.
+    node->m_CriticalPathMs = std::max(node->m_ActionTimeMs, 1u) + longest_waiter;
+  }
+
+  HeapFree(heap, order);
+  HeapFree(heap, dep_counts);
+}
+
 bool DriverPrepareNodes(Driver* self, const char** targets, int target_count)
 {
   ProfilerScope prof_scope("Tundra PrepareNodes", 0);
@@ -542,6 +710,10 @@ bool DriverPrepareNodes(Driver* self, const char** targets, int target_count)
     const NodeData* src_node = src_nodes + node_indices[i];
     out_nodes[i].m_MmapData  = src_node;
     out_nodes[i].m_PassIndex = (uint16_t) src_node->m_PassIndex;
+
+    // All dependencies are part of the node set by construction (see above),
+    // so every dependency will eventually complete and count this down.
+    out_nodes[i].m_PendingDependencyCount = src_node->m_Dependencies.GetCount();
   }
 
   // Find frozen node state from previous build, if present.
@@ -558,7 +730,8 @@ bool DriverPrepareNodes(Driver* self, const char** targets, int target_count)
       if (const HashDigest* old_guid = BinarySearch(state_guids, state_guid_count, *src_guid))
       {
         int state_index = int(old_guid - state_guids);
-        out_nodes[i].m_MmapState = frozen_states + state_index;
+        out_nodes[i].m_MmapState    = frozen_states + state_index;
+        out_nodes[i].m_ActionTimeMs = frozen_states[state_index].m_ActionTimeMs;
       }
     }
   }
@@ -590,6 +763,8 @@ bool DriverPrepareNodes(Driver* self, const char** targets, int target_count)
   Log(kDebug, "Node remap: %d src nodes, %d active nodes, using %d bytes of node state buffer space",
       dag->m_NodeCount, node_count, sizeof(NodeState) * node_count);
 
+  DriverComputeCriticalPaths(self);
+
   BufferDestroy(&node_stack, &self->m_Heap);
   BufferDestroy(&node_indices, &self->m_Heap);
 
@@ -626,17 +801,38 @@ bool DriverInit(Driver* self, const DriverOptions* options)
 
   memset(&self->m_PassNodeCount, 0, sizeof self->m_PassNodeCount);
 
+  self->m_UseActionCache = false;
+  self->m_UseRemoteCache = false;
+  self->m_UseFileWatcher = false;
+
   return true;
 }
 
 void DriverDestroy(Driver* self)
 {
+  // Waits for outstanding uploads, which read from the action cache.
+  if (self->m_UseRemoteCache)
+    RemoteCacheDestroy(&self->m_RemoteCache);
+
+  if (self->m_UseActionCache)
+    ActionCacheDestroy(&self->m_ActionCache);
+
   DigestCacheDestroy(&self->m_DigestCache);
 
+  if (self->m_UseFileWatcher)
+    FileWatcherDestroy(&self->m_FileWatcher);
+
   StatCacheDestroy(&self->m_StatCache);
 
   ScanCacheDestroy(&self->m_ScanCache);
 
+  for (NodeState& node : self->m_Nodes)
+  {
+    HeapFree(&self->m_Heap, node.m_OutputDigests);
+    HeapFree(&self->m_Heap, node.m_ImplicitDeps);
+    HeapFree(&self->m_Heap, node.m_ImplicitDepCounts);
+  }
+
   BufferDestroy(&self->m_Nodes, &self->m_Heap);
   BufferDestroy(&self->m_NodeRemap, &self->m_Heap);
 
@@ -653,6 +849,52 @@ void DriverDestroy(Driver* self)
 bool DriverPrepareDag(Driver* self, const char* dag_fn);
 bool DriverAllocNodes(Driver* self);
 
+// Queue the inputs of the nodes being built that are signed by content, and
+// the files they included last time, to be hashed as the build starts.
+// Outputs of these nodes are left out, as they may be written meanwhile.
+static void DriverPrefetchDigests(Driver* self, DigestPrefetch* prefetch, HashSet<kFlagPathStrings>* content_digest_files)
+{
+  const DagData* dag = self->m_DagData;
+
+  HashSet<kFlagPathStrings> outputs;
+  HashSetInit(&outputs, &self->m_Heap);
+
+  for (const NodeState& state : self->m_Nodes)
+  {
+    for (const FrozenFileAndHash& output : state.m_MmapData->m_OutputFiles)
+    {
+      if (!HashSetLookup(&outputs, output.m_FilenameHash, output.m_Filename))
+        HashSetInsert(&outputs, output.m_FilenameHash, output.m_Filename);
+    }
+  }
+
+  auto add_file = [&](const char* filename, uint32_t hash)
+  {
+    if (HashSetLookup(&outputs, hash, filename))
+      return;
+
+    if (IsSignedByContent(filename, hash, dag->m_ShaExtensionHashes.GetArray(), dag->m_ShaExtensionHashes.GetCount(),
+                          content_digest_files, 0 != dag->m_SignByContent))
+    {
+      DigestPrefetchAdd(prefetch, filename, hash);
+    }
+  };
+
+  for (const NodeState& state : self->m_Nodes)
+  {
+    for (const FrozenFileAndHash& input : state.m_MmapData->m_InputFiles)
+      add_file(input.m_Filename, input.m_FilenameHash);
+
+    if (const NodeStateData* old_state = state.m_MmapState)
+    {
+      for (const FrozenFileAndHash& dep : old_state->m_ImplicitDeps)
+        add_file(dep.m_Filename, dep.m_FilenameHash);
+    }
+  }
+
+  HashSetDestroy(&outputs);
+}
+
 BuildResult::Enum DriverBuild(Driver* self)
 {
   const DagData* dag = self->m_DagData;
@@ -688,6 +930,30 @@ BuildResult::Enum DriverBuild(Driver* self)
 
   Log(kDebug, "Max # expensive jobs: %d", max_expensive_count);
 
+  // Outputs of nodes that digest them are always signed by content when they
+  // show up as inputs, regardless of their extension.
+  HashSet<kFlagPathStrings> content_digest_files;
+  HashSetInit(&content_digest_files, &self->m_Heap);
+
+  for (int i = 0, count = dag->m_NodeCount; i < count; ++i)
+  {
+    const NodeData& node = dag->m_NodeData[i];
+
+    if (0 == (node.m_Flags & NodeData::kFlagContentDigestOutputs))
+      continue;
+
+    for (const FrozenFileAndHash& output : node.m_OutputFiles)
+    {
+      if (!HashSetLookup(&content_digest_files, output.m_FilenameHash, output.m_Filename))
+        HashSetInsert(&content_digest_files, output.m_FilenameHash, output.m_Filename);
+    }
+  }
+
+  DigestPrefetch digest_prefetch;
+  DigestPrefetchInit(&digest_prefetch, &self->m_Heap, &self->m_StatCache, &self->m_DigestCache);
+  DriverPrefetchDigests(self, &digest_prefetch, &content_digest_files);
+  DigestPrefetchStart(&digest_prefetch, self->m_Options.m_ThreadCount);
+
   BuildQueueConfig queue_config;
   queue_config.m_Flags                   = 0;
   queue_config.m_Heap                    = &self->m_Heap;
@@ -701,7 +967,14 @@ BuildResult::Enum DriverBuild(Driver* self)
   queue_config.m_DigestCache             = &self->m_DigestCache;
   queue_config.m_ShaDigestExtensionCount = dag->m_ShaExtensionHashes.GetCount();
   queue_config.m_ShaDigestExtensions     = dag->m_ShaExtensionHashes.GetArray();
+  queue_config.m_ContentDigestFiles      = &content_digest_files;
+  queue_config.m_SignByContent           = 0 != dag->m_SignByContent;
+  queue_config.m_ActionCache             = self->m_UseActionCache ? &self->m_ActionCache : nullptr;
+  queue_config.m_RemoteCache             = self->m_UseRemoteCache ? &self->m_RemoteCache : nullptr;
   queue_config.m_MaxExpensiveCount       = max_expensive_count;
+  queue_config.m_MaxRunningActions       = std::min(DriverActionCount(&self->m_Options), ExecAsyncSlotCount());
+
+  Log(kDebug, "Max # running actions: %d", queue_config.m_MaxRunningActions);
 
   if (self->m_Options.m_Verbose)
   {
@@ -715,6 +988,10 @@ BuildResult::Enum DriverBuild(Driver* self)
   {
     queue_config.m_Flags |= BuildQueueConfig::kFlagContinueOnError;
   }
+  if (self->m_Options.m_WorkStealing)
+  {
+    queue_config.m_Flags |= BuildQueueConfig::kFlagWorkStealing;
+  }
 
   if (self->m_Options.m_DebugSigning)
   {
@@ -751,19 +1028,30 @@ BuildResult::Enum DriverBuild(Driver* self)
 
   BuildResult::Enum build_result = BuildResult::kOk;
 
-  for (int pass = 0; BuildResult::kOk == build_result && pass < pass_count; ++pass)
+  if (dag->m_OverlapPasses)
+  {
+    Log(kInfo, "begin overlapped passes (nodes: %d)", int(self->m_Nodes.m_Size));
+
+    build_result = BuildQueueBuildPassesOverlapped(&build_queue, dag->m_Passes.GetArray(), pass_count, self->m_PassNodeCount);
+
+    Log(kInfo, "end overlapped passes");
+  }
+  else
   {
-    const char *pass_name  = dag->m_Passes[pass].m_PassName;
-    const int   pass_nodes = self->m_PassNodeCount[pass];
+    for (int pass = 0; BuildResult::kOk == build_result && pass < pass_count; ++pass)
+    {
+      const char *pass_name  = dag->m_Passes[pass].m_PassName;
+      const int   pass_nodes = self->m_PassNodeCount[pass];
 
-    Log(kInfo, "begin pass %s (nodes: %d - %d (%d))",
-        pass_name, global_node_index, global_node_index + pass_nodes - 1, pass_nodes);
+      Log(kInfo, "begin pass %s (nodes: %d - %d (%d))",
+          pass_name, global_node_index, global_node_index + pass_nodes - 1, pass_nodes);
 
-    build_result = BuildQueueBuildNodeRange(&build_queue, global_node_index, pass_nodes, pass);
+      build_result = BuildQueueBuildNodeRange(&build_queue, global_node_index, pass_nodes, pass);
 
-    global_node_index += pass_nodes;
+      global_node_index += pass_nodes;
 
-    Log(kInfo, "end pass %s", pass_name);
+      Log(kInfo, "end pass %s", pass_name);
+    }
   }
 
   if (self->m_Options.m_DebugSigning)
@@ -775,6 +1063,10 @@ BuildResult::Enum DriverBuild(Driver* self)
   // Shut down build queue
   BuildQueueDestroy(&build_queue);
 
+  DigestPrefetchDestroy(&digest_prefetch);
+
+  HashSetDestroy(&content_digest_files);
+
   return build_result;
 }
 
@@ -789,7 +1081,7 @@ bool DriverSaveScanCache(Driver* self)
   // This will be invalidated.
   self->m_ScanData = nullptr;
 
-  bool success = ScanCacheSave(scan_cache, self->m_DagData->m_ScanCacheFileNameTmp, &self->m_Heap);
+  bool success = ScanCacheSave(scan_cache, &self->m_StatCache, self->m_DagData->m_ScanCacheFileNameTmp, &self->m_Heap);
 
   // Unmap the file so we can overwrite it (on Windows.)
   MmapFileDestroy(&self->m_ScanFile);
@@ -813,6 +1105,64 @@ bool DriverSaveDigestCache(Driver* self)
   return DigestCacheSave(&self->m_DigestCache, &self->m_Heap, self->m_DagData->m_DigestCacheFileName, self->m_DagData->m_DigestCacheFileNameTmp);
 }
 
+// Save stat cache
+bool DriverSaveStatCache(Driver* self)
+{
+  return StatCacheSave(&self->m_StatCache, &self->m_Heap, self->m_DagData->m_StatCacheFileName, self->m_DagData->m_StatCacheFileNameTmp);
+}
+
+// Save action cache index
+bool DriverSaveActionCache(Driver* self)
+{
+  if (!self->m_UseActionCache)
+    return true;
+
+  return ActionCacheSave(&self->m_ActionCache, &self->m_Heap);
+}
+
+// Write a node's implicit dependencies. Most paths are shared by many nodes,
+// so each is only written once.
+template <typename FileT>
+static void WriteImplicitDeps(
+    BinarySegment*                              state_seg,
+    BinarySegment*                              array_seg,
+    BinarySegment*                              string_seg,
+    HashTable<BinaryLocator, kFlagPathStrings>* dep_strings,
+    const int32_t*                              counts,
+    int32_t                                     input_count,
+    const FileT*                                deps,
+    int32_t                                     dep_count,
+    const HashDigest&                           fingerprint)
+{
+  BinarySegmentWriteInt32(state_seg, input_count);
+  BinarySegmentWritePointer(state_seg, BinarySegmentPosition(array_seg));
+  for (int32_t i = 0; i < input_count; ++i)
+    BinarySegmentWriteInt32(array_seg, counts[i]);
+
+  BinarySegmentWriteInt32(state_seg, dep_count);
+  BinarySegmentWritePointer(state_seg, BinarySegmentPosition(array_seg));
+  for (int32_t i = 0; i < dep_count; ++i)
+  {
+    const char* filename = deps[i].m_Filename;
+    uint32_t    hash     = deps[i].m_FilenameHash;
+
+    if (const BinaryLocator* l = HashTableLookup(dep_strings, hash, filename))
+    {
+      BinarySegmentWritePointer(array_seg, *l);
+    }
+    else
+    {
+      BinaryLocator pos = BinarySegmentPosition(string_seg);
+      HashTableInsert(dep_strings, hash, filename, pos);
+      BinarySegmentWritePointer(array_seg, pos);
+      BinarySegmentWriteStringData(string_seg, filename);
+    }
+
+    BinarySegmentWriteUint32(array_seg, hash);
+  }
+
+  BinarySegmentWrite(state_seg, (const char*) &fingerprint, sizeof fingerprint);
+}
 
 bool DriverSaveBuildState(Driver* self)
 {
@@ -857,7 +1207,21 @@ bool DriverSaveBuildState(Driver* self)
 
   int entry_count = 0;
 
-  auto save_node_state = [=](int build_result, const HashDigest* input_signature, const NodeData* src_node, const HashDigest* guid) -> void
+  HashTable<BinaryLocator, kFlagPathStrings> dep_strings;
+  HashTableInit(&dep_strings, &self->m_Heap);
+  HashTable<BinaryLocator, kFlagPathStrings>* dep_strings_ptr = &dep_strings;
+
+  // Nodes that didn't find their implicit dependencies this time keep the ones
+  // from the previous build state.
+  auto save_old_implicit_deps = [=](const NodeStateData* old_node) -> void
+  {
+    WriteImplicitDeps(state_seg, array_seg, string_seg, dep_strings_ptr,
+        old_node->m_ImplicitDepCounts.GetArray(), old_node->m_ImplicitDepCounts.GetCount(),
+        old_node->m_ImplicitDeps.GetArray(), old_node->m_ImplicitDeps.GetCount(),
+        old_node->m_ImplicitDepsFingerprint);
+  };
+
+  auto save_node_state = [=](int build_result, const HashDigest* input_signature, uint32_t action_time_ms, const HashDigest* output_digests, int32_t output_digest_count, const NodeData* src_node, const HashDigest* guid) -> void
   {
     BinarySegmentWrite(guid_seg, (const char*) guid, sizeof(HashDigest));
 
@@ -881,9 +1245,15 @@ bool DriverSaveBuildState(Driver* self)
       BinarySegmentWritePointer(array_seg, BinarySegmentPosition(string_seg));
       BinarySegmentWriteStringData(string_seg, src_node->m_AuxOutputFiles[i].m_Filename);
     }
+
+    BinarySegmentWriteUint32(state_seg, action_time_ms);
+
+    BinarySegmentWriteInt32(state_seg, output_digest_count);
+    BinarySegmentWritePointer(state_seg, BinarySegmentPosition(array_seg));
+    BinarySegmentWrite(array_seg, (const char*) output_digests, output_digest_count * sizeof(HashDigest));
   };
 
-  auto save_node_state_old = [=](int build_result, const HashDigest* input_signature, const NodeStateData* src_node, const HashDigest* guid) -> void
+  auto save_node_state_old = [=](int build_result, const HashDigest* input_signature, uint32_t action_time_ms, const HashDigest* output_digests, int32_t output_digest_count, const NodeStateData* src_node, const HashDigest* guid) -> void
   {
     BinarySegmentWrite(guid_seg, (const char*) guid, sizeof(HashDigest));
 
@@ -907,6 +1277,12 @@ bool DriverSaveBuildState(Driver* self)
       BinarySegmentWritePointer(array_seg, BinarySegmentPosition(string_seg));
       BinarySegmentWriteStringData(string_seg, src_node->m_AuxOutputFiles[i]);
     }
+
+    BinarySegmentWriteUint32(state_seg, action_time_ms);
+
+    BinarySegmentWriteInt32(state_seg, output_digest_count);
+    BinarySegmentWritePointer(state_seg, BinarySegmentPosition(array_seg));
+    BinarySegmentWrite(array_seg, (const char*) output_digests, output_digest_count * sizeof(HashDigest));
   };
 
   auto save_new = [=, &entry_count](size_t index) {
@@ -915,22 +1291,52 @@ bool DriverSaveBuildState(Driver* self)
     const int         src_index = int(src_elem - src_data);
     const HashDigest *guid      = src_guids + src_index;
 
-    // If this node never computed an input signature (due to an error, or build cancellation), copy the old build progress over to retain the history.
+    // If this node never computed an input signature (due to an error, build cancellation, or its pass being skipped), copy the old build progress over to retain the history.
     // Only do this if the output files and aux output files agree with the previously stored build state.
-    if (elem->m_Progress < BuildProgress::kUnblocked)
+    if (elem->m_Progress < BuildProgress::kUnblocked || (elem->m_Flags & NodeStateFlags::kSkipped))
     {
       if (const HashDigest* old_guid = BinarySearch(old_guids, old_count, *guid))
       {
         size_t old_index = old_guid - old_guids;
         const NodeStateData* old_state_data = old_state + old_index;
-        save_node_state_old(old_state_data->m_BuildResult, &old_state_data->m_InputSignature, old_state_data, guid);
+        save_node_state_old(old_state_data->m_BuildResult, &old_state_data->m_InputSignature, old_state_data->m_ActionTimeMs,
+            old_state_data->m_OutputDigests.GetArray(), old_state_data->m_OutputDigests.GetCount(), old_state_data, guid);
+        save_old_implicit_deps(old_state_data);
         ++entry_count;
         ++g_Stats.m_StateSaveNew;
       }
     }
     else
     {
-      save_node_state(elem->m_BuildResult, &elem->m_InputSignature, src_elem, guid);
+      // Output digests are only recomputed when the action runs. Keep the old
+      // ones for nodes that were up to date.
+      const HashDigest* output_digests      = elem->m_OutputDigests;
+      int32_t           output_digest_count = output_digests ? src_elem->m_OutputFiles.GetCount() : 0;
+
+      if (!output_digests && 0 == elem->m_BuildResult && elem->m_MmapState &&
+          0 != (src_elem->m_Flags & NodeData::kFlagContentDigestOutputs) &&
+          elem->m_MmapState->m_OutputDigests.GetCount() == src_elem->m_OutputFiles.GetCount())
+      {
+        output_digests      = elem->m_MmapState->m_OutputDigests.GetArray();
+        output_digest_count = elem->m_MmapState->m_OutputDigests.GetCount();
+      }
+
+      save_node_state(elem->m_BuildResult, &elem->m_InputSignature, elem->m_ActionTimeMs, output_digests, output_digest_count, src_elem, guid);
+
+      if (const int32_t* counts = elem->m_ImplicitDepCounts)
+      {
+        WriteImplicitDeps(state_seg, array_seg, string_seg, dep_strings_ptr,
+            counts, src_elem->m_InputFiles.GetCount(), elem->m_ImplicitDeps, elem->m_ImplicitDepCount,
+            elem->m_ImplicitDepsFingerprint);
+      }
+      else
+      {
+        HashDigest no_fingerprint;
+        memset(&no_fingerprint, 0, sizeof no_fingerprint);
+        WriteImplicitDeps(state_seg, array_seg, string_seg, dep_strings_ptr,
+            counts, 0, elem->m_ImplicitDeps, 0, no_fingerprint);
+      }
+
       ++entry_count;
       ++g_Stats.m_StateSaveNew;
     }
@@ -946,7 +1352,9 @@ bool DriverSaveBuildState(Driver* self)
       const NodeData* src_elem = src_data + src_index;
       const NodeStateData *data = old_state + index;
 
-      save_node_state(data->m_BuildResult, &data->m_InputSignature, src_elem, guid);
+      save_node_state(data->m_BuildResult, &data->m_InputSignature, data->m_ActionTimeMs,
+          data->m_OutputDigests.GetArray(), data->m_OutputDigests.GetCount(), src_elem, guid);
+      save_old_implicit_deps(data);
       ++entry_count;
       ++g_Stats.m_StateSaveOld;
     }
@@ -970,6 +1378,8 @@ bool DriverSaveBuildState(Driver* self)
       new_state_count, save_new, key_new,
       old_count, save_old, key_old);
 
+  HashTableDestroy(&dep_strings);
+
   // Complete main data structure.
   BinarySegmentWriteUint32(main_seg, StateData::MagicNumber);
   BinarySegmentWriteInt32(main_seg, entry_count);
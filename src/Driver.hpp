@@ -9,7 +9,10 @@
 #include "Buffer.hpp"
 #include "ScanCache.hpp"
 #include "StatCache.hpp"
+#include "FileWatcher.hpp"
 #include "DigestCache.hpp"
+#include "ActionCache.hpp"
+#include "RemoteCache.hpp"
 
 namespace t2
 {
@@ -35,11 +38,16 @@ struct DriverOptions
   bool        m_Rebuild;
   bool        m_DebugSigning;
   bool        m_ContinueOnError;
+  bool        m_WorkStealing;
+  bool        m_UseBuildServer;
+  bool        m_StopBuildServer;
+  bool        m_RunBuildServer;
 #if defined(TUNDRA_WIN32)
   bool        m_RunUnprotected;
 #endif
   bool        m_QuickstartGen;
   int         m_ThreadCount;
+  int         m_ActionCount;
   const char *m_WorkingDir;
   const char *m_DAGFileName;
   const char *m_ProfileOutput;
@@ -47,6 +55,10 @@ struct DriverOptions
 
 void DriverOptionsInit(DriverOptions* self);
 
+// How many actions may run at once; as many as there are build threads
+// unless asked otherwise.
+int DriverActionCount(const DriverOptions* self);
+
 struct Driver
 {
   enum
@@ -85,8 +97,20 @@ struct Driver
   MemAllocLinear    m_StatCacheAllocator;
   StatCache         m_StatCache;
 
+  // Only initialized once a build server reuses the driver.
+  bool              m_UseFileWatcher;
+  FileWatcher       m_FileWatcher;
+
   DigestCache       m_DigestCache;
 
+  // Only initialized if the build configures an action cache directory.
+  bool              m_UseActionCache;
+  ActionCache       m_ActionCache;
+
+  // Only initialized if a remote cache server is configured.
+  bool              m_UseRemoteCache;
+  RemoteCache       m_RemoteCache;
+
   int32_t           m_PassNodeCount[kMaxPasses];
 };
 
@@ -108,9 +132,16 @@ BuildResult::Enum DriverBuild(Driver* self);
 
 bool DriverInitData(Driver* self);
 
+// Get a driver that has built before ready for another build, keeping the DAG
+// and caches it has loaded. Returns false if the DAG is out of date, in which
+// case the driver has to be destroyed and set up again.
+bool DriverReuseData(Driver* self, const DriverOptions* options);
+
 bool DriverSaveScanCache(Driver* self);
 bool DriverSaveBuildState(Driver* self);
 bool DriverSaveDigestCache(Driver* self);
+bool DriverSaveStatCache(Driver* self);
+bool DriverSaveActionCache(Driver* self);
 
 void DriverInitializeTundraFilePaths(DriverOptions* driverOptions);
 
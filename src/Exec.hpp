@@ -1,6 +1,8 @@
 #ifndef EXEC_HPP
 #define EXEC_HPP
 
+#include "Common.hpp"
+
 namespace t2
 {
   struct EnvVariable
@@ -15,15 +17,48 @@ namespace t2
     bool    m_WasSignalled;
   };
 
-  void ExecInit(int thread_count);
+  // Called on the exec reactor thread once a process started with
+  // ExecuteProcessAsync() has exited.
+  typedef void ExecDoneCallback(void* context, int32_t id, int slot);
+
+  // `action_count` is how many processes can run asynchronously at once.
+  void ExecInit(int thread_count, int action_count);
+
+  // How many processes can run asynchronously at once; 0 if this platform
+  // can't run them that way.
+  int ExecAsyncSlotCount();
 
+  // `args` optionally holds the command line split into a null-terminated
+  // argument vector, to run it without going through the shell.
   ExecResult ExecuteProcess(
         const char*         cmd_line,
+        const char* const*  args,
         int                 env_count,
         const EnvVariable*  env_vars,
         int                 job_id,
         int                 echo_cmdline,
         const char*         annotation);
+
+  // Start a process without waiting for it. Its output is held back until
+  // ExecFinishAsync(), and `callback` is called with `id` and the slot it ran
+  // in once it has exited. Returns the slot, or -1 if the process couldn't be
+  // started this way, in which case use ExecuteProcess() instead.
+  int ExecuteProcessAsync(
+        const char*         cmd_line,
+        const char* const*  args,
+        int                 env_count,
+        const EnvVariable*  env_vars,
+        ExecDoneCallback*   callback,
+        void*               context,
+        int32_t             id);
+
+  // Print the output of a process started with ExecuteProcessAsync() that
+  // has exited, the same way ExecuteProcess() would have, and free its slot.
+  ExecResult ExecFinishAsync(
+        int                 slot,
+        const char*         cmd_line,
+        int                 echo_cmdline,
+        const char*         annotation);
 }
 
 #endif
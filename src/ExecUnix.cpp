@@ -23,6 +23,24 @@
 #include <stdlib.h>
 #include <libgen.h>
 #include <errno.h>
+#include <spawn.h>
+
+extern char **environ;
+
+#if defined(TUNDRA_LINUX)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(TUNDRA_LINUX) && defined(SYS_pidfd_open)
+#define USE_EXEC_REACTOR YES
+#include "Thread.hpp"
+#include "Mutex.hpp"
+#include "ConditionVar.hpp"
+#include "SignalHandler.hpp"
+#else
+#define USE_EXEC_REACTOR NO
+#endif
 
 namespace t2
 {
@@ -37,11 +55,6 @@ static void SetFdNonBlocking(int fd)
 		CroakErrno("couldn't unblock fd %d", fd);
 }
 
-void ExecInit(int thread_count)
-{
-	TerminalIoInit();
-}
-
 static int
 EmitData(int job_id, int is_stderr, int sort_key, int fd)
 {
@@ -65,203 +78,882 @@ EmitData(int job_id, int is_stderr, int sort_key, int fd)
 	return 0;
 }
 
-ExecResult
-ExecuteProcess(
-		const char* cmd_line,
-		int env_count,
-		const EnvVariable *env_vars,
-		int job_id,
-		int echo_cmdline,
-		const char *annotation)
+#if ENABLED(USE_EXEC_REACTOR)
+/*
+ * A single reactor thread watches the output pipes and the exit of every
+ * running child through epoll and a pidfd, so build threads sleep until
+ * there is something to do rather than polling on a timeout.
+ *
+ * The reactor never writes to the terminal itself, as TerminalIoEmit() can
+ * block until another job is done printing. It reads output into a small
+ * buffer per job which the build thread owning the job passes on. Pipes are
+ * registered one-shot and only rearmed while their buffer has room, so a
+ * chatty child still blocks on a full pipe like it would without us.
+ *
+ * Children started with ExecuteProcessAsync() have no build thread waiting
+ * on them. The reactor keeps all of their output until the child is
+ * finished with, and calls back once the child has exited. Their slots
+ * come after those of the build threads, and so do their job ids.
+ */
+
+enum
 {
-  ExecResult result;
+	kReactorStdout = 0,
+	kReactorStderr = 1,
+	kReactorExit   = 2,
+	kReactorBufferSize = 8192
+};
 
-  result.m_ReturnCode   = 1;
-  result.m_WasSignalled = false;
+struct ExecChild
+{
+	Mutex             m_Lock;
+	ConditionVariable m_Wakeup;
+	pid_t             m_Pid;
+	int               m_PidFd;
+	int               m_Fds[2];
+	bool              m_PipeOpen[2];
+	bool              m_PipeStalled[2];
+	int               m_BufferLen[2];
+	char              m_Buffer[2][kReactorBufferSize];
+	bool              m_Exited;
+	int               m_Status;
+
+	/* Asynchronous children only. The output is a series of ExecOutputChunk
+	 * headers, each followed by its data. */
+	bool              m_Async;
+	bool              m_SpawnFailed;
+	ExecDoneCallback* m_Callback;
+	void*             m_Context;
+	int32_t           m_Id;
+	char*             m_Output;
+	size_t            m_OutputSize;
+	size_t            m_OutputCapacity;
+};
+
+struct ExecOutputChunk
+{
+	int               m_IsStderr;
+	int               m_Length;
+};
 
-	pid_t child;
-	const int pipe_read = 0;
-	const int pipe_write = 1;
+static int        s_EpollFd = -1;
+static ExecChild *s_Children;
+static int        s_ThreadCount;
 
-	/* Create a pair of pipes to read back stdout, stderr */
-	int stdout_pipe[2], stderr_pipe[2];
+/* Free asynchronous slots. */
+static Mutex      s_SlotLock;
+static int       *s_FreeSlots;
+static int        s_FreeSlotCount;
+static int        s_SlotCount;
 
-	if (-1 == pipe(stdout_pipe))
+static uint64_t ReactorKey(int job_id, int kind)
+{
+	return (uint64_t(job_id) << 2) | uint64_t(kind);
+}
+
+static void ReactorWatch(int op, int fd, int job_id, int kind)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof ev);
+	ev.events   = kind == kReactorExit ? EPOLLIN : EPOLLIN | EPOLLONESHOT;
+	ev.data.u64 = ReactorKey(job_id, kind);
+
+	if (-1 == epoll_ctl(s_EpollFd, op, fd, &ev))
+		CroakErrno("epoll_ctl failed for fd %d", fd);
+}
+
+static void ReactorUnwatch(int fd)
+{
+	if (-1 == epoll_ctl(s_EpollFd, EPOLL_CTL_DEL, fd, NULL))
+		CroakErrno("epoll_ctl failed for fd %d", fd);
+}
+
+static void AppendOutput(ExecChild* c, int kind, const char* data, int len)
+{
+	ExecOutputChunk chunk = { kReactorStderr == kind, len };
+	size_t          size  = c->m_OutputSize + sizeof chunk + len;
+
+	if (size > c->m_OutputCapacity)
 	{
-		perror("pipe failed");
-		return result;
+		size_t capacity = c->m_OutputCapacity ? c->m_OutputCapacity : kReactorBufferSize;
+		while (capacity < size)
+			capacity *= 2;
+
+		c->m_Output = (char*) realloc(c->m_Output, capacity);
+		if (!c->m_Output)
+			Croak("out of memory holding %d bytes of child output", int(size));
+		c->m_OutputCapacity = capacity;
 	}
 
-	if (-1 == pipe(stderr_pipe))
+	memcpy(c->m_Output + c->m_OutputSize, &chunk, sizeof chunk);
+	memcpy(c->m_Output + c->m_OutputSize + sizeof chunk, data, len);
+	c->m_OutputSize = size;
+}
+
+/* Called by the reactor with the child locked. */
+static void ReactorReadPipe(ExecChild* c, int job_id, int kind)
+{
+	if (!c->m_PipeOpen[kind] || c->m_Exited)
+		return;
+
+	ssize_t count = read(c->m_Fds[kind], c->m_Buffer[kind] + c->m_BufferLen[kind], kReactorBufferSize - c->m_BufferLen[kind]);
+
+	if (count > 0 && c->m_Async)
 	{
-		perror("pipe failed");
-		close(stdout_pipe[0]);
-		close(stdout_pipe[1]);
-		return result;
+		/* Nobody is around to pass it on yet, so keep all of it. */
+		AppendOutput(c, kind, c->m_Buffer[kind], int(count));
+	}
+	else if (count > 0)
+	{
+		c->m_BufferLen[kind] += int(count);
+		CondSignal(&c->m_Wakeup);
+	}
+	else if (0 == count || EAGAIN != errno)
+	{
+		/* EOF or error; the build thread closes the pipe. */
+		ReactorUnwatch(c->m_Fds[kind]);
+		c->m_PipeOpen[kind] = false;
+		return;
 	}
 
-	if (0 == (child = fork()))
+	if (c->m_BufferLen[kind] < kReactorBufferSize)
+		ReactorWatch(EPOLL_CTL_MOD, c->m_Fds[kind], job_id, kind);
+	else
+		c->m_PipeStalled[kind] = true;
+}
+
+/* Called by the reactor with the child locked. Returns true if the child
+ * has just been reaped. */
+static bool ReactorReapChild(ExecChild* c)
+{
+	if (c->m_Exited || -1 == c->m_PidFd)
+		return false;
+
+	/* The event may be stale if the job has moved on to another child. */
+	if (c->m_Pid != waitpid(c->m_Pid, &c->m_Status, WNOHANG))
+		return false;
+
+	ReactorUnwatch(c->m_PidFd);
+
+	/* Stalled pipes are disarmed, but still registered. */
+	for (int kind = 0; kind < 2; ++kind)
 	{
-		const char *args[] = { "/bin/sh", "-c", cmd_line, NULL };
+		if (c->m_PipeOpen[kind])
+			ReactorUnwatch(c->m_Fds[kind]);
+	}
 
-		close(stdout_pipe[pipe_read]);
-		close(stderr_pipe[pipe_read]);
+	/* Drain what's left in the pipes of an asynchronous child here, for the
+	 * same reasons WaitForChildReactor() does. */
+	for (int kind = 0; c->m_Async && kind < 2; ++kind)
+	{
+		ssize_t count;
+		while (c->m_PipeOpen[kind] && (count = read(c->m_Fds[kind], c->m_Buffer[kind], kReactorBufferSize)) > 0)
+			AppendOutput(c, kind, c->m_Buffer[kind], int(count));
+	}
 
-		if (-1 == dup2(stdout_pipe[pipe_write], STDOUT_FILENO))
-			perror("dup2 failed");
-		if (-1 == dup2(stderr_pipe[pipe_write], STDERR_FILENO))
-			perror("dup2 failed");
+	c->m_Exited = true;
+	CondSignal(&c->m_Wakeup);
+	return true;
+}
 
-		close(stdout_pipe[pipe_write]);
-		close(stderr_pipe[pipe_write]);
+static ThreadRoutineReturnType TUNDRA_STDCALL ExecReactorRoutine(void*)
+{
+	/* Leave SIGINT and friends to the signal handler thread. */
+	SignalBlockThread(true);
 
-		sigset_t sigs;
-		sigfillset(&sigs);
-		if (0 != sigprocmask(SIG_UNBLOCK, &sigs, 0))
-			perror("sigprocmask failed");
+	struct epoll_event events[64];
 
-		for (int i = 0; i < env_count; ++i)
+	for (;;)
+	{
+		int count = epoll_wait(s_EpollFd, events, 64, -1);
+
+		if (-1 == count)
 		{
-			setenv(env_vars[i].m_Name, env_vars[i].m_Value, /*overwrite:*/ 1);
+			if (EINTR == errno)
+				continue;
+			CroakErrno("epoll_wait failed");
 		}
 
-		if (-1 == execv("/bin/sh", (char **) args))
-			exit(1);
-		/* we never get here */
-		abort();
+		for (int i = 0; i < count; ++i)
+		{
+			int        job_id = int(events[i].data.u64 >> 2);
+			int        kind   = int(events[i].data.u64 & 3);
+			ExecChild* c      = &s_Children[job_id];
+
+			bool               done     = false;
+			ExecDoneCallback*  callback = nullptr;
+			void*              context  = nullptr;
+			int32_t            id       = 0;
+
+			MutexLock(&c->m_Lock);
+
+			if (kReactorExit == kind)
+				done = ReactorReapChild(c) && c->m_Async;
+			else
+				ReactorReadPipe(c, job_id, kind);
+
+			if (done)
+			{
+				callback = c->m_Callback;
+				context  = c->m_Context;
+				id       = c->m_Id;
+			}
+
+			MutexUnlock(&c->m_Lock);
+
+			/* Unlocked, as the callback is free to take its own locks. */
+			if (done)
+				callback(context, id, job_id - s_ThreadCount);
+		}
 	}
-	else if (-1 == child)
+
+	return 0;
+}
+
+static void ExecReactorInit(int thread_count, int action_count)
+{
+	/* Make sure pidfds work on this kernel, or stick to polling. */
+	int pidfd = (int) syscall(SYS_pidfd_open, getpid(), 0);
+	if (-1 == pidfd)
+		return;
+	close(pidfd);
+
+	s_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (-1 == s_EpollFd)
+		return;
+
+	s_ThreadCount = thread_count;
+	s_Children    = (ExecChild*) calloc(thread_count + action_count, sizeof s_Children[0]);
+
+	for (int i = 0; i < thread_count + action_count; ++i)
 	{
-		perror("fork failed");
-		close(stdout_pipe[pipe_read]);
-		close(stderr_pipe[pipe_read]);
-		close(stdout_pipe[pipe_write]);
-		close(stderr_pipe[pipe_write]);
-		return result;
+		MutexInit(&s_Children[i].m_Lock);
+		CondInit(&s_Children[i].m_Wakeup);
+		s_Children[i].m_PidFd = -1;
 	}
-	else
+
+	MutexInit(&s_SlotLock);
+	s_FreeSlots     = (int*) calloc(action_count, sizeof s_FreeSlots[0]);
+	s_FreeSlotCount = action_count;
+	s_SlotCount     = action_count;
+
+	for (int i = 0; i < action_count; ++i)
+		s_FreeSlots[i] = action_count - 1 - i;
+
+	/* The reactor lives as long as the process. */
+	ThreadStart(ExecReactorRoutine, nullptr);
+}
+
+/* Hand a child over to the reactor. Called with the child's slot locked. */
+static void ReactorAdopt(ExecChild* c, int job_id, pid_t child, int pidfd, const int rfds[2])
+{
+	c->m_Pid    = child;
+	c->m_PidFd  = pidfd;
+	c->m_Exited = false;
+	c->m_Status = 0;
+
+	for (int kind = 0; kind < 2; ++kind)
 	{
-		pid_t p;
-		int return_code = 0;
-		int sort_key = 0;
-		int rfd_count = 2;
-		int rfds[2];
-		fd_set read_fds;
+		c->m_Fds[kind]         = rfds[kind];
+		c->m_PipeOpen[kind]    = true;
+		c->m_PipeStalled[kind] = false;
+		c->m_BufferLen[kind]   = 0;
+		ReactorWatch(EPOLL_CTL_ADD, rfds[kind], job_id, kind);
+	}
 
-		rfds[0] = stdout_pipe[pipe_read];
-		rfds[1] = stderr_pipe[pipe_read];
+	ReactorWatch(EPOLL_CTL_ADD, pidfd, job_id, kReactorExit);
+}
 
-		SetFdNonBlocking(rfds[0]);
-		SetFdNonBlocking(rfds[1]);
+/* Returns false if the child couldn't be handed to the reactor. */
+static bool
+WaitForChildReactor(pid_t child, const int rfds[2], int job_id, int* return_code)
+{
+	ExecChild* c = &s_Children[job_id];
 
-		/* Close write end of the pipe, we're just going to be reading */
-		close(stdout_pipe[pipe_write]);
-		close(stderr_pipe[pipe_write]);
+	int pidfd = (int) syscall(SYS_pidfd_open, child, 0);
+	if (-1 == pidfd)
+		return false;
 
-		if (annotation)
-			TerminalIoPrintf(job_id, -200, "%s\n", annotation);
+	MutexLock(&c->m_Lock);
 
-		if (echo_cmdline)
-			TerminalIoPrintf(job_id, -199, "%s\n", cmd_line);
+	c->m_Async = false;
+	ReactorAdopt(c, job_id, child, pidfd, rfds);
+
+	int  sort_key = 0;
+	char text[kReactorBufferSize];
 
-		/* Sit in a select loop over the two fds */
+	for (;;)
+	{
+		bool emitted = false;
 
-		for (;;)
+		for (int kind = 0; kind < 2; ++kind)
 		{
-			int fd;
-			int count;
-			int max_fd = 0;
-			struct timeval timeout;
+			int len = c->m_BufferLen[kind];
+
+			if (0 == len)
+				continue;
 
-			/* don't select if we know both pipes are closed */
-			if (rfd_count > 0)
+			memcpy(text, c->m_Buffer[kind], len);
+			c->m_BufferLen[kind] = 0;
+
+			if (c->m_PipeStalled[kind])
 			{
-				FD_ZERO(&read_fds);
+				c->m_PipeStalled[kind] = false;
+				if (!c->m_Exited)
+					ReactorWatch(EPOLL_CTL_MOD, c->m_Fds[kind], job_id, kind);
+			}
+
+			MutexUnlock(&c->m_Lock);
+			TerminalIoEmit(job_id, /*is_stderr:*/ kReactorStderr == kind, sort_key++, text, len);
+			MutexLock(&c->m_Lock);
+
+			emitted = true;
+		}
+
+		if (c->m_Exited)
+			break;
+
+		if (!emitted)
+			CondWait(&c->m_Wakeup, &c->m_Lock);
+	}
+
+	*return_code = c->m_Status;
+	c->m_PidFd   = -1;
+
+	MutexUnlock(&c->m_Lock);
+
+	close(pidfd);
+
+	/* The reactor has let go of the pipes. Anything the child wrote before
+	 * exiting is in them now, so drain them without waiting for EOF, which
+	 * could be held up by a background process that inherited them. */
+	for (int kind = 0; kind < 2; ++kind)
+	{
+		if (!c->m_PipeOpen[kind])
+			continue;
+
+		ssize_t count;
+		while ((count = read(rfds[kind], text, sizeof text)) > 0)
+			TerminalIoEmit(job_id, /*is_stderr:*/ kReactorStderr == kind, sort_key++, text, int(count));
+	}
 
-				for (fd = 0; fd < 2; ++fd)
+	return true;
+}
+#endif
+
+static void SetFdCloseOnExec(int fd)
+{
+	if (-1 == fcntl(fd, F_SETFD, FD_CLOEXEC))
+		CroakErrno("couldn't set close-on-exec on fd %d", fd);
+}
+
+/*
+ * Build the environment for a child up front: our own environment with the
+ * node's variables overriding or adding to it. This used to be done with
+ * setenv() after fork(), which is not an option when spawning.
+ *
+ * Returns a single malloc()ed block holding both the pointer array and the
+ * strings for the node's variables.
+ */
+static char**
+BuildEnvironment(int env_count, const EnvVariable* env_vars)
+{
+	size_t inherited_count = 0;
+	size_t string_bytes = 0;
+
+	while (environ[inherited_count])
+		++inherited_count;
+
+	for (int i = 0; i < env_count; ++i)
+		string_bytes += strlen(env_vars[i].m_Name) + strlen(env_vars[i].m_Value) + 2;
+
+	size_t pointer_bytes = (inherited_count + env_count + 1) * sizeof(char*);
+	char** envp = (char**) malloc(pointer_bytes + string_bytes);
+	char* strings = (char*) envp + pointer_bytes;
+	size_t count = 0;
+
+	if (!envp)
+		Croak("out of memory building environment for %d variables", env_count);
+
+	for (size_t i = 0; i < inherited_count; ++i)
+	{
+		const char* var = environ[i];
+		const char* eq = strchr(var, '=');
+		size_t name_len = eq ? size_t(eq - var) : strlen(var);
+		bool overridden = false;
+
+		for (int k = 0; !overridden && k < env_count; ++k)
+			overridden = 0 == strncmp(env_vars[k].m_Name, var, name_len) && '\0' == env_vars[k].m_Name[name_len];
+
+		if (!overridden)
+			envp[count++] = (char*) var;
+	}
+
+	for (int i = 0; i < env_count; ++i)
+	{
+		/* Like repeated setenv() calls, the last setting of a name wins. */
+		bool superseded = false;
+		for (int k = i + 1; !superseded && k < env_count; ++k)
+			superseded = 0 == strcmp(env_vars[i].m_Name, env_vars[k].m_Name);
+
+		if (superseded)
+			continue;
+
+		envp[count++] = strings;
+		strings += sprintf(strings, "%s=%s", env_vars[i].m_Name, env_vars[i].m_Value) + 1;
+	}
+
+	envp[count] = NULL;
+	return envp;
+}
+
+/*
+ * Start a program with stdout and stderr going to the given pipes, looking
+ * it up in PATH if needed. posix_spawn() avoids copying our page tables the
+ * way fork() would, which gets expensive with a large DAG and caches mapped
+ * in.
+ *
+ * Returns 0 or an error number.
+ */
+static int
+SpawnProcess(pid_t* child, const char* const* args, char** envp, int stdout_fd, int stderr_fd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	int error;
+
+	if (0 != (error = posix_spawn_file_actions_init(&actions)))
+		return error;
+
+	if (0 != (error = posix_spawnattr_init(&attr)))
+	{
+		posix_spawn_file_actions_destroy(&actions);
+		return error;
+	}
+
+	posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, stderr_fd, STDERR_FILENO);
+
+	/* Build threads block signals; don't pass that on to the child. */
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+
+	/* A build server ignores these, which the child would inherit. */
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	if (strchr(args[0], '/'))
+		error = posix_spawn(child, args[0], &actions, &attr, (char**) args, envp);
+	else
+		error = posix_spawnp(child, args[0], &actions, &attr, (char**) args, envp);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	return error;
+}
+
+void ExecInit(int thread_count, int action_count)
+{
+	TerminalIoInit();
+
+#if ENABLED(USE_EXEC_REACTOR)
+	ExecReactorInit(thread_count, action_count);
+#endif
+}
+
+int ExecAsyncSlotCount()
+{
+#if ENABLED(USE_EXEC_REACTOR)
+	return s_Children ? s_SlotCount : 0;
+#else
+	return 0;
+#endif
+}
+
+static int
+WaitForChildPolling(pid_t child, int rfds[2], int job_id)
+{
+	pid_t p;
+	int return_code = 0;
+	int sort_key = 0;
+	int rfd_count = 2;
+	fd_set read_fds;
+
+	/* Sit in a select loop over the two fds */
+
+	for (;;)
+	{
+		int fd;
+		int count;
+		int max_fd = 0;
+		struct timeval timeout;
+
+		/* don't select if we know both pipes are closed */
+		if (rfd_count > 0)
+		{
+			FD_ZERO(&read_fds);
+
+			for (fd = 0; fd < 2; ++fd)
+			{
+				if (rfds[fd])
 				{
-					if (rfds[fd])
-					{
-						if (rfds[fd] > max_fd)
-							max_fd = rfds[fd];
-						FD_SET(rfds[fd], &read_fds);
-					}
+					if (rfds[fd] > max_fd)
+						max_fd = rfds[fd];
+					FD_SET(rfds[fd], &read_fds);
 				}
+			}
 
-				++max_fd;
+			++max_fd;
 
-				timeout.tv_sec = 0;
-				timeout.tv_usec = 500000;
+			timeout.tv_sec = 0;
+			timeout.tv_usec = 500000;
 
-				count = select(max_fd, &read_fds, NULL, NULL, &timeout);
+			count = select(max_fd, &read_fds, NULL, NULL, &timeout);
 
-				if (-1 == count) // happens in gdb due to syscall interruption
-					continue;
+			if (-1 == count) // happens in gdb due to syscall interruption
+				continue;
 
-				for (fd = 0; fd < 2; ++fd)
+			for (fd = 0; fd < 2; ++fd)
+			{
+				if (0 != rfds[fd] && FD_ISSET(rfds[fd], &read_fds))
 				{
-					if (0 != rfds[fd] && FD_ISSET(rfds[fd], &read_fds))
+					if (0 != EmitData(job_id, /*is_stderr:*/ 1 == fd, sort_key++, rfds[fd]))
 					{
-						if (0 != EmitData(job_id, /*is_stderr:*/ 1 == fd, sort_key++, rfds[fd]))
-						{
-							/* Done with this FD. */
-							rfds[fd] = 0;
-							--rfd_count;
-						}
+						/* Done with this FD. */
+						rfds[fd] = 0;
+						--rfd_count;
 					}
 				}
 			}
+		}
 
-			return_code = 0;
-			p = waitpid(child, &return_code, rfd_count > 0 ? WNOHANG : 0);
+		return_code = 0;
+		p = waitpid(child, &return_code, rfd_count > 0 ? WNOHANG : 0);
 
-			if (0 == p)
-			{
-				/* child still running */
-				continue;
-			}
-			else if (p != child)
-			{
-				return_code = 1;
-				perror("waitpid failed");
-				break;
-			}
-			else
-			{
-				/* fall out of the loop here - process has exited. */
-				/* FIXME - is there a race between getting the last data out of
-				 * the pipes vs quitting here? Probably there is. But it seems
-				 * to work well in practice. If I put a blocking waitpid()
-				 * after the loop I got deadlocks on Mac OS X in select. */
-				break;
-			}
+		if (0 == p)
+		{
+			/* child still running */
+			continue;
 		}
+		else if (p != child)
+		{
+			return_code = 1;
+			perror("waitpid failed");
+			break;
+		}
+		else
+		{
+			/* fall out of the loop here - process has exited. */
+			/* FIXME - is there a race between getting the last data out of
+			 * the pipes vs quitting here? Probably there is. But it seems
+			 * to work well in practice. If I put a blocking waitpid()
+			 * after the loop I got deadlocks on Mac OS X in select. */
+			break;
+		}
+	}
 
+	return return_code;
+}
+
+/*
+ * Start a child with its stdout and stderr going to pipes, and hand back the
+ * non-blocking read ends of those. Returns false if it couldn't be started,
+ * after saying why.
+ */
+static bool
+StartChild(
+		const char* cmd_line,
+		const char* const* args,
+		int env_count,
+		const EnvVariable *env_vars,
+		pid_t* child,
+		int rfds[2])
+{
+	const int pipe_read = 0;
+	const int pipe_write = 1;
+
+	/* Create a pair of pipes to read back stdout, stderr */
+	int stdout_pipe[2], stderr_pipe[2];
+
+	if (-1 == pipe(stdout_pipe))
+	{
+		perror("pipe failed");
+		return false;
+	}
+
+	if (-1 == pipe(stderr_pipe))
+	{
+		perror("pipe failed");
+		close(stdout_pipe[0]);
+		close(stdout_pipe[1]);
+		return false;
+	}
+
+	/* Keep our ends of the pipes out of other children. The spawn dups the
+	 * write ends onto stdout/stderr, which clears the flag on those. */
+	for (int i = 0; i < 2; ++i)
+	{
+		SetFdCloseOnExec(stdout_pipe[i]);
+		SetFdCloseOnExec(stderr_pipe[i]);
+	}
+
+	char** envp = BuildEnvironment(env_count, env_vars);
+
+	/* posix_spawnp() searches our PATH, not the one in the child's environment. */
+	for (int i = 0; args && i < env_count; ++i)
+	{
+		if (0 == strcmp(env_vars[i].m_Name, "PATH") && !strchr(args[0], '/'))
+			args = NULL;
+	}
+
+	int spawn_error = ENOENT;
+
+	if (args)
+		spawn_error = SpawnProcess(child, args, envp, stdout_pipe[pipe_write], stderr_pipe[pipe_write]);
+
+	/* Without a shell, or if running the program directly failed, let the
+	 * shell run it and report any problems the way it usually does. */
+	if (0 != spawn_error)
+	{
+		const char *shell_args[] = { "/bin/sh", "-c", cmd_line, NULL };
+		spawn_error = SpawnProcess(child, shell_args, envp, stdout_pipe[pipe_write], stderr_pipe[pipe_write]);
+	}
+
+	free(envp);
+
+	/* Close write end of the pipe, we're just going to be reading */
+	close(stdout_pipe[pipe_write]);
+	close(stderr_pipe[pipe_write]);
+
+	if (0 != spawn_error)
+	{
+		errno = spawn_error;
+		perror("posix_spawn failed");
 		close(stdout_pipe[pipe_read]);
 		close(stderr_pipe[pipe_read]);
+		return false;
+	}
+
+	rfds[0] = stdout_pipe[pipe_read];
+	rfds[1] = stderr_pipe[pipe_read];
 
-		if (WIFSIGNALED(return_code))
-    {
-			result.m_ReturnCode   = 1;
-			result.m_WasSignalled = true;
+	SetFdNonBlocking(rfds[0]);
+	SetFdNonBlocking(rfds[1]);
 
-			int sig = WTERMSIG(return_code);
-			TerminalIoPrintf(job_id, INT_MAX, "child process exited on signal %d: %s\n", sig, cmd_line);
+	return true;
+}
+
+/* Say how the child went, and let the next job have the tty. */
+static ExecResult
+ReportExit(int job_id, int return_code, const char* cmd_line, int echo_cmdline)
+{
+	ExecResult result;
+
+	if (WIFSIGNALED(return_code))
+	{
+		result.m_ReturnCode   = 1;
+		result.m_WasSignalled = true;
+
+		int sig = WTERMSIG(return_code);
+		TerminalIoPrintf(job_id, INT_MAX, "child process exited on signal %d: %s\n", sig, cmd_line);
+	}
+	else
+	{
+		result.m_ReturnCode   = WEXITSTATUS(return_code);
+		result.m_WasSignalled = false;
+
+		if (0 != result.m_ReturnCode && !echo_cmdline)
+		{
+			TerminalIoPrintf(job_id, INT_MAX, "child process failed with exit code %d: %s\n", result.m_ReturnCode, cmd_line);
 		}
-		else
-    {
-			result.m_ReturnCode   = WEXITSTATUS(return_code);
+	}
 
-			if (0 != result.m_ReturnCode && !echo_cmdline)
-			{
-				TerminalIoPrintf(job_id, INT_MAX, "child process failed with exit code %d: %s\n", result.m_ReturnCode, cmd_line);
-			}
-    }
+	TerminalIoJobExit(job_id);
 
-		TerminalIoJobExit(job_id);
+	return result;
+}
+
+ExecResult
+ExecuteProcess(
+		const char* cmd_line,
+		const char* const* args,
+		int env_count,
+		const EnvVariable *env_vars,
+		int job_id,
+		int echo_cmdline,
+		const char *annotation)
+{
+	ExecResult result;
 
+	result.m_ReturnCode   = 1;
+	result.m_WasSignalled = false;
+
+	pid_t child;
+	int   rfds[2];
+
+	if (!StartChild(cmd_line, args, env_count, env_vars, &child, rfds))
 		return result;
+
+	int return_code = 0;
+
+	if (annotation)
+		TerminalIoPrintf(job_id, -200, "%s\n", annotation);
+
+	if (echo_cmdline)
+		TerminalIoPrintf(job_id, -199, "%s\n", cmd_line);
+
+#if ENABLED(USE_EXEC_REACTOR)
+	if (!s_Children || !WaitForChildReactor(child, rfds, job_id, &return_code))
+		return_code = WaitForChildPolling(child, rfds, job_id);
+#else
+	return_code = WaitForChildPolling(child, rfds, job_id);
+#endif
+
+	close(rfds[0]);
+	close(rfds[1]);
+
+	return ReportExit(job_id, return_code, cmd_line, echo_cmdline);
+}
+
+int
+ExecuteProcessAsync(
+		const char* cmd_line,
+		const char* const* args,
+		int env_count,
+		const EnvVariable *env_vars,
+		ExecDoneCallback* callback,
+		void* context,
+		int32_t id)
+{
+#if ENABLED(USE_EXEC_REACTOR)
+	if (!s_Children)
+		return -1;
+
+	int slot = -1;
+
+	MutexLock(&s_SlotLock);
+	if (s_FreeSlotCount > 0)
+		slot = s_FreeSlots[--s_FreeSlotCount];
+	MutexUnlock(&s_SlotLock);
+
+	if (slot < 0)
+		return -1;
+
+	int        job_id  = s_ThreadCount + slot;
+	ExecChild* c       = &s_Children[job_id];
+	pid_t      child   = 0;
+	int        rfds[2] = { -1, -1 };
+	int        pidfd   = -1;
+	bool       started = StartChild(cmd_line, args, env_count, env_vars, &child, rfds);
+
+	if (started && -1 == (pidfd = (int) syscall(SYS_pidfd_open, child, 0)))
+	{
+		/* We can't watch this one, so wait for it here. Its output goes
+		 * straight to the tty rather than being held back. */
+		c->m_Status = WaitForChildPolling(child, rfds, job_id);
+	}
+
+	MutexLock(&c->m_Lock);
+
+	c->m_Async       = true;
+	c->m_SpawnFailed = !started;
+	c->m_Callback    = callback;
+	c->m_Context     = context;
+	c->m_Id          = id;
+	c->m_OutputSize  = 0;
+
+	if (-1 != pidfd)
+	{
+		ReactorAdopt(c, job_id, child, pidfd, rfds);
 	}
+	else
+	{
+		c->m_Pid         = child;
+		c->m_Fds[0]      = rfds[0];
+		c->m_Fds[1]      = rfds[1];
+		c->m_PipeOpen[0] = false;
+		c->m_PipeOpen[1] = false;
+		c->m_Exited      = true;
+	}
+
+	MutexUnlock(&c->m_Lock);
+
+	/* It's over already; let the caller know the way the reactor would. */
+	if (-1 == pidfd)
+		callback(context, id, slot);
+
+	return slot;
+#else
+	return -1;
+#endif
+}
+
+ExecResult
+ExecFinishAsync(int slot, const char* cmd_line, int echo_cmdline, const char* annotation)
+{
+#if ENABLED(USE_EXEC_REACTOR)
+	ExecResult result;
+
+	result.m_ReturnCode   = 1;
+	result.m_WasSignalled = false;
+
+	int        job_id = s_ThreadCount + slot;
+	ExecChild* c      = &s_Children[job_id];
+
+	/* The reactor is done with the child, but the lock makes sure we see
+	 * everything it did. */
+	MutexLock(&c->m_Lock);
+	CHECK(c->m_Async && c->m_Exited);
+	MutexUnlock(&c->m_Lock);
+
+	if (-1 != c->m_PidFd)
+	{
+		close(c->m_PidFd);
+		c->m_PidFd = -1;
+	}
+
+	if (!c->m_SpawnFailed)
+	{
+		close(c->m_Fds[0]);
+		close(c->m_Fds[1]);
+
+		if (annotation)
+			TerminalIoPrintf(job_id, -200, "%s\n", annotation);
+
+		if (echo_cmdline)
+			TerminalIoPrintf(job_id, -199, "%s\n", cmd_line);
+
+		int sort_key = 0;
+
+		for (size_t pos = 0; pos < c->m_OutputSize; )
+		{
+			ExecOutputChunk chunk;
+			memcpy(&chunk, c->m_Output + pos, sizeof chunk);
+			pos += sizeof chunk;
+
+			TerminalIoEmit(job_id, chunk.m_IsStderr, sort_key++, c->m_Output + pos, chunk.m_Length);
+			pos += chunk.m_Length;
+		}
+
+		result = ReportExit(job_id, c->m_Status, cmd_line, echo_cmdline);
+	}
+
+	c->m_Async      = false;
+	c->m_OutputSize = 0;
+
+	MutexLock(&s_SlotLock);
+	s_FreeSlots[s_FreeSlotCount++] = slot;
+	MutexUnlock(&s_SlotLock);
+
+	return result;
+#else
+	Croak("no asynchronous process in slot %d", slot);
+#endif
 }
 
 }
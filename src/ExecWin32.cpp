@@ -176,7 +176,7 @@ static char UTF8_WindowsEnvironment[128*1024];
 
 static size_t g_Win32EnvCount;
 
-void ExecInit(int thread_count)
+void ExecInit(int thread_count, int action_count)
 {
   s_TempFiles = (HANDLE*) calloc(thread_count, sizeof s_TempFiles[0]);
   s_TundraPid = GetCurrentProcessId();
@@ -435,6 +435,7 @@ static int Win32Spawn(int job_id, const char *cmd_line, const EnvVariable *env_v
 
 ExecResult ExecuteProcess(
       const char*         cmd_line,
+      const char* const*  args,
       int                 env_count,
       const EnvVariable*  env_vars,
       int                 job_id,
@@ -596,6 +597,29 @@ ExecResult ExecuteProcess(
   }
 }
 
+// Every process runs on the build thread that started it here.
+int ExecAsyncSlotCount()
+{
+  return 0;
+}
+
+int ExecuteProcessAsync(
+    const char* cmd_line,
+    const char* const* args,
+    int env_count,
+    const EnvVariable *env_vars,
+    ExecDoneCallback* callback,
+    void* context,
+    int32_t id)
+{
+  return -1;
+}
+
+ExecResult ExecFinishAsync(int slot, const char* cmd_line, int echo_cmdline, const char* annotation)
+{
+  Croak("no asynchronous process in slot %d", slot);
+}
+
 }
 
 #endif /* TUNDRA_WIN32 */
@@ -41,7 +41,18 @@ FileInfo GetFileInfo(const char* path)
 #endif
 
 #if defined(TUNDRA_UNIX)
-  if (0 == stat(path, &stbuf))
+  // Only symlinks need a second call. The file watcher can't trust them, as
+  // their targets can change without anything happening where they are.
+  uint32_t link_flag = 0;
+  int      rc        = lstat(path, &stbuf);
+
+  if (0 == rc && S_ISLNK(stbuf.st_mode))
+  {
+    link_flag = FileInfo::kFlagSymlink;
+    rc        = stat(path, &stbuf);
+  }
+
+  if (0 == rc)
 #elif defined(TUNDRA_WIN32_MINGW)
   if (0 == _stat64(path, &stbuf))
 #elif defined(TUNDRA_WIN32)
@@ -50,20 +61,39 @@ FileInfo GetFileInfo(const char* path)
   {
     uint32_t flags = FileInfo::kFlagExists;
 
+#if defined(TUNDRA_UNIX)
+    flags |= link_flag;
+#endif
+
     if ((stbuf.st_mode & S_IFMT) == S_IFDIR)
       flags |= FileInfo::kFlagDirectory;
     else if ((stbuf.st_mode & S_IFMT) == S_IFREG)
       flags |= FileInfo::kFlagFile;
 
-    result.m_Flags     = flags;
-    result.m_Timestamp = stbuf.st_mtime;
-    result.m_Size      = stbuf.st_size;
+    result.m_Flags       = flags;
+    result.m_Timestamp   = stbuf.st_mtime;
+    result.m_Size        = stbuf.st_size;
+#if defined(TUNDRA_UNIX)
+#if defined(TUNDRA_APPLE)
+    const struct timespec& ctime = stbuf.st_ctimespec;
+#else
+    const struct timespec& ctime = stbuf.st_ctim;
+#endif
+    result.m_ChangeStamp = (uint64_t(ctime.tv_sec) * 1000000000 + uint64_t(ctime.tv_nsec)) ^
+                           (uint64_t(stbuf.st_ino) * 0x9e3779b97f4a7c15ull) ^ (uint64_t(stbuf.st_dev) << 40);
+#else
+    result.m_ChangeStamp = stbuf.st_ctime;
+#endif
   }
   else
   {
     result.m_Flags     = errno == ENOENT ? 0 : FileInfo::kFlagError;
-    result.m_Timestamp = 0;
-    result.m_Size      = 0;
+#if defined(TUNDRA_UNIX)
+    result.m_Flags    |= link_flag;
+#endif
+    result.m_Timestamp   = 0;
+    result.m_Size        = 0;
+    result.m_ChangeStamp = 0;
   }
 
   return result;
@@ -101,6 +131,47 @@ bool ShouldFilter(const char* name, size_t len)
   return false;
 }
 
+#if defined(TUNDRA_WIN32)
+// Pattern matching everything in a directory, for FindFirstFile().
+static void GetFindPattern(char (&scan_path)[MAX_PATH], const char* path)
+{
+  _snprintf(scan_path, MAX_PATH, "%s/*", path);
+  scan_path[MAX_PATH - 1] = '\0';
+
+  for (int i = 0; i < MAX_PATH; ++i)
+  {
+    char ch = scan_path[i];
+    if ('/' == ch)
+      scan_path[i] = '\\';
+    else if ('\0' == ch)
+      break;
+  }
+}
+
+static FileInfo FileInfoFromFindData(const WIN32_FIND_DATAA& find_data)
+{
+  static const uint64_t kEpochDiff = 0x019DB1DED53E8000LL; // 116444736000000000 nsecs
+  static const uint64_t kRateDiff = 10000000; // 100 nsecs
+
+  uint64_t ft = uint64_t(find_data.ftLastWriteTime.dwHighDateTime) << 32 | find_data.ftLastWriteTime.dwLowDateTime;
+  uint64_t ct = uint64_t(find_data.ftCreationTime.dwHighDateTime) << 32 | find_data.ftCreationTime.dwLowDateTime;
+
+  // Matches what _stat64() gives, which is the creation time in st_ctime.
+  FileInfo info;
+  info.m_Flags       = FileInfo::kFlagExists;
+  info.m_Size        = uint64_t(find_data.nFileSizeHigh) << 32 | find_data.nFileSizeLow;
+  info.m_Timestamp   = (ft - kEpochDiff) / kRateDiff;
+  info.m_ChangeStamp = (ct - kEpochDiff) / kRateDiff;
+
+  if (FILE_ATTRIBUTE_DIRECTORY & find_data.dwFileAttributes)
+    info.m_Flags |= FileInfo::kFlagDirectory;
+  else
+    info.m_Flags |= FileInfo::kFlagFile;
+
+  return info;
+}
+#endif
+
 void ListDirectory(
     const char* path,
     void* user_data,
@@ -153,16 +224,7 @@ void ListDirectory(
 	WIN32_FIND_DATAA find_data;
 	char             scan_path[MAX_PATH];
 
-	_snprintf(scan_path, sizeof(scan_path), "%s/*", path);
-
-	for (int i = 0; i < MAX_PATH; ++i)
-	{
-		char ch = scan_path[i];
-		if ('/' == ch)
-			scan_path[i] = '\\';
-		else if ('\0' == ch)
-			break;
-	}
+	GetFindPattern(scan_path, path);
 
 	HANDLE h = FindFirstFileA(scan_path, &find_data);
 
@@ -177,27 +239,78 @@ void ListDirectory(
     if (ShouldFilter(find_data.cFileName, strlen(find_data.cFileName)))
       continue;
 
-    static const uint64_t kEpochDiff = 0x019DB1DED53E8000LL; // 116444736000000000 nsecs
-    static const uint64_t kRateDiff = 10000000; // 100 nsecs
+    (*callback)(user_data, FileInfoFromFindData(find_data), find_data.cFileName);
 
-    uint64_t ft = uint64_t(find_data.ftLastWriteTime.dwHighDateTime) << 32 | find_data.ftLastWriteTime.dwLowDateTime;
+	} while (FindNextFileA(h, &find_data));
 
-    FileInfo info;
-    info.m_Flags     = FileInfo::kFlagExists;
-    info.m_Size      = uint64_t(find_data.nFileSizeHigh) << 32 | find_data.nFileSizeLow;
-    info.m_Timestamp = (ft - kEpochDiff) / kRateDiff;
+	if (!FindClose(h))
+		CroakErrno("couldn't close FindFile handle");
+#endif
+}
 
-    if (FILE_ATTRIBUTE_DIRECTORY & find_data.dwFileAttributes)
-      info.m_Flags |= FileInfo::kFlagDirectory;
-    else
-      info.m_Flags |= FileInfo::kFlagFile;
+bool ListDirectoryNames(
+    const char* path,
+    void* user_data,
+    void (*callback)(void* user_data, const char* name, const FileInfo* info))
+{
+  TimingScope timing_scope(&g_Stats.m_StatCount, &g_Stats.m_StatTimeCycles);
 
-    (*callback)(user_data, info, find_data.cFileName);
+#if defined(TUNDRA_UNIX)
+  DIR* dir = opendir(path);
 
-	} while (FindNextFileA(h, &find_data));
+  if (!dir)
+    return ENOENT == errno || ENOTDIR == errno;
 
-	if (!FindClose(h))
-		CroakErrno("couldn't close FindFile handle");
+  // The DIR is private to this call, so readdir() is safe to use from
+  // several threads at once.
+  while (struct dirent* entry = readdir(dir))
+  {
+    const char* name = entry->d_name;
+
+    if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2])))
+      continue;
+
+    (*callback)(user_data, name, nullptr);
+  }
+
+  closedir(dir);
+  return true;
+
+#else
+  WIN32_FIND_DATAA find_data;
+  char             scan_path[MAX_PATH];
+
+  GetFindPattern(scan_path, path);
+
+  HANDLE h = FindFirstFileA(scan_path, &find_data);
+
+  if (INVALID_HANDLE_VALUE == h)
+  {
+    DWORD error = GetLastError();
+    return ERROR_FILE_NOT_FOUND == error || ERROR_PATH_NOT_FOUND == error || ERROR_DIRECTORY == error;
+  }
+
+  do
+  {
+    const char* name = find_data.cFileName;
+
+    if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2])))
+      continue;
+
+    // Reparse points describe the link rather than what it points to.
+    if (FILE_ATTRIBUTE_REPARSE_POINT & find_data.dwFileAttributes)
+    {
+      (*callback)(user_data, name, nullptr);
+      continue;
+    }
+
+    FileInfo info = FileInfoFromFindData(find_data);
+    (*callback)(user_data, name, &info);
+
+  } while (FindNextFileA(h, &find_data));
+
+  FindClose(h);
+  return true;
 #endif
 }
 
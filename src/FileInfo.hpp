@@ -14,12 +14,16 @@ struct FileInfo
     kFlagError        = 1 << 1,
     kFlagFile         = 1 << 2,
     kFlagDirectory    = 1 << 3,
+    kFlagSymlink      = 1 << 4,  // path is a symlink; the rest describes its target
     kFlagDirty        = 1 << 30  // used by stat cache
   };
 
   uint32_t      m_Flags;
   uint64_t      m_Size;
   uint64_t      m_Timestamp;
+  // Identity and change time of the file, mixed together. Anything that
+  // writes to the file changes it, even within the timestamp's resolution.
+  uint64_t      m_ChangeStamp;
 
   bool Exists()      const { return 0 != (kFlagExists & m_Flags); }
   bool IsFile()      const { return 0 != (kFlagFile & m_Flags); }
@@ -36,6 +40,15 @@ void ListDirectory(
     void* user_data,
     void (*callback)(void* user_data, const FileInfo& info, const char* path));
 
+// List every name in a directory, without filtering or statting anything.
+// Where listing the directory tells what a stat would have, it is passed
+// along; otherwise info is null. A directory that doesn't exist is listed as
+// empty. Returns false if the directory couldn't be read.
+bool ListDirectoryNames(
+    const char* dir,
+    void* user_data,
+    void (*callback)(void* user_data, const char* name, const FileInfo* info));
+
 }
 
 #endif
@@ -4,50 +4,107 @@
 #include "Stats.hpp"
 #include "DigestCache.hpp"
 #include "Buffer.hpp"
+#include "MemoryMappedFile.hpp"
 #include <stdio.h>
 
 namespace t2
 {
 
-static void ComputeFileSignatureSha1(HashState* state, StatCache* stat_cache, DigestCache* digest_cache, const char* filename, uint32_t fn_hash)
+enum
 {
-  FileInfo file_info = StatCacheStat(stat_cache, filename, fn_hash);
+  // Files at least this big are hashed straight from a mapping of the file.
+  kDigestMmapThreshold = 256 * 1024,
+  kDigestReadSize      = 64 * 1024
+};
 
-  if (!file_info.Exists())
-  {
-    HashAddInteger(state, ~0ull);
-    return;
-  }
+static bool HashFileContents(const char* filename, uint64_t size, HashDigest* digest_out)
+{
+  TimingScope timing_scope(&g_Stats.m_FileDigestCount, &g_Stats.m_FileDigestTimeCycles);
 
-  HashDigest digest;
+  HashState h;
+  HashInit(&h);
 
-  if (!DigestCacheGet(digest_cache, filename, fn_hash, file_info.m_Timestamp, &digest))
+  if (size >= kDigestMmapThreshold)
   {
-    TimingScope timing_scope(&g_Stats.m_FileDigestCount, &g_Stats.m_FileDigestTimeCycles);
+    MemoryMappedFile mapping;
+    MmapFileInit(&mapping);
+    MmapFileMap(&mapping, filename);
+
+    bool mapped = MmapFileValid(&mapping);
 
-    FILE* f = fopen(filename, "rb");
-    if (!f)
+    if (mapped)
     {
-      HashAddString(state, "<missing>");
-      return;
+      HashUpdate(&h, mapping.m_Address, mapping.m_Size);
+      MmapFileUnmap(&mapping);
     }
 
-    HashState h;
-    HashInit(&h);
+    MmapFileDestroy(&mapping);
 
-    char buffer[8192];
-    while (size_t nbytes = fread(buffer, 1, sizeof buffer, f))
+    if (mapped)
     {
-      HashUpdate(&h, buffer, nbytes);
+      HashFinalize(&h, digest_out);
+      return true;
     }
-    fclose(f);
 
-    HashFinalize(&h, &digest);
-    DigestCacheSet(digest_cache, filename, fn_hash, file_info.m_Timestamp, digest);
+    // Fall back to reading it.
   }
-  else
+
+  FILE* f = fopen(filename, "rb");
+  if (!f)
+    return false;
+
+  char buffer[kDigestReadSize];
+  while (size_t nbytes = fread(buffer, 1, sizeof buffer, f))
+  {
+    HashUpdate(&h, buffer, nbytes);
+  }
+  fclose(f);
+
+  HashFinalize(&h, digest_out);
+  return true;
+}
+
+static bool ComputeFileDigest(DigestCache* digest_cache, const char* filename, uint32_t fn_hash, const FileInfo& info, HashDigest* digest_out)
+{
+  // Another thread hashing the same file puts its digest in the cache, so
+  // look again after waiting for it.
+  for (;;)
   {
-    AtomicIncrement(&g_Stats.m_DigestCacheHits);
+    if (DigestCacheGet(digest_cache, filename, fn_hash, info, digest_out))
+    {
+      AtomicIncrement(&g_Stats.m_DigestCacheHits);
+      return true;
+    }
+
+    if (DigestCacheBeginHashing(digest_cache, filename, fn_hash))
+      break;
+  }
+
+  bool result = HashFileContents(filename, info.m_Size, digest_out);
+
+  if (result)
+    DigestCacheSet(digest_cache, filename, fn_hash, info, *digest_out);
+
+  DigestCacheEndHashing(digest_cache, filename, fn_hash);
+  return result;
+}
+
+static void ComputeFileSignatureSha1(HashState* state, StatCache* stat_cache, DigestCache* digest_cache, const char* filename, uint32_t fn_hash)
+{
+  FileInfo file_info = StatCacheStat(stat_cache, filename, fn_hash);
+
+  if (!file_info.Exists())
+  {
+    HashAddInteger(state, ~0ull);
+    return;
+  }
+
+  HashDigest digest;
+
+  if (!ComputeFileDigest(digest_cache, filename, fn_hash, file_info, &digest))
+  {
+    HashAddString(state, "<missing>");
+    return;
   }
 
   HashUpdate(state, &digest, sizeof(digest));
@@ -63,29 +120,60 @@ static bool ComputeFileSignatureTimestamp(HashState* out, StatCache* stat_cache,
   return false;
 }
 
-void ComputeFileSignature(
-  HashState*          out,
-  StatCache*          stat_cache,
-  DigestCache*        digest_cache,
+bool IsSignedByContent(
   const char*         filename,
   uint32_t            fn_hash,
   const uint32_t      sha_extension_hashes[],
-  int                 sha_extension_hash_count)
+  int                 sha_extension_hash_count,
+  HashSet<kFlagPathStrings>* content_digest_files,
+  bool                sign_by_content)
 {
+  if (sign_by_content || (content_digest_files && HashSetLookup(content_digest_files, fn_hash, filename)))
+    return true;
+
   if (const char* ext = strrchr(filename, '.'))
   {
     uint32_t ext_hash = Djb2Hash(ext);
     for (int i  = 0; i < sha_extension_hash_count; ++i)
     {
       if (sha_extension_hashes[i] == ext_hash)
-      {
-        ComputeFileSignatureSha1(out, stat_cache, digest_cache, filename, fn_hash);
-        return;
-      }
+        return true;
     }
   }
 
-  ComputeFileSignatureTimestamp(out, stat_cache, filename, fn_hash);
+  return false;
+}
+
+void ComputeFileSignature(
+  HashState*          out,
+  StatCache*          stat_cache,
+  DigestCache*        digest_cache,
+  const char*         filename,
+  uint32_t            fn_hash,
+  const uint32_t      sha_extension_hashes[],
+  int                 sha_extension_hash_count,
+  HashSet<kFlagPathStrings>* content_digest_files,
+  bool                sign_by_content)
+{
+  if (IsSignedByContent(filename, fn_hash, sha_extension_hashes, sha_extension_hash_count, content_digest_files, sign_by_content))
+    ComputeFileSignatureSha1(out, stat_cache, digest_cache, filename, fn_hash);
+  else
+    ComputeFileSignatureTimestamp(out, stat_cache, filename, fn_hash);
+}
+
+bool ComputeFileContentDigest(
+  StatCache*          stat_cache,
+  DigestCache*        digest_cache,
+  const char*         filename,
+  uint32_t            fn_hash,
+  HashDigest*         digest_out)
+{
+  FileInfo file_info = StatCacheStat(stat_cache, filename, fn_hash);
+
+  if (!file_info.Exists())
+    return false;
+
+  return ComputeFileDigest(digest_cache, filename, fn_hash, file_info, digest_out);
 }
 
 t2::HashDigest CalculateGlobSignatureFor(const char* path, t2::MemAllocHeap* heap, t2::MemAllocLinear* scratch)
@@ -3,6 +3,7 @@
 
 #include "Common.hpp"
 #include "Hash.hpp"
+#include "HashTable.hpp"
 
 namespace t2
 {
@@ -13,6 +14,15 @@ struct DigestCache;
 struct MemAllocHeap;
 struct MemAllocLinear;
 
+// Whether a file's signature is its content digest rather than its timestamp.
+bool IsSignedByContent(
+  const char*         filename,
+  uint32_t            fn_hash,
+  const uint32_t      sha_extension_hashes[],
+  int                 sha_extension_hash_count,
+  HashSet<kFlagPathStrings>* content_digest_files,
+  bool                sign_by_content);
+
 void ComputeFileSignature(
   HashState*          out,                  // out
   StatCache*          stat_cache,
@@ -20,7 +30,18 @@ void ComputeFileSignature(
   const char*         filename,
   uint32_t            fn_hash,
   const uint32_t      sha_extension_hashes[],
-  int                 sha_extension_hash_count);
+  int                 sha_extension_hash_count,
+  HashSet<kFlagPathStrings>* content_digest_files,  // Always signed by content, may be null
+  bool                sign_by_content);     // Sign every file by content
+
+// Get the SHA-1 digest of a file's contents, going through the digest cache.
+// Returns false if the file doesn't exist or can't be read.
+bool ComputeFileContentDigest(
+  StatCache*          stat_cache,
+  DigestCache*        digest_cache,
+  const char*         filename,
+  uint32_t            fn_hash,
+  HashDigest*         digest_out);  // out
 
   HashDigest CalculateGlobSignatureFor(const char* path, MemAllocHeap* heap, MemAllocLinear* scratch);
 
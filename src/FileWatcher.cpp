@@ -0,0 +1,444 @@
+#include "FileWatcher.hpp"
+#include "MemAllocHeap.hpp"
+#include "PathUtil.hpp"
+#include "StatCache.hpp"
+#include "Stats.hpp"
+
+#if defined(TUNDRA_LINUX)
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace t2
+{
+
+#if defined(TUNDRA_LINUX)
+
+namespace DirState
+{
+  enum Enum
+  {
+    kUnknown,
+    kWatched,
+    kAbsent,    // doesn't exist; its creation shows up in the parent
+    kFailed
+  };
+}
+
+// In order of precedence, when combining a directory's own verdict with its
+// parent's.
+namespace Verdict
+{
+  enum Enum
+  {
+    kTrusted,
+    kUntrusted,
+    kChanged    // the directory, or one of its parents, was created, moved or deleted
+  };
+}
+
+static const uint32_t kWatchMask =
+  IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY |
+  IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+// Events that change what's listed in a directory.
+static const uint32_t kListingMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+// Directories are watched up to "." or "/". Leading ".." are as far as
+// relative paths go; renaming what's above them would move the build
+// directory along with them.
+static bool GetParentDirectory(const char* dir, char (&parent)[kMaxPathLength])
+{
+  const char* slash = strrchr(dir, '/');
+  const char* name  = slash ? slash + 1 : dir;
+
+  if (0 == strcmp(dir, ".") || 0 == strcmp(dir, "/") || 0 == strcmp(name, ".."))
+    return false;
+
+  return PathDirectoryOf(parent, dir);
+}
+
+static bool JoinPath(char (&path)[kMaxPathLength], const char* dir, const char* name)
+{
+  int len;
+
+  if (0 == strcmp(dir, "."))
+    len = snprintf(path, sizeof path, "%s", name);
+  else if (0 == strcmp(dir, "/"))
+    len = snprintf(path, sizeof path, "/%s", name);
+  else
+    len = snprintf(path, sizeof path, "%s/%s", dir, name);
+
+  return len < int(sizeof path);
+}
+
+static void AddPath(FileWatcher* self, HashSet<kFlagPathStrings>* set, const char* path)
+{
+  uint32_t hash = Djb2HashPath(path);
+
+  if (!HashSetLookup(set, hash, path))
+    HashSetInsert(set, hash, StrDup(&self->m_ScratchAllocator, path));
+}
+
+static int32_t GetDir(FileWatcher* self, const char* path)
+{
+  uint32_t hash = Djb2HashPath(path);
+
+  if (const int32_t* index = HashTableLookup(&self->m_DirLookup, hash, path))
+    return *index;
+
+  int32_t         index = int32_t(self->m_Dirs.m_Size);
+  FileWatcherDir* dir   = BufferAlloc(&self->m_Dirs, self->m_Heap, 1);
+
+  dir->m_Path              = StrDup(&self->m_DirAllocator, path);
+  dir->m_State             = DirState::kUnknown;
+  dir->m_Wd                = -1;
+  dir->m_NextSameWd        = -1;
+  dir->m_Generation        = 0;
+  dir->m_VerdictGeneration = 0;
+  dir->m_Verdict           = Verdict::kUntrusted;
+
+  HashTableInsert(&self->m_DirLookup, hash, dir->m_Path, index);
+  return index;
+}
+
+// Take a directory off its watch, and remove the watch if nothing else uses
+// it.
+static void UnlinkDir(FileWatcher* self, int32_t index)
+{
+  int32_t wd = self->m_Dirs[index].m_Wd;
+
+  if (wd < 0)
+    return;
+
+  int32_t* link = &self->m_WdDirs[wd];
+  while (*link != index)
+    link = &self->m_Dirs[*link].m_NextSameWd;
+
+  *link = self->m_Dirs[index].m_NextSameWd;
+
+  if (self->m_WdDirs[wd] < 0)
+    inotify_rm_watch(self->m_Fd, wd);
+
+  self->m_Dirs[index].m_Wd         = -1;
+  self->m_Dirs[index].m_NextSameWd = -1;
+}
+
+static void WatchDir(FileWatcher* self, int32_t index)
+{
+  int wd    = inotify_add_watch(self->m_Fd, self->m_Dirs[index].m_Path, kWatchMask);
+  int error = errno;
+
+  // The same directory gets the same watch back, so nothing is missed while
+  // watching it again.
+  if (wd < 0 || wd != self->m_Dirs[index].m_Wd)
+  {
+    UnlinkDir(self, index);
+
+    if (wd >= 0)
+    {
+      if (size_t(wd) >= self->m_WdDirs.m_Size)
+        BufferAllocFill(&self->m_WdDirs, self->m_Heap, wd + 1 - self->m_WdDirs.m_Size, -1);
+
+      self->m_Dirs[index].m_Wd         = wd;
+      self->m_Dirs[index].m_NextSameWd = self->m_WdDirs[wd];
+      self->m_WdDirs[wd]               = index;
+    }
+  }
+
+  FileWatcherDir* dir = &self->m_Dirs[index];
+  dir->m_Generation = self->m_Generation;
+
+  if (wd >= 0)
+  {
+    dir->m_State = DirState::kWatched;
+  }
+  else if (ENOENT == error || ENOTDIR == error)
+  {
+    dir->m_State = DirState::kAbsent;
+  }
+  else
+  {
+    dir->m_State = DirState::kFailed;
+
+    if (ENOSPC == error && !self->m_OutOfWatches)
+    {
+      Log(kWarning, "out of inotify watches; raise fs.inotify.max_user_watches to avoid statting files every build");
+      self->m_OutOfWatches = true;
+    }
+    else
+    {
+      Log(kDebug, "couldn't watch %s: %s", dir->m_Path, strerror(error));
+    }
+  }
+}
+
+// Whether files in a directory statted during the last build are still as
+// they were, provided nothing happened to the files themselves. Also sets
+// up watches for the directory and its parents, where needed.
+static int32_t GetVerdict(FileWatcher* self, int32_t index)
+{
+  const FileWatcherDir* dir = &self->m_Dirs[index];
+
+  if (dir->m_VerdictGeneration == self->m_Generation)
+    return dir->m_Verdict;
+
+  int32_t verdict = Verdict::kTrusted;
+
+  char parent[kMaxPathLength];
+  if (GetParentDirectory(dir->m_Path, parent))
+    verdict = GetVerdict(self, GetDir(self, parent));
+
+  dir = &self->m_Dirs[index];
+
+  if (HashSetLookup(&self->m_Changed, Djb2HashPath(dir->m_Path), dir->m_Path))
+    verdict = Verdict::kChanged;
+
+  // What's at this path now may not be what was watched before.
+  if (Verdict::kChanged == verdict || DirState::kUnknown == dir->m_State)
+    WatchDir(self, index);
+
+  FileWatcherDir* d = &self->m_Dirs[index];
+
+  if (Verdict::kTrusted == verdict)
+  {
+    bool watched = DirState::kWatched == d->m_State || DirState::kAbsent == d->m_State;
+
+    // Changes between the stat and setting up the watch would be missed.
+    if (!watched || d->m_Generation == self->m_Generation)
+      verdict = Verdict::kUntrusted;
+  }
+
+  d->m_VerdictGeneration = self->m_Generation;
+  d->m_Verdict           = verdict;
+  return verdict;
+}
+
+static void HandleEvent(FileWatcher* self, const struct inotify_event* ev)
+{
+  if (ev->wd < 0 || size_t(ev->wd) >= self->m_WdDirs.m_Size)
+    return;
+
+  for (int32_t index = self->m_WdDirs[ev->wd]; index >= 0; index = self->m_Dirs[index].m_NextSameWd)
+  {
+    const char* dir = self->m_Dirs[index].m_Path;
+    char        path[kMaxPathLength];
+
+    // Events about the directory itself have no name, and a path too long to
+    // record makes the whole directory count as changed.
+    if (ev->len > 0 && ev->name[0] && JoinPath(path, dir, ev->name))
+      AddPath(self, &self->m_Changed, path);
+    else
+      AddPath(self, &self->m_Changed, dir);
+
+    if (ev->mask & kListingMask)
+      AddPath(self, &self->m_ListingChanged, dir);
+  }
+
+  // The watch is gone, because the directory was deleted or unmounted.
+  if (ev->mask & IN_IGNORED)
+  {
+    int32_t index = self->m_WdDirs[ev->wd];
+
+    while (index >= 0)
+    {
+      FileWatcherDir* dir = &self->m_Dirs[index];
+      index = dir->m_NextSameWd;
+
+      dir->m_State      = DirState::kUnknown;
+      dir->m_Wd         = -1;
+      dir->m_NextSameWd = -1;
+    }
+
+    self->m_WdDirs[ev->wd] = -1;
+  }
+}
+
+// Returns false if events were lost.
+static bool ReadEvents(FileWatcher* self)
+{
+  if (self->m_Fd < 0)
+    return false;
+
+  alignas(struct inotify_event) char buffer[65536];
+
+  for (;;)
+  {
+    ssize_t len = read(self->m_Fd, buffer, sizeof buffer);
+
+    if (len < 0 && EINTR == errno)
+      continue;
+
+    if (len < 0 && EAGAIN == errno)
+      return true;
+
+    if (len <= 0)
+      return false;
+
+    for (ssize_t pos = 0; pos < len; )
+    {
+      const struct inotify_event* ev = (const struct inotify_event*) (buffer + pos);
+      pos += sizeof(struct inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW)
+        return false;
+
+      HandleEvent(self, ev);
+    }
+  }
+}
+
+// Forget all watches, and start over.
+static void ResetWatches(FileWatcher* self)
+{
+  if (self->m_Fd >= 0)
+    close(self->m_Fd);
+
+  HashTableDestroy(&self->m_DirLookup);
+  BufferClear(&self->m_Dirs);
+  BufferClear(&self->m_WdDirs);
+  LinearAllocReset(&self->m_DirAllocator);
+
+  self->m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (self->m_Fd < 0)
+    Log(kDebug, "inotify_init1 failed: %s", strerror(errno));
+}
+
+bool FileWatcherInit(FileWatcher* self, MemAllocHeap* heap)
+{
+  self->m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (self->m_Fd < 0)
+  {
+    Log(kDebug, "not watching files; inotify_init1 failed: %s", strerror(errno));
+    return false;
+  }
+
+  self->m_Generation   = 0;
+  self->m_OutOfWatches = false;
+  self->m_Heap         = heap;
+
+  LinearAllocInit(&self->m_DirAllocator, heap, MB(16), "file watcher dirs");
+  HashTableInit(&self->m_DirLookup, heap);
+  BufferInit(&self->m_Dirs);
+  BufferInit(&self->m_WdDirs);
+
+  LinearAllocInit(&self->m_ScratchAllocator, heap, MB(64), "file watcher scratch");
+  HashSetInit(&self->m_Changed, heap);
+  HashSetInit(&self->m_ListingChanged, heap);
+  BufferInit(&self->m_Seeds);
+
+  return true;
+}
+
+void FileWatcherDestroy(FileWatcher* self)
+{
+  if (self->m_Fd >= 0)
+    close(self->m_Fd);
+
+  BufferDestroy(&self->m_Seeds, self->m_Heap);
+  HashSetDestroy(&self->m_ListingChanged);
+  HashSetDestroy(&self->m_Changed);
+  LinearAllocDestroy(&self->m_ScratchAllocator);
+
+  BufferDestroy(&self->m_WdDirs, self->m_Heap);
+  BufferDestroy(&self->m_Dirs, self->m_Heap);
+  HashTableDestroy(&self->m_DirLookup);
+  LinearAllocDestroy(&self->m_DirAllocator);
+}
+
+void FileWatcherCollect(FileWatcher* self, StatCache* stat_cache)
+{
+  BufferClear(&self->m_Seeds);
+  HashSetDestroy(&self->m_Changed);
+  HashSetDestroy(&self->m_ListingChanged);
+  LinearAllocReset(&self->m_ScratchAllocator);
+
+  ++self->m_Generation;
+
+  if (!ReadEvents(self))
+  {
+    Log(kDebug, "file watcher lost track of changes; statting everything again");
+    ResetWatches(self);
+
+    if (self->m_Fd < 0)
+      return;
+  }
+
+  HashTableWalk(&stat_cache->m_Files, [=](uint32_t index, uint32_t hash, const char* path, const FileInfo& info) {
+    if (info.m_Flags & (FileInfo::kFlagDirty | FileInfo::kFlagError | FileInfo::kFlagSymlink))
+      return;
+
+    char dir[kMaxPathLength];
+    if (!PathDirectoryOf(dir, path))
+      return;
+
+    if (Verdict::kTrusted != GetVerdict(self, GetDir(self, dir)))
+      return;
+
+    if (HashSetLookup(&self->m_Changed, Djb2HashPath(path), path))
+      return;
+
+    FileWatcherEntry* seed = BufferAlloc(&self->m_Seeds, self->m_Heap, 1);
+    seed->m_Path = StrDup(&self->m_ScratchAllocator, path);
+    seed->m_Hash = hash;
+    seed->m_Info = info;
+  });
+
+  Log(kDebug, "file watcher: %u changes, %u of %u stat cache entries kept, %u directories",
+      self->m_Changed.m_RecordCount, uint32_t(self->m_Seeds.m_Size), stat_cache->m_Files.m_RecordCount,
+      uint32_t(self->m_Dirs.m_Size));
+}
+
+void FileWatcherSeed(FileWatcher* self, StatCache* stat_cache)
+{
+  for (const FileWatcherEntry& seed : self->m_Seeds)
+  {
+    StatCacheSeed(stat_cache, seed.m_Path, seed.m_Hash, seed.m_Info);
+  }
+
+  g_Stats.m_StatCacheSeeded += uint32_t(self->m_Seeds.m_Size);
+}
+
+bool FileWatcherListingUnchanged(FileWatcher* self, const char* dir)
+{
+  if (self->m_Fd < 0)
+    return false;
+
+  if (Verdict::kTrusted != GetVerdict(self, GetDir(self, dir)))
+    return false;
+
+  return !HashSetLookup(&self->m_ListingChanged, Djb2HashPath(dir), dir);
+}
+
+#else
+
+bool FileWatcherInit(FileWatcher* self, MemAllocHeap* heap)
+{
+  return false;
+}
+
+void FileWatcherDestroy(FileWatcher* self)
+{
+}
+
+void FileWatcherCollect(FileWatcher* self, StatCache* stat_cache)
+{
+}
+
+void FileWatcherSeed(FileWatcher* self, StatCache* stat_cache)
+{
+}
+
+bool FileWatcherListingUnchanged(FileWatcher* self, const char* dir)
+{
+  return false;
+}
+
+#endif
+
+}
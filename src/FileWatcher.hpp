@@ -0,0 +1,84 @@
+#ifndef FILEWATCHER_HPP
+#define FILEWATCHER_HPP
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "FileInfo.hpp"
+#include "HashTable.hpp"
+#include "MemAllocLinear.hpp"
+
+namespace t2
+{
+  struct MemAllocHeap;
+  struct StatCache;
+
+  // Journal of file changes between builds, so a build server doesn't have
+  // to stat everything again for every build. The directories of all files
+  // in the stat cache are watched, along with their parents, and whatever
+  // nothing has happened to since it was statted is carried over into the
+  // next build's stat cache. Files in directories that weren't watched yet
+  // when they were statted, symlinks, and everything after the journal lost
+  // events are statted again.
+  //
+  // Uses inotify, so it's only available on Linux.
+
+  struct FileWatcherDir
+  {
+    const char* m_Path;
+    int32_t     m_State;
+    int32_t     m_Wd;
+    int32_t     m_NextSameWd;     // other paths to the same directory
+    uint32_t    m_Generation;     // when the watch was set up
+    uint32_t    m_VerdictGeneration;
+    int32_t     m_Verdict;
+  };
+
+  struct FileWatcherEntry
+  {
+    const char* m_Path;
+    uint32_t    m_Hash;
+    FileInfo    m_Info;
+  };
+
+  struct FileWatcher
+  {
+    int                                   m_Fd;
+    uint32_t                              m_Generation;
+    bool                                  m_OutOfWatches;
+    MemAllocHeap*                         m_Heap;
+
+    // Directory paths; these live as long as the watcher.
+    MemAllocLinear                        m_DirAllocator;
+    HashTable<int32_t, kFlagPathStrings>  m_DirLookup;
+    Buffer<FileWatcherDir>                m_Dirs;
+    Buffer<int32_t>                       m_WdDirs;
+
+    // Changed paths and carried over entries; these only live until the
+    // next call to FileWatcherCollect().
+    MemAllocLinear                        m_ScratchAllocator;
+    HashSet<kFlagPathStrings>             m_Changed;
+    HashSet<kFlagPathStrings>             m_ListingChanged;
+    Buffer<FileWatcherEntry>              m_Seeds;
+  };
+
+  // Returns false if file watching isn't available.
+  bool FileWatcherInit(FileWatcher* self, MemAllocHeap* heap);
+
+  void FileWatcherDestroy(FileWatcher* self);
+
+  // Go through the changes since the last call, and remember which of the
+  // stat cache's entries are still good. Also starts watching where the
+  // stat cache has been since. Call before throwing the stat cache away.
+  void FileWatcherCollect(FileWatcher* self, StatCache* stat_cache);
+
+  // Fill an empty stat cache with the entries kept by FileWatcherCollect().
+  void FileWatcherSeed(FileWatcher* self, StatCache* stat_cache);
+
+  // Whether nothing has been added to, removed from or renamed in a
+  // directory since the last call to FileWatcherCollect() but one, so a
+  // listing of it taken back then still holds. Starts watching it if need
+  // be, so ask again after every collect to keep it trusted.
+  bool FileWatcherListingUnchanged(FileWatcher* self, const char* dir);
+}
+
+#endif
@@ -3,14 +3,45 @@
 
 #include <cstring>
 #include <cstdio>
+#include <cctype>
 
 namespace t2
 {
 
 void HashInitImpl(HashStateImpl* impl);
-void HashBlock(const uint8_t* data, HashStateImpl* state, void* debug_file);
+void HashBlocks(const uint8_t* data, size_t block_count, HashStateImpl* state, void* debug_file);
 void HashFinalizeImpl(HashStateImpl* self, HashDigest* digest);
 
+void HashDebugDumpBlock(const uint8_t* block, size_t size, void* debug_file_)
+{
+  FILE*        debug_file = (FILE*) debug_file_;
+  const size_t line_size  = 16;
+
+  for (size_t i = 0; i < size; i += line_size)
+  {
+    for (size_t x = 0; x < line_size; ++x)
+    {
+      int ch = block[x + i];
+      static const char hex[] = "0123456789ABCDEF";
+      fputc(hex[(ch & 0xf0) >> 4], debug_file);
+      fputc(hex[(ch & 0x0f)     ], debug_file);
+      fputc(' ', debug_file);
+    }
+
+    fputs(" | ", debug_file);
+
+    for (size_t x = 0; x < line_size; ++x)
+    {
+      int ch = block[x + i];
+      if (isalnum(ch) || ispunct(ch) || ' ' == ch)
+        fputc(ch, debug_file);
+      else
+        fputc('.', debug_file);
+    }
+    fputc('\n', debug_file);
+  }
+}
+
 void HashUpdate(HashState* self, const void *data_in, size_t size)
 {
   const uint8_t*       data   = static_cast<const uint8_t*>(data_in);
@@ -33,15 +64,18 @@ void HashUpdate(HashState* self, const void *data_in, size_t size)
 
       if (used == sizeof self->m_Buffer)
       {
-        HashBlock(buffer, state, self->m_DebugFile);
+        HashBlocks(buffer, 1, state, self->m_DebugFile);
         used = 0;
       }
     }
     else
     {
-      HashBlock(data, state, self->m_DebugFile);
-      data   += sizeof self->m_Buffer;
-      remain -= sizeof self->m_Buffer;
+      // Hash all whole blocks straight from the input in one go.
+      const size_t block_count = remain / sizeof self->m_Buffer;
+      const size_t block_bytes = block_count * sizeof self->m_Buffer;
+      HashBlocks(data, block_count, state, self->m_DebugFile);
+      data   += block_bytes;
+      remain -= block_bytes;
     }
   }
   
@@ -146,7 +180,7 @@ DigestToString(char (&buffer)[kDigestStringSize], const HashDigest& digest)
 {
   static const char hex[] = "0123456789abcdef";
 
-#if ENABLED(USE_FAST_HASH)
+#if ENABLED(USE_128BIT_DIGEST)
   int i = 0;
   for (int k = 0; k < 2; ++k)
   {
@@ -92,11 +92,20 @@ struct ALIGN(16) HashStateImpl
 #endif
 
 #if ENABLED(USE_FAST_HASH)
-
 enum
 {
   kTundraHashMagic = 0x7810221e
 };
+#endif
+
+#if ENABLED(USE_VECTOR_HASH)
+enum
+{
+  kTundraHashMagic = 0x3c9e51b7
+};
+#endif
+
+#if ENABLED(USE_128BIT_DIGEST)
 
 #pragma pack(push, 4)
 union HashDigest
@@ -145,6 +154,9 @@ inline bool operator<(const HashDigest& lhs, const HashDigest& rhs)
   return CompareHashDigests(lhs, rhs) < 0;
 }
 
+#endif
+
+#if ENABLED(USE_FAST_HASH)
 // 4*xxhash hashing state
 struct ALIGN(16) HashStateImpl
 {
@@ -152,6 +164,15 @@ struct ALIGN(16) HashStateImpl
 };
 #endif
 
+#if ENABLED(USE_VECTOR_HASH)
+// Vector hash accumulators, and which stripe of the current block is next.
+struct ALIGN(16) HashStateImpl
+{
+  uint64_t      m_Acc[8];
+  uint32_t      m_StripeIndex;
+};
+#endif
+
 struct ALIGN(16) HashState
 {
   HashStateImpl m_StateImpl;
@@ -0,0 +1,169 @@
+// Hash throughput benchmark.
+//
+// Times the content hash this build uses on small strings, the way node and
+// path signatures are built up, and on a buffer of several megabytes, the
+// way file contents are digested. Then times each vector hash and SHA-1 kernel
+// this CPU can run over the same buffer, so they can be compared whichever
+// hash the build uses.
+//
+// usage: t2-hashbench [megabytes]
+
+#include "Common.hpp"
+#include "Hash.hpp"
+#include "HashSha1.hpp"
+#include "HashVector.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace t2;
+
+static const char* HashName()
+{
+#if ENABLED(USE_SHA1_HASH)
+  return "sha1";
+#elif ENABLED(USE_VECTOR_HASH)
+  return "vector";
+#else
+  return "fast";
+#endif
+}
+
+static void Report(const char* what, double seconds, uint64_t bytes, uint64_t count)
+{
+  printf("%-24s %9.1f MB/s %12.1f ns/op\n", what,
+      double(bytes) / (1024.0 * 1024.0) / seconds,
+      seconds * 1e9 / double(count));
+}
+
+static void BenchSmallStrings()
+{
+  static const char* const strings[] =
+  {
+    "a.c", "src/Foo.cpp", "t2-output/linux-gcc-debug-default/__tundra/Foo.o",
+    "-O2 -g -Wall -DNDEBUG -Isrc -Iinclude", "tundra.lua",
+  };
+
+  const int kRounds = 400000;
+  uint64_t  bytes   = 0;
+  uint64_t  sink    = 0;
+
+  uint64_t start = TimerGet();
+  for (int i = 0; i < kRounds; ++i)
+  {
+    for (const char* str : strings)
+    {
+      HashState  h;
+      HashDigest digest;
+      HashInit(&h);
+      HashAddString(&h, str);
+      HashFinalize(&h, &digest);
+      sink  += digest.m_Data[0];
+      bytes += strlen(str);
+    }
+  }
+  double seconds = TimerDiffSeconds(start, TimerGet());
+
+  Report("small strings", seconds, bytes, kRounds * uint64_t(sizeof strings / sizeof strings[0]));
+
+  if (sink == 1)
+    printf("\n");
+}
+
+static void BenchBuffer(const uint8_t* data, size_t size)
+{
+  const int kRounds = 10;
+
+  HashDigest digest;
+  uint64_t   start = TimerGet();
+  for (int i = 0; i < kRounds; ++i)
+  {
+    HashState h;
+    HashInit(&h);
+    HashUpdate(&h, data, size);
+    HashFinalize(&h, &digest);
+  }
+  double seconds = TimerDiffSeconds(start, TimerGet());
+
+  Report("buffer", seconds, uint64_t(size) * kRounds, kRounds);
+}
+
+static void BenchVectorKernels(const uint8_t* data, size_t size)
+{
+  const int    kRounds      = 10;
+  const size_t stripe_count = size / kVectorHashStripeSize;
+
+  for (int k = 0; k < VectorHashKernelCount(); ++k)
+  {
+    const VectorHashKernel* kernel = VectorHashGetKernel(k);
+
+    uint64_t acc[kVectorHashLanes];
+    uint64_t out[2];
+    uint64_t start = TimerGet();
+    for (int i = 0; i < kRounds; ++i)
+    {
+      uint32_t index = 0;
+      VectorHashInit(acc);
+      kernel->m_Accumulate(acc, data, stripe_count, &index);
+      VectorHashFinalize(acc, out);
+    }
+    double seconds = TimerDiffSeconds(start, TimerGet());
+
+    char what[64];
+    snprintf(what, sizeof what, "vector kernel %s", kernel->m_Name);
+    Report(what, seconds, uint64_t(stripe_count) * kVectorHashStripeSize * kRounds, kRounds);
+  }
+}
+
+static void BenchSha1Kernels(const uint8_t* data, size_t size)
+{
+  const int    kRounds     = 4;
+  const size_t block_count = size / 64;
+
+  for (int k = 0; k < Sha1KernelCount(); ++k)
+  {
+    const Sha1Kernel* kernel = Sha1GetKernel(k);
+
+    uint64_t start = TimerGet();
+    for (int i = 0; i < kRounds; ++i)
+    {
+      uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+      kernel->m_Compress(state, data, block_count);
+    }
+    double seconds = TimerDiffSeconds(start, TimerGet());
+
+    char what[64];
+    snprintf(what, sizeof what, "sha1 kernel %s", kernel->m_Name);
+    Report(what, seconds, uint64_t(block_count) * 64 * kRounds, kRounds);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  int megabytes = argc > 1 ? atoi(argv[1]) : 16;
+  if (megabytes <= 0)
+  {
+    fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+    return 1;
+  }
+
+  size_t   size = size_t(megabytes) * 1024 * 1024;
+  uint8_t* data = (uint8_t*) malloc(size);
+  if (!data)
+  {
+    fprintf(stderr, "couldn't allocate %d MB\n", megabytes);
+    return 1;
+  }
+
+  for (size_t i = 0; i < size; ++i)
+    data[i] = uint8_t(i * 131 + (i >> 11));
+
+  printf("hash: %s, buffer: %d MB\n", HashName(), megabytes);
+  BenchSmallStrings();
+  BenchBuffer(data, size);
+  BenchVectorKernels(data, size);
+  BenchSha1Kernels(data, size);
+
+  free(data);
+  return 0;
+}
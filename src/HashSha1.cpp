@@ -1,62 +1,304 @@
 #include "Hash.hpp"
+#include "HashSha1.hpp"
+#include "CpuKernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TUNDRA_SHA1_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SHA __attribute__((target("sha,sse4.1,ssse3")))
+#else
+#define TARGET_SHA
+#endif
 
 namespace t2
 {
 
-#if ENABLED(USE_SHA1_HASH)
+void HashDebugDumpBlock(const uint8_t* block, size_t size, void* debug_file);
 
 static inline uint32_t SHA1Rotate(uint32_t value, uint32_t bits)
 {
   return ((value) << bits) | (value >> (32 - bits));
 }
 
-void HashBlock(const uint8_t* block, HashStateImpl* state, void* debug_file_)
+static void CompressScalar(uint32_t state[5], const uint8_t* block, size_t block_count)
 {
-  uint32_t w[80];
-
-  // Prepare message schedule
-  for (int i = 0; i < 16; ++i)
+  for (size_t n = 0; n < block_count; ++n, block += 64)
   {
-    w[i] =
-      (((uint32_t)block[(i*4)+0]) << 24) |
-      (((uint32_t)block[(i*4)+1]) << 16) |
-      (((uint32_t)block[(i*4)+2]) <<  8) |
-      (((uint32_t)block[(i*4)+3]) <<  0);
+    uint32_t w[80];
+
+    // Prepare message schedule
+    for (int i = 0; i < 16; ++i)
+    {
+      w[i] =
+        (((uint32_t)block[(i*4)+0]) << 24) |
+        (((uint32_t)block[(i*4)+1]) << 16) |
+        (((uint32_t)block[(i*4)+2]) <<  8) |
+        (((uint32_t)block[(i*4)+3]) <<  0);
+    }
+
+    for (int i = 16; i < 80; ++i)
+    {
+      w[i] = SHA1Rotate(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    // Initialize working variables
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+    // This is the core loop for each 20-word span.
+#define SHA1_LOOP(start, end, func, constant) \
+    for (int i = (start); i < (end); ++i) \
+    { \
+      uint32_t t = SHA1Rotate(a, 5) + (func) + e + (constant) + w[i]; \
+      e = d; d = c; c = SHA1Rotate(b, 30); b = a; a = t; \
+    }
+
+    SHA1_LOOP( 0, 20, ((b & c) ^ (~b & d)),           0x5a827999)
+    SHA1_LOOP(20, 40, (b ^ c ^ d),                    0x6ed9eba1)
+    SHA1_LOOP(40, 60, ((b & c) ^ (b & d) ^ (c & d)),  0x8f1bbcdc)
+    SHA1_LOOP(60, 80, (b ^ c ^ d),                    0xca62c1d6)
+
+#undef SHA1_LOOP
+
+    // Update state
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
   }
+}
 
-  for (int i = 16; i < 80; ++i)
+#if defined(TUNDRA_SHA1_X86)
+// Uses the SHA extensions, which do four rounds and the message schedule a
+// vector at a time. ABCD live in one register with A in the top lane, and E
+// rides in the top lane of another, pre-added to the next four message words.
+TARGET_SHA
+static void CompressShaNi(uint32_t state[5], const uint8_t* data, size_t block_count)
+{
+  const __m128i kByteSwap = _mm_set_epi64x(0x0001020304050607ll, 0x08090a0b0c0d0e0fll);
+
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1b);
+  __m128i e0   = _mm_set_epi32(int(state[4]), 0, 0, 0);
+  __m128i e1, msg0, msg1, msg2, msg3;
+
+  for (size_t n = 0; n < block_count; ++n, data += 64)
   {
-    w[i] = SHA1Rotate(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
-  }
+    const __m128i abcd_save = abcd;
+    const __m128i e0_save   = e0;
 
-  // Initialize working variables
-  uint32_t a = state->m_State[0];
-  uint32_t b = state->m_State[1];
-  uint32_t c = state->m_State[2];
-  uint32_t d = state->m_State[3];
-  uint32_t e = state->m_State[4];
+    // Rounds 0-3
+    msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 0)), kByteSwap);
+    e0   = _mm_add_epi32(e0, msg0);
+    e1   = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
 
-  // This is the core loop for each 20-word span.
-#define SHA1_LOOP(start, end, func, constant) \
-  for (int i = (start); i < (end); ++i) \
-  { \
-    uint32_t t = SHA1Rotate(a, 5) + (func) + e + (constant) + w[i]; \
-    e = d; d = c; c = SHA1Rotate(b, 30); b = a; a = t; \
+    // Rounds 4-7
+    msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 16)), kByteSwap);
+    e1   = _mm_sha1nexte_epu32(e1, msg1);
+    e0   = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+    // Rounds 8-11
+    msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 32)), kByteSwap);
+    e0   = _mm_sha1nexte_epu32(e0, msg2);
+    e1   = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+    msg0 = _mm_xor_si128(msg0, msg2);
+
+    // Rounds 12-15
+    msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 48)), kByteSwap);
+    e1   = _mm_sha1nexte_epu32(e1, msg3);
+    e0   = abcd;
+    msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+    msg1 = _mm_xor_si128(msg1, msg3);
+
+    // Rounds 16-19
+    e0   = _mm_sha1nexte_epu32(e0, msg0);
+    e1   = abcd;
+    msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+    msg2 = _mm_xor_si128(msg2, msg0);
+
+    // Rounds 20-23
+    e1   = _mm_sha1nexte_epu32(e1, msg1);
+    e0   = abcd;
+    msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+    msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+    msg3 = _mm_xor_si128(msg3, msg1);
+
+    // Rounds 24-27
+    e0   = _mm_sha1nexte_epu32(e0, msg2);
+    e1   = abcd;
+    msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+    msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+    msg0 = _mm_xor_si128(msg0, msg2);
+
+    // Rounds 28-31
+    e1   = _mm_sha1nexte_epu32(e1, msg3);
+    e0   = abcd;
+    msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+    msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+    msg1 = _mm_xor_si128(msg1, msg3);
+
+    // Rounds 32-35
+    e0   = _mm_sha1nexte_epu32(e0, msg0);
+    e1   = abcd;
+    msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+    msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+    msg2 = _mm_xor_si128(msg2, msg0);
+
+    // Rounds 36-39
+    e1   = _mm_sha1nexte_epu32(e1, msg1);
+    e0   = abcd;
+    msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+    msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+    msg3 = _mm_xor_si128(msg3, msg1);
+
+    // Rounds 40-43
+    e0   = _mm_sha1nexte_epu32(e0, msg2);
+    e1   = abcd;
+    msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+    msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+    msg0 = _mm_xor_si128(msg0, msg2);
+
+    // Rounds 44-47
+    e1   = _mm_sha1nexte_epu32(e1, msg3);
+    e0   = abcd;
+    msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+    msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+    msg1 = _mm_xor_si128(msg1, msg3);
+
+    // Rounds 48-51
+    e0   = _mm_sha1nexte_epu32(e0, msg0);
+    e1   = abcd;
+    msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+    msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+    msg2 = _mm_xor_si128(msg2, msg0);
+
+    // Rounds 52-55
+    e1   = _mm_sha1nexte_epu32(e1, msg1);
+    e0   = abcd;
+    msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+    msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+    msg3 = _mm_xor_si128(msg3, msg1);
+
+    // Rounds 56-59
+    e0   = _mm_sha1nexte_epu32(e0, msg2);
+    e1   = abcd;
+    msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+    msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+    msg0 = _mm_xor_si128(msg0, msg2);
+
+    // Rounds 60-63
+    e1   = _mm_sha1nexte_epu32(e1, msg3);
+    e0   = abcd;
+    msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+    msg1 = _mm_xor_si128(msg1, msg3);
+
+    // Rounds 64-67
+    e0   = _mm_sha1nexte_epu32(e0, msg0);
+    e1   = abcd;
+    msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+    msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+    msg2 = _mm_xor_si128(msg2, msg0);
+
+    // Rounds 68-71
+    e1   = _mm_sha1nexte_epu32(e1, msg1);
+    e0   = abcd;
+    msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    msg3 = _mm_xor_si128(msg3, msg1);
+
+    // Rounds 72-75
+    e0   = _mm_sha1nexte_epu32(e0, msg2);
+    e1   = abcd;
+    msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+    // Rounds 76-79
+    e1   = _mm_sha1nexte_epu32(e1, msg3);
+    e0   = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+
+    e0   = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
   }
 
-  SHA1_LOOP( 0, 20, ((b & c) ^ (~b & d)),           0x5a827999)
-  SHA1_LOOP(20, 40, (b ^ c ^ d),                    0x6ed9eba1)
-  SHA1_LOOP(40, 60, ((b & c) ^ (b & d) ^ (c & d)),  0x8f1bbcdc)
-  SHA1_LOOP(60, 80, (b ^ c ^ d),                    0xca62c1d6)
+  _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = uint32_t(_mm_extract_epi32(e0, 3));
+}
+#endif
 
-#undef SHA1_LOOP
+static const Sha1Kernel s_ScalarKernel = { "scalar", CompressScalar };
+#if defined(TUNDRA_SHA1_X86)
+static const Sha1Kernel s_ShaNiKernel  = { "sha-ni", CompressShaNi };
+#endif
+
+static const CpuKernelOption<Sha1Kernel> s_KernelOptions[] =
+{
+  { &s_ScalarKernel, 0 },
+#if defined(TUNDRA_SHA1_X86)
+  { &s_ShaNiKernel,  kCpuShaNi },
+#endif
+};
 
-  // Update state
-  state->m_State[0] += a;
-  state->m_State[1] += b;
-  state->m_State[2] += c;
-  state->m_State[3] += d;
-  state->m_State[4] += e;
+static const CpuKernels<Sha1Kernel>& GetKernels()
+{
+  static const CpuKernels<Sha1Kernel> kernels(s_KernelOptions);
+  return kernels;
+}
+
+int Sha1KernelCount()
+{
+  return GetKernels().m_Count;
+}
+
+const Sha1Kernel* Sha1GetKernel(int index)
+{
+  return GetKernels().m_Kernels[index];
+}
+
+#if ENABLED(USE_SHA1_HASH)
+
+void HashBlocks(const uint8_t* data, size_t block_count, HashStateImpl* state, void* debug_file)
+{
+  static const Sha1Kernel* kernel = Sha1GetKernel(Sha1KernelCount() - 1);
+
+  static_assert(sizeof(HashState().m_Buffer) == 64, "buffer must be one SHA-1 block");
+
+  if (debug_file)
+  {
+    for (size_t i = 0; i < block_count; ++i)
+      HashDebugDumpBlock(data + i * 64, 64, debug_file);
+  }
+
+  kernel->m_Compress(state->m_State, data, block_count);
 }
 
 void HashInitImpl(HashStateImpl* self)
@@ -80,5 +322,4 @@ void HashFinalizeImpl(HashStateImpl* self, HashDigest* digest)
 }
 
 #endif
-
 }
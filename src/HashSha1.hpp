@@ -0,0 +1,25 @@
+#ifndef HASHSHA1_HPP
+#define HASHSHA1_HPP
+
+#include "Common.hpp"
+
+// SHA-1 block compression functions. They are built in every configuration so
+// the accelerated ones can be tested against the portable one, whichever hash
+// the build uses.
+
+namespace t2
+{
+  struct Sha1Kernel
+  {
+    const char* m_Name;
+
+    // Compress whole 64-byte blocks into the five state words.
+    void (*m_Compress)(uint32_t state[5], const uint8_t* blocks, size_t block_count);
+  };
+
+  // Kernels this CPU can run, the portable one first and the fastest last.
+  int Sha1KernelCount();
+  const Sha1Kernel* Sha1GetKernel(int index);
+}
+
+#endif
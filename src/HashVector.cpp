@@ -0,0 +1,309 @@
+#include "Hash.hpp"
+#include "HashVector.hpp"
+#include "CpuKernels.hpp"
+
+#include <cstring>
+
+// An XXH3-style hash - https://github.com/Cyan4973/xxHash
+//
+// Every 64-byte stripe of input is added into eight 64-bit accumulators,
+// each lane getting the product of the halves of its input word mixed with a
+// secret, plus its neighbour's input word. That maps directly onto 128- and
+// 256-bit integer SIMD. Every 16 stripes the accumulators are scrambled, and
+// at the end they're folded into two 64-bit words. The secret is our own, so
+// digests don't match XXH3's.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TUNDRA_VECTOR_HASH_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace t2
+{
+
+void HashDebugDumpBlock(const uint8_t* block, size_t size, void* debug_file);
+
+static const uint64_t kPrime32_1 = 0x9e3779b1ull;
+static const uint64_t kPrime32_2 = 0x85ebca77ull;
+static const uint64_t kPrime32_3 = 0xc2b2ae3dull;
+static const uint64_t kPrime64_1 = 0x9e3779b185ebca87ull;
+static const uint64_t kPrime64_2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t kPrime64_3 = 0x165667b19e3779f9ull;
+static const uint64_t kPrime64_4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t kPrime64_5 = 0x27d4eb2f165667c5ull;
+
+// Stripe n of a block is mixed with words n to n + 7. The last eight words
+// are used for scrambling.
+static const uint64_t kSecret[kVectorHashStripesPerBlock + kVectorHashLanes] =
+{
+  0x97c1f349d684082bull, 0x2ff07ef2adfea0b1ull, 0x0dae85aefff487a0ull,
+  0x3a4ec12cc5faafe4ull, 0x39c30935ba7b23d3ull, 0x1a05533916ae8724ull,
+  0xb55f59bc292648a1ull, 0xc345f5d5e49852e2ull, 0x2128588a15f36b06ull,
+  0x00efd1d03d096c97ull, 0xaf6f50b60b62a46full, 0x7b021e22094bc3fcull,
+  0xe0c8b28e45f59a7cull, 0xcd8d96fef715ad8dull, 0xc2c8c888361a494eull,
+  0x13085e430b397c9dull, 0x8c34720ad24f809full, 0x8d719fa906464556ull,
+  0x91d6323fe03acfd4ull, 0x7c4804041873294dull, 0xfcb7035d0cb0177full,
+  0x0725e040d02c01beull, 0x36631c6583fa45ffull, 0x282bd2e4030d8eb7ull,
+};
+
+static const uint64_t* const kScrambleKey = kSecret + kVectorHashStripesPerBlock;
+
+static inline uint64_t ReadLittleEndian64(const uint8_t* p)
+{
+#if ENABLED(USE_LITTLE_ENDIAN)
+  uint64_t value;
+  memcpy(&value, p, sizeof value);
+  return value;
+#else
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i)
+    value = (value << 8) | p[i];
+  return value;
+#endif
+}
+
+static void AccumulateScalar(uint64_t acc[kVectorHashLanes], const uint8_t* data, size_t stripe_count, uint32_t* stripe_index)
+{
+  uint32_t index = *stripe_index;
+
+  for (size_t s = 0; s < stripe_count; ++s, data += kVectorHashStripeSize)
+  {
+    const uint64_t* key = kSecret + index;
+
+    for (int i = 0; i < kVectorHashLanes; ++i)
+    {
+      uint64_t value = ReadLittleEndian64(data + 8 * i);
+      uint64_t mixed = value ^ key[i];
+      acc[i ^ 1] += value;
+      acc[i]     += (mixed & 0xffffffff) * (mixed >> 32);
+    }
+
+    if (++index == kVectorHashStripesPerBlock)
+    {
+      for (int i = 0; i < kVectorHashLanes; ++i)
+      {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= kScrambleKey[i];
+        a *= kPrime32_1;
+        acc[i] = a;
+      }
+      index = 0;
+    }
+  }
+
+  *stripe_index = index;
+}
+
+#if defined(TUNDRA_VECTOR_HASH_X86)
+static void AccumulateSse2(uint64_t acc_out[kVectorHashLanes], const uint8_t* data, size_t stripe_count, uint32_t* stripe_index)
+{
+  uint32_t      index = *stripe_index;
+  const __m128i prime = _mm_set1_epi32(int(kPrime32_1));
+  __m128i       acc[4];
+
+  for (int i = 0; i < 4; ++i)
+    acc[i] = _mm_loadu_si128((const __m128i*) acc_out + i);
+
+  for (size_t s = 0; s < stripe_count; ++s, data += kVectorHashStripeSize)
+  {
+    const __m128i* key = (const __m128i*) (kSecret + index);
+
+    for (int i = 0; i < 4; ++i)
+    {
+      __m128i value   = _mm_loadu_si128((const __m128i*) data + i);
+      __m128i mixed   = _mm_xor_si128(value, _mm_loadu_si128(key + i));
+      __m128i mixed_h = _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1));
+      __m128i product = _mm_mul_epu32(mixed, mixed_h);
+      __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, swapped));
+    }
+
+    if (++index == kVectorHashStripesPerBlock)
+    {
+      for (int i = 0; i < 4; ++i)
+      {
+        __m128i a       = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+        __m128i mixed   = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*) kScrambleKey + i));
+        __m128i mixed_h = _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i prod_lo = _mm_mul_epu32(mixed, prime);
+        __m128i prod_hi = _mm_mul_epu32(mixed_h, prime);
+        acc[i] = _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32));
+      }
+      index = 0;
+    }
+  }
+
+  for (int i = 0; i < 4; ++i)
+    _mm_storeu_si128((__m128i*) acc_out + i, acc[i]);
+
+  *stripe_index = index;
+}
+
+TARGET_AVX2
+static void AccumulateAvx2(uint64_t acc_out[kVectorHashLanes], const uint8_t* data, size_t stripe_count, uint32_t* stripe_index)
+{
+  uint32_t      index = *stripe_index;
+  const __m256i prime = _mm256_set1_epi32(int(kPrime32_1));
+  __m256i       acc[2];
+
+  for (int i = 0; i < 2; ++i)
+    acc[i] = _mm256_loadu_si256((const __m256i*) acc_out + i);
+
+  for (size_t s = 0; s < stripe_count; ++s, data += kVectorHashStripeSize)
+  {
+    const __m256i* key = (const __m256i*) (kSecret + index);
+
+    for (int i = 0; i < 2; ++i)
+    {
+      __m256i value   = _mm256_loadu_si256((const __m256i*) data + i);
+      __m256i mixed   = _mm256_xor_si256(value, _mm256_loadu_si256(key + i));
+      __m256i mixed_h = _mm256_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1));
+      __m256i product = _mm256_mul_epu32(mixed, mixed_h);
+      __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      acc[i] = _mm256_add_epi64(acc[i], _mm256_add_epi64(product, swapped));
+    }
+
+    if (++index == kVectorHashStripesPerBlock)
+    {
+      for (int i = 0; i < 2; ++i)
+      {
+        __m256i a       = _mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47));
+        __m256i mixed   = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*) kScrambleKey + i));
+        __m256i mixed_h = _mm256_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i prod_lo = _mm256_mul_epu32(mixed, prime);
+        __m256i prod_hi = _mm256_mul_epu32(mixed_h, prime);
+        acc[i] = _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32));
+      }
+      index = 0;
+    }
+  }
+
+  for (int i = 0; i < 2; ++i)
+    _mm256_storeu_si256((__m256i*) acc_out + i, acc[i]);
+
+  *stripe_index = index;
+}
+#endif
+
+static const VectorHashKernel s_ScalarKernel = { "scalar", AccumulateScalar };
+#if defined(TUNDRA_VECTOR_HASH_X86)
+static const VectorHashKernel s_Sse2Kernel   = { "sse2", AccumulateSse2 };
+static const VectorHashKernel s_Avx2Kernel   = { "avx2", AccumulateAvx2 };
+#endif
+
+static const CpuKernelOption<VectorHashKernel> s_KernelOptions[] =
+{
+  { &s_ScalarKernel, 0 },
+#if defined(TUNDRA_VECTOR_HASH_X86)
+  { &s_Sse2Kernel,   kCpuSse2 },
+  { &s_Avx2Kernel,   kCpuAvx2 },
+#endif
+};
+
+static const CpuKernels<VectorHashKernel>& GetKernels()
+{
+  static const CpuKernels<VectorHashKernel> kernels(s_KernelOptions);
+  return kernels;
+}
+
+int VectorHashKernelCount()
+{
+  return GetKernels().m_Count;
+}
+
+const VectorHashKernel* VectorHashGetKernel(int index)
+{
+  return GetKernels().m_Kernels[index];
+}
+
+void VectorHashInit(uint64_t acc[kVectorHashLanes])
+{
+  acc[0] = kPrime32_3;
+  acc[1] = kPrime64_1;
+  acc[2] = kPrime64_2;
+  acc[3] = kPrime64_3;
+  acc[4] = kPrime64_4;
+  acc[5] = kPrime32_2;
+  acc[6] = kPrime64_5;
+  acc[7] = kPrime32_1;
+}
+
+static inline uint64_t Multiply128Fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 product = (unsigned __int128) a * b;
+  return uint64_t(product) ^ uint64_t(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  uint64_t high;
+  uint64_t low = _umul128(a, b, &high);
+  return low ^ high;
+#else
+  uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+  uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+  uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+  uint64_t hi_hi = (a >> 32) * (b >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+  return lower ^ upper;
+#endif
+}
+
+static uint64_t MergeAccumulators(const uint64_t acc[kVectorHashLanes], const uint64_t* key, uint64_t start)
+{
+  uint64_t result = start;
+
+  for (int i = 0; i < kVectorHashLanes; i += 2)
+    result += Multiply128Fold64(acc[i] ^ key[i], acc[i + 1] ^ key[i + 1]);
+
+  result ^= result >> 37;
+  result *= 0x165667919e3779f9ull;
+  result ^= result >> 32;
+  return result;
+}
+
+void VectorHashFinalize(const uint64_t acc[kVectorHashLanes], uint64_t out[2])
+{
+  out[0] = MergeAccumulators(acc, kSecret + 1, kPrime64_1);
+  out[1] = MergeAccumulators(acc, kSecret + 13, ~kPrime64_2);
+}
+
+#if ENABLED(USE_VECTOR_HASH)
+static_assert(sizeof(HashState().m_Buffer) % kVectorHashStripeSize == 0, "buffer must be whole stripes");
+
+void HashBlocks(const uint8_t* data, size_t block_count, HashStateImpl* state, void* debug_file)
+{
+  static const VectorHashKernel* kernel = VectorHashGetKernel(VectorHashKernelCount() - 1);
+
+  const size_t block_size = sizeof(HashState().m_Buffer);
+
+  if (debug_file)
+  {
+    for (size_t i = 0; i < block_count; ++i)
+      HashDebugDumpBlock(data + i * block_size, block_size, debug_file);
+  }
+
+  kernel->m_Accumulate(state->m_Acc, data, block_count * (block_size / kVectorHashStripeSize), &state->m_StripeIndex);
+}
+
+void HashInitImpl(HashStateImpl* self)
+{
+  VectorHashInit(self->m_Acc);
+  self->m_StripeIndex = 0;
+}
+
+void HashFinalizeImpl(HashStateImpl* state, HashDigest* digest)
+{
+  VectorHashFinalize(state->m_Acc, digest->m_Words64);
+}
+#endif
+
+}
@@ -0,0 +1,38 @@
+#ifndef HASHVECTOR_HPP
+#define HASHVECTOR_HPP
+
+#include "Common.hpp"
+
+// Kernels of the vector hash, an XXH3-style hash over eight 64-bit lanes.
+// They are built in every configuration so they can be tested and
+// benchmarked against each other, whichever hash the build uses.
+
+namespace t2
+{
+  enum
+  {
+    kVectorHashLanes           = 8,
+    kVectorHashStripeSize      = 64,
+    // Stripes between scrambles of the accumulators.
+    kVectorHashStripesPerBlock = 16
+  };
+
+  struct VectorHashKernel
+  {
+    const char* m_Name;
+
+    // Mix whole stripes into the accumulators. The stripe index is where in
+    // the current block the next stripe goes, and is updated.
+    void (*m_Accumulate)(uint64_t acc[kVectorHashLanes], const uint8_t* data, size_t stripe_count, uint32_t* stripe_index);
+  };
+
+  // Kernels this CPU can run, the portable one first and the fastest last.
+  int VectorHashKernelCount();
+  const VectorHashKernel* VectorHashGetKernel(int index);
+
+  void VectorHashInit(uint64_t acc[kVectorHashLanes]);
+
+  void VectorHashFinalize(const uint64_t acc[kVectorHashLanes], uint64_t out[2]);
+}
+
+#endif
@@ -0,0 +1,486 @@
+#include "HttpIo.hpp"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(TUNDRA_UNIX)
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace t2
+{
+
+// Sockets block for at most this long on a stalled peer.
+static const int kSocketTimeoutSeconds = 30;
+
+static bool CopyString(char* dest, size_t dest_size, const char* src, size_t len)
+{
+  if (len >= dest_size)
+    return false;
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+  return true;
+}
+
+bool HttpParseAddress(HttpAddress* out, const char* address)
+{
+  memset(out, 0, sizeof *out);
+
+  if (0 == strncmp(address, "unix:", 5))
+  {
+    out->m_IsUnixSocket = true;
+    return CopyString(out->m_SocketPath, sizeof out->m_SocketPath, address + 5, strlen(address + 5)) && out->m_SocketPath[0];
+  }
+
+  if (0 == strncmp(address, "http://", 7))
+    address += 7;
+  else if (strstr(address, "://"))
+    return false;
+
+  const char* host_end;
+
+  if ('[' == address[0])
+  {
+    // IPv6 literal
+    if (nullptr == (host_end = strchr(address, ']')))
+      return false;
+    if (!CopyString(out->m_Host, sizeof out->m_Host, address + 1, host_end - address - 1))
+      return false;
+    ++host_end;
+  }
+  else
+  {
+    host_end = address + strcspn(address, ":/");
+    if (!CopyString(out->m_Host, sizeof out->m_Host, address, host_end - address))
+      return false;
+  }
+
+  const char* path = host_end;
+
+  if (':' == *host_end)
+  {
+    const char* port     = host_end + 1;
+    size_t      port_len = strspn(port, "0123456789");
+    if (0 == port_len || !CopyString(out->m_Port, sizeof out->m_Port, port, port_len))
+      return false;
+    path = port + port_len;
+  }
+  else
+  {
+    strcpy(out->m_Port, "80");
+  }
+
+  if (*path && '/' != *path)
+    return false;
+
+  size_t path_len = strlen(path);
+  while (path_len > 0 && '/' == path[path_len - 1])
+    --path_len;
+
+  return CopyString(out->m_BasePath, sizeof out->m_BasePath, path, path_len);
+}
+
+#if defined(TUNDRA_UNIX)
+
+static void SetSocketOptions(int fd, bool tcp)
+{
+  struct timeval tv;
+  tv.tv_sec  = kSocketTimeoutSeconds;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+  int one = 1;
+#if defined(SO_NOSIGPIPE)
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof one);
+#endif
+  if (tcp)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+static bool MakeUnixSocketAddress(const HttpAddress* address, struct sockaddr_un* sa)
+{
+  memset(sa, 0, sizeof *sa);
+  sa->sun_family = AF_UNIX;
+  return CopyString(sa->sun_path, sizeof sa->sun_path, address->m_SocketPath, strlen(address->m_SocketPath));
+}
+
+// Connect without blocking for longer than the timeout, so an unreachable
+// server can't hold up the build for minutes.
+static bool ConnectWithTimeout(int fd, const struct sockaddr* sa, socklen_t sa_len, int timeout_ms)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+  bool connected = 0 == connect(fd, sa, sa_len);
+
+  if (!connected && EINPROGRESS == errno)
+  {
+    struct pollfd p;
+    p.fd      = fd;
+    p.events  = POLLOUT;
+    p.revents = 0;
+
+    int       error     = 0;
+    socklen_t error_len = sizeof error;
+
+    connected = 1 == poll(&p, 1, timeout_ms) &&
+                0 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) &&
+                0 == error;
+  }
+
+  fcntl(fd, F_SETFL, flags);
+  return connected;
+}
+
+int HttpConnect(const HttpAddress* address, int timeout_ms)
+{
+  if (address->m_IsUnixSocket)
+  {
+    struct sockaddr_un sa;
+    if (!MakeUnixSocketAddress(address, &sa))
+      return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+
+    if (0 != connect(fd, (struct sockaddr*) &sa, sizeof sa))
+    {
+      close(fd);
+      return -1;
+    }
+
+    SetSocketOptions(fd, false);
+    return fd;
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo* result = nullptr;
+  const char*      host   = address->m_Host[0] ? address->m_Host : "localhost";
+
+  if (0 != getaddrinfo(host, address->m_Port, &hints, &result))
+    return -1;
+
+  int fd = -1;
+
+  for (struct addrinfo* ai = result; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (ConnectWithTimeout(fd, ai->ai_addr, ai->ai_addrlen, timeout_ms))
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(result);
+
+  if (fd >= 0)
+    SetSocketOptions(fd, true);
+
+  return fd;
+}
+
+int HttpListen(const HttpAddress* address)
+{
+  if (address->m_IsUnixSocket)
+  {
+    struct sockaddr_un sa;
+    if (!MakeUnixSocketAddress(address, &sa))
+      return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+
+    // Remove a socket left behind by an earlier server.
+    unlink(address->m_SocketPath);
+
+    if (0 != bind(fd, (struct sockaddr*) &sa, sizeof sa) || 0 != listen(fd, 64))
+    {
+      close(fd);
+      return -1;
+    }
+
+    return fd;
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_PASSIVE;
+
+  struct addrinfo* result = nullptr;
+
+  if (0 != getaddrinfo(address->m_Host[0] ? address->m_Host : nullptr, address->m_Port, &hints, &result))
+    return -1;
+
+  int fd = -1;
+
+  for (struct addrinfo* ai = result; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    if (0 == bind(fd, ai->ai_addr, ai->ai_addrlen) && 0 == listen(fd, 64))
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(result);
+  return fd;
+}
+
+int HttpAccept(int listen_socket)
+{
+  for (;;)
+  {
+    int fd = accept(listen_socket, nullptr, nullptr);
+
+    if (fd < 0 && EINTR == errno)
+      continue;
+
+    if (fd >= 0)
+    {
+      struct sockaddr_storage sa;
+      socklen_t               sa_len = sizeof sa;
+      bool                    tcp    = 0 == getsockname(fd, (struct sockaddr*) &sa, &sa_len) && AF_UNIX != sa.ss_family;
+      SetSocketOptions(fd, tcp);
+    }
+
+    return fd;
+  }
+}
+
+void HttpCloseSocket(int socket)
+{
+  close(socket);
+}
+
+bool HttpWrite(HttpConnection* self, const void* data, size_t size)
+{
+  const char* p = (const char*) data;
+
+#if defined(MSG_NOSIGNAL)
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+
+  while (size > 0)
+  {
+    ssize_t n = send(self->m_Socket, p, size, flags);
+
+    if (n < 0 && EINTR == errno)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    p    += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+static bool FillReadBuffer(HttpConnection* self)
+{
+  for (;;)
+  {
+    ssize_t n = recv(self->m_Socket, self->m_ReadBuffer, sizeof self->m_ReadBuffer, 0);
+
+    if (n < 0 && EINTR == errno)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    self->m_ReadPos = 0;
+    self->m_ReadEnd = uint32_t(n);
+    return true;
+  }
+}
+
+#else
+
+int HttpConnect(const HttpAddress* address, int timeout_ms)
+{
+  return -1;
+}
+
+int HttpListen(const HttpAddress* address)
+{
+  return -1;
+}
+
+int HttpAccept(int listen_socket)
+{
+  return -1;
+}
+
+void HttpCloseSocket(int socket)
+{
+}
+
+bool HttpWrite(HttpConnection* self, const void* data, size_t size)
+{
+  return false;
+}
+
+static bool FillReadBuffer(HttpConnection* self)
+{
+  return false;
+}
+
+#endif
+
+void HttpConnectionInit(HttpConnection* self, int socket)
+{
+  self->m_Socket  = socket;
+  self->m_ReadPos = 0;
+  self->m_ReadEnd = 0;
+}
+
+void HttpConnectionClose(HttpConnection* self)
+{
+  if (self->m_Socket >= 0)
+    HttpCloseSocket(self->m_Socket);
+
+  HttpConnectionInit(self, -1);
+}
+
+bool HttpRead(HttpConnection* self, void* data, size_t size)
+{
+  char* p = (char*) data;
+
+  while (size > 0)
+  {
+    if (self->m_ReadPos == self->m_ReadEnd && !FillReadBuffer(self))
+      return false;
+
+    size_t n = self->m_ReadEnd - self->m_ReadPos;
+    if (n > size)
+      n = size;
+
+    memcpy(p, self->m_ReadBuffer + self->m_ReadPos, n);
+    self->m_ReadPos += uint32_t(n);
+    p               += n;
+    size            -= n;
+  }
+
+  return true;
+}
+
+bool HttpReadHead(HttpConnection* self, char* head, size_t head_size)
+{
+  size_t len = 0;
+
+  for (;;)
+  {
+    if (self->m_ReadPos == self->m_ReadEnd && !FillReadBuffer(self))
+      return false;
+
+    char ch = self->m_ReadBuffer[self->m_ReadPos++];
+
+    if ('\r' == ch)
+      continue;
+
+    if ('\n' == ch)
+    {
+      // An empty line ends the head.
+      if (0 == len || '\n' == head[len - 1])
+        break;
+    }
+
+    if (len + 1 >= head_size)
+      return false;
+
+    head[len++] = ch;
+  }
+
+  head[len] = '\0';
+  return len > 0;
+}
+
+int HttpParseStatus(const char* head)
+{
+  if (0 != strncmp(head, "HTTP/1.", 7))
+    return -1;
+
+  const char* p = strchr(head, ' ');
+  if (!p || !isdigit((unsigned char) p[1]))
+    return -1;
+
+  return atoi(p + 1);
+}
+
+bool HttpParseRequest(const char* head, char* method, size_t method_size, char* path, size_t path_size)
+{
+  const char* method_end = strchr(head, ' ');
+  if (!method_end || !CopyString(method, method_size, head, method_end - head))
+    return false;
+
+  const char* p        = method_end + 1;
+  const char* path_end = p + strcspn(p, " \n");
+  if (' ' != *path_end || 0 != strncmp(path_end + 1, "HTTP/1.", 7))
+    return false;
+
+  return CopyString(path, path_size, p, path_end - p);
+}
+
+int64_t HttpGetContentLength(const char* head)
+{
+  static const char kName[] = "content-length:";
+
+  for (const char* line = strchr(head, '\n'); line; line = strchr(line, '\n'))
+  {
+    ++line;
+
+    size_t i = 0;
+    while (kName[i] && tolower((unsigned char) line[i]) == kName[i])
+      ++i;
+
+    if (kName[i])
+      continue;
+
+    const char* value = line + i;
+    while (' ' == *value || '\t' == *value)
+      ++value;
+
+    if (!isdigit((unsigned char) *value))
+      return -1;
+
+    return strtoll(value, nullptr, 10);
+  }
+
+  return -1;
+}
+
+}
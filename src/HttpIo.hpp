@@ -0,0 +1,67 @@
+#ifndef HTTPIO_HPP
+#define HTTPIO_HPP
+
+#include "Common.hpp"
+#include "PathUtil.hpp"
+
+namespace t2
+{
+  // Where a cache server lives. Either "unix:/path/to/socket", or an HTTP
+  // URL of the form "[http://]host[:port][/base/path]".
+  struct HttpAddress
+  {
+    bool m_IsUnixSocket;
+    char m_Host[256];
+    char m_Port[16];
+    char m_BasePath[256];
+    char m_SocketPath[kMaxPathLength];
+  };
+
+  bool HttpParseAddress(HttpAddress* out, const char* address);
+
+  // Returns a connected socket, or -1 on failure.
+  int HttpConnect(const HttpAddress* address, int timeout_ms);
+
+  // Returns a listening socket, or -1 on failure.
+  int HttpListen(const HttpAddress* address);
+
+  // Wait for a client on a listening socket. Returns -1 on failure.
+  int HttpAccept(int listen_socket);
+
+  void HttpCloseSocket(int socket);
+
+  // Buffered reader and writer over a socket. Both requests and responses are
+  // plain HTTP/1.1 messages that always carry a Content-Length, so a
+  // connection can be reused for any number of them.
+  struct HttpConnection
+  {
+    int      m_Socket;
+    uint32_t m_ReadPos;
+    uint32_t m_ReadEnd;
+    char     m_ReadBuffer[16384];
+  };
+
+  void HttpConnectionInit(HttpConnection* self, int socket);
+
+  // Closes the socket, if any.
+  void HttpConnectionClose(HttpConnection* self);
+
+  bool HttpWrite(HttpConnection* self, const void* data, size_t size);
+
+  bool HttpRead(HttpConnection* self, void* data, size_t size);
+
+  // Read a message head up to and including the blank line that ends it. The
+  // head is stored null terminated, without the blank line.
+  bool HttpReadHead(HttpConnection* self, char* head, size_t head_size);
+
+  // Status code from a response head, or -1 if it isn't one.
+  int HttpParseStatus(const char* head);
+
+  // Method and path from a request head.
+  bool HttpParseRequest(const char* head, char* method, size_t method_size, char* path, size_t path_size);
+
+  // Value of the Content-Length header, or -1 if missing.
+  int64_t HttpGetContentLength(const char* head);
+}
+
+#endif
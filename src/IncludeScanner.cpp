@@ -7,34 +7,54 @@
 
 #include "MemAllocLinear.hpp"
 #include "DagData.hpp"
+#include "CpuKernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TUNDRA_INCLUDE_SCANNER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
 
 namespace t2
 {
 
-static IncludeData*
-ScanCppLine(const char* start, MemAllocLinear* allocator)
+// Lines are scanned in place in the file data, up to the end of the line.
+static const char*
+SkipSpace(const char* start, const char* end)
 {
-	while (isspace(*start))
+	while (start < end && isspace(*start))
 		++start;
+	return start;
+}
 
-	if (*start++ != '#')
+static IncludeData*
+ScanCppLine(const char* start, const char* end, MemAllocLinear* allocator)
+{
+	start = SkipSpace(start, end);
+
+	if (start == end || *start++ != '#')
 		return nullptr;
 
-	while (isspace(*start))
-		++start;
+	start = SkipSpace(start, end);
 	
-	if (0 != strncmp("include", start, 7))
+	if (end - start < 7 || 0 != memcmp("include", start, 7))
 		return nullptr;
 
 	start += 7;
 
-	if (!isspace(*start++))
+	if (start == end || !isspace(*start++))
 		return nullptr;
 
-	while (isspace(*start))
-		++start;
+	start = SkipSpace(start, end);
 
-  IncludeData* dest = LinearAllocate<IncludeData>(allocator);
+	if (start == end)
+		return nullptr;
 
   char closing_separator;
 
@@ -53,6 +73,8 @@ ScanCppLine(const char* start, MemAllocLinear* allocator)
 	const char* str_start = start;
 	for (;;)
 	{
+		if (start == end)
+			return nullptr;
 		char ch = *start++;
 		if (ch == closing_separator)
 			break;
@@ -60,6 +82,8 @@ ScanCppLine(const char* start, MemAllocLinear* allocator)
 			return nullptr;
 	}
 
+  IncludeData* dest = LinearAllocate<IncludeData>(allocator);
+
 	dest->m_StringLen       = (size_t) (start - str_start - 1);
 	dest->m_String          = StrDupN(allocator, str_start, dest->m_StringLen);
 	dest->m_IsSystemInclude = '>' == closing_separator;
@@ -69,16 +93,19 @@ ScanCppLine(const char* start, MemAllocLinear* allocator)
   return dest;
 }
 
-static char*
-GetNextLine(char *p)
+// Where the line starting at p ends, and where the next one starts, or null
+// if it's the last.
+static const char*
+GetNextLine(const char* p, const char* end, const char** line_end)
 {
-  if (char *lf = strchr(p, '\n'))
+  if (const char* lf = (const char*) memchr(p, '\n', size_t(end - p)))
   {
-    *lf = '\0';
+    *line_end = lf;
     return lf + 1;
   }
   else
   {
+    *line_end = end;
     return nullptr;
   }
 }
@@ -110,29 +137,121 @@ struct IncludeDataList
   }
 };
 
+static const char* FindHashScalar(const char* p, const char* end)
+{
+  const char* hash = (const char*) memchr(p, '#', size_t(end - p));
+  return hash ? hash : end;
+}
+
+#if defined(TUNDRA_INCLUDE_SCANNER_X86)
+static const char* FindHashSse2(const char* p, const char* end)
+{
+  const __m128i hash = _mm_set1_epi8('#');
+
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i chars = _mm_loadu_si128((const __m128i*) p);
+    if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, hash)))
+      return p + CountTrailingZeroes(uint32_t(mask));
+  }
+
+  return FindHashScalar(p, end);
+}
+
+TARGET_AVX2
+static const char* FindHashAvx2(const char* p, const char* end)
+{
+  const __m256i hash = _mm256_set1_epi8('#');
+
+  for (; end - p >= 32; p += 32)
+  {
+    __m256i chars = _mm256_loadu_si256((const __m256i*) p);
+    if (uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, hash))))
+      return p + CountTrailingZeroes(mask);
+  }
+
+  return FindHashScalar(p, end);
+}
+#endif
+
+static const IncludeScannerKernel s_ScalarKernel = { "scalar", FindHashScalar };
+#if defined(TUNDRA_INCLUDE_SCANNER_X86)
+static const IncludeScannerKernel s_Sse2Kernel   = { "sse2", FindHashSse2 };
+static const IncludeScannerKernel s_Avx2Kernel   = { "avx2", FindHashAvx2 };
+#endif
+
+static const CpuKernelOption<IncludeScannerKernel> s_KernelOptions[] =
+{
+  { &s_ScalarKernel, 0 },
+#if defined(TUNDRA_INCLUDE_SCANNER_X86)
+  { &s_Sse2Kernel,   kCpuSse2 },
+  { &s_Avx2Kernel,   kCpuAvx2 },
+#endif
+};
+
+static const CpuKernels<IncludeScannerKernel>& GetKernels()
+{
+  static const CpuKernels<IncludeScannerKernel> kernels(s_KernelOptions);
+  return kernels;
+}
+
+int IncludeScannerKernelCount()
+{
+  return GetKernels().m_Count;
+}
+
+const IncludeScannerKernel* IncludeScannerGetKernel(int index)
+{
+  return GetKernels().m_Kernels[index];
+}
+
+// Most lines of a source file have no '#', and only lines where one comes
+// first can be includes. So rather than splitting the file into lines, jump
+// from one '#' to the next and only look at the lines where whitespace alone
+// comes before them.
 IncludeData*
-ScanIncludesCpp(char* buffer, MemAllocLinear* allocator)
+ScanIncludesCpp(const char* buffer, size_t size, MemAllocLinear* allocator)
 {
+  static const IncludeScannerKernel* kernel = IncludeScannerGetKernel(IncludeScannerKernelCount() - 1);
+
   IncludeDataList list;
 
-  char *linep = buffer;
+  const char* const end = buffer + size;
+  const char*       p   = buffer;
 
-  while (linep)
+  while (p < end)
   {
-    char *line = linep;
-    linep = GetNextLine(linep);
+    const char* hash = kernel->m_FindHash(p, end);
+    if (hash == end)
+      break;
+
+    // p is always at the start of a line.
+    const char* line = hash;
+    while (line > p && line[-1] != '\n' && isspace(line[-1]))
+      --line;
 
-    if (IncludeData* d = ScanCppLine(line, allocator))
+    const char* line_end;
+    const char* next = GetNextLine(hash, end, &line_end);
+
+    if (line == p || line[-1] == '\n')
     {
-      list.Add(d);
+      if (IncludeData* d = ScanCppLine(hash, line_end, allocator))
+      {
+        list.Add(d);
+      }
     }
+
+    if (!next)
+      break;
+
+    p = next;
   }
 
   return list.m_Head;
 }
 
 static IncludeData*
-ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericScannerData& config)
+ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const char* end, const GenericScannerData& config)
 {
 	const char *start = start_in;
 	const char *str_start;
@@ -141,8 +260,7 @@ ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericSc
   const bool use_separators = 0 != (config.m_Flags & GenericScannerData::kFlagUseSeparators);
   const bool bare_is_system = 0 != (config.m_Flags & GenericScannerData::kFlagBareMeansSystem);
 
-	while (isspace(*start))
-		++start;
+	start = SkipSpace(start, end);
 
 	if (require_ws && start == start_in)
 		return nullptr;
@@ -151,7 +269,7 @@ ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericSc
 
   for (const KeywordData& kwdata : config.m_Keywords)
   {
-    if (0 == strncmp(kwdata.m_String, start, kwdata.m_StringLength))
+    if (end - start >= kwdata.m_StringLength && 0 == memcmp(kwdata.m_String, start, kwdata.m_StringLength))
     {
       keyword = &kwdata;
       break;
@@ -164,18 +282,20 @@ ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericSc
 	start += keyword->m_StringLength;
 	
   // TDDO: Should make this optional
-	if (!isspace(*start++))
+	if (start == end || !isspace(*start++))
 		return nullptr;
 
-	while (isspace(*start))
-		++start;
+	start = SkipSpace(start, end);
 
-  IncludeData* dest = LinearAllocate<IncludeData>(allocator);
+  bool is_system_include;
 
 	if (use_separators)
 	{
     char closing_separator;
 
+    if (start == end)
+      return nullptr;
+
     switch (*start++)
     {
       case '<':
@@ -194,6 +314,8 @@ ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericSc
 		str_start = start;
 		for (;;)
 		{
+			if (start == end)
+				return 0;
 			char ch = *start++;
 			if (ch == closing_separator)
 				break;
@@ -204,22 +326,25 @@ ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericSc
     // start is pointing to the character after the closing separator, so wind it back one
     start--;
 
-    dest->m_IsSystemInclude = '>' == closing_separator;
+    is_system_include = '>' == closing_separator;
 	}
 	else
 	{
 		str_start = start;
 
 		// just grab the next token 
-		while (*start && !isspace(*start))
+		while (start < end && *start && !isspace(*start))
 			++start;
 
 		if (str_start == start)
 			return 0;
 
-    dest->m_IsSystemInclude = bare_is_system;
+    is_system_include = bare_is_system;
 	}
 
+  IncludeData* dest = LinearAllocate<IncludeData>(allocator);
+
+	dest->m_IsSystemInclude = is_system_include;
 	dest->m_StringLen    = (unsigned short) (start - str_start);
 	dest->m_String       = StrDupN(allocator, str_start, dest->m_StringLen);
 	dest->m_ShouldFollow = keyword->m_ShouldFollow ? true : false;
@@ -227,20 +352,45 @@ ScanLineGeneric(MemAllocLinear* allocator, const char *start_in, const GenericSc
 	return dest;
 }
 
-IncludeData* ScanIncludesGeneric(char* buffer, MemAllocLinear* allocator, const GenericScannerData& config)
+// True for blank lines and lines starting with a keyword, whether or not they
+// turned out to be includes.
+static bool IsPreambleLine(const char* start, const char* end, const GenericScannerData& config)
+{
+  start = SkipSpace(start, end);
+
+  if (start == end)
+    return true;
+
+  for (const KeywordData& kwdata : config.m_Keywords)
+  {
+    if (end - start >= kwdata.m_StringLength && 0 == memcmp(kwdata.m_String, start, kwdata.m_StringLength))
+      return true;
+  }
+
+  return false;
+}
+
+IncludeData* ScanIncludesGeneric(const char* buffer, size_t size, MemAllocLinear* allocator, const GenericScannerData& config)
 {
-  char* linep = buffer;
+  const bool  preamble_only = 0 != (config.m_Flags & GenericScannerData::kFlagStopAfterPreamble);
+  const char* end           = buffer + size;
+  const char* linep         = buffer;
   IncludeDataList includes;
 
   while (linep)
   {
-    char *line_data = linep;
-    linep = GetNextLine(linep);
+    const char* line_data = linep;
+    const char* line_end;
+    linep = GetNextLine(linep, end, &line_end);
 
-    if (IncludeData* d = ScanLineGeneric(allocator, line_data, config))
+    if (IncludeData* d = ScanLineGeneric(allocator, line_data, line_end, config))
     {
       includes.Add(d);
     }
+    else if (preamble_only && !IsPreambleLine(line_data, line_end, config))
+    {
+      break;
+    }
   }
 
   return includes.m_Head;
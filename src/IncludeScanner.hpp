@@ -20,15 +20,27 @@ struct IncludeData
   IncludeData *m_Next;
 };
 
-// Scan C/C++ style #includes from buffer.
-// Buffer must be null-terminated and will be modified in place.
+// Scan C/C++ style #includes from a buffer of file data, such as a mapped
+// file. The buffer isn't modified and needn't be null-terminated.
 IncludeData*
-ScanIncludesCpp(char* buffer, MemAllocLinear* allocator);
+ScanIncludesCpp(const char* buffer, size_t size, MemAllocLinear* allocator);
 
-// Scan generic includes from buffer (slower, customizable).
-// Buffer must be null-terminated and will be modified in place.
+// Finds the first '#' in [p, end), or returns end. The C/C++ scanner only
+// looks closer at lines where one of these starts the line.
+struct IncludeScannerKernel
+{
+  const char* m_Name;
+  const char* (*m_FindHash)(const char* p, const char* end);
+};
+
+// Kernels this CPU can run, the portable one first and the fastest last.
+int IncludeScannerKernelCount();
+const IncludeScannerKernel* IncludeScannerGetKernel(int index);
+
+// Scan generic includes from a buffer of file data (slower, customizable).
+// The buffer isn't modified and needn't be null-terminated.
 IncludeData*
-ScanIncludesGeneric(char* buffer, MemAllocLinear* allocator, const GenericScannerData& config);
+ScanIncludesGeneric(const char* buffer, size_t size, MemAllocLinear* allocator, const GenericScannerData& config);
 
 }
 
@@ -3,6 +3,8 @@
 #include "StateData.hpp"
 #include "ScanData.hpp"
 #include "DigestCache.hpp"
+#include "StatCache.hpp"
+#include "ActionCache.hpp"
 #include "MemoryMappedFile.hpp"
 
 #include <stdio.h>
@@ -35,6 +37,11 @@ static void DumpDag(const DagData* data)
     printf("  annotation: %s\n", node.m_Annotation.Get());
     printf("  pass index: %d\n", node.m_PassIndex);
 
+    printf("  action args (%s):", node.m_ActionArgs.GetCount() ? "direct" : "shell");
+    for (const FrozenString& arg : node.m_ActionArgs)
+      printf(" \"%s\"", arg.Get());
+    printf("\n");
+
     printf("  dependencies:");
     for (int32_t dep : node.m_Dependencies)
       printf(" %d", dep);
@@ -98,6 +105,8 @@ static void DumpDag(const DagData* data)
           printf(" UseSeparators");
         if (GenericScannerData::kFlagBareMeansSystem & gs->m_Flags)
           printf(" BareMeansSystem");
+        if (GenericScannerData::kFlagStopAfterPreamble & gs->m_Flags)
+          printf(" StopAfterPreamble");
         printf("\n");
 
         printf("    keywords:\n");
@@ -116,6 +125,10 @@ static void DumpDag(const DagData* data)
   for (const PassData& pass : data->m_Passes)
   {
     printf("  pass: %s\n", pass.m_PassName.Get());
+    for (int32_t dep : pass.m_Dependencies)
+    {
+      printf("    waits for: %s\n", data->m_Passes[dep].m_PassName.Get());
+    }
   }
 
   printf("\nconfig count: %d\n", data->m_ConfigCount);
@@ -181,7 +194,18 @@ static void DumpDag(const DagData* data)
     printf("hash            : 0x%08x\n", ext);
   }
 
+  printf("Sign every file by content: %s\n", data->m_SignByContent ? "yes" : "no");
+
   printf("\nMax expensive jobs: %d\n", data->m_MaxExpensiveCount);
+  printf("Overlap passes: %s\n", data->m_OverlapPasses ? "yes" : "no");
+  if (const char* dir = data->m_ActionCacheDir)
+    printf("Action cache: %s (%d MB)\n", dir, data->m_ActionCacheSizeMb);
+  else
+    printf("Action cache: disabled\n");
+  if (const char* url = data->m_RemoteCacheUrl)
+    printf("Remote cache: %s (%s)\n", url, data->m_RemoteCacheUpload ? "read/write" : "read only");
+  else
+    printf("Remote cache: disabled\n");
 }
 
 static void DumpState(const StateData* data)
@@ -207,6 +231,28 @@ static void DumpState(const StateData* data)
     printf("  aux outputs:\n");
     for (const char* path : node.m_AuxOutputFiles)
       printf("    %s\n", path);
+    printf("  action time: %u ms\n", node.m_ActionTimeMs);
+    if (node.m_OutputDigests.GetCount() > 0)
+    {
+      printf("  output digests:\n");
+      for (const HashDigest& digest : node.m_OutputDigests)
+      {
+        DigestToString(digest_str, digest);
+        printf("    %s\n", digest_str);
+      }
+    }
+    if (node.m_ImplicitDepCounts.GetCount() > 0)
+    {
+      DigestToString(digest_str, node.m_ImplicitDepsFingerprint);
+      printf("  implicit deps fingerprint: %s\n", digest_str);
+      printf("  implicit deps per input:");
+      for (int32_t count : node.m_ImplicitDepCounts)
+        printf(" %d", count);
+      printf("\n");
+      printf("  implicit deps:\n");
+      for (const FrozenFileAndHash& dep : node.m_ImplicitDeps)
+        printf("    %s\n", dep.m_Filename.Get());
+    }
     printf("\n");
   }
 }
@@ -231,6 +277,25 @@ static void DumpScanCache(const ScanData* data)
     for (const FrozenFileAndHash& path : entry.m_IncludedFiles)
       printf("    %s (0x%08x)\n", path.m_Filename.Get(), path.m_FilenameHash);
   }
+
+  printf("include resolution count: %d\n", data->m_ResolutionCount);
+  for (int i = 0; i < data->m_ResolutionCount; ++i)
+  {
+    char digest_str[kDigestStringSize];
+
+    const FrozenIncludeResolution& resolution = data->m_Resolutions[i];
+
+    DigestToString(digest_str, data->m_ResolutionKeys[i]);
+    printf("resolution %s:\n", digest_str);
+    printf("  access time stamp: %llu\n", (long long unsigned int) data->m_ResolutionAccessTimes[i]);
+    printf("  found: %s\n", resolution.m_Path.Get() ? resolution.m_Path.Get() : "(nowhere)");
+    printf("  directories searched:\n");
+    for (int32_t dir_index : resolution.m_Dirs)
+      printf("    %s\n", data->m_IncludeDirs[dir_index].m_Path.Get());
+  }
+
+  printf("entry index: %d slots\n", data->m_KeyIndex.GetCount());
+  printf("include resolution index: %d slots\n", data->m_ResolutionIndex.GetCount());
 }
 
 static const char* FmtTime(uint64_t t)
@@ -244,6 +309,7 @@ static const char* FmtTime(uint64_t t)
 static void DumpDigestCache(const DigestCacheState* data)
 {
   printf("record count: %d\n", data->m_Records.GetCount());
+  printf("index slots: %d\n", data->m_Index.GetCount());
   for (const FrozenDigestRecord& r : data->m_Records)
   {
     char digest_str[kDigestStringSize];
@@ -253,10 +319,70 @@ static void DumpDigestCache(const DigestCacheState* data)
     printf("  digest SHA1  : %s\n", digest_str);
     printf("  access time  : %s\n", FmtTime(r.m_AccessTime));
     printf("  timestamp    : %s\n", FmtTime(r.m_Timestamp));
+    printf("  size         : %llu\n", (long long unsigned int) r.m_Size);
+    printf("  change stamp : %016llx\n", (long long unsigned int) r.m_ChangeStamp);
     printf("\n");
   }
 }
 
+static void DumpStatCache(const StatCacheState* data)
+{
+  printf("directory count: %d\n", data->m_Dirs.GetCount());
+  for (const FrozenStatDir& d : data->m_Dirs)
+  {
+    printf("  path         : %s\n", d.m_Path.Get());
+    if (d.m_Exists)
+    {
+      printf("  timestamp    : %s.%09u\n", FmtTime(d.m_Timestamp / 1000000000), unsigned(d.m_Timestamp % 1000000000));
+      printf("  identity     : %016llx\n", (unsigned long long) d.m_Identity);
+    }
+    else
+    {
+      printf("  (doesn't exist)\n");
+    }
+    printf("\n");
+  }
+
+  printf("missing file count: %d\n", data->m_Misses.GetCount());
+  for (const FrozenStatMiss& m : data->m_Misses)
+  {
+    printf("  %s (directory %d)\n", m.m_Path.Get(), m.m_DirIndex);
+  }
+}
+
+static void DumpActionCache(const ActionCacheState* data)
+{
+  static const char* const kind_names[] = { "object", "action" };
+
+  uint64_t total_size = 0;
+  int      kind_counts[2] = { 0, 0 };
+
+  for (const ActionCacheRecord& r : data->m_Records)
+  {
+    total_size += r.m_Size;
+    kind_counts[r.m_Kind]++;
+  }
+
+  const uint64_t lookups = data->m_HitCount + data->m_MissCount;
+
+  printf("hits:      %llu\n", (long long unsigned int) data->m_HitCount);
+  printf("misses:    %llu\n", (long long unsigned int) data->m_MissCount);
+  printf("hit rate:  %.1f%%\n", lookups ? 100.0 * data->m_HitCount / lookups : 0.0);
+  printf("stores:    %llu\n", (long long unsigned int) data->m_StoreCount);
+  printf("evictions: %llu\n", (long long unsigned int) data->m_EvictCount);
+  printf("objects:   %d\n", kind_counts[ActionCacheRecord::kKindObject]);
+  printf("actions:   %d\n", kind_counts[ActionCacheRecord::kKindAction]);
+  printf("size:      %.2f MB\n", total_size / (1024.0 * 1024.0));
+  printf("\n");
+
+  for (const ActionCacheRecord& r : data->m_Records)
+  {
+    char digest_str[kDigestStringSize];
+    DigestToString(digest_str, r.m_Digest);
+    printf("  %s %s %10llu bytes, last used %s\n", kind_names[r.m_Kind], digest_str, (long long unsigned int) r.m_Size, FmtTime(r.m_AccessTime));
+  }
+}
+
 int main(int argc, char* argv[])
 {
   MemoryMappedFile f;
@@ -318,6 +444,30 @@ int main(int argc, char* argv[])
         fprintf(stderr, "%s: bad magic number\n", fn);
       }
     }
+    else if (0 == strcmp(suffix, ".statcache"))
+    {
+      const StatCacheState* data = (const StatCacheState*) f.m_Address;
+      if (data->m_MagicNumber == StatCacheState::MagicNumber)
+      {
+        DumpStatCache(data);
+      }
+      else
+      {
+        fprintf(stderr, "%s: bad magic number\n", fn);
+      }
+    }
+    else if (0 == strcmp(suffix, ".actioncache"))
+    {
+      const ActionCacheState* data = (const ActionCacheState*) f.m_Address;
+      if (data->m_MagicNumber == ActionCacheState::MagicNumber)
+      {
+        DumpActionCache(data);
+      }
+      else
+      {
+        fprintf(stderr, "%s: bad magic number\n", fn);
+      }
+    }
     else
     {
       fprintf(stderr, "%s: unknown file type\n", fn);
@@ -5,6 +5,7 @@
 #include "SignalHandler.hpp"
 #include "DagGenerator.hpp"
 #include "Profiler.hpp"
+#include "BuildServer.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,6 +43,8 @@ static const struct OptionTemplate
 } g_OptionTemplates[] = {
   { 'j', "threads", OptionType::kInt, offsetof(t2::DriverOptions, m_ThreadCount),
   "Specify number of build threads" },
+  { 'a', "actions", OptionType::kInt, offsetof(t2::DriverOptions, m_ActionCount),
+  "Specify number of actions to run at once (Linux; default: number of build threads)" },
   { 'n', "dry-run", OptionType::kBool, offsetof(t2::DriverOptions, m_DryRun),
   "Don't actually execute any build actions" },
   { 'f', "force-dag-regen", OptionType::kBool, offsetof(t2::DriverOptions, m_ForceDagRegen),
@@ -76,6 +79,13 @@ static const struct OptionTemplate
     "Show help" },
   { 'k', "continue", OptionType::kBool, offsetof(t2::DriverOptions, m_ContinueOnError),
     "Continue building on error" },
+  { 'W', "work-stealing", OptionType::kBool, offsetof(t2::DriverOptions, m_WorkStealing),
+    "Use per-thread work queues with work stealing" },
+  { 'd', "daemon", OptionType::kBool, offsetof(t2::DriverOptions, m_UseBuildServer),
+    "Build through a build server that keeps caches loaded between runs" },
+  { 'K', "kill-daemon", OptionType::kBool, offsetof(t2::DriverOptions, m_StopBuildServer),
+    "Stop the build server for this directory" },
+  { 'Z', "build-server", OptionType::kBool, offsetof(t2::DriverOptions, m_RunBuildServer), nullptr },
 #if defined(TUNDRA_WIN32)
   { 'U', "unprotected", OptionType::kBool, offsetof(t2::DriverOptions, m_RunUnprotected), "Run unprotected (same process group - for debugging)" },
 #endif
@@ -246,6 +256,232 @@ static void ShowHelp()
 }
 
 
+static void InitLogging(const t2::DriverOptions& options)
+{
+  using namespace t2;
+
+  int log_flags = kWarning | kError;
+
+  if (options.m_DebugMessages)
+    log_flags |= kInfo | kDebug;
+
+  if (options.m_SpammyVerbose)
+    log_flags |= kSpam | kInfo | kDebug;
+
+  SetLogFlags(log_flags);
+}
+
+// Build with a driver that has its data loaded.
+static t2::BuildResult::Enum RunDriver(t2::Driver* driver, int argc, char** argv)
+{
+  using namespace t2;
+
+  if (driver->m_Options.m_GenDagOnly)
+  {
+    Log(kDebug, "Only generating DAG - quitting");
+    return BuildResult::kOk;
+  }
+
+  if (driver->m_Options.m_ShowTargets)
+  {
+    DriverShowTargets(driver);
+    Log(kDebug, "Only showing targets - quitting");
+    return BuildResult::kOk;
+  }
+
+  DriverRemoveStaleOutputs(driver);
+
+  // Prepare list of nodes to build/clean/rebuild
+  if (!DriverPrepareNodes(driver, (const char**) argv, argc))
+  {
+    Log(kError, "couldn't set up list of targets to build");
+    return BuildResult::kSetupError;
+  }
+
+  if (driver->m_Options.m_Clean || driver->m_Options.m_Rebuild)
+  {
+    DriverCleanOutputs(driver);
+
+    if (!driver->m_Options.m_Rebuild)
+      return BuildResult::kOk;
+  }
+
+  BuildResult::Enum build_result = DriverBuild(driver);
+
+  if (!DriverSaveBuildState(driver))
+    Log(kError, "Couldn't save build state");
+
+  if (!DriverSaveScanCache(driver))
+    Log(kWarning, "Couldn't save header scanning cache");
+
+  if (!DriverSaveDigestCache(driver))
+    Log(kWarning, "Couldn't save SHA1 digest cache");
+
+  if (!DriverSaveStatCache(driver))
+    Log(kWarning, "Couldn't save stat cache");
+
+  if (!DriverSaveActionCache(driver))
+    Log(kWarning, "Couldn't save action cache index");
+
+  return build_result;
+}
+
+// Print stats and the result of a build, and return the exit code.
+static int ReportResult(const t2::DriverOptions& options, t2::BuildResult::Enum build_result, uint64_t start_time)
+{
+  using namespace t2;
+
+  // Dump stats
+  if (options.m_DisplayStats)
+  {
+    printf("output cleanup:    %10.2f ms\n", TimerToSeconds(g_Stats.m_StaleCheckTimeCycles) * 1000.0);
+    printf("json parse time:   %10.2f ms\n", TimerToSeconds(g_Stats.m_JsonParseTimeCycles) * 1000.0);
+    printf("scan cache:\n");
+    printf("  hits (new):      %10u\n", g_Stats.m_NewScanCacheHits);
+    printf("  hits (frozen):   %10u\n", g_Stats.m_OldScanCacheHits);
+    printf("  misses:          %10u\n", g_Stats.m_ScanCacheMisses);
+    printf("  inserts:         %10u\n", g_Stats.m_ScanCacheInserts);
+    printf("  save time:       %10.2f ms\n", TimerToSeconds(g_Stats.m_ScanCacheSaveTime) * 1000.0);
+    printf("  entries dropped: %10u\n", g_Stats.m_ScanCacheEntriesDropped);
+    printf("  include hits:    %10u\n", g_Stats.m_IncludeCacheHits);
+    printf("  include misses:  %10u\n", g_Stats.m_IncludeCacheMisses);
+    printf("  closure hits:    %10u\n", g_Stats.m_ClosureCacheHits);
+    printf("  closure misses:  %10u\n", g_Stats.m_ClosureCacheMisses);
+    printf("  deps reused:     %10u\n", g_Stats.m_ImplicitDepsReused);
+    printf("  deps scanned:    %10u\n", g_Stats.m_ImplicitDepsScanned);
+    printf("file signing:\n");
+    printf("  cache hits:      %10u\n", g_Stats.m_DigestCacheHits);
+    printf("  cache get time:  %10.2f ms\n", TimerToSeconds(g_Stats.m_DigestCacheGetTimeCycles) * 1000.0);
+    printf("  cache save time: %10.2f ms\n", TimerToSeconds(g_Stats.m_DigestCacheSaveTimeCycles) * 1000.0);
+    printf("  digests:         %10u\n", g_Stats.m_FileDigestCount);
+    printf("  digest time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_FileDigestTimeCycles) * 1000.0);
+    printf("  digest waits:    %10u\n", g_Stats.m_FileDigestWaits);
+    printf("  prefetched:      %10u\n", g_Stats.m_FileDigestPrefetches);
+    printf("action cache:\n");
+    printf("  hits:            %10u\n", g_Stats.m_ActionCacheHits);
+    printf("  misses:          %10u\n", g_Stats.m_ActionCacheMisses);
+    printf("  stores:          %10u\n", g_Stats.m_ActionCacheStores);
+    printf("  evictions:       %10u\n", g_Stats.m_ActionCacheEvictions);
+    printf("  restore time:    %10.2f ms\n", TimerToSeconds(g_Stats.m_ActionCacheRestoreTimeCycles) * 1000.0);
+    printf("  store time:      %10.2f ms\n", TimerToSeconds(g_Stats.m_ActionCacheStoreTimeCycles) * 1000.0);
+    printf("remote cache:\n");
+    printf("  hits:            %10u\n", g_Stats.m_RemoteCacheHits);
+    printf("  misses:          %10u\n", g_Stats.m_RemoteCacheMisses);
+    printf("  uploads:         %10u\n", g_Stats.m_RemoteCacheUploads);
+    printf("  downloaded:      %10.2f MB\n", g_Stats.m_RemoteCacheBytesDown / double(MB(1)));
+    printf("  uploaded:        %10.2f MB\n", g_Stats.m_RemoteCacheBytesUp / double(MB(1)));
+    printf("  lookup time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_RemoteCacheFetchTimeCycles) * 1000.0);
+    printf("stat cache:\n");
+    printf("  hits:            %10u\n", g_Stats.m_StatCacheHits);
+    printf("  misses:          %10u\n", g_Stats.m_StatCacheMisses);
+    printf("  dirty:           %10u\n", g_Stats.m_StatCacheDirty);
+    printf("  seeded:          %10u\n", g_Stats.m_StatCacheSeeded);
+    printf("  known missing:   %10u\n", g_Stats.m_StatCacheKnownMissing);
+    printf("  dirs listed:     %10u\n", g_Stats.m_StatCacheDirsListed);
+    printf("  listed misses:   %10u\n", g_Stats.m_StatCacheListedMisses);
+    printf("  save time:       %10.2f ms\n", TimerToSeconds(g_Stats.m_StatCacheSaveTimeCycles) * 1000.0);
+    printf("building:\n");
+    printf("  old records:     %10u\n", g_Stats.m_StateSaveOld);
+    printf("  new records:     %10u\n", g_Stats.m_StateSaveNew);
+    printf("  dropped records: %10u\n", g_Stats.m_StateSaveDropped);
+    printf("  state save time: %10.2f ms\n", TimerToSeconds(g_Stats.m_StateSaveTimeCycles) * 1000.0);
+    printf("  exec() count:    %10u\n", g_Stats.m_ExecCount);
+    printf("  same outputs:    %10u\n", g_Stats.m_OutputDigestsUnchanged);
+    printf("  exec() time:     %10.2f s\n", TimerToSeconds(g_Stats.m_ExecTimeCycles));
+    printf("  nodes stolen:    %10u\n", g_Stats.m_StealCount);
+    printf("low-level syscalls:\n");
+    printf("  mmap() calls:    %10u\n", g_Stats.m_MmapCalls);
+    printf("  mmap() time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_MmapTimeCycles) * 1000.0);
+    printf("  munmap() calls:  %10u\n", g_Stats.m_MunmapCalls);
+    printf("  munmap() time:   %10.2f ms\n", TimerToSeconds(g_Stats.m_MunmapTimeCycles) * 1000.0);
+    printf("  stat() calls:    %10u\n", g_Stats.m_StatCount);
+    printf("  stat() time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_StatTimeCycles) * 1000.0);
+  }
+
+  if (!options.m_Quiet)
+  {
+    double total_time = TimerDiffSeconds(start_time, TimerGet());
+    if (total_time < 60.0)
+    {
+      printf("*** %s (%.2f seconds)\n", BuildResult::Names[build_result], total_time);
+    }
+    else
+    {
+      int t = (int)total_time;
+      int h = t / 3600; t -= h * 3600;
+      int m = t / 60; t -= m * 60;
+      int s = t;
+      printf("*** %s (%.2f seconds - %d:%02d:%02d)\n", BuildResult::Names[build_result], total_time, h, m, s);
+    }
+  }
+
+  return build_result == BuildResult::kOk ? 0 : 1;
+}
+
+struct BuildServerState
+{
+  t2::Driver* m_Driver;
+  bool        m_DriverLoaded;
+};
+
+// Run a build for a build server client. The driver is kept from one build
+// to the next for as long as the DAG stays valid and the clients'
+// environment doesn't change.
+static int ServeBuildRequest(void* user_data, int argc, char** argv, bool env_changed)
+{
+  using namespace t2;
+
+  BuildServerState* state      = static_cast<BuildServerState*>(user_data);
+  Driver*           driver     = state->m_Driver;
+  uint64_t          start_time = TimerGet();
+
+  DriverOptions options;
+  DriverOptionsInit(&options);
+
+  if (!InitOptions(&options, &argc, &argv))
+  {
+    ShowHelp();
+    return 1;
+  }
+
+  // The client has already changed to the build directory.
+  options.m_WorkingDir = nullptr;
+
+  InitLogging(options);
+
+  memset(&g_Stats, 0, sizeof g_Stats);
+
+  DriverInitializeTundraFilePaths(&options);
+
+  if (state->m_DriverLoaded && (env_changed || !DriverReuseData(driver, &options)))
+  {
+    Log(kDebug, "build server reloading everything");
+    DriverDestroy(driver);
+    state->m_DriverLoaded = false;
+  }
+
+  if (options.m_ProfileOutput)
+    ProfilerInit(options.m_ProfileOutput, options.m_ThreadCount);
+
+  BuildResult::Enum build_result = BuildResult::kSetupError;
+
+  if (!state->m_DriverLoaded && DriverInit(driver, &options))
+  {
+    state->m_DriverLoaded = DriverInitData(driver);
+
+    if (!state->m_DriverLoaded)
+      DriverDestroy(driver);
+  }
+
+  if (state->m_DriverLoaded)
+    build_result = RunDriver(driver, argc, argv);
+
+  if (options.m_ProfileOutput)
+    ProfilerDestroy();
+
+  return ReportResult(options, build_result, start_time);
+}
+
 int main(int argc, char* argv[])
 {
   using namespace t2;
@@ -258,6 +494,10 @@ int main(int argc, char* argv[])
   // Set default options
   DriverOptionsInit(&options);
 
+  // Build servers are handed the whole command line.
+  int    all_argc = argc;
+  char** all_argv = argv;
+
   // Scan options from command line, update argc/argv
   if (!InitOptions(&options, &argc, &argv))
   {
@@ -266,6 +506,46 @@ int main(int argc, char* argv[])
   }
 
   DriverInitializeTundraFilePaths(&options);
+
+  if (const char* use_server = getenv("TUNDRA_DAEMON"))
+  {
+    if (use_server[0] && 0 != strcmp(use_server, "0"))
+      options.m_UseBuildServer = true;
+  }
+
+  // Let a build server do the work if asked to, unless we are one.
+  if ((options.m_UseBuildServer || options.m_StopBuildServer) && !options.m_RunBuildServer &&
+      !options.m_ShowHelp && !options.m_IdeGen && !options.m_QuickstartGen)
+  {
+#if defined(TUNDRA_UNIX)
+    InitLogging(options);
+
+    if (options.m_WorkingDir)
+    {
+      if (!SetCwd(options.m_WorkingDir))
+        Croak("couldn't change directory to %s", options.m_WorkingDir);
+
+      options.m_WorkingDir = nullptr;
+    }
+
+    if (options.m_StopBuildServer)
+    {
+      if (!BuildClientStop(options.m_DAGFileName))
+        printf("no build server is running here\n");
+      return 0;
+    }
+
+    int exit_code;
+    if (BuildClientRun(options.m_DAGFileName, options.m_ThreadCount, DriverActionCount(&options), all_argc, all_argv, &exit_code))
+      return exit_code;
+#else
+    fprintf(stderr, "build servers aren't supported on this platform; building without one\n");
+
+    if (options.m_StopBuildServer)
+      return 0;
+#endif
+  }
+
 #if defined(TUNDRA_WIN32)
   if (!options.m_RunUnprotected && nullptr == getenv("_TUNDRA2_PARENT_PROCESS_HANDLE"))
   {
@@ -334,7 +614,23 @@ int main(int argc, char* argv[])
 
   uint64_t start_time = TimerGet();
 
-  ExecInit(options.m_ThreadCount);
+  ExecInit(options.m_ThreadCount, DriverActionCount(&options));
+
+#if defined(TUNDRA_UNIX)
+  if (options.m_RunBuildServer)
+  {
+    BuildServerState state;
+    state.m_Driver       = &driver;
+    state.m_DriverLoaded = false;
+
+    int exit_code = BuildServerRun(options.m_DAGFileName, options.m_ThreadCount, DriverActionCount(&options), ServeBuildRequest, &state);
+
+    if (state.m_DriverLoaded)
+      DriverDestroy(&driver);
+
+    return exit_code;
+  }
+#endif
 
   if (options.m_WorkingDir)
   {
@@ -348,16 +644,7 @@ int main(int argc, char* argv[])
     return 0;
   }
 
-  // Initialize logging
-  int log_flags = kWarning | kError;
-
-  if (options.m_DebugMessages)
-    log_flags |= kInfo | kDebug;
-
-  if (options.m_SpammyVerbose)
-    log_flags |= kSpam | kInfo | kDebug;
-
-  SetLogFlags(log_flags);
+  InitLogging(options);
 
   if (options.m_IdeGen)
   {
@@ -426,118 +713,16 @@ int main(int argc, char* argv[])
 
   BuildResult::Enum build_result = BuildResult::kSetupError;
 
-  if (!DriverInitData(&driver))
-    goto leave;
+  if (DriverInitData(&driver))
+    build_result = RunDriver(&driver, argc, argv);
 
-  if (driver.m_Options.m_GenDagOnly)
-  {
-    Log(kDebug, "Only generating DAG - quitting");
-    build_result = BuildResult::kOk;
-    goto leave;
-  }
-
-  if (driver.m_Options.m_ShowTargets)
-  {
-    DriverShowTargets(&driver);
-    Log(kDebug, "Only showing targets - quitting");
-    build_result = BuildResult::kOk;
-    goto leave;
-  }
-
-  DriverRemoveStaleOutputs(&driver);
-
-  // Prepare list of nodes to build/clean/rebuild
-  if (!DriverPrepareNodes(&driver, (const char**) argv, argc))
-  {
-    Log(kError, "couldn't set up list of targets to build");
-    goto leave;
-  }
-
-  if (driver.m_Options.m_Clean || driver.m_Options.m_Rebuild)
-  {
-    DriverCleanOutputs(&driver);
-
-    if (!driver.m_Options.m_Rebuild)
-    {
-      build_result = BuildResult::kOk;
-      goto leave;
-    }
-  }
-
-  build_result = DriverBuild(&driver);
-
-  if (!DriverSaveBuildState(&driver))
-    Log(kError, "Couldn't save build state");
-
-  if (!DriverSaveScanCache(&driver))
-    Log(kWarning, "Couldn't save header scanning cache");
-
-  if (!DriverSaveDigestCache(&driver))
-    Log(kWarning, "Couldn't save SHA1 digest cache");
-
-leave:
   DriverDestroy(&driver);
 
   // Dump/close profiler
   if (driver.m_Options.m_ProfileOutput)
     ProfilerDestroy();
 
-  // Dump stats
-  if (options.m_DisplayStats)
-  {
-    printf("output cleanup:    %10.2f ms\n", TimerToSeconds(g_Stats.m_StaleCheckTimeCycles) * 1000.0);
-    printf("json parse time:   %10.2f ms\n", TimerToSeconds(g_Stats.m_JsonParseTimeCycles) * 1000.0);
-    printf("scan cache:\n");
-    printf("  hits (new):      %10u\n", g_Stats.m_NewScanCacheHits);
-    printf("  hits (frozen):   %10u\n", g_Stats.m_OldScanCacheHits);
-    printf("  misses:          %10u\n", g_Stats.m_ScanCacheMisses);
-    printf("  inserts:         %10u\n", g_Stats.m_ScanCacheInserts);
-    printf("  save time:       %10.2f ms\n", TimerToSeconds(g_Stats.m_ScanCacheSaveTime) * 1000.0);
-    printf("  entries dropped: %10u\n", g_Stats.m_ScanCacheEntriesDropped);
-    printf("file signing:\n");
-    printf("  cache hits:      %10u\n", g_Stats.m_DigestCacheHits);
-    printf("  cache get time:  %10.2f ms\n", TimerToSeconds(g_Stats.m_DigestCacheGetTimeCycles) * 1000.0);
-    printf("  cache save time: %10.2f ms\n", TimerToSeconds(g_Stats.m_DigestCacheSaveTimeCycles) * 1000.0);
-    printf("  digests:         %10u\n", g_Stats.m_FileDigestCount);
-    printf("  digest time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_FileDigestTimeCycles) * 1000.0);
-    printf("stat cache:\n");
-    printf("  hits:            %10u\n", g_Stats.m_StatCacheHits);
-    printf("  misses:          %10u\n", g_Stats.m_StatCacheMisses);
-    printf("  dirty:           %10u\n", g_Stats.m_StatCacheDirty);
-    printf("building:\n");
-    printf("  old records:     %10u\n", g_Stats.m_StateSaveOld);
-    printf("  new records:     %10u\n", g_Stats.m_StateSaveNew);
-    printf("  dropped records: %10u\n", g_Stats.m_StateSaveDropped);
-    printf("  state save time: %10.2f ms\n", TimerToSeconds(g_Stats.m_StateSaveTimeCycles) * 1000.0);
-    printf("  exec() count:    %10u\n", g_Stats.m_ExecCount);
-    printf("  exec() time:     %10.2f s\n", TimerToSeconds(g_Stats.m_ExecTimeCycles));
-    printf("low-level syscalls:\n");
-    printf("  mmap() calls:    %10u\n", g_Stats.m_MmapCalls);
-    printf("  mmap() time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_MmapTimeCycles) * 1000.0);
-    printf("  munmap() calls:  %10u\n", g_Stats.m_MunmapCalls);
-    printf("  munmap() time:   %10.2f ms\n", TimerToSeconds(g_Stats.m_MunmapTimeCycles) * 1000.0);
-    printf("  stat() calls:    %10u\n", g_Stats.m_StatCount);
-    printf("  stat() time:     %10.2f ms\n", TimerToSeconds(g_Stats.m_StatTimeCycles) * 1000.0);
-  }
-
-  if (!options.m_Quiet)
-  {
-    double total_time = TimerDiffSeconds(start_time, TimerGet());
-    if (total_time < 60.0)
-    {
-      printf("*** %s (%.2f seconds)\n", BuildResult::Names[build_result], total_time);
-    }
-    else
-    {
-      int t = (int)total_time;
-      int h = t / 3600; t -= h * 3600;
-      int m = t / 60; t -= m * 60;
-      int s = t;
-      printf("*** %s (%.2f seconds - %d:%02d:%02d)\n", BuildResult::Names[build_result], total_time, h, m, s);
-    }
-  }
-
-  return build_result == BuildResult::kOk ? 0 : 1;
+  return ReportResult(options, build_result, start_time);
 
   // Match up nodes to nodes in the build state
   //   Walk DAG node array in parallel with build state node array
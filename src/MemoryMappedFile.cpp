@@ -48,14 +48,14 @@ void MmapFileMap(MemoryMappedFile* self, const char *fn)
     goto error;
 
   struct stat stbuf;
-  if (0 != fstat(fd, &stbuf))
+  if (0 != fstat(fd, &stbuf) || 0 == stbuf.st_size)
     goto error;
 
   self->m_Address    = mmap(NULL, stbuf.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
   self->m_Size       = stbuf.st_size;
   self->m_SysData[0] = fd;
 
-  if (self->m_Address)
+  if (MAP_FAILED != self->m_Address)
     return;
 
 error:
@@ -109,6 +109,13 @@ void MmapFileMap(MemoryMappedFile* self, const char *fn)
 
   const uint64_t file_size = GetFileSize64(file);
 
+  // There's no mapping an empty file.
+  if (0 == file_size)
+  {
+    CloseHandle(file);
+    return;
+  }
+
   HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, DWORD(file_size >> 32), DWORD(file_size), NULL);
   if (nullptr == mapping)
   {
@@ -12,9 +12,9 @@ namespace BuildProgress
   enum Enum
   {
     kInitial         = 0,
-    kBlocked         = 1,
     kUnblocked       = 2,
     kRunAction       = 3,
+    kRunningAction   = 4,
     kSucceeded       = 100,
     kUpToDate        = 101,
     kFailed          = 102,
@@ -26,6 +26,12 @@ namespace NodeStateFlags
 {
   static const uint16_t kQueued = 1 << 0;
   static const uint16_t kActive = 1 << 1;
+  // m_ActionCacheKey has been computed, and the remote cache asked for it if
+  // there is one.
+  static const uint16_t kCacheKeyValid = 1 << 2;
+  // The node's pass was skipped because a pass it waits for failed, so it
+  // completed without running.
+  static const uint16_t kSkipped = 1 << 3;
 }
 
 struct NodeData;
@@ -43,10 +49,42 @@ struct NodeState
   int32_t                   m_FailedDependencyCount;
   int32_t                   m_BuildResult;
 
+  // Number of dependencies that haven't completed yet. Decremented atomically
+  // as dependencies complete; the node is ready to run when it reaches zero.
+  int32_t                   m_PendingDependencyCount;
+
+  // Wall time of the node's action in milliseconds. Carried over from the
+  // previous build state, and updated if the action runs.
+  uint32_t                  m_ActionTimeMs;
+
+  // Estimated time in milliseconds from starting this node until the longest
+  // chain of nodes depending on it has finished. Used to dispatch nodes on
+  // the critical path first.
+  uint64_t                  m_CriticalPathMs;
+
+  // Content digests of the output files, in output file order. Only set for
+  // nodes flagged to digest their outputs, once the action has run. Owned by
+  // the driver heap.
+  HashDigest*               m_OutputDigests;
+
+  // Files included by the node's inputs, directly or not, in input file
+  // order. m_ImplicitDepCounts has how many of them each input has, and is
+  // only set once they've been found. Owned by the driver heap.
   int32_t                   m_ImplicitDepCount;
-  const char**              m_ImplicitDeps;
+  FileAndHash*              m_ImplicitDeps;
+  int32_t*                  m_ImplicitDepCounts;
+  HashDigest                m_ImplicitDepsFingerprint;
 
   HashDigest                m_InputSignature;
+
+  // Action cache key, computed before the node runs if the remote cache is
+  // in use so it doesn't need computing again after the lookup.
+  HashDigest                m_ActionCacheKey;
+
+  // While the action runs asynchronously: when it started, and the slot its
+  // process runs in once that has exited.
+  uint64_t                  m_ActionStartTime;
+  int32_t                   m_ExecSlot;
 };
 
 inline bool NodeStateIsCompleted(const NodeState* state)
@@ -84,12 +122,6 @@ inline void NodeStateFlagInactive(NodeState* state)
   state->m_Flags &= ~NodeStateFlags::kActive;
 }
 
-
-inline bool NodeStateIsBlocked(const NodeState* state)
-{
-  return BuildProgress::kBlocked == state->m_Progress;
-}
-
 }
 
 #endif
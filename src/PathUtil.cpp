@@ -344,6 +344,34 @@ void PathFormatPartial(char (&output)[kMaxPathLength], const PathBuffer* buffer,
   *cursor = 0;
 }
 
-}
+bool PathDirectoryOf(char (&output)[kMaxPathLength], const char* path)
+{
+  const char* sep = strrchr(path, '/');
+#if defined(TUNDRA_WIN32)
+  if (const char* bsep = strrchr(path, '\\'))
+  {
+    if (!sep || bsep > sep)
+      sep = bsep;
+  }
+#endif
+
+  if (!sep)
+  {
+    strcpy(output, ".");
+    return true;
+  }
 
+  // Keep the separator of a root directory, as in "/" or "c:\".
+  size_t len = sep - path;
+  if (0 == len || ':' == sep[-1])
+    ++len;
+
+  if (len >= sizeof output)
+    return false;
 
+  memcpy(output, path, len);
+  output[len] = '\0';
+  return true;
+}
+
+}
@@ -87,6 +87,11 @@ namespace t2
 
   void PathFormat(char (&output)[kMaxPathLength], const PathBuffer* buffer);
   void PathFormatPartial(char (&output)[kMaxPathLength], const PathBuffer* buffer, int start_seg, int end_seg);
+
+  // Directory of a file path as it's written, without normalizing it: "a/b"
+  // gives "a", "b" gives "." and "/b" gives "/". Returns false if it doesn't
+  // fit.
+  bool PathDirectoryOf(char (&output)[kMaxPathLength], const char* path);
 }
 
 #endif
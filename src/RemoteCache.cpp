@@ -0,0 +1,570 @@
+#include "RemoteCache.hpp"
+#include "ActionCache.hpp"
+#include "Atomic.hpp"
+#include "FileInfo.hpp"
+#include "MemAllocHeap.hpp"
+#include "SignalHandler.hpp"
+#include "Stats.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace t2
+{
+
+// How long to wait for the server to accept a connection.
+static const int kConnectTimeoutMs = 3000;
+
+// Action entries are a few bytes per output; anything bigger is bogus.
+static const int64_t kMaxEntrySize = 1024 * 1024;
+
+static const char* const s_KindPaths[] = { "cas", "ac" };
+
+static void GoOffline(RemoteCache* cache)
+{
+  MutexLock(&cache->m_Lock);
+  bool was_online = !cache->m_Offline;
+  cache->m_Offline = true;
+  MutexUnlock(&cache->m_Lock);
+
+  if (was_online)
+    Log(kWarning, "remote cache %s isn't responding; building without it", cache->m_Url);
+}
+
+static bool SendRequest(RemoteCacheWorker* self, const char* method, uint32_t kind, const HashDigest& digest, const void* data, FILE* file, uint64_t size)
+{
+  const HttpAddress* address = &self->m_Cache->m_Address;
+  HttpConnection*    conn    = &self->m_Connection;
+
+  char digest_str[kDigestStringSize];
+  DigestToString(digest_str, digest);
+
+  char head[1024];
+  int  len = snprintf(head, sizeof head, "%s %s/%s/%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %llu\r\n\r\n",
+                      method, address->m_BasePath, s_KindPaths[kind], digest_str,
+                      address->m_Host[0] ? address->m_Host : "localhost", (unsigned long long) size);
+
+  if (!HttpWrite(conn, head, len))
+    return false;
+
+  if (data)
+    return HttpWrite(conn, data, size);
+
+  if (file)
+  {
+    rewind(file);
+
+    char     buffer[65536];
+    uint64_t remaining = size;
+
+    while (remaining > 0)
+    {
+      size_t chunk = remaining < sizeof buffer ? size_t(remaining) : sizeof buffer;
+      if (chunk != fread(buffer, 1, chunk, file) || !HttpWrite(conn, buffer, chunk))
+        return false;
+      remaining -= chunk;
+    }
+  }
+
+  return true;
+}
+
+// Send a request and read the head of the response. Returns the status code,
+// or -1 if the server couldn't be reached. A kept-alive connection the server
+// has since closed is retried once on a fresh one.
+static int Transact(RemoteCacheWorker* self, const char* method, uint32_t kind, const HashDigest& digest,
+                    const void* data, FILE* file, uint64_t size, int64_t* content_length_out)
+{
+  HttpConnection* conn = &self->m_Connection;
+
+  for (int attempt = 0; attempt < 2; ++attempt)
+  {
+    bool reused = conn->m_Socket >= 0;
+
+    if (!reused)
+    {
+      int socket = HttpConnect(&self->m_Cache->m_Address, kConnectTimeoutMs);
+      if (socket < 0)
+        return -1;
+      HttpConnectionInit(conn, socket);
+    }
+
+    char head[4096];
+    if (SendRequest(self, method, kind, digest, data, file, size) && HttpReadHead(conn, head, sizeof head))
+    {
+      int     status         = HttpParseStatus(head);
+      int64_t content_length = HttpGetContentLength(head);
+
+      if (status > 0 && content_length >= 0)
+      {
+        *content_length_out = content_length;
+        return status;
+      }
+
+      Log(kDebug, "remote cache: malformed response");
+      HttpConnectionClose(conn);
+      return -1;
+    }
+
+    HttpConnectionClose(conn);
+
+    if (!reused)
+      break;
+  }
+
+  return -1;
+}
+
+static bool SkipBody(RemoteCacheWorker* self, int64_t size)
+{
+  char buffer[4096];
+
+  while (size > 0)
+  {
+    size_t chunk = size < int64_t(sizeof buffer) ? size_t(size) : sizeof buffer;
+
+    if (!HttpRead(&self->m_Connection, buffer, chunk))
+    {
+      HttpConnectionClose(&self->m_Connection);
+      return false;
+    }
+
+    size -= chunk;
+  }
+
+  return true;
+}
+
+// Stream a response body into a temporary file in the local action cache.
+static bool ReceiveFile(RemoteCacheWorker* self, const char* tmp_path, int64_t size, HashDigest* digest_out)
+{
+  FILE* f = fopen(tmp_path, "wb");
+  if (!f)
+  {
+    SkipBody(self, size);
+    return false;
+  }
+
+  HashState h;
+  HashInit(&h);
+
+  bool    success   = true;
+  int64_t remaining = size;
+  char    buffer[65536];
+
+  while (remaining > 0)
+  {
+    size_t chunk = remaining < int64_t(sizeof buffer) ? size_t(remaining) : sizeof buffer;
+
+    if (!HttpRead(&self->m_Connection, buffer, chunk))
+    {
+      HttpConnectionClose(&self->m_Connection);
+      success = false;
+      break;
+    }
+
+    HashUpdate(&h, buffer, chunk);
+
+    if (success && chunk != fwrite(buffer, 1, chunk, f))
+      success = false;
+
+    remaining -= chunk;
+  }
+
+  if (0 != fclose(f))
+    success = false;
+
+  if (!success)
+  {
+    remove(tmp_path);
+    return false;
+  }
+
+  HashFinalize(&h, digest_out);
+  AtomicAdd(&g_Stats.m_RemoteCacheBytesDown, uint64_t(size));
+  return true;
+}
+
+static bool FetchObject(RemoteCacheWorker* self, const HashDigest& digest)
+{
+  ActionCache* action_cache = self->m_Cache->m_ActionCache;
+  int64_t      size         = 0;
+  int          status       = Transact(self, "GET", ActionCacheRecord::kKindObject, digest, nullptr, nullptr, 0, &size);
+
+  if (status < 0)
+  {
+    GoOffline(self->m_Cache);
+    return false;
+  }
+
+  if (200 != status)
+  {
+    SkipBody(self, size);
+    return false;
+  }
+
+  char tmp_path[kMaxPathLength];
+  ActionCacheTempPath(action_cache, tmp_path);
+
+  HashDigest received;
+  if (!ReceiveFile(self, tmp_path, size, &received))
+    return false;
+
+  // Never let a damaged object into the local cache, where it would be
+  // restored as a build output.
+  if (received != digest)
+  {
+    char digest_str[kDigestStringSize];
+    DigestToString(digest_str, digest);
+    Log(kWarning, "remote cache: object %s has the wrong contents", digest_str);
+    remove(tmp_path);
+    return false;
+  }
+
+  return ActionCacheImport(action_cache, ActionCacheRecord::kKindObject, digest, tmp_path, uint64_t(size));
+}
+
+// Download an action entry and whatever objects of it the local cache is
+// missing. The entry is imported last, so the local cache never has an entry
+// without its objects.
+static bool FetchEntry(RemoteCacheWorker* self, const HashDigest& key)
+{
+  RemoteCache* cache        = self->m_Cache;
+  ActionCache* action_cache = cache->m_ActionCache;
+  int64_t      size         = 0;
+  int          status       = Transact(self, "GET", ActionCacheRecord::kKindAction, key, nullptr, nullptr, 0, &size);
+
+  if (status < 0)
+  {
+    GoOffline(cache);
+    return false;
+  }
+
+  if (size > kMaxEntrySize)
+  {
+    HttpConnectionClose(&self->m_Connection);
+    return false;
+  }
+
+  if (200 != status)
+  {
+    SkipBody(self, size);
+    return false;
+  }
+
+  char* entry = (char*) HeapAllocate(cache->m_Heap, size_t(size) + 1);
+  bool  success = HttpRead(&self->m_Connection, entry, size_t(size));
+
+  if (!success)
+    HttpConnectionClose(&self->m_Connection);
+
+  int         output_count = success ? ActionCacheParseEntry(entry, size_t(size), nullptr, 0) : -1;
+  HashDigest* digests      = nullptr;
+
+  if (output_count >= 0)
+  {
+    digests = HeapAllocateArray<HashDigest>(cache->m_Heap, output_count + 1);
+    ActionCacheParseEntry(entry, size_t(size), digests, output_count);
+  }
+  else
+  {
+    success = false;
+  }
+
+  for (int i = 0; success && i < output_count; ++i)
+  {
+    char path[kMaxPathLength];
+    ActionCachePath(action_cache, ActionCacheRecord::kKindObject, digests[i], path);
+
+    if (!GetFileInfo(path).Exists())
+      success = FetchObject(self, digests[i]);
+  }
+
+  if (success)
+  {
+    char tmp_path[kMaxPathLength];
+    ActionCacheTempPath(action_cache, tmp_path);
+
+    FILE* f = fopen(tmp_path, "wb");
+    success = nullptr != f && size_t(size) == fwrite(entry, 1, size_t(size), f);
+
+    if (f && 0 != fclose(f))
+      success = false;
+
+    if (success)
+      success = ActionCacheImport(action_cache, ActionCacheRecord::kKindAction, key, tmp_path, uint64_t(size));
+    else
+      remove(tmp_path);
+  }
+
+  HeapFree(cache->m_Heap, digests);
+  HeapFree(cache->m_Heap, entry);
+  return success;
+}
+
+static bool UploadFile(RemoteCacheWorker* self, uint32_t kind, const HashDigest& digest, const void* data, FILE* file, uint64_t size)
+{
+  int64_t response_size = 0;
+  int     status        = Transact(self, "PUT", kind, digest, data, file, size, &response_size);
+
+  if (status < 0)
+  {
+    GoOffline(self->m_Cache);
+    return false;
+  }
+
+  SkipBody(self, response_size);
+
+  if (status < 200 || status > 299)
+  {
+    Log(kDebug, "remote cache: upload failed with status %d", status);
+    return false;
+  }
+
+  AtomicAdd(&g_Stats.m_RemoteCacheBytesUp, size);
+  return true;
+}
+
+static bool UploadObject(RemoteCacheWorker* self, const HashDigest& digest)
+{
+  // Outputs are often identical across actions and machines, so see if the
+  // server has the object before sending it.
+  int64_t size   = 0;
+  int     status = Transact(self, "HEAD", ActionCacheRecord::kKindObject, digest, nullptr, nullptr, 0, &size);
+
+  if (status < 0)
+  {
+    GoOffline(self->m_Cache);
+    return false;
+  }
+
+  if (200 == status)
+    return true;
+
+  char path[kMaxPathLength];
+  ActionCachePath(self->m_Cache->m_ActionCache, ActionCacheRecord::kKindObject, digest, path);
+
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return false;
+
+  FileInfo info    = GetFileInfo(path);
+  bool     success = UploadFile(self, ActionCacheRecord::kKindObject, digest, nullptr, f, info.m_Size);
+
+  fclose(f);
+  return success;
+}
+
+// Objects go up before the entry that refers to them, so other machines
+// never see an entry they can't restore.
+static void UploadEntry(RemoteCacheWorker* self, const HashDigest& key)
+{
+  RemoteCache* cache = self->m_Cache;
+
+  char path[kMaxPathLength];
+  ActionCachePath(cache->m_ActionCache, ActionCacheRecord::kKindAction, key, path);
+
+  FileInfo info = GetFileInfo(path);
+  if (!info.Exists() || int64_t(info.m_Size) > kMaxEntrySize)
+    return;
+
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return;
+
+  size_t size  = size_t(info.m_Size);
+  char*  entry = (char*) HeapAllocate(cache->m_Heap, size + 1);
+  bool   valid = size == fread(entry, 1, size, f);
+  fclose(f);
+
+  int         output_count = valid ? ActionCacheParseEntry(entry, size, nullptr, 0) : -1;
+  HashDigest* digests      = nullptr;
+  bool        success      = output_count >= 0;
+
+  if (success)
+  {
+    digests = HeapAllocateArray<HashDigest>(cache->m_Heap, output_count + 1);
+    ActionCacheParseEntry(entry, size, digests, output_count);
+  }
+
+  for (int i = 0; success && i < output_count; ++i)
+    success = UploadObject(self, digests[i]);
+
+  if (success && UploadFile(self, ActionCacheRecord::kKindAction, key, entry, nullptr, size))
+    AtomicIncrement(&g_Stats.m_RemoteCacheUploads);
+
+  HeapFree(cache->m_Heap, digests);
+  HeapFree(cache->m_Heap, entry);
+}
+
+static ThreadRoutineReturnType TUNDRA_STDCALL RemoteCacheThreadRoutine(void* param)
+{
+  RemoteCacheWorker* self  = static_cast<RemoteCacheWorker*>(param);
+  RemoteCache*       cache = self->m_Cache;
+
+  for (;;)
+  {
+    MutexLock(&cache->m_Lock);
+
+    while (!cache->m_Quit && cache->m_LookupHead == cache->m_Lookups.m_Size && 0 == cache->m_Uploads.m_Size)
+      CondWait(&cache->m_WorkAvailable, &cache->m_Lock);
+
+    bool              is_lookup = false;
+    bool              is_upload = false;
+    RemoteCacheLookup lookup;
+    HashDigest        upload_key;
+
+    if (cache->m_LookupHead < cache->m_Lookups.m_Size)
+    {
+      lookup    = cache->m_Lookups[cache->m_LookupHead++];
+      is_lookup = true;
+
+      if (cache->m_LookupHead == cache->m_Lookups.m_Size)
+      {
+        BufferClear(&cache->m_Lookups);
+        cache->m_LookupHead = 0;
+      }
+    }
+    else if (cache->m_Uploads.m_Size > 0)
+    {
+      upload_key = BufferPopOne(&cache->m_Uploads);
+      is_upload  = true;
+    }
+
+    bool offline = cache->m_Offline || nullptr != SignalGetReason();
+
+    MutexUnlock(&cache->m_Lock);
+
+    if (is_lookup)
+    {
+      TimingScope timing_scope(nullptr, &g_Stats.m_RemoteCacheFetchTimeCycles);
+
+      bool hit = !offline && FetchEntry(self, lookup.m_Key);
+
+      AtomicIncrement(hit ? &g_Stats.m_RemoteCacheHits : &g_Stats.m_RemoteCacheMisses);
+
+      lookup.m_Callback(lookup.m_Context, lookup.m_Tag, hit);
+
+      MutexLock(&cache->m_Lock);
+      if (0 == --cache->m_LookupsInFlight)
+        CondBroadcast(&cache->m_LookupsDone);
+      MutexUnlock(&cache->m_Lock);
+    }
+    else if (is_upload)
+    {
+      if (!offline)
+        UploadEntry(self, upload_key);
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  HttpConnectionClose(&self->m_Connection);
+  return 0;
+}
+
+bool RemoteCacheInit(RemoteCache* self, MemAllocHeap* heap, ActionCache* action_cache, const char* url, bool upload)
+{
+  if (!HttpParseAddress(&self->m_Address, url))
+  {
+    Log(kWarning, "bad remote cache address %s; expected unix:<path> or http://<host>[:<port>][/<path>]", url);
+    return false;
+  }
+
+#if !defined(TUNDRA_UNIX)
+  Log(kWarning, "the remote cache isn't supported on this platform");
+  return false;
+#endif
+
+  self->m_Url             = url;
+  self->m_ActionCache     = action_cache;
+  self->m_Heap            = heap;
+  self->m_Upload          = upload;
+  self->m_Offline         = false;
+  self->m_Quit            = false;
+  self->m_LookupHead      = 0;
+  self->m_LookupsInFlight = 0;
+
+  MutexInit(&self->m_Lock);
+  CondInit(&self->m_WorkAvailable);
+  CondInit(&self->m_LookupsDone);
+  BufferInit(&self->m_Lookups);
+  BufferInit(&self->m_Uploads);
+
+  for (RemoteCacheWorker& worker : self->m_Workers)
+  {
+    worker.m_Cache = self;
+    HttpConnectionInit(&worker.m_Connection, -1);
+    worker.m_Thread = ThreadStart(RemoteCacheThreadRoutine, &worker);
+  }
+
+  return true;
+}
+
+void RemoteCacheDestroy(RemoteCache* self)
+{
+  MutexLock(&self->m_Lock);
+  self->m_Quit = true;
+  if (self->m_Uploads.m_Size > 0)
+    Log(kDebug, "remote cache: finishing %d uploads", int(self->m_Uploads.m_Size));
+  CondBroadcast(&self->m_WorkAvailable);
+  MutexUnlock(&self->m_Lock);
+
+  for (RemoteCacheWorker& worker : self->m_Workers)
+    ThreadJoin(worker.m_Thread);
+
+  BufferDestroy(&self->m_Uploads, self->m_Heap);
+  BufferDestroy(&self->m_Lookups, self->m_Heap);
+  CondDestroy(&self->m_LookupsDone);
+  CondDestroy(&self->m_WorkAvailable);
+  MutexDestroy(&self->m_Lock);
+}
+
+bool RemoteCacheIsOnline(RemoteCache* self)
+{
+  MutexLock(&self->m_Lock);
+  bool online = !self->m_Offline;
+  MutexUnlock(&self->m_Lock);
+  return online;
+}
+
+void RemoteCacheFetch(RemoteCache* self, const HashDigest& key, RemoteCacheCallback callback, void* context, int32_t tag)
+{
+  RemoteCacheLookup lookup;
+  lookup.m_Key      = key;
+  lookup.m_Callback = callback;
+  lookup.m_Context  = context;
+  lookup.m_Tag      = tag;
+
+  MutexLock(&self->m_Lock);
+  BufferAppendOne(&self->m_Lookups, self->m_Heap, lookup);
+  ++self->m_LookupsInFlight;
+  CondSignal(&self->m_WorkAvailable);
+  MutexUnlock(&self->m_Lock);
+}
+
+void RemoteCacheUpload(RemoteCache* self, const HashDigest& key)
+{
+  if (!self->m_Upload)
+    return;
+
+  MutexLock(&self->m_Lock);
+  if (!self->m_Offline)
+  {
+    BufferAppendOne(&self->m_Uploads, self->m_Heap, key);
+    CondSignal(&self->m_WorkAvailable);
+  }
+  MutexUnlock(&self->m_Lock);
+}
+
+void RemoteCacheWaitForLookups(RemoteCache* self)
+{
+  MutexLock(&self->m_Lock);
+  while (self->m_LookupsInFlight > 0)
+    CondWait(&self->m_LookupsDone, &self->m_Lock);
+  MutexUnlock(&self->m_Lock);
+}
+
+}
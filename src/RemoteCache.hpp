@@ -0,0 +1,92 @@
+#ifndef REMOTECACHE_HPP
+#define REMOTECACHE_HPP
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "ConditionVar.hpp"
+#include "Hash.hpp"
+#include "HttpIo.hpp"
+#include "Mutex.hpp"
+#include "Thread.hpp"
+
+namespace t2
+{
+  struct ActionCache;
+  struct MemAllocHeap;
+  struct RemoteCache;
+
+  enum
+  {
+    kRemoteCacheThreadCount = 4
+  };
+
+  // Called on a remote cache thread when a lookup has finished. On a hit the
+  // entry and its objects are now in the local action cache.
+  typedef void (*RemoteCacheCallback)(void* context, int32_t tag, bool hit);
+
+  struct RemoteCacheLookup
+  {
+    HashDigest          m_Key;
+    RemoteCacheCallback m_Callback;
+    void*               m_Context;
+    int32_t             m_Tag;
+  };
+
+  struct RemoteCacheWorker
+  {
+    RemoteCache*        m_Cache;
+    ThreadId            m_Thread;
+    HttpConnection      m_Connection;
+  };
+
+  // Shared action cache tier on a server, spoken to over HTTP or a unix
+  // socket. Action entries live under <base>/ac/<key> and output files under
+  // <base>/cas/<content digest>, the same split as the local action cache.
+  // Build threads only ever queue requests; the network traffic happens on
+  // the remote cache's own threads, which move whole files between the
+  // server and the local action cache.
+  struct RemoteCache
+  {
+    HttpAddress                m_Address;
+    const char*                m_Url;
+    ActionCache*               m_ActionCache;
+    MemAllocHeap*              m_Heap;
+    bool                       m_Upload;
+
+    // Set once the server fails to respond. Everything after that is a miss,
+    // so a dead server costs one timeout rather than one per node.
+    bool                       m_Offline;
+
+    Mutex                      m_Lock;
+    ConditionVariable          m_WorkAvailable;
+    ConditionVariable          m_LookupsDone;
+    bool                       m_Quit;
+
+    // Lookups are served before uploads, as build threads are waiting on them.
+    Buffer<RemoteCacheLookup>  m_Lookups;
+    size_t                     m_LookupHead;
+    int32_t                    m_LookupsInFlight;
+    Buffer<HashDigest>         m_Uploads;
+
+    RemoteCacheWorker          m_Workers[kRemoteCacheThreadCount];
+  };
+
+  bool RemoteCacheInit(RemoteCache* self, MemAllocHeap* heap, ActionCache* action_cache, const char* url, bool upload);
+
+  // Finishes queued uploads before returning.
+  void RemoteCacheDestroy(RemoteCache* self);
+
+  bool RemoteCacheIsOnline(RemoteCache* self);
+
+  // Queue a lookup of an action key. The callback is always called exactly
+  // once, from another thread, possibly before this returns.
+  void RemoteCacheFetch(RemoteCache* self, const HashDigest& key, RemoteCacheCallback callback, void* context, int32_t tag);
+
+  // Queue an upload of an entry that's in the local action cache.
+  void RemoteCacheUpload(RemoteCache* self, const HashDigest& key);
+
+  // Block until every queued lookup has called back.
+  void RemoteCacheWaitForLookups(RemoteCache* self);
+}
+
+#endif
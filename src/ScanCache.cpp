@@ -10,6 +10,7 @@
 #include "SortedArrayUtil.hpp"
 #include "HashTable.hpp"
 #include "Profiler.hpp"
+#include "StatCache.hpp"
 
 #include <algorithm>
 #include <time.h>
@@ -23,9 +24,48 @@ struct ScanCache::Record
   uint64_t            m_FileTimestamp;
   int                 m_IncludeCount;
   FileAndHash        *m_Includes;
-  Record             *m_Next;
 };
 
+// Open-addressed table of records, probed linearly. Slots only ever go from
+// empty to a record, or from a record to a newer one with the same key.
+struct ScanCache::RecordTable
+{
+  uint32_t            m_Size;
+  Record            **m_Slots;
+};
+
+struct ScanCache::Resolution
+{
+  HashDigest          m_Key;
+  uint32_t            m_Generation;
+  const char         *m_Path;
+  uint32_t            m_PathHash;
+  int                 m_DirCount;
+  int32_t            *m_Dirs;
+  Resolution         *m_Next;
+};
+
+struct ScanCache::Closure
+{
+  HashDigest          m_Key;
+  uint64_t            m_FileTimestamp;
+  uint32_t            m_CheckedWriteCount;  // stat cache write count when last found good
+  int                 m_FileCount;
+  FileAndHash        *m_Files;
+  uint64_t           *m_Timestamps;
+  Closure            *m_Next;
+};
+
+namespace FrozenDirCheck
+{
+  enum Enum
+  {
+    kUnchanged = 1,
+    kChanged   = 2,
+    kShift     = 2
+  };
+}
+
 void ComputeScanCacheKey(
     HashDigest*        key_out,
     const char*        filename,
@@ -42,6 +82,31 @@ void ComputeScanCacheKey(
   key_out->m_Words64[1] = scanner_hash.m_Words64[1];
 #endif
 }
+
+void ComputeIncludeKey(
+    HashDigest*        key_out,
+    const HashDigest&  scanner_hash,
+    const char*        including_dir,
+    const char*        include)
+{
+  HashState h;
+  HashInit(&h);
+  HashUpdate(&h, scanner_hash.m_Data, sizeof scanner_hash.m_Data);
+
+  if (including_dir)
+  {
+    HashAddInteger(&h, 1);
+    HashAddPath(&h, including_dir);
+  }
+  else
+  {
+    HashAddInteger(&h, 0);
+  }
+
+  HashAddSeparator(&h);
+  HashAddString(&h, include);
+  HashFinalize(&h, key_out);
+}
     
 void ScanCacheInit(ScanCache* self, MemAllocHeap* heap, MemAllocLinear* allocator)
 {
@@ -49,17 +114,39 @@ void ScanCacheInit(ScanCache* self, MemAllocHeap* heap, MemAllocLinear* allocato
   self->m_Heap             = heap;
   self->m_Allocator        = allocator;
   self->m_RecordCount      = 0;
-  self->m_TableSize        = 0;
-  self->m_Table            = nullptr;
+  self->m_Records          = nullptr;
+  BufferInit(&self->m_OldRecordTables);
   self->m_FrozenAccess     = nullptr;
 
+  self->m_ResolutionCount        = 0;
+  self->m_ResolutionTableSize    = 0;
+  self->m_ResolutionTable        = nullptr;
+  HashTableInit(&self->m_DirLookup, heap);
+  BufferInit(&self->m_Dirs);
+  self->m_FrozenDirChecks        = nullptr;
+  self->m_FrozenResolutionAccess = nullptr;
+  self->m_StartTime              = time(nullptr);
+
+  self->m_ClosureCount           = 0;
+  self->m_ClosureTableSize       = 0;
+  self->m_ClosureTable           = nullptr;
+
   ReadWriteLockInit(&self->m_Lock);
 }
 
 void ScanCacheDestroy(ScanCache* self)
 {
+  HeapFree(self->m_Heap, self->m_ClosureTable);
+  HeapFree(self->m_Heap, self->m_FrozenResolutionAccess);
+  HeapFree(self->m_Heap, self->m_FrozenDirChecks);
+  BufferDestroy(&self->m_Dirs, self->m_Heap);
+  HashTableDestroy(&self->m_DirLookup);
+  HeapFree(self->m_Heap, self->m_ResolutionTable);
   HeapFree(self->m_Heap, self->m_FrozenAccess);
-  HeapFree(self->m_Heap, self->m_Table);
+  for (ScanCache::RecordTable* table : self->m_OldRecordTables)
+    HeapFree(self->m_Heap, table);
+  BufferDestroy(&self->m_OldRecordTables, self->m_Heap);
+  HeapFree(self->m_Heap, self->m_Records);
   ReadWriteLockDestroy(&self->m_Lock);
 }
 
@@ -70,8 +157,11 @@ void ScanCacheSetCache(ScanCache* self, const ScanData* frozen_data)
   if (frozen_data)
   {
     self->m_FrozenAccess = HeapAllocateArrayZeroed<uint8_t>(self->m_Heap, frozen_data->m_EntryCount);
+    self->m_FrozenDirChecks = HeapAllocateArrayZeroed<uint32_t>(self->m_Heap, frozen_data->m_IncludeDirs.GetCount());
+    self->m_FrozenResolutionAccess = HeapAllocateArrayZeroed<uint8_t>(self->m_Heap, frozen_data->m_ResolutionCount);
 
-    Log(kDebug, "Scan cache initialized from frozen data - %u entries", frozen_data->m_EntryCount);
+    Log(kDebug, "Scan cache initialized from frozen data - %u entries, %u include resolutions",
+        frozen_data->m_EntryCount, frozen_data->m_ResolutionCount);
 
 #if ENABLED(CHECKED_BUILD)
     // Paranoia - make sure the cache is sorted.
@@ -80,24 +170,34 @@ void ScanCacheSetCache(ScanCache* self, const ScanData* frozen_data)
       if (frozen_data->m_Keys[i] < frozen_data->m_Keys[i - 1])
         Croak("Header scanning cache is not sorted");
     }
+
+    for (int i = 1, count = frozen_data->m_ResolutionCount; i < count; ++i)
+    {
+      if (frozen_data->m_ResolutionKeys[i] < frozen_data->m_ResolutionKeys[i - 1])
+        Croak("Include resolution cache is not sorted");
+    }
 #endif
   }
 }
 
-static ScanCache::Record* LookupDynamic(ScanCache* self, const HashDigest& key)
+// Scan cache keys only differ from the scanner's hash in the first word.
+static uint32_t KeyHash(const HashDigest& key)
 {
-  uint32_t table_size = self->m_TableSize;
+#if ENABLED(USE_SHA1_HASH)
+  return uint32_t(key.m_Words.m_A);
+#elif ENABLED(USE_128BIT_DIGEST)
+  return key.m_Words32[0];
+#endif
+}
 
+template <typename T>
+static T* LookupDynamic(T** table, uint32_t table_size, const HashDigest& key)
+{
   if (table_size > 0)
   {
-#if ENABLED(USE_SHA1_HASH)
-    const uint32_t hash = key.m_Words.m_C;
-#elif ENABLED(USE_FAST_HASH)
-    const uint32_t hash = key.m_Words32[0];
-#endif
-    uint32_t index = hash & (table_size - 1);
+    uint32_t index = KeyHash(key) & (table_size - 1);
 
-    ScanCache::Record* chain = self->m_Table[index];
+    T* chain = table[index];
     while (chain)
     {
       if (key == chain->m_Key)
@@ -112,6 +212,53 @@ static ScanCache::Record* LookupDynamic(ScanCache* self, const HashDigest& key)
   return nullptr;
 }
 
+// Index of a key in the frozen data, or -1.
+static int32_t FrozenKeyLookup(const FrozenArray<FrozenKeySlot>& index, const HashDigest* keys, const HashDigest& key)
+{
+  uint32_t size = index.GetCount();
+
+  if (0 == size)
+    return -1;
+
+  uint32_t hash = KeyHash(key);
+  uint32_t mask = size - 1;
+
+  for (uint32_t i = hash & mask; ; i = (i + 1) & mask)
+  {
+    const FrozenKeySlot& slot = index[i];
+
+    if (slot.m_Index < 0)
+      return -1;
+
+    if (slot.m_Hash == hash && keys[slot.m_Index] == key)
+      return slot.m_Index;
+  }
+}
+
+// Slot holding a key, or the empty slot it would go in.
+static uint32_t FindRecordSlot(const ScanCache::RecordTable* table, const HashDigest& key)
+{
+  uint32_t mask = table->m_Size - 1;
+
+  for (uint32_t i = KeyHash(key) & mask; ; i = (i + 1) & mask)
+  {
+    ScanCache::Record* record = AtomicLoadAcquire(&table->m_Slots[i]);
+
+    if (!record || key == record->m_Key)
+      return i;
+  }
+}
+
+static ScanCache::Record* LookupRecord(ScanCache* self, const HashDigest& key)
+{
+  ScanCache::RecordTable* table = AtomicLoadAcquire(&self->m_Records);
+
+  if (!table)
+    return nullptr;
+
+  return AtomicLoadAcquire(&table->m_Slots[FindRecordSlot(table, key)]);
+}
+
 bool ScanCacheLookup(ScanCache* self, const HashDigest& key, uint64_t timestamp, ScanCacheLookupResult* result_out, MemAllocLinear* scratch)
 {
   bool success = false;
@@ -123,11 +270,10 @@ bool ScanCacheLookup(ScanCache* self, const HashDigest& key, uint64_t timestamp,
 
   if (scan_data)
   {
-    const int32_t count = scan_data->m_EntryCount;
+    int32_t index = FrozenKeyLookup(scan_data->m_KeyIndex, scan_data->m_Keys.Get(), key);
 
-    if (const HashDigest* ptr = BinarySearch(scan_data->m_Keys.Get(), count, key))
+    if (index >= 0)
     {
-      int                   index      = int(ptr - scan_data->m_Keys.Get());
       const ScanCacheEntry *entry      = scan_data->m_Data.Get() + index;
 
       if (entry->m_FileTimestamp == timestamp)
@@ -162,9 +308,7 @@ bool ScanCacheLookup(ScanCache* self, const HashDigest& key, uint64_t timestamp,
     result_out->m_IncludedFileCount = 0;
     result_out->m_IncludedFiles     = nullptr;
 
-    ReadWriteLockRead(&self->m_Lock);
-
-    if (ScanCache::Record* record = LookupDynamic(self, key))
+    if (ScanCache::Record* record = LookupRecord(self, key))
     {
       if (record->m_FileTimestamp == timestamp)
       {
@@ -174,8 +318,6 @@ bool ScanCacheLookup(ScanCache* self, const HashDigest& key, uint64_t timestamp,
       }
     }
 
-    ReadWriteUnlockRead(&self->m_Lock);
-
     if (success)
     {
       AtomicIncrement(&g_Stats.m_NewScanCacheHits);
@@ -190,39 +332,34 @@ bool ScanCacheLookup(ScanCache* self, const HashDigest& key, uint64_t timestamp,
   return success;
 }
 
-static void ScanCachePrepareInsert(ScanCache* self)
+template <typename T>
+static void PrepareInsert(MemAllocHeap* heap, T*** table, uint32_t* table_size, uint32_t record_count)
 {
   // Check if a rehash is needed.
-  size_t        old_size = self->m_TableSize;
+  size_t        old_size = *table_size;
 
   if (old_size > 0)
   {
-    int64_t load = 0x100 * self->m_RecordCount / old_size;
+    int64_t load = 0x100 * record_count / old_size;
     if (load < 0xc0)
       return;
   }
 
-  MemAllocHeap *heap     = self->m_Heap;
   size_t        new_size = NextPowerOfTwo(uint32_t(old_size + 1));
 
   if (new_size < 64)
     new_size = 64;
 
-  ScanCache::Record** old_table = self->m_Table;
-  ScanCache::Record** new_table = HeapAllocateArrayZeroed<ScanCache::Record*>(heap, new_size);
+  T** old_table = *table;
+  T** new_table = HeapAllocateArrayZeroed<T*>(heap, new_size);
 
   for (size_t i = 0; i < old_size; ++i)
   {
-    ScanCache::Record* r = old_table[i];
+    T* r = old_table[i];
     while (r)
     {
-      ScanCache::Record *next  = r->m_Next;
-#if ENABLED(USE_SHA1_HASH)
-      uint32_t           hash  = r->m_Key.m_Words.m_C;
-#elif ENABLED(USE_FAST_HASH)
-      uint32_t           hash  = r->m_Key.m_Words32[0];
-#endif
-      uint32_t           index = hash &(new_size - 1);
+      T*        next  = r->m_Next;
+      uint32_t  index = KeyHash(r->m_Key) & (new_size - 1);
 
       r->m_Next        = new_table[index];
       new_table[index] = r;
@@ -231,8 +368,8 @@ static void ScanCachePrepareInsert(ScanCache* self)
     }
   }
 
-  self->m_TableSize = (uint32_t) new_size;
-  self->m_Table     = new_table;
+  *table_size = (uint32_t) new_size;
+  *table      = new_table;
 
   HeapFree(heap, old_table);
 }
@@ -242,37 +379,61 @@ void ScanCacheInsert(
     const HashDigest&   key,
     uint64_t            timestamp,
     const char**        included_files,
-    int                 count)
+    int                 count,
+    ScanCacheLookupResult* result_out)
 {
   AtomicIncrement(&g_Stats.m_ScanCacheInserts);
 
   ReadWriteLockWrite(&self->m_Lock);
 
-  ScanCache::Record* record = LookupDynamic(self, key);
+  ScanCache::RecordTable* table  = self->m_Records;
+  ScanCache::Record*      record = nullptr;
+  uint32_t                slot   = 0;
+
+  if (table)
+  {
+    slot   = FindRecordSlot(table, key);
+    record = table->m_Slots[slot];
+  }
 
   // See if we have this record already (races to insert same include set are possible)
   if (nullptr == record || record->m_FileTimestamp != timestamp)
   {
     // Make sure we have room to insert.
-    ScanCachePrepareInsert(self);
+    if (nullptr == record && (!table || 4 * (self->m_RecordCount + 1) > 3 * table->m_Size))
+    {
+      uint32_t new_size = table ? 2 * table->m_Size : 64;
 
-    uint32_t table_size = self->m_TableSize;
-#if ENABLED(USE_SHA1_HASH)
-    uint32_t hash       = key.m_Words.m_C;
-#elif ENABLED(USE_FAST_HASH)
-    uint32_t hash       = key.m_Words32[0];
-#endif
-    uint32_t index      = hash &(table_size - 1);
+      ScanCache::RecordTable* new_table = (ScanCache::RecordTable*)
+        HeapAllocate(self->m_Heap, sizeof(ScanCache::RecordTable) + new_size * sizeof(ScanCache::Record*));
+      new_table->m_Size  = new_size;
+      new_table->m_Slots = (ScanCache::Record**) (new_table + 1);
+      memset(new_table->m_Slots, 0, new_size * sizeof(ScanCache::Record*));
 
-    // Allocate a new record if needed
-    const bool is_fresh = record == nullptr;
+      if (table)
+      {
+        for (uint32_t i = 0; i < table->m_Size; ++i)
+        {
+          if (ScanCache::Record* r = table->m_Slots[i])
+            new_table->m_Slots[FindRecordSlot(new_table, r->m_Key)] = r;
+        }
 
-    if (is_fresh)
-    {
-      record        = LinearAllocate<ScanCache::Record>(self->m_Allocator);
-      record->m_Key = key;
+        BufferAppendOne(&self->m_OldRecordTables, self->m_Heap, table);
+      }
+
+      AtomicStoreRelease(&self->m_Records, new_table);
+
+      table = new_table;
+      slot  = FindRecordSlot(table, key);
     }
 
+    // Records can't change once other threads may be reading them, so a
+    // newer version of a file gets a new record.
+    if (nullptr == record)
+      self->m_RecordCount++;
+
+    record                  = LinearAllocate<ScanCache::Record>(self->m_Allocator);
+    record->m_Key           = key;
     record->m_FileTimestamp = timestamp;
     record->m_IncludeCount  = count;
     record->m_Includes      = LinearAllocateArray<FileAndHash>(self->m_Allocator, count);
@@ -283,14 +444,242 @@ void ScanCacheInsert(
       record->m_Includes[i].m_FilenameHash = Djb2HashPath(included_files[i]);
     }
 
-    if (is_fresh)
+    AtomicStoreRelease(&table->m_Slots[slot], record);
+  }
+
+  result_out->m_IncludedFileCount = record->m_IncludeCount;
+  result_out->m_IncludedFiles     = record->m_Includes;
+
+  ReadWriteUnlockWrite(&self->m_Lock);
+}
+
+// Whether a directory in the frozen data is still as it was, as of the stat
+// cache's current generation.
+static bool FrozenDirUnchanged(ScanCache* self, StatCache* stat_cache, int32_t dir_index)
+{
+  uint32_t generation = stat_cache->m_Generation;
+  uint32_t check      = self->m_FrozenDirChecks[dir_index];
+
+  // Threads racing to check the same directory come to the same conclusion.
+  if ((check >> FrozenDirCheck::kShift) != generation + 1)
+  {
+    const FrozenStatDir& dir   = self->m_FrozenData->m_IncludeDirs[dir_index];
+    const char*          path  = dir.m_Path.Get();
+    DirStamp             stamp = StatCacheDirStamp(stat_cache, path, Djb2HashPath(path));
+
+    check  = (generation + 1) << FrozenDirCheck::kShift;
+    check |= DirStampMatches(stamp, dir) ? FrozenDirCheck::kUnchanged : FrozenDirCheck::kChanged;
+    self->m_FrozenDirChecks[dir_index] = check;
+  }
+
+  return 0 != (check & FrozenDirCheck::kUnchanged);
+}
+
+bool ScanCacheLookupInclude(ScanCache* self, StatCache* stat_cache, const HashDigest& key, FileAndHash* result_out)
+{
+  // Resolutions from earlier builds are good as long as none of the
+  // directories searched have changed.
+  if (const ScanData* scan_data = self->m_FrozenData)
+  {
+    int32_t index = FrozenKeyLookup(scan_data->m_ResolutionIndex, scan_data->m_ResolutionKeys.Get(), key);
+
+    if (index >= 0)
     {
-      record->m_Next       = self->m_Table[index];
-      self->m_Table[index] = record;
-      self->m_RecordCount++;
+      const FrozenIncludeResolution& resolution = scan_data->m_Resolutions[index];
+      bool                           unchanged  = true;
+
+      for (int32_t dir_index : resolution.m_Dirs)
+      {
+        if (!FrozenDirUnchanged(self, stat_cache, dir_index))
+        {
+          unchanged = false;
+          break;
+        }
+      }
+
+      if (unchanged)
+      {
+        result_out->m_Filename     = resolution.m_Path.Get();
+        result_out->m_FilenameHash = resolution.m_PathHash;
+
+        self->m_FrozenResolutionAccess[index] = 1;
+
+        AtomicIncrement(&g_Stats.m_IncludeCacheHits);
+        return true;
+      }
+    }
+  }
+
+  // Resolutions from this build are good until something is written where
+  // the build has looked for files.
+  bool success = false;
+
+  ReadWriteLockRead(&self->m_Lock);
+
+  if (ScanCache::Resolution* resolution = LookupDynamic(self->m_ResolutionTable, self->m_ResolutionTableSize, key))
+  {
+    if (resolution->m_Generation == stat_cache->m_Generation)
+    {
+      result_out->m_Filename     = resolution->m_Path;
+      result_out->m_FilenameHash = resolution->m_PathHash;
+      success                    = true;
+    }
+  }
+
+  ReadWriteUnlockRead(&self->m_Lock);
+
+  AtomicIncrement(success ? &g_Stats.m_IncludeCacheHits : &g_Stats.m_IncludeCacheMisses);
+
+  return success;
+}
+
+void ScanCacheInsertInclude(ScanCache* self, const HashDigest& key, uint32_t generation, const char* path, const char** dirs, int dir_count)
+{
+  ReadWriteLockWrite(&self->m_Lock);
+
+  ScanCache::Resolution* resolution = LookupDynamic(self->m_ResolutionTable, self->m_ResolutionTableSize, key);
+
+  if (nullptr == resolution)
+  {
+    PrepareInsert(self->m_Heap, &self->m_ResolutionTable, &self->m_ResolutionTableSize, self->m_ResolutionCount);
+
+    uint32_t index = KeyHash(key) & (self->m_ResolutionTableSize - 1);
+
+    resolution         = LinearAllocate<ScanCache::Resolution>(self->m_Allocator);
+    resolution->m_Key  = key;
+    resolution->m_Next = self->m_ResolutionTable[index];
+    self->m_ResolutionTable[index] = resolution;
+    self->m_ResolutionCount++;
+  }
+  else if (resolution->m_Generation == generation)
+  {
+    // Another thread got here first.
+    ReadWriteUnlockWrite(&self->m_Lock);
+    return;
+  }
+
+  resolution->m_Generation = generation;
+  resolution->m_Path       = path ? StrDup(self->m_Allocator, path) : nullptr;
+  resolution->m_PathHash   = path ? Djb2HashPath(path) : 0;
+  resolution->m_DirCount   = dir_count;
+  resolution->m_Dirs       = LinearAllocateArray<int32_t>(self->m_Allocator, dir_count);
+
+  for (int i = 0; i < dir_count; ++i)
+  {
+    const char* dir      = dirs[i];
+    uint32_t    dir_hash = Djb2HashPath(dir);
+
+    if (const int32_t* dir_index = HashTableLookup(&self->m_DirLookup, dir_hash, dir))
+    {
+      resolution->m_Dirs[i] = *dir_index;
+    }
+    else
+    {
+      const char* dir_copy  = StrDup(self->m_Allocator, dir);
+      resolution->m_Dirs[i] = int32_t(self->m_Dirs.m_Size);
+      HashTableInsert(&self->m_DirLookup, dir_hash, dir_copy, resolution->m_Dirs[i]);
+      BufferAppendOne(&self->m_Dirs, self->m_Heap, dir_copy);
+    }
+  }
+
+  ReadWriteUnlockWrite(&self->m_Lock);
+}
+
+bool ScanCacheLookupClosure(ScanCache* self, StatCache* stat_cache, const HashDigest& key, uint64_t timestamp, ScanCacheClosure* result_out)
+{
+  ScanCache::Closure* closure       = nullptr;
+  uint32_t            checked_count = 0;
+
+  ReadWriteLockRead(&self->m_Lock);
+
+  if (ScanCache::Closure* c = LookupDynamic(self->m_ClosureTable, self->m_ClosureTableSize, key))
+  {
+    if (c->m_FileTimestamp == timestamp)
+    {
+      closure       = c;
+      checked_count = c->m_CheckedWriteCount;
+      result_out->m_FileCount  = c->m_FileCount;
+      result_out->m_Files      = c->m_Files;
+      result_out->m_Timestamps = c->m_Timestamps;
     }
   }
 
+  ReadWriteUnlockRead(&self->m_Lock);
+
+  // Closures are good until the build writes something. After that, they're
+  // checked against the timestamps of the files in them.
+  if (closure)
+  {
+    uint32_t write_count = stat_cache->m_WriteCount;
+
+    if (checked_count != write_count)
+    {
+      for (int i = 0, count = result_out->m_FileCount; i < count; ++i)
+      {
+        const FileAndHash& file = result_out->m_Files[i];
+        FileInfo           info = StatCacheStat(stat_cache, file.m_Filename, file.m_FilenameHash);
+
+        if ((info.Exists() ? info.m_Timestamp : kClosureMissing) != result_out->m_Timestamps[i])
+        {
+          closure = nullptr;
+          break;
+        }
+      }
+
+      if (closure)
+      {
+        ReadWriteLockWrite(&self->m_Lock);
+        // Unless another thread has put it together again meanwhile.
+        if (closure->m_Files == result_out->m_Files)
+          closure->m_CheckedWriteCount = write_count;
+        ReadWriteUnlockWrite(&self->m_Lock);
+      }
+    }
+  }
+
+  AtomicIncrement(closure ? &g_Stats.m_ClosureCacheHits : &g_Stats.m_ClosureCacheMisses);
+
+  return closure != nullptr;
+}
+
+void ScanCacheInsertClosure(ScanCache* self, const HashDigest& key, uint64_t timestamp, uint32_t write_count, const ScanCacheClosure& closure, ScanCacheClosure* result_out)
+{
+  int count = closure.m_FileCount;
+
+  ReadWriteLockWrite(&self->m_Lock);
+
+  ScanCache::Closure* c = LookupDynamic(self->m_ClosureTable, self->m_ClosureTableSize, key);
+
+  if (nullptr == c)
+  {
+    PrepareInsert(self->m_Heap, &self->m_ClosureTable, &self->m_ClosureTableSize, self->m_ClosureCount);
+
+    uint32_t index = KeyHash(key) & (self->m_ClosureTableSize - 1);
+
+    c         = LinearAllocate<ScanCache::Closure>(self->m_Allocator);
+    c->m_Key  = key;
+    c->m_Next = self->m_ClosureTable[index];
+    self->m_ClosureTable[index] = c;
+    self->m_ClosureCount++;
+  }
+
+  // Arrays are never changed once they're in the table, as other threads
+  // may be reading them.
+  FileAndHash* files      = LinearAllocateArray<FileAndHash>(self->m_Allocator, count);
+  uint64_t*    timestamps = LinearAllocateArray<uint64_t>(self->m_Allocator, count);
+  memcpy(files, closure.m_Files, count * sizeof files[0]);
+  memcpy(timestamps, closure.m_Timestamps, count * sizeof timestamps[0]);
+
+  c->m_FileTimestamp     = timestamp;
+  c->m_CheckedWriteCount = write_count;
+  c->m_FileCount         = count;
+  c->m_Files             = files;
+  c->m_Timestamps        = timestamps;
+
+  result_out->m_FileCount  = count;
+  result_out->m_Files      = files;
+  result_out->m_Timestamps = timestamps;
+
   ReadWriteUnlockWrite(&self->m_Lock);
 }
 
@@ -300,7 +689,7 @@ bool ScanCacheDirty(ScanCache* self)
 
   ReadWriteLockRead(&self->m_Lock);
 
-  result = self->m_RecordCount > 0;
+  result = self->m_RecordCount > 0 || self->m_ResolutionCount > 0;
 
   ReadWriteUnlockRead(&self->m_Lock);
 
@@ -326,6 +715,22 @@ struct ScanCacheWriter
   BinaryLocator  m_TimestampPtr;
   uint32_t       m_RecordsOut;
 
+  BinarySegment *m_DirSeg;
+  BinarySegment *m_ResolutionKeySeg;
+  BinarySegment *m_ResolutionSeg;
+  BinarySegment *m_ResolutionTimeSeg;
+  BinaryLocator  m_DirPtr;
+  BinaryLocator  m_ResolutionKeyPtr;
+  BinaryLocator  m_ResolutionPtr;
+  BinaryLocator  m_ResolutionTimePtr;
+  int32_t        m_DirsOut;
+  int32_t        m_ResolutionsOut;
+
+  // Key hashes of what has been written, in order, to index them by.
+  MemAllocHeap    *m_Heap;
+  BinarySegment   *m_IndexSeg;
+  Buffer<uint32_t> m_RecordHashes;
+  Buffer<uint32_t> m_ResolutionHashes;
 };
 
 static void ScanCacheWriterInit(ScanCacheWriter* self, MemAllocHeap* heap)
@@ -344,13 +749,74 @@ static void ScanCacheWriterInit(ScanCacheWriter* self, MemAllocHeap* heap)
   self->m_TimestampPtr = BinarySegmentPosition(self->m_TimestampSeg);
 
   self->m_RecordsOut   = 0;
+
+  self->m_DirSeg            = BinaryWriterAddSegment(&self->m_Writer);
+  self->m_ResolutionKeySeg  = BinaryWriterAddSegment(&self->m_Writer);
+  self->m_ResolutionSeg     = BinaryWriterAddSegment(&self->m_Writer);
+  self->m_ResolutionTimeSeg = BinaryWriterAddSegment(&self->m_Writer);
+
+  self->m_DirPtr            = BinarySegmentPosition(self->m_DirSeg);
+  self->m_ResolutionKeyPtr  = BinarySegmentPosition(self->m_ResolutionKeySeg);
+  self->m_ResolutionPtr     = BinarySegmentPosition(self->m_ResolutionSeg);
+  self->m_ResolutionTimePtr = BinarySegmentPosition(self->m_ResolutionTimeSeg);
+
+  self->m_DirsOut           = 0;
+  self->m_ResolutionsOut    = 0;
+
+  self->m_Heap              = heap;
+  self->m_IndexSeg          = BinaryWriterAddSegment(&self->m_Writer);
+  BufferInit(&self->m_RecordHashes);
+  BufferInit(&self->m_ResolutionHashes);
 }
 
 static void ScanCacheWriterDestroy(ScanCacheWriter* self)
 {
+  BufferDestroy(&self->m_ResolutionHashes, self->m_Heap);
+  BufferDestroy(&self->m_RecordHashes, self->m_Heap);
   BinaryWriterDestroy(&self->m_Writer);
 }
 
+// Write an open-addressed index of keys with the given hashes, at most half full.
+static void WriteKeyIndex(ScanCacheWriter* self, const Buffer<uint32_t>& hashes)
+{
+  uint32_t count = uint32_t(hashes.m_Size);
+
+  if (0 == count)
+  {
+    BinarySegmentWriteInt32(self->m_MainSeg, 0);
+    BinarySegmentWriteNullPointer(self->m_MainSeg);
+    return;
+  }
+
+  uint32_t size = NextPowerOfTwo(2 * count);
+  uint32_t mask = size - 1;
+
+  FrozenKeySlot* slots = HeapAllocateArray<FrozenKeySlot>(self->m_Heap, size);
+
+  for (uint32_t i = 0; i < size; ++i)
+  {
+    slots[i].m_Hash  = 0;
+    slots[i].m_Index = -1;
+  }
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    uint32_t slot = hashes[i] & mask;
+
+    while (slots[slot].m_Index >= 0)
+      slot = (slot + 1) & mask;
+
+    slots[slot].m_Hash  = hashes[i];
+    slots[slot].m_Index = int32_t(i);
+  }
+
+  BinarySegmentWriteInt32(self->m_MainSeg, int32_t(size));
+  BinarySegmentWritePointer(self->m_MainSeg, BinarySegmentPosition(self->m_IndexSeg));
+  BinarySegmentWrite(self->m_IndexSeg, (const char*) slots, size * sizeof(FrozenKeySlot));
+
+  HeapFree(self->m_Heap, slots);
+}
+
 static bool ScanCacheWriterFlush(ScanCacheWriter* self, const char* filename)
 {
   BinarySegmentWriteUint32(self->m_MainSeg, ScanData::MagicNumber);
@@ -358,6 +824,14 @@ static bool ScanCacheWriterFlush(ScanCacheWriter* self, const char* filename)
   BinarySegmentWritePointer(self->m_MainSeg, self->m_DigestPtr);
   BinarySegmentWritePointer(self->m_MainSeg, self->m_EntryPtr);
   BinarySegmentWritePointer(self->m_MainSeg, self->m_TimestampPtr);
+  BinarySegmentWriteInt32(self->m_MainSeg, self->m_DirsOut);
+  BinarySegmentWritePointer(self->m_MainSeg, self->m_DirPtr);
+  BinarySegmentWriteInt32(self->m_MainSeg, self->m_ResolutionsOut);
+  BinarySegmentWritePointer(self->m_MainSeg, self->m_ResolutionKeyPtr);
+  BinarySegmentWritePointer(self->m_MainSeg, self->m_ResolutionPtr);
+  BinarySegmentWritePointer(self->m_MainSeg, self->m_ResolutionTimePtr);
+  WriteKeyIndex(self, self->m_RecordHashes);
+  WriteKeyIndex(self, self->m_ResolutionHashes);
 
   return BinaryWriterFlush(&self->m_Writer, filename);
 }
@@ -411,10 +885,196 @@ static void SaveRecord(
 
   BinarySegmentWriteUint64(timestamp_seg, access_time);
 
+  BufferAppendOne(&self->m_RecordHashes, self->m_Heap, KeyHash(*digest));
   self->m_RecordsOut++;
 }
 
-bool ScanCacheSave(ScanCache* self, const char* fn, MemAllocHeap* heap)
+namespace
+{
+  struct SaveDir
+  {
+    const char* m_Path;
+    DirStamp    m_Stamp;
+    int32_t     m_SavedIndex;
+  };
+
+  struct ResolutionSaver
+  {
+    ScanCacheWriter*                             m_Writer;
+    HashTable<BinaryLocator, kFlagPathStrings>*  m_StringPool;
+    MemAllocHeap*                                m_Heap;
+    HashTable<int32_t, kFlagPathStrings>         m_DirLookup;
+    Buffer<SaveDir>                              m_Dirs;
+  };
+}
+
+// Stamp of a directory as it is now, taken once per save.
+static int32_t GetSaveDir(ResolutionSaver* self, const char* path)
+{
+  uint32_t hash = Djb2HashPath(path);
+
+  if (const int32_t* index = HashTableLookup(&self->m_DirLookup, hash, path))
+    return *index;
+
+  int32_t index = int32_t(self->m_Dirs.m_Size);
+  HashTableInsert(&self->m_DirLookup, hash, path, index);
+
+  SaveDir* dir      = BufferAlloc(&self->m_Dirs, self->m_Heap, 1);
+  dir->m_Path       = path;
+  dir->m_SavedIndex = -1;
+  GetDirStamp(path, &dir->m_Stamp);
+  return index;
+}
+
+static void SaveResolution(
+    ResolutionSaver*   self,
+    const HashDigest&  key,
+    const char*        path,
+    uint32_t           path_hash,
+    const int32_t*     dirs,
+    int                dir_count,
+    uint64_t           access_time)
+{
+  ScanCacheWriter* writer = self->m_Writer;
+
+  BinaryLocator dirs_ptr = BinarySegmentPosition(writer->m_ArraySeg);
+
+  for (int i = 0; i < dir_count; ++i)
+  {
+    SaveDir* dir = &self->m_Dirs[dirs[i]];
+
+    if (dir->m_SavedIndex < 0)
+    {
+      dir->m_SavedIndex = writer->m_DirsOut++;
+
+      BinarySegmentWriteUint64(writer->m_DirSeg, dir->m_Stamp.m_Timestamp);
+      BinarySegmentWriteUint64(writer->m_DirSeg, dir->m_Stamp.m_Identity);
+      BinarySegmentWriteUint32(writer->m_DirSeg, dir->m_Stamp.m_Exists ? 1 : 0);
+      WriteUniqueStringPointer(self->m_StringPool, writer->m_DirSeg, writer->m_StringSeg, Djb2HashPath(dir->m_Path), dir->m_Path);
+    }
+
+    BinarySegmentWriteInt32(writer->m_ArraySeg, dir->m_SavedIndex);
+  }
+
+  BinarySegmentWrite(writer->m_ResolutionKeySeg, (const char*) key.m_Data, sizeof(HashDigest));
+
+  if (path)
+    WriteUniqueStringPointer(self->m_StringPool, writer->m_ResolutionSeg, writer->m_StringSeg, path_hash, path);
+  else
+    BinarySegmentWriteNullPointer(writer->m_ResolutionSeg);
+
+  BinarySegmentWriteUint32(writer->m_ResolutionSeg, path_hash);
+  BinarySegmentWriteInt32(writer->m_ResolutionSeg, dir_count);
+  BinarySegmentWritePointer(writer->m_ResolutionSeg, dirs_ptr);
+
+  BinarySegmentWriteUint64(writer->m_ResolutionTimeSeg, access_time);
+
+  BufferAppendOne(&writer->m_ResolutionHashes, writer->m_Heap, KeyHash(key));
+  writer->m_ResolutionsOut++;
+}
+
+static bool SortResolutionsByHash(const ScanCache::Resolution* l, const ScanCache::Resolution* r)
+{
+  return l->m_Key < r->m_Key;
+}
+
+static void SaveResolutions(
+    ScanCache*        self,
+    StatCache*        stat_cache,
+    ResolutionSaver*  saver,
+    MemAllocLinear*   scratch,
+    uint64_t          now,
+    uint64_t          timestamp_cutoff)
+{
+  // Resolutions made in this build that are still good. They can only be
+  // kept if the directories searched haven't changed since before the build
+  // started, as the timestamps of later changes can't be trusted to tell
+  // them apart.
+  ScanCache::Resolution** dyn_resolutions = LinearAllocateArray<ScanCache::Resolution*>(scratch, self->m_ResolutionCount);
+  uint32_t                dyn_count       = 0;
+
+  for (uint32_t ti = 0, tsize = self->m_ResolutionTableSize; ti < tsize; ++ti)
+  {
+    for (ScanCache::Resolution* r = self->m_ResolutionTable[ti]; r; r = r->m_Next)
+    {
+      if (r->m_Generation == stat_cache->m_Generation)
+        dyn_resolutions[dyn_count++] = r;
+    }
+  }
+
+  std::sort(dyn_resolutions, dyn_resolutions + dyn_count, SortResolutionsByHash);
+
+  const ScanData*                scan_data       = self->m_FrozenData;
+  uint32_t                       frozen_count    = scan_data ? scan_data->m_ResolutionCount : 0;
+  const HashDigest*              frozen_keys     = scan_data ? scan_data->m_ResolutionKeys.Get() : nullptr;
+  const FrozenIncludeResolution* frozen_entries  = scan_data ? scan_data->m_Resolutions.Get() : nullptr;
+  const uint64_t*                frozen_times    = scan_data ? scan_data->m_ResolutionAccessTimes.Get() : nullptr;
+
+  Buffer<int32_t> dirs;
+  BufferInit(&dirs);
+
+  auto key_dynamic = [=](size_t index) -> const HashDigest* { return &dyn_resolutions[index]->m_Key; };
+  auto key_frozen = [=](size_t index) { return frozen_keys + index; };
+
+  auto save_dynamic = [&](size_t index)
+  {
+    const ScanCache::Resolution* r = dyn_resolutions[index];
+
+    BufferClear(&dirs);
+
+    for (int i = 0; i < r->m_DirCount; ++i)
+    {
+      int32_t dir = GetSaveDir(saver, self->m_Dirs[r->m_Dirs[i]]);
+
+      if (!DirStampIsSettled(saver->m_Dirs[dir].m_Stamp, self->m_StartTime))
+        return;
+
+      BufferAppendOne(&dirs, saver->m_Heap, dir);
+    }
+
+    // The directory the include was found in must still be there.
+    if (r->m_Path && (0 == dirs.m_Size || !saver->m_Dirs[dirs[dirs.m_Size - 1]].m_Stamp.m_Exists))
+      return;
+
+    SaveResolution(saver, r->m_Key, r->m_Path, r->m_PathHash, dirs.m_Storage, int(dirs.m_Size), now);
+  };
+
+  auto save_frozen = [&](size_t index)
+  {
+    uint64_t timestamp = frozen_times[index];
+    if (self->m_FrozenResolutionAccess[index])
+      timestamp = now;
+
+    if (timestamp <= timestamp_cutoff)
+      return;
+
+    const FrozenIncludeResolution& r = frozen_entries[index];
+
+    BufferClear(&dirs);
+
+    for (int32_t dir_index : r.m_Dirs)
+    {
+      if (FrozenDirCheck::kChanged & self->m_FrozenDirChecks[dir_index])
+        return;
+
+      const FrozenStatDir& frozen_dir = scan_data->m_IncludeDirs[dir_index];
+      int32_t              dir        = GetSaveDir(saver, frozen_dir.m_Path.Get());
+
+      if (!DirStampMatches(saver->m_Dirs[dir].m_Stamp, frozen_dir))
+        return;
+
+      BufferAppendOne(&dirs, saver->m_Heap, dir);
+    }
+
+    SaveResolution(saver, frozen_keys[index], r.m_Path.Get(), r.m_PathHash, dirs.m_Storage, int(dirs.m_Size), timestamp);
+  };
+
+  TraverseSortedArrays(dyn_count, save_dynamic, key_dynamic, frozen_count, save_frozen, key_frozen);
+
+  BufferDestroy(&dirs, saver->m_Heap);
+}
+
+bool ScanCacheSave(ScanCache* self, StatCache* stat_cache, const char* fn, MemAllocHeap* heap)
 {
   TimingScope timing_scope(nullptr, &g_Stats.m_ScanCacheSaveTime);
   ProfilerScope prof_scope("Tundra SaveScanCache", 0);
@@ -437,16 +1097,13 @@ bool ScanCacheSave(ScanCache* self, const char* fn, MemAllocHeap* heap)
   const uint32_t      record_count = self->m_RecordCount;
   ScanCache::Record **dyn_records  = LinearAllocateArray<ScanCache::Record*>(scratch, record_count);
 
+  if (const ScanCache::RecordTable* table = self->m_Records)
   {
     uint32_t records_out = 0;
-    for (uint32_t ti = 0, tsize = self->m_TableSize; ti < tsize; ++ti)
+    for (uint32_t i = 0; i < table->m_Size; ++i)
     {
-      ScanCache::Record* chain = self->m_Table[ti];
-      while (chain)
-      {
-        dyn_records[records_out++] = chain;
-        chain                      = chain->m_Next;
-      }
+      if (ScanCache::Record* record = table->m_Slots[i])
+        dyn_records[records_out++] = record;
     }
 
     CHECK(records_out == record_count);
@@ -503,6 +1160,18 @@ bool ScanCacheSave(ScanCache* self, const char* fn, MemAllocHeap* heap)
 
   TraverseSortedArrays(record_count, save_dynamic, key_dynamic, frozen_count, save_frozen, key_frozen);
 
+  ResolutionSaver resolution_saver;
+  resolution_saver.m_Writer     = &writer;
+  resolution_saver.m_StringPool = &string_pool;
+  resolution_saver.m_Heap       = heap;
+  HashTableInit(&resolution_saver.m_DirLookup, heap);
+  BufferInit(&resolution_saver.m_Dirs);
+
+  SaveResolutions(self, stat_cache, &resolution_saver, scratch, now, timestamp_cutoff);
+
+  BufferDestroy(&resolution_saver.m_Dirs, heap);
+  HashTableDestroy(&resolution_saver.m_DirLookup);
+
   self->m_FrozenData = nullptr;
 
   bool result = ScanCacheWriterFlush(&writer, fn);
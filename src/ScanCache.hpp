@@ -2,7 +2,9 @@
 #define SCANCACHE_HPP
 
 #include "Common.hpp"
+#include "Buffer.hpp"
 #include "Hash.hpp"
+#include "HashTable.hpp"
 #include "ReadWriteLock.hpp"
 
 namespace t2
@@ -11,33 +13,82 @@ namespace t2
   struct MemAllocHeap;
   struct MemAllocLinear;
   struct MemoryMappedFile;
+  struct StatCache;
 
   void ComputeScanCacheKey(
       HashDigest*        key_out,
       const char*        filename,
       const HashDigest&  scanner_hash);
 
+  // Key for where an include is found. The including directory only matters
+  // for ""-style includes, and is null for others.
+  void ComputeIncludeKey(
+      HashDigest*        key_out,
+      const HashDigest&  scanner_hash,
+      const char*        including_dir,
+      const char*        include);
+
   struct ScanCacheLookupResult
   {
     int           m_IncludedFileCount;
     FileAndHash*  m_IncludedFiles;
   };
 
+  // Everything a file includes, directly or not, along with the timestamp
+  // each file had when its includes were looked at. Files that didn't exist
+  // have a timestamp of kClosureMissing.
+  struct ScanCacheClosure
+  {
+    int                 m_FileCount;
+    const FileAndHash*  m_Files;
+    const uint64_t*     m_Timestamps;
+  };
+
+  static const uint64_t kClosureMissing = ~uint64_t(0);
+
   struct ScanCache
   {
     struct Record;
+    struct RecordTable;
+    struct Resolution;
+    struct Closure;
 
     const ScanData* m_FrozenData;
 
     ReadWriteLock   m_Lock;
     MemAllocHeap*   m_Heap;
     MemAllocLinear* m_Allocator;
-    uint32_t        m_RecordCount;
-    uint32_t        m_TableSize;
-    Record**        m_Table;
+
+    // Records from this build. Lookups don't lock; inserts hold m_Lock, and
+    // never change a record once it's in the table. Tables that have been
+    // outgrown are kept until the cache is destroyed, as lookups may still
+    // be reading them.
+    uint32_t             m_RecordCount;
+    RecordTable*         m_Records;
+    Buffer<RecordTable*> m_OldRecordTables;
 
     // Table of bits to track whether frozen records have been accessed.
     uint8_t*        m_FrozenAccess;
+
+    // Where includes were found, and the directories searched for them.
+    uint32_t                              m_ResolutionCount;
+    uint32_t                              m_ResolutionTableSize;
+    Resolution**                          m_ResolutionTable;
+    HashTable<int32_t, kFlagPathStrings>  m_DirLookup;
+    Buffer<const char*>                   m_Dirs;
+
+    // Whether frozen directories are unchanged, and as of which stat cache
+    // generation.
+    uint32_t*       m_FrozenDirChecks;
+    uint8_t*        m_FrozenResolutionAccess;
+
+    uint64_t        m_StartTime;
+
+    // Include closures put together during this build, shared by all
+    // files that include the same headers.
+    uint32_t        m_ClosureCount;
+    uint32_t        m_ClosureTableSize;
+    Closure**       m_ClosureTable;
   };
     
   void ScanCacheInit(ScanCache* self, MemAllocHeap* heap, MemAllocLinear* allocator);
@@ -48,11 +99,30 @@ namespace t2
 
   bool ScanCacheLookup(ScanCache* self, const HashDigest& key, uint64_t timestamp, ScanCacheLookupResult* result_out, MemAllocLinear* scratch);
 
-  void ScanCacheInsert(ScanCache* self, const HashDigest& key, uint64_t timestamp, const char** included_files, int count);
+  // The included files as stored in the cache are returned in result_out.
+  void ScanCacheInsert(ScanCache* self, const HashDigest& key, uint64_t timestamp, const char** included_files, int count, ScanCacheLookupResult* result_out);
+
+  // Where an include was found before, if the directories searched for it
+  // haven't changed since. The filename is null if it wasn't found.
+  bool ScanCacheLookupInclude(ScanCache* self, StatCache* stat_cache, const HashDigest& key, FileAndHash* result_out);
+
+  // Remember where an include was found, if anywhere, after searching the
+  // given directories. The generation is that of the stat cache before the
+  // search.
+  void ScanCacheInsertInclude(ScanCache* self, const HashDigest& key, uint32_t generation, const char* path, const char** dirs, int dir_count);
+
+  // The closure of a file as of the given timestamp, if none of the files in
+  // it have changed since it was put together.
+  bool ScanCacheLookupClosure(ScanCache* self, StatCache* stat_cache, const HashDigest& key, uint64_t timestamp, ScanCacheClosure* result_out);
+
+  // Remember the closure of a file. The write count is that of the stat cache
+  // before the files in it were looked at. Filenames must stay valid for the
+  // rest of the build, like the ones returned by the functions above.
+  void ScanCacheInsertClosure(ScanCache* self, const HashDigest& key, uint64_t timestamp, uint32_t write_count, const ScanCacheClosure& closure, ScanCacheClosure* result_out);
 
   bool ScanCacheDirty(ScanCache* self);
 
-  bool ScanCacheSave(ScanCache* self, const char* fn, MemAllocHeap* heap);
+  bool ScanCacheSave(ScanCache* self, StatCache* stat_cache, const char* fn, MemAllocHeap* heap);
 
 }
 
@@ -2,6 +2,7 @@
 #define SCANDATA_HPP
 
 #include "BinaryData.hpp"
+#include "StatCache.hpp"
 
 namespace t2
 {
@@ -11,9 +12,27 @@ namespace t2
     FrozenArray<FrozenFileAndHash>  m_IncludedFiles;
   };
 
+  // Where an include was found, if anywhere, and the directories that were
+  // searched for it. It stays good as long as they don't change.
+  struct FrozenIncludeResolution
+  {
+    FrozenString          m_Path;
+    uint32_t              m_PathHash;
+    FrozenArray<int32_t>  m_Dirs;
+  };
+
+  // Slot in an open-addressed index of sorted keys, probed linearly from the
+  // key's hash, so lookups touch a cache line or two instead of binary
+  // searching.
+  struct FrozenKeySlot
+  {
+    uint32_t              m_Hash;
+    int32_t               m_Index;    // into the keys, or -1 if the slot is empty
+  };
+
   struct ScanData
   {
-    static const uint32_t MagicNumber = 0x1517000e ^ kTundraHashMagic;
+    static const uint32_t MagicNumber = 0x15170010 ^ kTundraHashMagic;
 
     uint32_t                   m_MagicNumber;
 
@@ -22,6 +41,15 @@ namespace t2
     FrozenPtr<HashDigest>      m_Keys;
     FrozenPtr<ScanCacheEntry>  m_Data;
     FrozenPtr<uint64_t>        m_AccessTimes;
+
+    FrozenArray<FrozenStatDir>              m_IncludeDirs;
+    int32_t                                 m_ResolutionCount;
+    FrozenPtr<HashDigest>                   m_ResolutionKeys;
+    FrozenPtr<FrozenIncludeResolution>      m_Resolutions;
+    FrozenPtr<uint64_t>                     m_ResolutionAccessTimes;
+
+    FrozenArray<FrozenKeySlot>              m_KeyIndex;
+    FrozenArray<FrozenKeySlot>              m_ResolutionIndex;
   };
 
 }
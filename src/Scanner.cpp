@@ -10,8 +10,10 @@
 #include "ScanCache.hpp"
 #include "StatCache.hpp"
 #include "HashTable.hpp"
+#include "MemoryMappedFile.hpp"
 
 #include <stdio.h>
+#include <algorithm>
 
 namespace t2
 {
@@ -46,17 +48,12 @@ static bool IncludeSetAddNoDuplicateString(IncludeSet* self, const char* string,
   return true;
 }
 
-static bool IncludeSetAddDuplicateString(IncludeSet* self, const char* string, uint32_t hash)
+// Remember the directory of a path searched for an include.
+static void AddSearchedDir(Buffer<const char*>* searched_dirs, MemAllocHeap* heap, MemAllocLinear* scratch, const char* path)
 {
-  if (HashSetLookup(&self->m_HashTable, hash, string))
-  {
-    return false;
-  }
-
-  // Allocate a new cell
-  HashSetInsert(&self->m_HashTable, hash, StrDup(self->m_LinearAlloc, string));
-
-  return true;
+  char dir[kMaxPathLength];
+  PathDirectoryOf(dir, path);
+  BufferAppendOne(searched_dirs, heap, StrDup(scratch, dir));
 }
 
 static bool FindFile(
@@ -65,7 +62,10 @@ static bool FindFile(
     char (&path_buf)[kMaxPathLength],
     const char* filename,
     const ScannerData* scanner_config,
-    const IncludeData* include)
+    const IncludeData* include,
+    Buffer<const char*>* searched_dirs,
+    MemAllocHeap* heap,
+    MemAllocLinear* scratch)
 {
   PathBuffer filename_buf;
   PathInit(&filename_buf, filename);
@@ -80,7 +80,8 @@ static bool FindFile(
     PathStripLast(buffer);
     PathConcat(buffer, &include_buf);
     PathFormat(path_buf, buffer);
-    FileInfo info = StatCacheStat(stat_cache, path_buf);
+    AddSearchedDir(searched_dirs, heap, scratch, path_buf);
+    FileInfo info = StatCacheProbe(stat_cache, path_buf);
     if (info.Exists())
       return true;
   }
@@ -90,8 +91,9 @@ static bool FindFile(
     PathInit(buffer, include_path);
     PathConcat(buffer, &include_buf);
     PathFormat(path_buf, buffer);
+    AddSearchedDir(searched_dirs, heap, scratch, path_buf);
 
-    FileInfo info = StatCacheStat(stat_cache, path_buf);
+    FileInfo info = StatCacheProbe(stat_cache, path_buf);
     if (info.Exists())
       return true;
   }
@@ -103,7 +105,8 @@ static bool FindFile(
 static void ScanFile(
     StatCache* stat_cache,
     const char* filename,
-    char* file_data,
+    const char* file_data,
+    size_t file_size,
     const ScanInput* input,
     Buffer<const char*>* found_includes)
 {
@@ -115,139 +118,276 @@ static void ScanFile(
   switch (scanner_config->m_ScannerType)
   {
     case ScannerType::kGeneric:
-      includes = ScanIncludesGeneric(file_data, scratch, *static_cast<const GenericScannerData*>(scanner_config));
+      includes = ScanIncludesGeneric(file_data, file_size, scratch, *static_cast<const GenericScannerData*>(scanner_config));
       break;
     case ScannerType::kCpp:
-      includes = ScanIncludesCpp(file_data, scratch);
+      includes = ScanIncludesCpp(file_data, file_size, scratch);
       break;
     default:
       Croak("Unsupported scanner type");
   }
 
-  // Resolve includes to file paths.
+  // Resolve includes to file paths. Where an include was found is
+  // remembered for other files including the same thing.
+  char including_dir[kMaxPathLength];
+  PathDirectoryOf(including_dir, filename);
+
+  Buffer<const char*> searched_dirs;
+  BufferInit(&searched_dirs);
+
   IncludeData* include = includes;
 
   while (include)
   {
-    PathBuffer path;
-    char path_buf[kMaxPathLength];
+    HashDigest key;
+    ComputeIncludeKey(&key, scanner_config->m_ScannerGuid, include->m_IsSystemInclude ? nullptr : including_dir, include->m_String);
 
-    if (FindFile(stat_cache, &path, path_buf, filename, scanner_config, include))
+    FileAndHash resolved;
+
+    if (ScanCacheLookupInclude(input->m_ScanCache, stat_cache, key, &resolved))
     {
-      BufferAppendOne(found_includes, heap, StrDup(scratch, path_buf));
+      if (resolved.m_Filename)
+        BufferAppendOne(found_includes, heap, resolved.m_Filename);
+    }
+    else
+    {
+      PathBuffer path;
+      char path_buf[kMaxPathLength];
+
+      // Anything written after this may not have been seen by the search.
+      uint32_t generation = stat_cache->m_Generation;
+
+      BufferClear(&searched_dirs);
+
+      bool found = FindFile(stat_cache, &path, path_buf, filename, scanner_config, include, &searched_dirs, heap, scratch);
+
+      if (found)
+      {
+        BufferAppendOne(found_includes, heap, StrDup(scratch, path_buf));
+      }
+
+      ScanCacheInsertInclude(input->m_ScanCache, key, generation, found ? path_buf : nullptr, searched_dirs.m_Storage, int(searched_dirs.m_Size));
     }
 
     include = include->m_Next;
   }
+
+  BufferDestroy(&searched_dirs, heap);
 }
 
-bool ScanImplicitDeps(StatCache* stat_cache, const ScanInput* input, ScanOutput* output)
+// Get the files a file includes directly, from the scan cache or by scanning
+// it. Filenames stay valid for the rest of the build.
+static void GetIncludes(StatCache* stat_cache, const ScanInput* input, const char* fn, uint64_t timestamp, Buffer<const char*>* found_includes, ScanCacheLookupResult* result)
+{
+  const ScannerData *scanner_config = input->m_ScannerConfig;
+  ScanCache         *scan_cache     = input->m_ScanCache;
+
+  HashDigest scan_key;
+  ComputeScanCacheKey(&scan_key, fn, scanner_config->m_ScannerGuid);
+
+  if (ScanCacheLookup(scan_cache, scan_key, timestamp, result, input->m_ScratchAlloc))
+    return;
+
+  result->m_IncludedFileCount = 0;
+  result->m_IncludedFiles     = nullptr;
+
+  // Reset buffer
+  BufferClear(found_includes);
+
+  // Scan the file where it's mapped, straight from the page cache. Empty
+  // files can't be mapped, and have nothing to scan.
+  MemoryMappedFile file;
+  MmapFileInit(&file);
+  MmapFileMap(&file, fn);
+
+  if (!MmapFileValid(&file))
+    return;
+
+  const char* scan_start = static_cast<const char*>(file.m_Address);
+  size_t      scan_size  = file.m_Size;
+
+  // Skip UTF-8 marker if present as it freaks out ctype functions
+  static const unsigned char utf8_mark[] = { 0xef, 0xbb, 0xbf };
+  if (scan_size >= 3 && 0 == memcmp(scan_start, utf8_mark, sizeof utf8_mark))
+  {
+    scan_start += sizeof utf8_mark;
+    scan_size  -= sizeof utf8_mark;
+  }
+
+  ScanFile(stat_cache, fn, scan_start, scan_size, input, found_includes);
+
+  // Insert result into scan cache
+  ScanCacheInsert(scan_cache, scan_key, timestamp, found_includes->m_Storage, (int) found_includes->m_Size, result);
+
+  MmapFileDestroy(&file);
+}
+
+typedef HashTable<uint64_t, kFlagPathStrings> ReachedFiles;
+
+static bool ReachFile(ReachedFiles* reached, const FileAndHash& file, uint64_t timestamp)
+{
+  if (HashTableLookup(reached, file.m_FilenameHash, file.m_Filename))
+    return false;
+
+  HashTableInsert(reached, file.m_FilenameHash, file.m_Filename, timestamp);
+  return true;
+}
+
+// Put together everything a header includes, directly or not. Headers met on
+// the way that already have a closure aren't walked again.
+static void BuildClosure(StatCache* stat_cache, const ScanInput* input, const char* fn, uint64_t timestamp, const HashDigest& key, ScanCacheClosure* closure_out)
 {
   MemAllocHeap      *scratch_heap   = input->m_ScratchHeap;
   MemAllocLinear    *scratch_alloc  = input->m_ScratchAlloc;
   const ScannerData *scanner_config = input->m_ScannerConfig;
   ScanCache         *scan_cache     = input->m_ScanCache;
 
+  // Anything written after this may not be reflected in the closure.
+  uint32_t write_count = stat_cache->m_WriteCount;
+
+  // Files reached so far, with their timestamps once they've been walked.
+  ReachedFiles reached;
+  HashTableInit(&reached, scratch_heap);
+
   Buffer<const char*> found_includes;
-  Buffer<const char*> filename_stack;
+  Buffer<FileAndHash> file_stack;
   BufferInitWithCapacity(&found_includes, scratch_heap, 128);
-  BufferInitWithCapacity(&filename_stack, scratch_heap, 128);
-  BufferAppendOne(&filename_stack, scratch_heap, input->m_FileName);
+  BufferInitWithCapacity(&file_stack, scratch_heap, 128);
 
-  IncludeSet incset;
-  IncludeSetInit(&incset, scratch_heap, scratch_alloc);
+  FileAndHash root;
+  root.m_Filename     = fn;
+  root.m_FilenameHash = Djb2HashPath(fn);
+  BufferAppendOne(&file_stack, scratch_heap, root);
 
-  while (filename_stack.m_Size > 0)
+  while (file_stack.m_Size > 0)
   {
-    const char* fn = BufferPopOne(&filename_stack);
-
-    // Compute key for scan cache lookup/insert
-    // Reuse scan key for initial file.
-    HashDigest scan_key;
-
-    FileInfo info = StatCacheStat(stat_cache, fn);
+    FileAndHash file = BufferPopOne(&file_stack);
+    FileInfo    info = StatCacheStat(stat_cache, file.m_Filename, file.m_FilenameHash);
 
     if (!info.Exists())
       continue;
 
-    ComputeScanCacheKey(&scan_key, fn, scanner_config->m_ScannerGuid);
+    // Everything but the root was reached before it was pushed. The root only
+    // shows up in its own closure if it includes itself, and its closure is
+    // the one being put together, so it's never looked up.
+    if (uint64_t* reached_timestamp = HashTableLookup(&reached, file.m_FilenameHash, file.m_Filename))
+    {
+      // Already part of a closure merged since it was pushed.
+      if (kClosureMissing != *reached_timestamp)
+        continue;
 
-    ScanCacheLookupResult cache_result;
+      *reached_timestamp = info.m_Timestamp;
 
-    if (ScanCacheLookup(scan_cache, scan_key, info.m_Timestamp, &cache_result, scratch_alloc))
-    {
-      int                 file_count = cache_result.m_IncludedFileCount;
-      const FileAndHash  *files      = cache_result.m_IncludedFiles;
+      HashDigest       sub_key;
+      ScanCacheClosure sub;
+      ComputeScanCacheKey(&sub_key, file.m_Filename, scanner_config->m_ScannerGuid);
 
-      for (int i = 0; i < file_count; ++i)
+      if (ScanCacheLookupClosure(scan_cache, stat_cache, sub_key, info.m_Timestamp, &sub))
       {
-        if (IncludeSetAddNoDuplicateString(&incset, files[i].m_Filename, files[i].m_FilenameHash))
+        for (int i = 0; i < sub.m_FileCount; ++i)
         {
-          // This was a new file, schedule it for scanning as well. 
-          BufferAppendOne(&filename_stack, scratch_heap, files[i].m_Filename);
+          const FileAndHash& sub_file = sub.m_Files[i];
+
+          // Files still waiting on the stack are covered by the closure now.
+          if (uint64_t* sub_timestamp = HashTableLookup(&reached, sub_file.m_FilenameHash, sub_file.m_Filename))
+          {
+            if (kClosureMissing == *sub_timestamp)
+              *sub_timestamp = sub.m_Timestamps[i];
+          }
+          else
+          {
+            HashTableInsert(&reached, sub_file.m_FilenameHash, sub_file.m_Filename, sub.m_Timestamps[i]);
+          }
         }
+
+        continue;
       }
     }
-    else
-    {
-      // Reset buffer
-      BufferClear(&found_includes);
 
-      // Read file into RAM, and add a terminating newline character.
-      FILE* f = fopen(fn, "rb");
-      if (!f)
-        continue;
+    ScanCacheLookupResult includes;
+    GetIncludes(stat_cache, input, file.m_Filename, info.m_Timestamp, &found_includes, &includes);
 
-      if (0 != fseek(f, 0, SEEK_END))
+    for (int i = 0; i < includes.m_IncludedFileCount; ++i)
+    {
+      if (ReachFile(&reached, includes.m_IncludedFiles[i], kClosureMissing))
       {
-        fclose(f);
-        continue;
+        // This was a new file, schedule it for scanning as well. 
+        BufferAppendOne(&file_stack, scratch_heap, includes.m_IncludedFiles[i]);
       }
+    }
+  }
 
-      long file_size = ftell(f);
-      if (-1 == file_size || 0 == file_size)
-      {
-        fclose(f);
-        continue;
-      }
+  ScanCacheClosure closure;
+  FileAndHash* files      = LinearAllocateArray<FileAndHash>(scratch_alloc, reached.m_RecordCount);
+  uint64_t*    timestamps = LinearAllocateArray<uint64_t>(scratch_alloc, reached.m_RecordCount);
+  closure.m_FileCount  = (int) reached.m_RecordCount;
+  closure.m_Files      = files;
+  closure.m_Timestamps = timestamps;
+
+  HashTableWalk(&reached, [=] (uint32_t index, uint32_t hash, const char* path, uint64_t file_timestamp) {
+    files[index].m_Filename     = path;
+    files[index].m_FilenameHash = hash;
+    timestamps[index]           = file_timestamp;
+  });
 
-      rewind(f);
+  ScanCacheInsertClosure(scan_cache, key, timestamp, write_count, closure, closure_out);
 
-      char* buffer = (char*) HeapAllocate(scratch_heap, file_size + 2);
-      if (1 == (long) fread(buffer, file_size, 1, f))
-      {
-        // Add an extra newline to sort out trailing #includes on last line
-        buffer[file_size + 0] = '\n';
-        buffer[file_size + 1] = '\0';
+  BufferDestroy(&file_stack, scratch_heap);
+  BufferDestroy(&found_includes, scratch_heap);
+  HashTableDestroy(&reached);
+}
 
-        char* scan_start = buffer;
+// Everything a file includes is what it includes directly, along with the
+// closures of those headers. Closures are shared by all files including the
+// same headers, so a header pulled in by many files is only walked once.
+bool ScanImplicitDeps(StatCache* stat_cache, const ScanInput* input, ScanOutput* output)
+{
+  MemAllocHeap      *scratch_heap   = input->m_ScratchHeap;
+  MemAllocLinear    *scratch_alloc  = input->m_ScratchAlloc;
+  const ScannerData *scanner_config = input->m_ScannerConfig;
+  ScanCache         *scan_cache     = input->m_ScanCache;
 
-        // Skip UTF-8 marker if present as it freaks out ctype functions
-        static const unsigned char utf8_mark[] = { 0xef, 0xbb, 0xbf };
-        if (file_size >= 3 && 0 == memcmp(scan_start, utf8_mark, sizeof utf8_mark))
-          scan_start += sizeof utf8_mark;
+  IncludeSet incset;
+  IncludeSetInit(&incset, scratch_heap, scratch_alloc);
 
-        ScanFile(stat_cache, fn, scan_start, input, &found_includes);
-      }
+  FileInfo info = StatCacheStat(stat_cache, input->m_FileName);
 
-      // Insert result into scan cache
-      ScanCacheInsert(scan_cache, scan_key, info.m_Timestamp, found_includes.m_Storage, (int) found_includes.m_Size);
+  if (info.Exists())
+  {
+    Buffer<const char*> found_includes;
+    BufferInitWithCapacity(&found_includes, scratch_heap, 128);
 
-      for (const char* file : found_includes)
-      {
-        if (IncludeSetAddDuplicateString(&incset, file, Djb2HashPath(file)))
-        {
-          // This was a new file, schedule it for scanning as well. 
-          BufferAppendOne(&filename_stack, scratch_heap, file);
-        }
-      }
+    ScanCacheLookupResult includes;
+    GetIncludes(stat_cache, input, input->m_FileName, info.m_Timestamp, &found_includes, &includes);
 
-      HeapFree(scratch_heap, buffer);
-      fclose(f);
+    for (int i = 0; i < includes.m_IncludedFileCount; ++i)
+    {
+      const FileAndHash& header = includes.m_IncludedFiles[i];
+
+      // Already there along with its closure, through another header.
+      if (!IncludeSetAddNoDuplicateString(&incset, header.m_Filename, header.m_FilenameHash))
+        continue;
+
+      FileInfo header_info = StatCacheStat(stat_cache, header.m_Filename, header.m_FilenameHash);
+
+      if (!header_info.Exists())
+        continue;
+
+      HashDigest       key;
+      ScanCacheClosure closure;
+      ComputeScanCacheKey(&key, header.m_Filename, scanner_config->m_ScannerGuid);
+
+      if (!ScanCacheLookupClosure(scan_cache, stat_cache, key, header_info.m_Timestamp, &closure))
+        BuildClosure(stat_cache, input, header.m_Filename, header_info.m_Timestamp, key, &closure);
+
+      for (int j = 0; j < closure.m_FileCount; ++j)
+        IncludeSetAddNoDuplicateString(&incset, closure.m_Files[j].m_Filename, closure.m_Files[j].m_FilenameHash);
     }
+
+    BufferDestroy(&found_includes, scratch_heap);
   }
 
-  // Allocate space for output array. String data is already in scratch allocator.
+  // Allocate space for output array. String data lives in the scan cache.
   int include_count = incset.m_HashTable.m_RecordCount;
   FileAndHash* result = LinearAllocateArray<FileAndHash>(scratch_alloc, include_count);
   HashSetWalk(&incset.m_HashTable, [=] (uint32_t index, uint32_t hash, const char* path) {
@@ -255,8 +395,14 @@ bool ScanImplicitDeps(StatCache* stat_cache, const ScanInput* input, ScanOutput*
     result[index].m_FilenameHash = hash;
   });
 
-  BufferDestroy(&filename_stack, scratch_heap);
-  BufferDestroy(&found_includes, scratch_heap);
+  // Files are added to the input signature in this order. Where they end up
+  // in the set depends on the order closures were put together in, which
+  // varies between builds.
+  std::sort(result, result + include_count, [](const FileAndHash& l, const FileAndHash& r) {
+    if (l.m_FilenameHash != r.m_FilenameHash)
+      return l.m_FilenameHash < r.m_FilenameHash;
+    return strcmp(l.m_Filename, r.m_Filename) < 0;
+  });
 
   output->m_IncludedFileCount = include_count;
   output->m_IncludedFiles     = result;
@@ -25,6 +25,10 @@ static struct
 
 static Mutex              s_SignalMutex;
 static ConditionVariable *s_SignalCond;
+static void             (*s_SignalCallback)(void* user_data);
+static void              *s_SignalCallbackData;
+static int                s_SignalCallbacksRunning;
+static ConditionVariable  s_SignalCallbackDone;
 
 const char* SignalGetReason(void)
 {
@@ -44,8 +48,26 @@ void SignalSet(const char* reason)
   if (ConditionVariable* cvar = s_SignalCond)
     CondBroadcast(cvar);
 
+  void (*callback)(void*) = s_SignalCallback;
+  void *callback_data     = s_SignalCallbackData;
+
+  if (callback)
+    ++s_SignalCallbacksRunning;
+
   MutexUnlock(&s_SignalMutex);
 
+  // Call outside the lock; the callback is likely to call SignalGetReason().
+  // SignalHandlerSetCallback() waits on the running count instead.
+  if (callback)
+  {
+    callback(callback_data);
+
+    MutexLock(&s_SignalMutex);
+    if (--s_SignalCallbacksRunning == 0)
+      CondBroadcast(&s_SignalCallbackDone);
+    MutexUnlock(&s_SignalMutex);
+  }
+
 #if defined(TUNDRA_WIN32)
   // Also signal this event - build threads waiting on external programs are stuck in WaitForMultipleObjects()
   // and can't wait for a condition variable at the same time.
@@ -53,6 +75,18 @@ void SignalSet(const char* reason)
 #endif
 }
 
+void SignalReset(void)
+{
+  MutexLock(&s_SignalMutex);
+  s_SignalInfo.m_Signalled = false;
+  s_SignalInfo.m_Reason    = nullptr;
+  MutexUnlock(&s_SignalMutex);
+
+#if defined(TUNDRA_WIN32)
+  ResetEvent(s_SignalHandle);
+#endif
+}
+
 #if defined(TUNDRA_UNIX)
 static void* PosixSignalHandlerThread(void *arg)
 {
@@ -111,6 +145,7 @@ BOOL WINAPI WindowsSignalHandlerFunc(DWORD ctrl_type)
 void SignalHandlerInit()
 {
   MutexInit(&s_SignalMutex);
+  CondInit(&s_SignalCallbackDone);
 
 #if defined(TUNDRA_UNIX)
 	{
@@ -164,6 +199,18 @@ void SignalHandlerSetCondition(ConditionVariable *cvar)
   MutexUnlock(&s_SignalMutex);
 }
 
+void SignalHandlerSetCallback(void (*callback)(void* user_data), void* user_data)
+{
+  MutexLock(&s_SignalMutex);
+  s_SignalCallback     = callback;
+  s_SignalCallbackData = user_data;
+  // A signal may have picked up the old callback just before; don't return
+  // until it's done, so the caller can free whatever it uses.
+  while (s_SignalCallbacksRunning > 0)
+    CondWait(&s_SignalCallbackDone, &s_SignalMutex);
+  MutexUnlock(&s_SignalMutex);
+}
+
 #if defined(TUNDRA_UNIX)
 void SignalBlockThread(bool block)
 {
@@ -16,6 +16,9 @@ namespace t2
   // all build threads.
   void SignalSet(const char* reason);
 
+  // Forget an earlier signal, so a build server can go on to the next build.
+  void SignalReset(void);
+
   // Init the signal handler.
   void SignalHandlerInit(void);
 
@@ -31,6 +34,12 @@ namespace t2
   // arrived.
   void SignalHandlerSetCondition(ConditionVariable *variable);
 
+  // Specify a function which will be called when a signal has arrived. Used
+  // when build threads sleep on their own wake primitives rather than a
+  // shared condition variable. Waits for a callback that is already running
+  // to return, so its user data can be freed once this returns.
+  void SignalHandlerSetCallback(void (*callback)(void* user_data), void* user_data);
+
   // Block (or unblock) all normal interruption signals for the calling thread.
 #if defined(TUNDRA_UNIX)
   void SignalBlockThread(bool block);
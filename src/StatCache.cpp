@@ -1,27 +1,349 @@
 #include "StatCache.hpp"
+#include "BinaryWriter.hpp"
+#include "Buffer.hpp"
 #include "MemAllocHeap.hpp"
 #include "MemAllocLinear.hpp"
+#include "PathUtil.hpp"
 #include "Stats.hpp"
 
 #include <algorithm>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
 
 namespace t2
 {
 
+namespace DirCheck
+{
+  enum Enum
+  {
+    kUnchecked,
+    kUnchanged,
+    kChanged
+  };
+}
+
+// File systems can stamp changes with a time slightly behind the clock, and
+// some only keep whole or even seconds. Directories changed this close to
+// the start of a build may still change without their timestamp moving.
+static const uint64_t kRacyTimestampSeconds = 2;
+
+void GetDirStamp(const char* path, DirStamp* out)
+{
+  TimingScope timing_scope(&g_Stats.m_StatCount, &g_Stats.m_StatTimeCycles);
+
+  out->m_Timestamp = 0;
+  out->m_Identity  = 0;
+  out->m_Exists    = false;
+
+#if defined(TUNDRA_UNIX)
+  struct stat stbuf;
+  if (0 == stat(path, &stbuf) && S_ISDIR(stbuf.st_mode))
+  {
+#if defined(TUNDRA_APPLE)
+    const struct timespec& mtime = stbuf.st_mtimespec;
+#else
+    const struct timespec& mtime = stbuf.st_mtim;
+#endif
+    out->m_Timestamp = uint64_t(mtime.tv_sec) * 1000000000 + uint64_t(mtime.tv_nsec);
+    out->m_Identity  = uint64_t(stbuf.st_ino) ^ (uint64_t(stbuf.st_dev) << 40);
+    out->m_Exists    = true;
+  }
+#elif defined(TUNDRA_WIN32)
+  struct __stat64 stbuf;
+#if defined(TUNDRA_WIN32_MINGW)
+  if (0 == _stat64(path, &stbuf) && (stbuf.st_mode & _S_IFDIR))
+#else
+  if (0 == __stat64(path, &stbuf) && (stbuf.st_mode & _S_IFDIR))
+#endif
+  {
+    out->m_Timestamp = uint64_t(stbuf.st_mtime) * 1000000000;
+    out->m_Exists    = true;
+  }
+#endif
+}
+
+bool DirStampMatches(const DirStamp& stamp, const FrozenStatDir& dir)
+{
+  if (!stamp.m_Exists || !dir.m_Exists)
+    return stamp.m_Exists == (0 != dir.m_Exists);
+
+  return stamp.m_Timestamp == dir.m_Timestamp && stamp.m_Identity == dir.m_Identity;
+}
+
+bool DirStampIsSettled(const DirStamp& stamp, uint64_t start_time)
+{
+  return !stamp.m_Exists || stamp.m_Timestamp < (start_time - kRacyTimestampSeconds) * 1000000000;
+}
+
 void StatCacheInit(StatCache* self, MemAllocLinear* allocator, MemAllocHeap* heap)
 {
   self->m_Allocator      = allocator;
   self->m_Heap           = heap;
   HashTableInit(&self->m_Files, heap);
   ReadWriteLockInit(&self->m_HashLock);
+
+  MmapFileInit(&self->m_StateFile);
+  self->m_State          = nullptr;
+  HashTableInit(&self->m_KnownMissing, heap);
+  self->m_DirChecks      = nullptr;
+  self->m_StartTime      = time(nullptr);
+
+  HashSetInit(&self->m_ListedDirs, heap);
+  HashSetInit(&self->m_ListedPaths, heap);
+
+  self->m_Generation     = 0;
+  self->m_WriteCount     = 0;
+  HashTableInit(&self->m_DirStamps, heap);
+}
+
+static void StatCacheClose(StatCache* self)
+{
+  HashTableDestroy(&self->m_KnownMissing);
+  HeapFree(self->m_Heap, self->m_DirChecks);
+  self->m_DirChecks = nullptr;
+  self->m_State     = nullptr;
+  MmapFileUnmap(&self->m_StateFile);
 }
 
 void StatCacheDestroy(StatCache* self)
 {
+  StatCacheClose(self);
+  MmapFileDestroy(&self->m_StateFile);
+  HashTableDestroy(&self->m_DirStamps);
+  HashSetDestroy(&self->m_ListedPaths);
+  HashSetDestroy(&self->m_ListedDirs);
   HashTableDestroy(&self->m_Files);
   ReadWriteLockDestroy(&self->m_HashLock);
 }
 
+void StatCacheOpen(StatCache* self, const char* filename)
+{
+  MmapFileMap(&self->m_StateFile, filename);
+
+  if (!MmapFileValid(&self->m_StateFile))
+    return;
+
+  const StatCacheState* state = (const StatCacheState*) self->m_StateFile.m_Address;
+
+  if (StatCacheState::MagicNumber != state->m_MagicNumber)
+  {
+    MmapFileUnmap(&self->m_StateFile);
+    return;
+  }
+
+  self->m_State     = state;
+  self->m_DirChecks = (uint8_t*) HeapAllocate(self->m_Heap, state->m_Dirs.GetCount() + 1);
+  memset(self->m_DirChecks, DirCheck::kUnchecked, state->m_Dirs.GetCount() + 1);
+
+  for (int32_t i = 0, count = state->m_Misses.GetCount(); i < count; ++i)
+  {
+    const FrozenStatMiss& miss = state->m_Misses[i];
+    HashTableInsert(&self->m_KnownMissing, miss.m_PathHash, miss.m_Path.Get(), i);
+  }
+
+  Log(kDebug, "stat cache initialized -- %d known missing files in %d directories",
+      state->m_Misses.GetCount(), state->m_Dirs.GetCount());
+}
+
+// Whether a path is one of the saved misses, and its directory is still the
+// same. Directories are checked once per build.
+static bool IsKnownMissing(StatCache* self, const char* path, uint32_t hash)
+{
+  if (!self->m_State)
+    return false;
+
+  const int32_t* index = HashTableLookup(&self->m_KnownMissing, hash, path);
+  if (!index)
+    return false;
+
+  int32_t dir_index = self->m_State->m_Misses[*index].m_DirIndex;
+  uint8_t check     = self->m_DirChecks[dir_index];
+
+  // Threads racing to check the same directory come to the same conclusion.
+  if (DirCheck::kUnchecked == check)
+  {
+    const FrozenStatDir& dir = self->m_State->m_Dirs[dir_index];
+
+    DirStamp stamp;
+    GetDirStamp(dir.m_Path.Get(), &stamp);
+
+    check = DirStampMatches(stamp, dir) ? DirCheck::kUnchanged : DirCheck::kChanged;
+    self->m_DirChecks[dir_index] = check;
+  }
+
+  return DirCheck::kUnchanged == check;
+}
+
+namespace
+{
+  struct SaveDir
+  {
+    const char* m_Path;
+    DirStamp    m_Stamp;
+    bool        m_Usable;
+    int32_t     m_SavedIndex;
+  };
+
+  struct SaveMiss
+  {
+    const char* m_Path;
+    uint32_t    m_Hash;
+    int32_t     m_DirIndex;
+  };
+
+  struct SaveState
+  {
+    MemAllocHeap*                        m_Heap;
+    MemAllocLinear                       m_Allocator;
+    HashTable<int32_t, kFlagPathStrings> m_DirLookup;
+    Buffer<SaveDir>                      m_Dirs;
+    Buffer<SaveMiss>                     m_Misses;
+    uint64_t                             m_StartTime;
+  };
+}
+
+// Look up, or stat, the directory of a path. Returns -1 if the path is too
+// long.
+static int32_t GetSaveDir(SaveState* state, const char* path)
+{
+  char dir[kMaxPathLength];
+  if (!PathDirectoryOf(dir, path))
+    return -1;
+
+  uint32_t hash = Djb2HashPath(dir);
+
+  if (const int32_t* index = HashTableLookup(&state->m_DirLookup, hash, dir))
+    return *index;
+
+  int32_t  index = int32_t(state->m_Dirs.m_Size);
+  SaveDir* d     = BufferAlloc(&state->m_Dirs, state->m_Heap, 1);
+
+  d->m_Path       = StrDup(&state->m_Allocator, dir);
+  d->m_SavedIndex = -1;
+  GetDirStamp(dir, &d->m_Stamp);
+  d->m_Usable     = DirStampIsSettled(d->m_Stamp, state->m_StartTime);
+
+  HashTableInsert(&state->m_DirLookup, hash, d->m_Path, index);
+  return index;
+}
+
+static void AddSaveMiss(SaveState* state, const char* path, uint32_t hash, int32_t dir_index)
+{
+  SaveMiss* miss   = BufferAlloc(&state->m_Misses, state->m_Heap, 1);
+  miss->m_Path     = path;
+  miss->m_Hash     = hash;
+  miss->m_DirIndex = dir_index;
+}
+
+bool StatCacheSave(StatCache* self, MemAllocHeap* serialization_heap, const char* filename, const char* tmp_filename)
+{
+  TimingScope timing_scope(nullptr, &g_Stats.m_StatCacheSaveTimeCycles);
+
+  SaveState state;
+  state.m_Heap     = serialization_heap;
+  state.m_StartTime = self->m_StartTime;
+  LinearAllocInit(&state.m_Allocator, serialization_heap, MB(16), "stat cache save");
+  HashTableInit(&state.m_DirLookup, serialization_heap);
+  BufferInit(&state.m_Dirs);
+  BufferInit(&state.m_Misses);
+
+  // Misses from this build. Their directories must not have changed since
+  // before the build started, or they may have missed something added
+  // since.
+  HashTableWalk(&self->m_Files, [&](uint32_t index, uint32_t hash, const char* path, const FileInfo& info) {
+    const uint32_t skip_flags = FileInfo::kFlagExists | FileInfo::kFlagError | FileInfo::kFlagDirty | FileInfo::kFlagSymlink;
+    if (info.m_Flags & skip_flags)
+      return;
+
+    int32_t dir_index = GetSaveDir(&state, path);
+    if (dir_index >= 0 && state.m_Dirs[dir_index].m_Usable)
+      AddSaveMiss(&state, path, hash, dir_index);
+  });
+
+  // Misses saved earlier, that this build didn't look at. They're still good
+  // as long as their directory is as it was when they were saved.
+  if (const StatCacheState* old_state = self->m_State)
+  {
+    for (const FrozenStatMiss& miss : old_state->m_Misses)
+    {
+      if (DirCheck::kChanged == self->m_DirChecks[miss.m_DirIndex])
+        continue;
+
+      if (HashTableLookup(&self->m_Files, miss.m_PathHash, miss.m_Path.Get()))
+        continue;
+
+      int32_t dir_index = GetSaveDir(&state, miss.m_Path.Get());
+      if (dir_index >= 0 && DirStampMatches(state.m_Dirs[dir_index].m_Stamp, old_state->m_Dirs[miss.m_DirIndex]))
+        AddSaveMiss(&state, miss.m_Path.Get(), miss.m_PathHash, dir_index);
+    }
+  }
+
+  BinaryWriter writer;
+  BinaryWriterInit(&writer, serialization_heap);
+
+  BinarySegment *main_seg   = BinaryWriterAddSegment(&writer);
+  BinarySegment *dir_seg    = BinaryWriterAddSegment(&writer);
+  BinarySegment *miss_seg   = BinaryWriterAddSegment(&writer);
+  BinarySegment *string_seg = BinaryWriterAddSegment(&writer);
+  BinaryLocator  dir_ptr    = BinarySegmentPosition(dir_seg);
+  BinaryLocator  miss_ptr   = BinarySegmentPosition(miss_seg);
+
+  int32_t dir_count = 0;
+
+  for (const SaveMiss& miss : state.m_Misses)
+  {
+    SaveDir* dir = &state.m_Dirs[miss.m_DirIndex];
+
+    if (dir->m_SavedIndex < 0)
+    {
+      dir->m_SavedIndex = dir_count++;
+
+      BinarySegmentWriteUint64(dir_seg, dir->m_Stamp.m_Timestamp);
+      BinarySegmentWriteUint64(dir_seg, dir->m_Stamp.m_Identity);
+      BinarySegmentWriteUint32(dir_seg, dir->m_Stamp.m_Exists ? 1 : 0);
+      BinarySegmentWritePointer(dir_seg, BinarySegmentPosition(string_seg));
+      BinarySegmentWriteStringData(string_seg, dir->m_Path);
+    }
+
+    BinarySegmentWriteUint32(miss_seg, miss.m_Hash);
+    BinarySegmentWriteInt32(miss_seg, dir->m_SavedIndex);
+    BinarySegmentWritePointer(miss_seg, BinarySegmentPosition(string_seg));
+    BinarySegmentWriteStringData(string_seg, miss.m_Path);
+  }
+
+  BinarySegmentWriteUint32(main_seg, StatCacheState::MagicNumber);
+  BinarySegmentWriteInt32(main_seg, dir_count);
+  BinarySegmentWritePointer(main_seg, dir_ptr);
+  BinarySegmentWriteInt32(main_seg, int32_t(state.m_Misses.m_Size));
+  BinarySegmentWritePointer(main_seg, miss_ptr);
+
+  // The old file has been copied from; let go of it so it can be replaced
+  // on Windows.
+  StatCacheClose(self);
+
+  bool success = BinaryWriterFlush(&writer, tmp_filename);
+
+  if (success)
+  {
+    success = RenameFile(tmp_filename, filename);
+  }
+  else
+  {
+    remove(tmp_filename);
+  }
+
+  BinaryWriterDestroy(&writer);
+
+  BufferDestroy(&state.m_Misses, serialization_heap);
+  BufferDestroy(&state.m_Dirs, serialization_heap);
+  HashTableDestroy(&state.m_DirLookup);
+  LinearAllocDestroy(&state.m_Allocator);
+
+  return success;
+}
+
 static void StatCacheInsert(StatCache* self, uint32_t hash, const char* path, const FileInfo& info)
 {
   ReadWriteLockWrite(&self->m_HashLock);
@@ -31,16 +353,86 @@ static void StatCacheInsert(StatCache* self, uint32_t hash, const char* path, co
 
 void StatCacheMarkDirty(StatCache* self, const char* path, uint32_t hash)
 {
+  char dir[kMaxPathLength];
+  bool has_dir = PathDirectoryOf(dir, path);
+
   ReadWriteLockWrite(&self->m_HashLock);
 
   if (FileInfo* fi = HashTableLookup(&self->m_Files, hash, path))
   {
+    if (0 == (fi->m_Flags & FileInfo::kFlagExists))
+      AtomicIncrement(&self->m_Generation);
+
     fi->m_Flags = FileInfo::kFlagDirty;
   }
 
+  AtomicIncrement(&self->m_WriteCount);
+
+  if (has_dir)
+  {
+    uint32_t dir_hash = Djb2HashPath(dir);
+
+    // The file may not have been there when its directory was listed.
+    if (HashSetLookup(&self->m_ListedDirs, dir_hash, dir))
+    {
+      if (!HashSetLookup(&self->m_ListedPaths, hash, path))
+        HashSetInsert(&self->m_ListedPaths, hash, StrDup(self->m_Allocator, path));
+    }
+
+    if (StatCacheDir* stamped = HashTableLookup(&self->m_DirStamps, dir_hash, dir))
+    {
+      if (!stamped->m_Stale)
+      {
+        stamped->m_Stale = true;
+        AtomicIncrement(&self->m_Generation);
+      }
+    }
+  }
+
   ReadWriteUnlockWrite(&self->m_HashLock);
 }
 
+void StatCacheSeed(StatCache* self, const char* path, uint32_t hash, const FileInfo& info)
+{
+  if (!HashTableLookup(&self->m_Files, hash, path))
+    StatCacheInsert(self, hash, path, info);
+}
+
+DirStamp StatCacheDirStamp(StatCache* self, const char* dir, uint32_t hash)
+{
+  ReadWriteLockRead(&self->m_HashLock);
+
+  const StatCacheDir* cached = HashTableLookup(&self->m_DirStamps, hash, dir);
+
+  if (cached && !cached->m_Stale)
+  {
+    DirStamp result = cached->m_Stamp;
+    ReadWriteUnlockRead(&self->m_HashLock);
+    return result;
+  }
+
+  ReadWriteUnlockRead(&self->m_HashLock);
+
+  uint32_t generation = self->m_Generation;
+
+  StatCacheDir entry;
+  GetDirStamp(dir, &entry.m_Stamp);
+
+  ReadWriteLockWrite(&self->m_HashLock);
+
+  // Something may have been written in the meantime.
+  entry.m_Stale = generation != self->m_Generation;
+
+  if (StatCacheDir* existing = HashTableLookup(&self->m_DirStamps, hash, dir))
+    *existing = entry;
+  else
+    HashTableInsert(&self->m_DirStamps, hash, StrDup(self->m_Allocator, dir), entry);
+
+  ReadWriteUnlockWrite(&self->m_HashLock);
+
+  return entry.m_Stamp;
+}
+
 FileInfo StatCacheStat(StatCache* self, const char* path, uint32_t hash)
 {
   ReadWriteLockRead(&self->m_HashLock);
@@ -56,8 +448,23 @@ FileInfo StatCacheStat(StatCache* self, const char* path, uint32_t hash)
 
   ReadWriteUnlockRead(&self->m_HashLock);
 
-  AtomicIncrement(&g_Stats.m_StatCacheMisses);
-  FileInfo file_info = GetFileInfo(path);
+  FileInfo file_info;
+
+  // Known missing files are only taken on trust once; if they're marked
+  // dirty, they have been written to since.
+  if (fi == nullptr && IsKnownMissing(self, path, hash))
+  {
+    AtomicIncrement(&g_Stats.m_StatCacheKnownMissing);
+    file_info.m_Flags       = 0;
+    file_info.m_Size        = 0;
+    file_info.m_Timestamp   = 0;
+    file_info.m_ChangeStamp = 0;
+  }
+  else
+  {
+    AtomicIncrement(&g_Stats.m_StatCacheMisses);
+    file_info = GetFileInfo(path);
+  }
 
   // There's a natural race condition here. Some other thread might come in,
   // stat the file and insert it before us. We just let that happen. The DAG
@@ -67,4 +474,149 @@ FileInfo StatCacheStat(StatCache* self, const char* path, uint32_t hash)
   return file_info;
 }
 
+namespace
+{
+  struct DirListing
+  {
+    MemAllocHeap*    m_Heap;
+    Buffer<char>     m_Names;   // each one null terminated
+    Buffer<FileInfo> m_Infos;   // zero flags where not known
+  };
+}
+
+static void AddListedName(void* user_data, const char* name, const FileInfo* info)
+{
+  DirListing* listing = (DirListing*) user_data;
+
+  size_t len = strlen(name) + 1;
+  memcpy(BufferAlloc(&listing->m_Names, listing->m_Heap, len), name, len);
+
+  FileInfo* dest = BufferAlloc(&listing->m_Infos, listing->m_Heap, 1);
+  if (info)
+  {
+    *dest = *info;
+  }
+  else
+  {
+    dest->m_Flags     = 0;
+    dest->m_Size      = 0;
+    dest->m_Timestamp = 0;
+  }
+}
+
+// Length of the part of a path before its last component.
+static size_t DirPrefixLength(const char* path)
+{
+  const char* sep = strrchr(path, '/');
+#if defined(TUNDRA_WIN32)
+  if (const char* bsep = strrchr(path, '\\'))
+  {
+    if (!sep || bsep > sep)
+      sep = bsep;
+  }
+#endif
+  return sep ? sep - path + 1 : 0;
+}
+
+// List the directory of a path, unless another thread got there first.
+// Whatever the listing tells about the files in it goes into the cache as
+// well. Returns false if the directory couldn't be listed.
+static bool ListDirectoryOf(StatCache* self, const char* path, const char* dir, uint32_t dir_hash)
+{
+  DirListing listing;
+  listing.m_Heap = self->m_Heap;
+  BufferInit(&listing.m_Names);
+  BufferInit(&listing.m_Infos);
+
+  bool success = ListDirectoryNames(dir, &listing, AddListedName);
+
+  if (success)
+  {
+    char   file_path[kMaxPathLength];
+    size_t prefix_len = DirPrefixLength(path);
+    memcpy(file_path, path, prefix_len);
+
+    ReadWriteLockWrite(&self->m_HashLock);
+
+    if (!HashSetLookup(&self->m_ListedDirs, dir_hash, dir))
+    {
+      const char* name = listing.m_Names.m_Storage;
+
+      for (const FileInfo& info : listing.m_Infos)
+      {
+        size_t len = strlen(name);
+
+        // Anything longer couldn't be probed for anyway.
+        if (prefix_len + len < kMaxPathLength)
+        {
+          memcpy(file_path + prefix_len, name, len + 1);
+
+          uint32_t    hash     = Djb2HashPath(file_path);
+          const char* path_dup = StrDup(self->m_Allocator, file_path);
+
+          HashSetInsert(&self->m_ListedPaths, hash, path_dup);
+
+          if (info.m_Flags && !HashTableLookup(&self->m_Files, hash, path_dup))
+            HashTableInsert(&self->m_Files, hash, path_dup, info);
+        }
+
+        name += len + 1;
+      }
+
+      HashSetInsert(&self->m_ListedDirs, dir_hash, StrDup(self->m_Allocator, dir));
+      AtomicIncrement(&g_Stats.m_StatCacheDirsListed);
+    }
+
+    ReadWriteUnlockWrite(&self->m_HashLock);
+  }
+
+  BufferDestroy(&listing.m_Infos, self->m_Heap);
+  BufferDestroy(&listing.m_Names, self->m_Heap);
+
+  return success;
+}
+
+FileInfo StatCacheProbe(StatCache* self, const char* path, uint32_t hash)
+{
+  char dir[kMaxPathLength];
+  if (!PathDirectoryOf(dir, path))
+    return StatCacheStat(self, path, hash);
+
+  uint32_t dir_hash = Djb2HashPath(dir);
+
+  // Goes around a second time only after listing the directory.
+  for (;;)
+  {
+    ReadWriteLockRead(&self->m_HashLock);
+    bool cached  = nullptr != HashTableLookup(&self->m_Files, hash, path);
+    bool listed  = HashSetLookup(&self->m_ListedDirs, dir_hash, dir);
+    bool present = listed && HashSetLookup(&self->m_ListedPaths, hash, path);
+    ReadWriteUnlockRead(&self->m_HashLock);
+
+    if (cached || present)
+      return StatCacheStat(self, path, hash);
+
+    if (listed)
+    {
+      AtomicIncrement(&g_Stats.m_StatCacheListedMisses);
+
+      FileInfo file_info;
+      file_info.m_Flags       = 0;
+      file_info.m_Size        = 0;
+      file_info.m_Timestamp   = 0;
+      file_info.m_ChangeStamp = 0;
+      StatCacheInsert(self, hash, path, file_info);
+      return file_info;
+    }
+
+    // A saved miss costs at most a stat of the directory, which is less
+    // than listing it.
+    if (IsKnownMissing(self, path, hash))
+      return StatCacheStat(self, path, hash);
+
+    if (!ListDirectoryOf(self, path, dir, dir_hash))
+      return StatCacheStat(self, path, hash);
+  }
+}
+
 }
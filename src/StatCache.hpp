@@ -2,7 +2,10 @@
 #define STATCACHE_HPP
 
 #include "Common.hpp"
+#include "BinaryData.hpp"
 #include "FileInfo.hpp"
+#include "Hash.hpp"
+#include "MemoryMappedFile.hpp"
 #include "ReadWriteLock.hpp"
 #include "HashTable.hpp"
 
@@ -14,18 +17,99 @@ namespace t2
 struct MemAllocHeap;
 struct MemAllocLinear;
 
+// A directory as it was when a build saved the stat cache.
+struct FrozenStatDir
+{
+  uint64_t     m_Timestamp;   // modification time in nanoseconds
+  uint64_t     m_Identity;    // device and inode, where available
+  uint32_t     m_Exists;      // zero if it didn't exist, or wasn't a directory
+  FrozenString m_Path;
+};
+static_assert(sizeof(FrozenStatDir) == 24, "struct size");
+
+struct FrozenStatMiss
+{
+  uint32_t     m_PathHash;
+  int32_t      m_DirIndex;
+  FrozenString m_Path;
+};
+static_assert(sizeof(FrozenStatMiss) == 12, "struct size");
+
+// What a directory was like when it was looked at.
+struct DirStamp
+{
+  uint64_t m_Timestamp;   // modification time in nanoseconds
+  uint64_t m_Identity;
+  bool     m_Exists;
+};
+
+void GetDirStamp(const char* path, DirStamp* out);
+
+bool DirStampMatches(const DirStamp& stamp, const FrozenStatDir& dir);
+
+// Whether a directory looked at after a build has finished was last changed
+// well before the build started, so the build saw it as it is now.
+bool DirStampIsSettled(const DirStamp& stamp, uint64_t start_time);
+
+struct StatCacheDir
+{
+  DirStamp m_Stamp;
+  bool     m_Stale;
+};
+
+// Paths that didn't exist when the last build finished, along with their
+// directories. Nothing can have been added to a directory that is still
+// the same as it was then, so these paths needn't be statted again. Include
+// path searches are mostly made up of such lookups.
+struct StatCacheState
+{
+  static const uint32_t        MagicNumber = 0x3a7c0e01 ^ kTundraHashMagic;
+
+  uint32_t                     m_MagicNumber;
+  FrozenArray<FrozenStatDir>   m_Dirs;
+  FrozenArray<FrozenStatMiss>  m_Misses;
+};
+
 struct StatCache
 {
   MemAllocLinear* m_Allocator;
   MemAllocHeap*   m_Heap;
   ReadWriteLock   m_HashLock;
   HashTable<FileInfo, kFlagPathStrings> m_Files;
+
+  // Saved misses from an earlier build, indexed by path.
+  MemoryMappedFile                      m_StateFile;
+  const StatCacheState*                 m_State;
+  HashTable<int32_t, kFlagPathStrings>  m_KnownMissing;
+  uint8_t*                              m_DirChecks;
+
+  // Directories listed to answer probes, and all paths in them.
+  HashSet<kFlagPathStrings>             m_ListedDirs;
+  HashSet<kFlagPathStrings>             m_ListedPaths;
+
+  // Misses only get saved for directories that haven't changed since
+  // before this.
+  uint64_t        m_StartTime;
+
+  // Bumped whenever a file is written where the build may already have
+  // looked for it: a path that was found missing, or a directory stamped
+  // through StatCacheDirStamp().
+  uint32_t                                  m_Generation;
+  HashTable<StatCacheDir, kFlagPathStrings> m_DirStamps;
+
+  // Bumped whenever the build writes a file.
+  uint32_t                                  m_WriteCount;
 };
 
 void StatCacheInit(StatCache* stat_cache, MemAllocLinear* allocator, MemAllocHeap* heap);
 
 void StatCacheDestroy(StatCache* stat_cache);
 
+// Load the misses saved by an earlier build.
+void StatCacheOpen(StatCache* stat_cache, const char* filename);
+
+bool StatCacheSave(StatCache* stat_cache, MemAllocHeap* serialization_heap, const char* filename, const char* tmp_filename);
+
 void StatCacheMarkDirty(StatCache* stat_cache, const char* path, uint32_t hash);
 
 FileInfo StatCacheStat(StatCache* stat_cache, const char* path, uint32_t hash);
@@ -35,6 +119,21 @@ inline FileInfo StatCacheStat(StatCache* stat_cache, const char* path)
   return StatCacheStat(stat_cache, path, Djb2HashPath(path));
 }
 
+// Like StatCacheStat(), for paths that most likely don't exist, like include
+// path candidates. The path's directory is listed the first time, and paths
+// that aren't in it don't need to be statted.
+FileInfo StatCacheProbe(StatCache* stat_cache, const char* path, uint32_t hash);
+
+inline FileInfo StatCacheProbe(StatCache* stat_cache, const char* path)
+{
+  return StatCacheProbe(stat_cache, path, Djb2HashPath(path));
+}
+
+// Stamp of a directory, taken once per generation.
+DirStamp StatCacheDirStamp(StatCache* stat_cache, const char* dir, uint32_t hash);
+
+// Add what's known about a file without statting it, unless it's there already.
+void StatCacheSeed(StatCache* stat_cache, const char* path, uint32_t hash, const FileInfo& info);
 
 }
 
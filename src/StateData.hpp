@@ -13,11 +13,22 @@ struct NodeStateData
   HashDigest                m_InputSignature;
   FrozenArray<FrozenString> m_OutputFiles;
   FrozenArray<FrozenString> m_AuxOutputFiles;
+  // Wall time of the node's action in milliseconds, as of the last time it ran.
+  uint32_t                  m_ActionTimeMs;
+  // Content digests of m_OutputFiles, if the node digests its outputs.
+  FrozenArray<HashDigest>   m_OutputDigests;
+  // Files included by the node's inputs, directly or not, in input file
+  // order, and how many of them each input has. The fingerprint covers the
+  // stat data of the inputs and these files when they were scanned; while it
+  // matches, they needn't be scanned again.
+  FrozenArray<int32_t>           m_ImplicitDepCounts;
+  FrozenArray<FrozenFileAndHash> m_ImplicitDeps;
+  HashDigest                     m_ImplicitDepsFingerprint;
 };
 
 struct StateData
 {
-  static const uint32_t     MagicNumber = 0x15890102 ^ kTundraHashMagic;
+  static const uint32_t     MagicNumber = 0x15890105 ^ kTundraHashMagic;
 
   uint32_t                 m_MagicNumber;
 
@@ -15,6 +15,12 @@ struct TundraStats
   uint32_t m_ScanCacheInserts;
   uint64_t m_ScanCacheSaveTime;
   uint32_t m_ScanCacheEntriesDropped;
+  uint32_t m_IncludeCacheHits;
+  uint32_t m_IncludeCacheMisses;
+  uint32_t m_ClosureCacheHits;
+  uint32_t m_ClosureCacheMisses;
+  uint32_t m_ImplicitDepsReused;
+  uint32_t m_ImplicitDepsScanned;
 
   uint32_t m_StateSaveNew;
   uint32_t m_StateSaveOld;
@@ -34,12 +40,20 @@ struct TundraStats
   uint32_t m_StatCacheHits;
   uint32_t m_StatCacheMisses;
   uint32_t m_StatCacheDirty;
+  uint32_t m_StatCacheSeeded;
+  uint32_t m_StatCacheKnownMissing;
+  uint32_t m_StatCacheDirsListed;
+  uint32_t m_StatCacheListedMisses;
+  uint64_t m_StatCacheSaveTimeCycles;
 
   uint64_t m_StaleCheckTimeCycles;
 
   uint32_t m_ExecCount;
   uint64_t m_ExecTimeCycles;
 
+  uint32_t m_StealCount;
+  uint32_t m_OutputDigestsUnchanged;
+
   uint64_t m_JsonParseTimeCycles;
 
   uint64_t m_DigestCacheSaveTimeCycles;
@@ -47,6 +61,22 @@ struct TundraStats
   uint32_t m_DigestCacheHits;
   uint32_t m_FileDigestCount;
   uint64_t m_FileDigestTimeCycles;
+  uint32_t m_FileDigestWaits;
+  uint32_t m_FileDigestPrefetches;
+
+  uint32_t m_ActionCacheHits;
+  uint32_t m_ActionCacheMisses;
+  uint32_t m_ActionCacheStores;
+  uint32_t m_ActionCacheEvictions;
+  uint64_t m_ActionCacheRestoreTimeCycles;
+  uint64_t m_ActionCacheStoreTimeCycles;
+
+  uint32_t m_RemoteCacheHits;
+  uint32_t m_RemoteCacheMisses;
+  uint32_t m_RemoteCacheUploads;
+  uint64_t m_RemoteCacheBytesDown;
+  uint64_t m_RemoteCacheBytesUp;
+  uint64_t m_RemoteCacheFetchTimeCycles;
 };
 
 struct TimingScope
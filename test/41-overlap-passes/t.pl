@@ -0,0 +1,68 @@
+my $build_file = <<END;
+local native = require 'tundra.native'
+require 'tundra.syntax.testsupport'
+Build {
+	Configs = {
+		Config {
+			Name = "foo-bar",
+			DefaultOnHost = { native.host_platform },
+		}
+	},
+	Passes = {
+		First = { Name = "First", BuildOrder = 1 },
+		Second = { Name = "Second", BuildOrder = 2, Depends = { "First" } },
+		Third = { Name = "Third", BuildOrder = 3 },
+	},
+	Options = {
+		OverlapPasses = true,
+	},
+	Units = function()
+		UpperCaseFile {
+			Pass = "First",
+			Name = "broken",
+			InputFile = "missing.input",
+			OutputFile = "\$(OBJECTDIR)/broken.output",
+		}
+		UpperCaseFile {
+			Pass = "Second",
+			Name = "skipped",
+			InputFile = "test.input",
+			OutputFile = "\$(OBJECTDIR)/skipped.output",
+		}
+		UpperCaseFile {
+			Pass = "Third",
+			Name = "last",
+			InputFile = "test.input",
+			OutputFile = "\$(OBJECTDIR)/last.output",
+			Depends = { "skipped" },
+		}
+		Default "broken"
+		Default "last"
+	end,
+}
+END
+
+my $test_input = "this is the test input";
+
+sub run_test() {
+	my $files = {
+		"tundra.lua" => $build_file,
+		"test.input" => $test_input,
+	};
+
+	with_sandbox($files, sub {
+		# The third pass doesn't wait for the second, but one of its nodes depends
+		# on a node in it. That node must still complete when its pass is skipped.
+		local $TundraTest::tundra_options = "$TundraTest::tundra_options -k";
+		run_tundra_expect_failure 'foo-bar';
+		fail "skipped pass was built" if output_file_exists 'skipped.output';
+		expect_output_contents 'last.output', uc($test_input);
+	});
+}
+
+deftest {
+	name => "Overlapped passes",
+	procs => [
+		"Nodes in skipped passes release their dependents" => sub { run_test(); },
+	]
+};
@@ -0,0 +1,77 @@
+my $build_file = <<END;
+local native = require 'tundra.native'
+Build {
+	Configs = {
+		Config {
+			Name = "foo-bar",
+			DefaultOnHost = { native.host_platform },
+		}
+	},
+	Units = function()
+		DefRule {
+			Name = "Rendezvous",
+			Command = "sh \$(<) \$(@)",
+			Blueprint = {
+				Name = { Required = true, Type = "string" },
+			},
+			Setup = function (env, data)
+				return {
+					InputFiles  = { "rendezvous.sh" },
+					OutputFiles = { "\$(OBJECTDIR)/" .. data.Name .. ".done" },
+				}
+			end,
+		}
+		Rendezvous { Name = "a" }
+		Rendezvous { Name = "b" }
+		Rendezvous { Name = "c" }
+		Rendezvous { Name = "d" }
+		Default "a"
+	end,
+}
+END
+
+# Each action waits for all four to have started, so they only succeed if
+# they run at the same time.
+my $rendezvous = <<'END';
+touch "$1.started"
+dir=$(dirname "$1")
+for i in $(seq 1 40); do
+	if [ $(ls "$dir" | grep -c '\.started$') -ge 4 ]; then
+		echo done > "$1"
+		exit 0
+	fi
+	sleep 0.05
+done
+exit 1
+END
+
+sub run_test($$) {
+	my ($options, $expect_success) = @_;
+
+	# Actions only run asynchronously on Linux.
+	return unless $^O eq 'linux';
+
+	my $files = {
+		"tundra.lua" => $build_file,
+		"rendezvous.sh" => $rendezvous,
+	};
+
+	with_sandbox($files, sub {
+		local $TundraTest::tundra_options = "$TundraTest::tundra_options $options";
+		if ($expect_success) {
+			run_tundra 'foo-bar a b c d';
+			expect_contents 't2-output/foo-bar-debug-default/d.done', "done\n";
+		} else {
+			run_tundra_expect_failure 'foo-bar a b c d';
+		}
+	});
+}
+
+deftest {
+	name => "Concurrent actions",
+	procs => [
+		"More actions than threads run at once" => sub { run_test('-j 1 -a 4', 1); },
+		"More actions than threads run at once with work stealing" => sub { run_test('-j 1 -a 4 -W', 1); },
+		"No more actions than asked for run at once" => sub { run_test('-j 4 -a 2', 0); },
+	]
+};
@@ -18,7 +18,7 @@ BEGIN {
     $VERSION = 1.00;
     @ISA = qw(Exporter);
     @EXPORT = qw(
-    &deftest &run_tundra &expect_contents &expect_output_contents
+    &deftest &run_tundra &run_tundra_expect_failure &expect_contents &expect_output_contents
     &output_file_exists
     &update_file &with_sandbox &bump_timestamp
     &md5_output_file
@@ -76,9 +76,8 @@ sub with_sandbox($$) {
   die $@ if $@;
 }
 
-sub run_tundra($;$) {
-  my $config = shift;
-  my $args = shift;
+sub launch_tundra($$) {
+  my ($config, $args) = @_;
   $args = "" unless defined $args;
 
   $last_run_time = time();
@@ -93,7 +92,16 @@ sub run_tundra($;$) {
   }
   close($child);
 
-  my $rc = $?;
+  # Store away config & output dir for convenience later when checking results.
+  $curr_config = $config;
+  $curr_output_dir = catdir($objectroot, $curr_config . '-debug-default');
+
+  return ($?, @output);
+}
+
+sub run_tundra($;$) {
+  my ($rc, @output) = launch_tundra($_[0], $_[1]);
+
   unless ($rc == 0) {
     my $separator = ("=" x 79) . "\n";
     push @output, $separator;
@@ -101,10 +109,12 @@ sub run_tundra($;$) {
     unshift @output, "\ntundra failed with result code $rc\n";
     fail (join("", @output) . "\n");
   }
+}
 
-  # Store away config & output dir for convenience later when checking results.
-  $curr_config = $config;
-  $curr_output_dir = catdir($objectroot, $curr_config . '-debug-default');
+sub run_tundra_expect_failure($;$) {
+  my ($rc, @output) = launch_tundra($_[0], $_[1]);
+
+  fail "tundra succeeded, but was expected to fail:\n" . join("", @output) if $rc == 0;
 }
 
 sub expect_contents($$) {
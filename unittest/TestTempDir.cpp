@@ -0,0 +1,41 @@
+#include "TestTempDir.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool TestTempDir::Create(const char* prefix)
+{
+  snprintf(m_Dir, sizeof m_Dir, "/tmp/%s-XXXXXX", prefix);
+  return nullptr != mkdtemp(m_Dir);
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+  return remove(path);
+}
+
+bool TestTempDir::Remove()
+{
+  // Depth first, so directories are empty by the time they're removed.
+  return 0 == nftw(m_Dir, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+const char* TestTempDir::Path(const char* name)
+{
+  snprintf(m_Path, sizeof m_Path, "%s/%s", m_Dir, name);
+  return m_Path;
+}
+
+bool TestTempDir::WriteFile(const char* name, const char* data)
+{
+  FILE* f = fopen(Path(name), "w");
+  if (!f)
+    return false;
+  bool ok = EOF != fputs(data, f);
+  return 0 == fclose(f) && ok;
+}
+
+#endif
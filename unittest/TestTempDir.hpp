@@ -0,0 +1,27 @@
+#ifndef TESTTEMPDIR_HPP
+#define TESTTEMPDIR_HPP
+
+#include "Common.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+// A scratch directory for tests that need real files. Everything in it is
+// removed along with it.
+struct TestTempDir
+{
+  char m_Dir[64];
+  char m_Path[256];
+
+  // `prefix` names the directory, which is created under /tmp.
+  bool Create(const char* prefix);
+  bool Remove();
+
+  // Full path of a file in the directory. Only valid until the next call.
+  const char* Path(const char* name);
+
+  bool WriteFile(const char* name, const char* data);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,300 @@
+#include "TestHarness.hpp"
+#include "TestTempDir.hpp"
+#include "ActionCache.hpp"
+#include "BinaryWriter.hpp"
+#include "DagData.hpp"
+#include "FileInfo.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemoryMappedFile.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace t2;
+
+class ActionCacheTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap     heap;
+  ActionCache      cache;
+  MemoryMappedFile node_file;
+  MemoryMappedFile index_file;
+  TestTempDir      dir;
+  char             cache_dir[256];
+  char             buffer[2048];
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    MmapFileInit(&node_file);
+    MmapFileInit(&index_file);
+    ASSERT_TRUE(dir.Create("t2-actioncache"));
+    strcpy(cache_dir, dir.Path("cache"));
+    ASSERT_TRUE(ActionCacheInit(&cache, &heap, cache_dir, MB(1)));
+  }
+
+  void TearDown() override
+  {
+    ActionCacheDestroy(&cache);
+    MmapFileDestroy(&index_file);
+    MmapFileDestroy(&node_file);
+    HeapDestroy(&heap);
+    ASSERT_TRUE(dir.Remove());
+  }
+
+  // Freeze a node with the given output files, the way the DAG generator
+  // does. Only the outputs matter to the cache.
+  const NodeData* MakeNode(const char* name, const char* output1, const char* output2)
+  {
+    BinaryWriter writer;
+    BinaryWriterInit(&writer, &heap);
+    BinarySegment* seg      = BinaryWriterAddSegment(&writer);
+    BinarySegment* file_seg = BinaryWriterAddSegment(&writer);
+    BinarySegment* str_seg  = BinaryWriterAddSegment(&writer);
+
+    BinarySegmentWriteNullPointer(seg);  // m_Action
+    BinarySegmentWriteNullPointer(seg);  // m_PreAction
+    BinarySegmentWriteNullPointer(seg);  // m_Annotation
+    BinarySegmentWriteInt32(seg, 0);     // m_PassIndex
+    for (int i = 0; i < 3; ++i)          // m_Dependencies, m_BackLinks, m_InputFiles
+    {
+      BinarySegmentWriteInt32(seg, 0);
+      BinarySegmentWriteNullPointer(seg);
+    }
+    BinarySegmentWriteInt32(seg, 2);     // m_OutputFiles
+    BinarySegmentWritePointer(seg, BinarySegmentPosition(file_seg));
+    for (int i = 0; i < 2; ++i)          // m_AuxOutputFiles, m_EnvVars
+    {
+      BinarySegmentWriteInt32(seg, 0);
+      BinarySegmentWriteNullPointer(seg);
+    }
+    BinarySegmentWriteNullPointer(seg);  // m_Scanner
+    BinarySegmentWriteUint32(seg, 0);    // m_Flags
+    for (int i = 0; i < 2; ++i)          // m_ActionArgs, m_PreActionArgs
+    {
+      BinarySegmentWriteInt32(seg, 0);
+      BinarySegmentWriteNullPointer(seg);
+    }
+
+    for (const char* output : { output1, output2 })
+    {
+      const char* path = dir.Path(output);
+      BinarySegmentWritePointer(file_seg, BinarySegmentPosition(str_seg));
+      BinarySegmentWriteUint32(file_seg, Djb2HashPath(path));
+      BinarySegmentWriteStringData(str_seg, path);
+    }
+
+    EXPECT_TRUE(BinaryWriterFlush(&writer, dir.Path(name)));
+    BinaryWriterDestroy(&writer);
+
+    MmapFileMap(&node_file, dir.Path(name));
+    EXPECT_TRUE(MmapFileValid(&node_file));
+    return static_cast<const NodeData*>(node_file.m_Address);
+  }
+
+  void WriteFile(const char* name, const char* data)
+  {
+    ASSERT_TRUE(dir.WriteFile(name, data));
+  }
+
+  const char* ReadFile(const char* name)
+  {
+    buffer[0] = '\0';
+    if (FILE* f = fopen(dir.Path(name), "rb"))
+    {
+      size_t len = fread(buffer, 1, sizeof buffer - 1, f);
+      buffer[len] = '\0';
+      fclose(f);
+    }
+    return buffer;
+  }
+
+  bool Exists(const char* path)
+  {
+    return GetFileInfo(path).Exists();
+  }
+
+  bool HasObject(const char* data)
+  {
+    HashDigest digest;
+    HashState  h;
+    HashInit(&h);
+    HashUpdate(&h, data, strlen(data));
+    HashFinalize(&h, &digest);
+
+    char path[kMaxPathLength];
+    ActionCachePath(&cache, ActionCacheRecord::kKindObject, digest, path);
+    return Exists(path);
+  }
+
+  void RemoveObject(const char* data)
+  {
+    HashDigest digest;
+    HashState  h;
+    HashInit(&h);
+    HashUpdate(&h, data, strlen(data));
+    HashFinalize(&h, &digest);
+
+    char path[kMaxPathLength];
+    ActionCachePath(&cache, ActionCacheRecord::kKindObject, digest, path);
+    ASSERT_EQ(0, remove(path));
+  }
+
+  int CountFiles()
+  {
+    int count = 0;
+    DIR* d = opendir(dir.m_Dir);
+    while (struct dirent* entry = readdir(d))
+    {
+      if (entry->d_name[0] != '.')
+        ++count;
+    }
+    closedir(d);
+    return count;
+  }
+
+  const ActionCacheState* LoadIndex()
+  {
+    MmapFileUnmap(&index_file);
+    MmapFileMap(&index_file, dir.Path("cache/index.actioncache"));
+    if (!MmapFileValid(&index_file))
+      return nullptr;
+    return static_cast<const ActionCacheState*>(index_file.m_Address);
+  }
+};
+
+static HashDigest MakeKey(const char* name)
+{
+  HashDigest key;
+  HashSingleString(&key, name);
+  return key;
+}
+
+TEST_F(ActionCacheTest, RestoresStoredOutputs)
+{
+  const NodeData* node = MakeNode("node", "a.out", "b.out");
+  HashDigest      key  = MakeKey("action");
+
+  WriteFile("a.out", "output a");
+  WriteFile("b.out", "output b");
+
+  ASSERT_FALSE(ActionCacheHasEntry(&cache, key));
+  ASSERT_TRUE(ActionCacheStore(&cache, key, node));
+  ASSERT_TRUE(ActionCacheHasEntry(&cache, key));
+
+  WriteFile("a.out", "stale a");
+  ASSERT_EQ(0, remove(dir.Path("b.out")));
+
+  ASSERT_TRUE(ActionCacheRestore(&cache, key, node));
+  ASSERT_STREQ("output a", ReadFile("a.out"));
+  ASSERT_STREQ("output b", ReadFile("b.out"));
+}
+
+TEST_F(ActionCacheTest, MissesUnknownKeys)
+{
+  const NodeData* node = MakeNode("node", "a.out", "b.out");
+
+  WriteFile("a.out", "output a");
+  WriteFile("b.out", "output b");
+
+  ASSERT_FALSE(ActionCacheRestore(&cache, MakeKey("action"), node));
+  ASSERT_STREQ("output a", ReadFile("a.out"));
+}
+
+TEST_F(ActionCacheTest, MissingObjectLeavesOutputsAlone)
+{
+  const NodeData* node = MakeNode("node", "a.out", "b.out");
+  HashDigest      key  = MakeKey("action");
+
+  WriteFile("a.out", "output a");
+  WriteFile("b.out", "output b");
+  ASSERT_TRUE(ActionCacheStore(&cache, key, node));
+
+  WriteFile("a.out", "stale a");
+  WriteFile("b.out", "stale b");
+  int file_count = CountFiles();
+
+  RemoveObject("output b");
+
+  ASSERT_FALSE(ActionCacheRestore(&cache, key, node));
+  ASSERT_STREQ("stale a", ReadFile("a.out"));
+  ASSERT_STREQ("stale b", ReadFile("b.out"));
+
+  // No restored copies are left lying around.
+  ASSERT_EQ(file_count, CountFiles());
+}
+
+TEST_F(ActionCacheTest, SavesIndexAndEvictsLeastRecentlyUsed)
+{
+  const NodeData* node = MakeNode("node", "a.out", "b.out");
+
+  static char new_a[20 * 1024], new_b[10 * 1024], big_a[40 * 1024];
+  memset(new_a, 'a', sizeof new_a - 1);
+  memset(new_b, 'b', sizeof new_b - 1);
+  memset(big_a, 'c', sizeof big_a - 1);
+
+  cache.m_MaxSize = 64 * 1024;
+
+  cache.m_AccessTime = 1000;
+  WriteFile("a.out", "old a");
+  WriteFile("b.out", "old b");
+  ASSERT_TRUE(ActionCacheStore(&cache, MakeKey("old"), node));
+
+  cache.m_AccessTime = 2000;
+  WriteFile("a.out", new_a);
+  WriteFile("b.out", new_b);
+  ASSERT_TRUE(ActionCacheStore(&cache, MakeKey("new"), node));
+
+  ASSERT_TRUE(ActionCacheSave(&cache, &heap));
+
+  const ActionCacheState* state = LoadIndex();
+  ASSERT_NE(nullptr, state);
+  ASSERT_TRUE(ActionCacheState::MagicNumber == state->m_MagicNumber);
+  ASSERT_EQ(6, state->m_Records.GetCount());
+  ASSERT_EQ(0u, state->m_EvictCount);
+
+  // Using the old entry again makes the new one the least recently used, so
+  // it's the one trimmed when the next entry pushes the cache over its bound:
+  // its action entry and its largest object go, which is enough.
+  cache.m_AccessTime = 3000;
+  ASSERT_TRUE(ActionCacheRestore(&cache, MakeKey("old"), node));
+
+  cache.m_AccessTime = 4000;
+  WriteFile("a.out", big_a);
+  WriteFile("b.out", "big b");
+  ASSERT_TRUE(ActionCacheStore(&cache, MakeKey("big"), node));
+
+  ASSERT_TRUE(ActionCacheSave(&cache, &heap));
+
+  ASSERT_TRUE(ActionCacheHasEntry(&cache, MakeKey("old")));
+  ASSERT_TRUE(HasObject("old a"));
+  ASSERT_TRUE(HasObject("old b"));
+  ASSERT_TRUE(ActionCacheHasEntry(&cache, MakeKey("big")));
+  ASSERT_TRUE(HasObject(big_a));
+  ASSERT_TRUE(HasObject("big b"));
+  ASSERT_FALSE(ActionCacheHasEntry(&cache, MakeKey("new")));
+  ASSERT_FALSE(HasObject(new_a));
+  ASSERT_TRUE(HasObject(new_b));
+
+  state = LoadIndex();
+  ASSERT_NE(nullptr, state);
+  ASSERT_EQ(2u, state->m_EvictCount);
+  ASSERT_EQ(7, state->m_Records.GetCount());
+}
+
+TEST_F(ActionCacheTest, RejectsDirectoriesTooLongForItsPaths)
+{
+  char long_dir[kMaxPathLength];
+  memset(long_dir, 'x', sizeof long_dir - 1);
+  long_dir[0] = '/';
+  long_dir[sizeof long_dir - 40] = '\0';
+
+  ActionCache other;
+  ASSERT_FALSE(ActionCacheInit(&other, &heap, long_dir, MB(1)));
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "TestHarness.hpp"
+#include "BuildQueue.hpp"
+#include "SignalHandler.hpp"
+#include "MemAllocHeap.hpp"
+#include "Thread.hpp"
+#include "Atomic.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <string.h>
+#include <unistd.h>
+
+using namespace t2;
+
+class BuildQueueTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap heap;
+
+protected:
+  static void SetUpTestCase()
+  {
+    SignalHandlerInit();
+  }
+
+  void SetUp() override
+  {
+    HeapInit(&heap);
+  }
+
+  void TearDown() override
+  {
+    SignalReset();
+    HeapDestroy(&heap);
+  }
+};
+
+struct SlowCallbackState
+{
+  int32_t m_Started;
+  int32_t m_Finished;
+};
+
+static void SlowCallback(void* user_data)
+{
+  SlowCallbackState* state = static_cast<SlowCallbackState*>(user_data);
+  AtomicStoreRelease(&state->m_Started, 1);
+  usleep(50 * 1000);
+  AtomicStoreRelease(&state->m_Finished, 1);
+}
+
+static ThreadRoutineReturnType TUNDRA_STDCALL RaiseSignalOnce(void*)
+{
+  SignalSet("test signal");
+  return 0;
+}
+
+struct SignalLoop
+{
+  int32_t m_Stop;
+  int32_t m_Count;
+};
+
+static ThreadRoutineReturnType TUNDRA_STDCALL RaiseSignalUntilStopped(void* param)
+{
+  SignalLoop* loop = static_cast<SignalLoop*>(param);
+
+  while (!AtomicLoadAcquire(&loop->m_Stop))
+  {
+    SignalSet("test signal");
+    AtomicIncrement(&loop->m_Count);
+  }
+
+  return 0;
+}
+
+TEST_F(BuildQueueTest, SetCallbackWaitsForRunningCallback)
+{
+  SlowCallbackState state = { 0, 0 };
+
+  SignalHandlerSetCallback(SlowCallback, &state);
+  ThreadId thread = ThreadStart(RaiseSignalOnce, nullptr);
+
+  while (!AtomicLoadAcquire(&state.m_Started))
+    usleep(1000);
+
+  // The callback is asleep on the other thread; clearing it must not return
+  // before it has.
+  SignalHandlerSetCallback(nullptr, nullptr);
+  ASSERT_EQ(1, AtomicLoadAcquire(&state.m_Finished));
+
+  ThreadJoin(thread);
+}
+
+TEST_F(BuildQueueTest, DestroyWhileSignalled)
+{
+  BuildQueueConfig config;
+  memset(&config, 0, sizeof config);
+  config.m_Flags             = BuildQueueConfig::kFlagWorkStealing;
+  config.m_Heap              = &heap;
+  config.m_ThreadCount       = 4;
+  config.m_MaxExpensiveCount = 1;
+
+  SignalLoop loop = { 0, 0 };
+  ThreadId   thread = ThreadStart(RaiseSignalUntilStopped, &loop);
+
+  // Each signal wakes every build thread through the queue's callback, so any
+  // that lands after teardown has started touches freed thread state.
+  for (int i = 0; i < 100; ++i)
+  {
+    BuildQueue queue;
+    BuildQueueInit(&queue, &config);
+    BuildQueueDestroy(&queue);
+  }
+
+  AtomicStoreRelease(&loop.m_Stop, 1);
+  ThreadJoin(thread);
+
+  ASSERT_LT(0, AtomicLoadAcquire(&loop.m_Count));
+}
+
+#endif
@@ -0,0 +1,233 @@
+#include "TestHarness.hpp"
+#include "TestTempDir.hpp"
+#include "BuildServer.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace t2;
+
+// Writes what it was asked to do where the test can see it; the server runs
+// in another process.
+static int RecordRequest(void* user_data, int argc, char** argv, bool env_changed)
+{
+  FILE* f = fopen(static_cast<const char*>(user_data), "w");
+  if (!f)
+    return 1;
+
+  for (int i = 0; i < argc; ++i)
+    fprintf(f, "%s\n", argv[i]);
+
+  fprintf(f, "env_changed=%d\n", int(env_changed));
+  fclose(f);
+  return 40 + argc;
+}
+
+class BuildServerTest : public ::testing::Test
+{
+protected:
+  TestTempDir dir;
+  char        dag_file[256];
+  char        socket_path[256];
+  char        result_path[256];
+  char        buffer[1024];
+  pid_t       server_pid;
+
+protected:
+  void SetUp() override
+  {
+    server_pid = -1;
+    ASSERT_TRUE(dir.Create("t2-buildserver"));
+    strcpy(dag_file, dir.Path("test.dag"));
+    strcpy(socket_path, dir.Path("test.dag.server"));
+    strcpy(result_path, dir.Path("result"));
+  }
+
+  void TearDown() override
+  {
+    if (server_pid > 0)
+    {
+      if (!BuildClientStop(dag_file))
+        kill(server_pid, SIGTERM);
+      waitpid(server_pid, nullptr, 0);
+    }
+
+    ASSERT_TRUE(dir.Remove());
+  }
+
+  // Run a server in a child process, and wait until it's listening. A client
+  // that finds no server starts one from the running executable, which
+  // would be this test, so tests only go on once there is one.
+  void StartServer()
+  {
+    server_pid = fork();
+    ASSERT_LE(0, server_pid);
+
+    if (0 == server_pid)
+    {
+      int null_fd = open("/dev/null", O_WRONLY);
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+      _exit(BuildServerRun(dag_file, 4, 4, RecordRequest, result_path));
+    }
+
+    for (int waited = 0; waited < 10000 && !IsSocket(socket_path); waited += 10)
+      usleep(10 * 1000);
+
+    ASSERT_TRUE(IsSocket(socket_path));
+  }
+
+  static bool IsSocket(const char* path)
+  {
+    struct stat st;
+    return 0 == stat(path, &st) && S_ISSOCK(st.st_mode);
+  }
+
+  int Connect()
+  {
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && 0 != connect(fd, (struct sockaddr*) &sa, sizeof sa))
+    {
+      close(fd);
+      fd = -1;
+    }
+    return fd;
+  }
+
+  const char* ReadResult()
+  {
+    buffer[0] = '\0';
+    if (FILE* f = fopen(result_path, "r"))
+    {
+      size_t len = fread(buffer, 1, sizeof buffer - 1, f);
+      buffer[len] = '\0';
+      fclose(f);
+    }
+    return buffer;
+  }
+};
+
+TEST_F(BuildServerTest, RunsClientRequests)
+{
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+
+  const char* args[] = { "tundra2", "-v", "debug" };
+  int exit_code = -1;
+
+  ASSERT_TRUE(BuildClientRun(dag_file, 2, 2, 3, const_cast<char**>(args), &exit_code));
+  ASSERT_EQ(43, exit_code);
+  ASSERT_STREQ("tundra2\n-v\ndebug\nenv_changed=1\n", ReadResult());
+
+  // Same environment the second time around.
+  ASSERT_TRUE(BuildClientRun(dag_file, 2, 2, 2, const_cast<char**>(args), &exit_code));
+  ASSERT_EQ(42, exit_code);
+  ASSERT_STREQ("tundra2\n-v\nenv_changed=0\n", ReadResult());
+}
+
+TEST_F(BuildServerTest, StopsWhenAsked)
+{
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+
+  ASSERT_TRUE(BuildClientStop(dag_file));
+
+  int status = -1;
+  ASSERT_EQ(server_pid, waitpid(server_pid, &status, 0));
+  server_pid = -1;
+
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+  ASSERT_FALSE(IsSocket(socket_path));
+  ASSERT_FALSE(BuildClientStop(dag_file));
+}
+
+TEST_F(BuildServerTest, IgnoresMalformedRequests)
+{
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+
+  int fd = Connect();
+  ASSERT_LE(0, fd);
+
+  static const char garbage[64] = "GET / HTTP/1.0\r\n\r\n";
+  ASSERT_EQ(ssize_t(sizeof garbage), send(fd, garbage, sizeof garbage, 0));
+
+  // Dropped without a reply; the unread rest of it may reset the connection.
+  char reply;
+  ASSERT_GE(0, recv(fd, &reply, 1, 0));
+  close(fd);
+
+  const char* args[] = { "tundra2" };
+  int exit_code = -1;
+
+  ASSERT_TRUE(BuildClientRun(dag_file, 1, 1, 1, const_cast<char**>(args), &exit_code));
+  ASSERT_EQ(41, exit_code);
+}
+
+TEST_F(BuildServerTest, SocketIsOwnerOnly)
+{
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+
+  struct stat st;
+  ASSERT_EQ(0, stat(socket_path, &st));
+  ASSERT_EQ(0u, st.st_mode & 077);
+  ASSERT_EQ(geteuid(), st.st_uid);
+}
+
+TEST_F(BuildServerTest, RefusesOtherUsers)
+{
+  if (0 != geteuid())
+    GTEST_SKIP();
+
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+
+  // Open the way to the socket, so it's the server itself that turns the
+  // other user away.
+  ASSERT_EQ(0, chmod(dir.m_Dir, 0711));
+  ASSERT_EQ(0, chmod(socket_path, 0777));
+
+  pid_t pid = fork();
+  ASSERT_LE(0, pid);
+
+  if (0 == pid)
+  {
+    if (0 != setuid(65534))
+      _exit(2);
+
+    int fd = Connect();
+    if (fd < 0)
+      _exit(3);
+
+    // A request from our own user would have the server wait for the rest
+    // of it; another user's connection is closed straight away.
+    struct pollfd p;
+    p.fd      = fd;
+    p.events  = POLLIN;
+    p.revents = 0;
+
+    char reply;
+    if (1 != poll(&p, 1, 5000) || 0 != recv(fd, &reply, 1, 0))
+      _exit(4);
+
+    _exit(0);
+  }
+
+  int status = -1;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "TestHarness.hpp"
+#include "CommandLine.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemAllocLinear.hpp"
+
+using namespace t2;
+
+class CommandLineTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap heap;
+  MemAllocLinear alloc;
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    LinearAllocInit(&alloc, &heap, MB(1), "test alloc");
+  }
+
+  void TearDown() override
+  {
+    LinearAllocDestroy(&alloc);
+    HeapDestroy(&heap);
+  }
+
+  bool Split(const char* cmd_line)
+  {
+    argv = nullptr;
+    argc = 0;
+    return CommandLineSplit(cmd_line, &alloc, &argv, &argc);
+  }
+
+  const char** argv;
+  int argc;
+};
+
+TEST_F(CommandLineTest, PlainCommand)
+{
+  ASSERT_TRUE(Split("gcc -c -o foo.o -I../include -DFOO=1 foo.c"));
+  ASSERT_EQ(7, argc);
+  ASSERT_STREQ("gcc", argv[0]);
+  ASSERT_STREQ("-c", argv[1]);
+  ASSERT_STREQ("-o", argv[2]);
+  ASSERT_STREQ("foo.o", argv[3]);
+  ASSERT_STREQ("-I../include", argv[4]);
+  ASSERT_STREQ("-DFOO=1", argv[5]);
+  ASSERT_STREQ("foo.c", argv[6]);
+  ASSERT_EQ(nullptr, argv[7]);
+}
+
+TEST_F(CommandLineTest, ExtraBlanks)
+{
+  ASSERT_TRUE(Split("  /usr/bin/ar \t rcs  libfoo.a   a.o b.o  "));
+  ASSERT_EQ(5, argc);
+  ASSERT_STREQ("/usr/bin/ar", argv[0]);
+  ASSERT_STREQ("rcs", argv[1]);
+  ASSERT_STREQ("b.o", argv[4]);
+  ASSERT_EQ(nullptr, argv[5]);
+}
+
+TEST_F(CommandLineTest, Empty)
+{
+  ASSERT_FALSE(Split(""));
+  ASSERT_FALSE(Split("   "));
+}
+
+TEST_F(CommandLineTest, NeedsShell)
+{
+  ASSERT_FALSE(Split("gcc -c foo.c && touch foo.stamp"));
+  ASSERT_FALSE(Split("gcc -c foo.c; true"));
+  ASSERT_FALSE(Split("tr a-z A-Z < in.txt > out.txt"));
+  ASSERT_FALSE(Split("cat a.txt | sort"));
+  ASSERT_FALSE(Split("cc $CFLAGS foo.c"));
+  ASSERT_FALSE(Split("cc `cat flags` foo.c"));
+  ASSERT_FALSE(Split("cc \"-DNAME=a b\" foo.c"));
+  ASSERT_FALSE(Split("cc '-DX' foo.c"));
+  ASSERT_FALSE(Split("cc -DX=\\\"a\\\" foo.c"));
+  ASSERT_FALSE(Split("rm -f *.o"));
+  ASSERT_FALSE(Split("ls ~/foo"));
+  ASSERT_FALSE(Split("cc foo.c # comment"));
+  ASSERT_FALSE(Split("cc foo.c\ncc bar.c"));
+  ASSERT_FALSE(Split("(cd foo; make)"));
+  ASSERT_FALSE(Split("sleep 10 &"));
+}
+
+TEST_F(CommandLineTest, ShellBuiltins)
+{
+  ASSERT_FALSE(Split("cd foo"));
+  ASSERT_FALSE(Split("echo hello"));
+  ASSERT_FALSE(Split("exit 1"));
+  ASSERT_FALSE(Split("CC=gcc make"));
+  ASSERT_TRUE(Split("make CC=gcc"));
+}
@@ -0,0 +1,242 @@
+#include "TestHarness.hpp"
+#include "DigestCache.hpp"
+#include "FileSign.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemAllocLinear.hpp"
+#include "StatCache.hpp"
+#include "Stats.hpp"
+#include "Thread.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace t2;
+
+class DigestCacheTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap heap;
+  DigestCache  cache;
+
+  const char*  state_file = "t2-test-digestcache.tmp";
+  const char*  tmp_file   = "t2-test-digestcache.tmp.tmp";
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    DigestCacheInit(&cache, 1024*1024);
+  }
+
+  void TearDown() override
+  {
+    DigestCacheDestroy(&cache);
+    HeapDestroy(&heap);
+    remove(state_file);
+  }
+
+  // Save, and start over like the next build would.
+  void NextBuild()
+  {
+    ASSERT_TRUE(DigestCacheSave(&cache, &heap, state_file, tmp_file));
+    DigestCacheDestroy(&cache);
+    DigestCacheInit(&cache, 1024*1024);
+    DigestCacheOpen(&cache, state_file);
+  }
+
+  static FileInfo Info(uint64_t timestamp, uint64_t change_stamp = 0)
+  {
+    FileInfo info;
+    info.m_Flags       = FileInfo::kFlagExists | FileInfo::kFlagFile;
+    info.m_Size        = 100;
+    info.m_Timestamp   = timestamp;
+    info.m_ChangeStamp = change_stamp;
+    return info;
+  }
+
+  static void Set(DigestCache* cache, const char* name, const FileInfo& info)
+  {
+    HashDigest digest;
+    HashSingleString(&digest, name);
+    DigestCacheSet(cache, name, Djb2HashPath(name), info, digest);
+  }
+
+  static bool Get(DigestCache* cache, const char* name, const FileInfo& info)
+  {
+    HashDigest digest, expected;
+    HashSingleString(&expected, name);
+    return DigestCacheGet(cache, name, Djb2HashPath(name), info, &digest) && digest == expected;
+  }
+
+  static void Set(DigestCache* cache, const char* name, uint64_t timestamp)
+  {
+    Set(cache, name, Info(timestamp));
+  }
+
+  static bool Get(DigestCache* cache, const char* name, uint64_t timestamp)
+  {
+    return Get(cache, name, Info(timestamp));
+  }
+};
+
+TEST_F(DigestCacheTest, ServesSavedRecordsFromTheIndex)
+{
+  const int count = 1000;
+  char      name[64];
+
+  for (int i = 0; i < count; ++i)
+  {
+    snprintf(name, sizeof name, "t2-test-nowhere/file%d.c", i);
+    Set(&cache, name, i);
+  }
+
+  NextBuild();
+  ASSERT_NE(nullptr, cache.m_State);
+  ASSERT_EQ(count, cache.m_State->m_Records.GetCount());
+  ASSERT_LE(2 * count, cache.m_State->m_Index.GetCount());
+
+  for (int i = 0; i < count; ++i)
+  {
+    snprintf(name, sizeof name, "t2-test-nowhere/file%d.c", i);
+    ASSERT_TRUE(Get(&cache, name, i));
+    ASSERT_FALSE(Get(&cache, name, i + 1));
+  }
+
+  ASSERT_FALSE(Get(&cache, "t2-test-nowhere/missing.c", 0));
+
+  // Nothing was copied out of the saved state to serve those.
+  ASSERT_EQ(0u, cache.m_Table.m_RecordCount);
+}
+
+TEST_F(DigestCacheTest, UpdatedRecordsReplaceSavedOnes)
+{
+  Set(&cache, "t2-test-nowhere/a.c", 1);
+  Set(&cache, "t2-test-nowhere/b.c", 1);
+  NextBuild();
+
+  Set(&cache, "t2-test-nowhere/a.c", 2);
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/a.c", 2));
+  ASSERT_FALSE(Get(&cache, "t2-test-nowhere/a.c", 1));
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/b.c", 1));
+  NextBuild();
+
+  ASSERT_EQ(2, cache.m_State->m_Records.GetCount());
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/a.c", 2));
+  ASSERT_FALSE(Get(&cache, "t2-test-nowhere/a.c", 1));
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/b.c", 1));
+}
+
+TEST_F(DigestCacheTest, DropsRecordsNotAccessedInAWeek)
+{
+  cache.m_AccessTime = time(nullptr) - 8 * 24 * 60 * 60;
+  Set(&cache, "t2-test-nowhere/old.c", 1);
+  Set(&cache, "t2-test-nowhere/used.c", 1);
+  NextBuild();
+
+  // Using a saved record keeps it.
+  ASSERT_EQ(2, cache.m_State->m_Records.GetCount());
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/used.c", 1));
+  NextBuild();
+
+  ASSERT_EQ(1, cache.m_State->m_Records.GetCount());
+  ASSERT_FALSE(Get(&cache, "t2-test-nowhere/old.c", 1));
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/used.c", 1));
+}
+
+TEST_F(DigestCacheTest, ChecksMoreThanTheTimestamp)
+{
+  Set(&cache, "t2-test-nowhere/a.c", Info(1, 10));
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/a.c", Info(1, 10)));
+  NextBuild();
+
+  ASSERT_TRUE(Get(&cache, "t2-test-nowhere/a.c", Info(1, 10)));
+
+  // Written again within the same second.
+  ASSERT_FALSE(Get(&cache, "t2-test-nowhere/a.c", Info(1, 11)));
+
+  FileInfo resized = Info(1, 10);
+  resized.m_Size   = 101;
+  ASSERT_FALSE(Get(&cache, "t2-test-nowhere/a.c", resized));
+}
+
+struct HashingClaim
+{
+  DigestCache* m_Cache;
+  bool         m_Claimed;
+};
+
+static ThreadRoutineReturnType TUNDRA_STDCALL ClaimRoutine(void* param)
+{
+  HashingClaim* claim = (HashingClaim*) param;
+  claim->m_Claimed = DigestCacheBeginHashing(claim->m_Cache, "t2-test-nowhere/a.c", Djb2HashPath("t2-test-nowhere/a.c"));
+  if (claim->m_Claimed)
+    DigestCacheEndHashing(claim->m_Cache, "t2-test-nowhere/a.c", Djb2HashPath("t2-test-nowhere/a.c"));
+  return 0;
+}
+
+TEST_F(DigestCacheTest, HashesEachFileOnceAtATime)
+{
+  ASSERT_TRUE(DigestCacheBeginHashing(&cache, "t2-test-nowhere/a.c", Djb2HashPath("t2-test-nowhere/a.c")));
+  ASSERT_TRUE(DigestCacheBeginHashing(&cache, "t2-test-nowhere/b.c", Djb2HashPath("t2-test-nowhere/b.c")));
+
+  // Another thread wanting the same file waits for it, and doesn't hash it again.
+  HashingClaim claim = { &cache, true };
+  uint32_t     waits  = g_Stats.m_FileDigestWaits;
+  ThreadId     thread = ThreadStart(ClaimRoutine, &claim);
+  for (bool waiting = false; !waiting; )
+  {
+    MutexLock(&cache.m_HashingLock);
+    waiting = g_Stats.m_FileDigestWaits != waits;
+    MutexUnlock(&cache.m_HashingLock);
+  }
+  Set(&cache, "t2-test-nowhere/a.c", 1);
+  DigestCacheEndHashing(&cache, "t2-test-nowhere/a.c", Djb2HashPath("t2-test-nowhere/a.c"));
+  ThreadJoin(thread);
+  ASSERT_FALSE(claim.m_Claimed);
+
+  DigestCacheEndHashing(&cache, "t2-test-nowhere/b.c", Djb2HashPath("t2-test-nowhere/b.c"));
+  ASSERT_EQ(0u, cache.m_Hashing.m_Size);
+
+  // Once it's done, it can be hashed again.
+  ClaimRoutine(&claim);
+  ASSERT_TRUE(claim.m_Claimed);
+}
+
+TEST_F(DigestCacheTest, DigestsLargeAndSmallFiles)
+{
+  MemAllocLinear alloc;
+  StatCache      stat_cache;
+  LinearAllocInit(&alloc, &heap, 1024*1024, "stat cache");
+  StatCacheInit(&stat_cache, &alloc, &heap);
+
+  const char* filename = "t2-test-digest.tmp";
+  const size_t sizes[] = { 0, 1000, 3 * 1024 * 1024 + 17 };
+
+  char* data = (char*) malloc(sizes[2]);
+  for (size_t i = 0; i < sizes[2]; ++i)
+    data[i] = char(i * 7 + (i >> 12));
+
+  for (size_t size : sizes)
+  {
+    FILE* f = fopen(filename, "wb");
+    ASSERT_NE(nullptr, f);
+    fwrite(data, 1, size, f);
+    fclose(f);
+    StatCacheMarkDirty(&stat_cache, filename, Djb2HashPath(filename));
+
+    HashState h;
+    HashDigest expected, digest;
+    HashInit(&h);
+    HashUpdate(&h, data, size);
+    HashFinalize(&h, &expected);
+
+    ASSERT_TRUE(ComputeFileContentDigest(&stat_cache, &cache, filename, Djb2HashPath(filename), &digest));
+    ASSERT_EQ(expected, digest);
+  }
+
+  free(data);
+  remove(filename);
+  StatCacheDestroy(&stat_cache);
+  LinearAllocDestroy(&alloc);
+}
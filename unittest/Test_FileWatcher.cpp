@@ -0,0 +1,213 @@
+#include "TestHarness.hpp"
+#include "FileWatcher.hpp"
+#include "StatCache.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemAllocLinear.hpp"
+#include "TestTempDir.hpp"
+
+#if defined(TUNDRA_LINUX)
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace t2;
+
+class FileWatcherTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap   heap;
+  MemAllocLinear alloc;
+  StatCache      stat_cache;
+  FileWatcher    watcher;
+  TestTempDir    dir;
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    LinearAllocInit(&alloc, &heap, 1024*1024, "stat cache");
+    StatCacheInit(&stat_cache, &alloc, &heap);
+
+    ASSERT_TRUE(dir.Create("t2-watch"));
+    ASSERT_TRUE(FileWatcherInit(&watcher, &heap));
+  }
+
+  void TearDown() override
+  {
+    FileWatcherDestroy(&watcher);
+    StatCacheDestroy(&stat_cache);
+    LinearAllocDestroy(&alloc);
+    HeapDestroy(&heap);
+
+    ASSERT_TRUE(dir.Remove());
+  }
+
+  const char* Path(const char* name)
+  {
+    return dir.Path(name);
+  }
+
+  void WriteFile(const char* name, const char* data)
+  {
+    ASSERT_TRUE(dir.WriteFile(name, data));
+  }
+
+  void Stat(const char* name)
+  {
+    StatCacheStat(&stat_cache, Path(name));
+  }
+
+  // What a build server does between builds.
+  void NextBuild()
+  {
+    FileWatcherCollect(&watcher, &stat_cache);
+    StatCacheDestroy(&stat_cache);
+    LinearAllocReset(&alloc);
+    StatCacheInit(&stat_cache, &alloc, &heap);
+    FileWatcherSeed(&watcher, &stat_cache);
+  }
+
+  bool IsSeeded(const char* name)
+  {
+    const char* p = Path(name);
+    return nullptr != HashTableLookup(&stat_cache.m_Files, Djb2HashPath(p), p);
+  }
+};
+
+TEST_F(FileWatcherTest, KeepsUnchangedFiles)
+{
+  WriteFile("a", "a");
+  WriteFile("b", "b");
+
+  Stat("a");
+  Stat("b");
+  NextBuild();
+
+  // Statted before the directory was watched.
+  ASSERT_FALSE(IsSeeded("a"));
+  ASSERT_FALSE(IsSeeded("b"));
+
+  Stat("a");
+  Stat("b");
+  NextBuild();
+
+  ASSERT_TRUE(IsSeeded("a"));
+  ASSERT_TRUE(IsSeeded("b"));
+
+  WriteFile("a", "changed");
+  NextBuild();
+
+  ASSERT_FALSE(IsSeeded("a"));
+  ASSERT_TRUE(IsSeeded("b"));
+}
+
+TEST_F(FileWatcherTest, NoticesCreatedFiles)
+{
+  Stat("c");
+  NextBuild();
+  Stat("c");
+  NextBuild();
+
+  ASSERT_TRUE(IsSeeded("c"));
+  ASSERT_FALSE(StatCacheStat(&stat_cache, Path("c")).Exists());
+
+  WriteFile("c", "c");
+  NextBuild();
+
+  ASSERT_FALSE(IsSeeded("c"));
+  ASSERT_TRUE(StatCacheStat(&stat_cache, Path("c")).Exists());
+}
+
+TEST_F(FileWatcherTest, NoticesReplacedDirectories)
+{
+  ASSERT_EQ(0, mkdir(Path("sub"), 0777));
+  WriteFile("sub/x", "x");
+
+  Stat("sub/x");
+  NextBuild();
+  Stat("sub/x");
+  NextBuild();
+
+  ASSERT_TRUE(IsSeeded("sub/x"));
+
+  char old_path[256];
+  strcpy(old_path, Path("sub"));
+  ASSERT_EQ(0, rename(old_path, Path("old")));
+  ASSERT_EQ(0, mkdir(Path("sub"), 0777));
+  WriteFile("sub/x", "new x");
+
+  NextBuild();
+  ASSERT_FALSE(IsSeeded("sub/x"));
+
+  Stat("sub/x");
+  NextBuild();
+  Stat("sub/x");
+  NextBuild();
+  ASSERT_TRUE(IsSeeded("sub/x"));
+
+  // Changes to the new directory are seen, and those to the old one don't matter.
+  WriteFile("old/x", "old x");
+  NextBuild();
+  ASSERT_TRUE(IsSeeded("sub/x"));
+
+  WriteFile("sub/x", "newer x");
+  NextBuild();
+  ASSERT_FALSE(IsSeeded("sub/x"));
+}
+
+TEST_F(FileWatcherTest, SkipsSymlinks)
+{
+  WriteFile("target", "t");
+
+  char target[256];
+  strcpy(target, Path("target"));
+  ASSERT_EQ(0, symlink(target, Path("link")));
+
+  Stat("link");
+  NextBuild();
+  Stat("link");
+  NextBuild();
+
+  ASSERT_FALSE(IsSeeded("link"));
+}
+
+TEST_F(FileWatcherTest, TracksDirectoryListings)
+{
+  ASSERT_EQ(0, mkdir(Path("sub"), 0777));
+  WriteFile("sub/x", "x");
+
+  char sub[256];
+  strcpy(sub, Path("sub"));
+
+  // Not trusted until it's been watched since the previous build.
+  NextBuild();
+  ASSERT_FALSE(FileWatcherListingUnchanged(&watcher, sub));
+  NextBuild();
+  ASSERT_TRUE(FileWatcherListingUnchanged(&watcher, sub));
+
+  // Changing a file doesn't change the listing.
+  WriteFile("sub/x", "changed x");
+  NextBuild();
+  ASSERT_TRUE(FileWatcherListingUnchanged(&watcher, sub));
+
+  WriteFile("sub/y", "y");
+  NextBuild();
+  ASSERT_FALSE(FileWatcherListingUnchanged(&watcher, sub));
+  NextBuild();
+  ASSERT_TRUE(FileWatcherListingUnchanged(&watcher, sub));
+
+  ASSERT_EQ(0, remove(Path("sub/y")));
+  NextBuild();
+  ASSERT_FALSE(FileWatcherListingUnchanged(&watcher, sub));
+  NextBuild();
+  ASSERT_TRUE(FileWatcherListingUnchanged(&watcher, sub));
+
+  // A different directory at the same path.
+  ASSERT_EQ(0, rename(sub, Path("old")));
+  ASSERT_EQ(0, mkdir(sub, 0777));
+  NextBuild();
+  ASSERT_FALSE(FileWatcherListingUnchanged(&watcher, sub));
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "Hash.hpp"
+#include "HashSha1.hpp"
+#include "HashVector.hpp"
 #include "TestHarness.hpp"
 #include <cstring>
 
@@ -6,29 +8,27 @@ using namespace t2;
 
 #if ENABLED(USE_SHA1_HASH)
 
-BEGIN_TEST_CASE("DigestToString")
+TEST(HashTest, Sha1DigestToString)
 {
   HashDigest digest;
   memset(&digest, 0, sizeof digest);
-  char str[41];
+  char str[kDigestStringSize];
   DigestToString(str, digest);
-  ASSERT_EQUAL_STRING(str, "0000000000000000000000000000000000000000");
+  ASSERT_STREQ("0000000000000000000000000000000000000000", str);
 }
-END_TEST_CASE
 
-BEGIN_TEST_CASE("Hasher/EmptyInput")
+TEST(HashTest, Sha1EmptyInput)
 {
   HashDigest digest;
   HashState h;
   HashInit(&h);
   HashFinalize(&h, &digest);
-  char str[41];
+  char str[kDigestStringSize];
   DigestToString(str, digest);
-  ASSERT_EQUAL_STRING(str, "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+  ASSERT_STREQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", str);
 }
-END_TEST_CASE
 
-BEGIN_TEST_CASE("Hasher/General")
+TEST(HashTest, Sha1General)
 {
   HashDigest digest;
   HashState h;
@@ -39,30 +39,28 @@ BEGIN_TEST_CASE("Hasher/General")
   }
   HashFinalize(&h, &digest);
 
-  char str[41];
+  char str[kDigestStringSize];
   DigestToString(str, digest);
-  ASSERT_EQUAL_STRING(str, "2683f3ebfa90689caf6d1be96370908e0315bc0b");
+  ASSERT_STREQ("2683f3ebfa90689caf6d1be96370908e0315bc0b", str);
 }
-END_TEST_CASE
 
-BEGIN_TEST_CASE("Hasher/Int64")
+TEST(HashTest, Sha1Int64)
 {
   HashDigest digest;
   HashState h;
   HashInit(&h);
   HashAddInteger(&h, 0x1122334455667788);
   HashFinalize(&h, &digest);
-  char str[41];
+  char str[kDigestStringSize];
   DigestToString(str, digest);
-  ASSERT_EQUAL_STRING(str, "bdc04c0992f37f1e3889f274d0549cc0405811d5");
+  ASSERT_STREQ("bdc04c0992f37f1e3889f274d0549cc0405811d5", str);
 }
-END_TEST_CASE
 
 #endif
 
 TEST(HashTest, CompareEqual)
 {
-#if ENABLED(USE_FAST_HASH)
+#if ENABLED(USE_128BIT_DIGEST)
   HashDigest a, b;
   a.m_Words64[0] = 0; a.m_Words64[1] = 0;
   b.m_Words64[0] = 0; b.m_Words64[1] = 0;
@@ -74,7 +72,7 @@ TEST(HashTest, CompareEqual)
 
 TEST(HashTest, CompareLess)
 {
-#if ENABLED(USE_FAST_HASH)
+#if ENABLED(USE_128BIT_DIGEST)
   HashDigest a, b;
   a.m_Words64[0] = 0; a.m_Words64[1] = 0;
   b.m_Words64[0] = 1; b.m_Words64[1] = 0;
@@ -103,3 +101,127 @@ TEST(HashTest, CompareLess)
 #endif
 }
 
+
+TEST(HashTest, SplitUpdatesMatchOneUpdate)
+{
+  static uint8_t data[5000];
+  for (size_t i = 0; i < sizeof data; ++i)
+    data[i] = uint8_t(i * 31 + (i >> 8));
+
+  HashState  h;
+  HashDigest whole, split;
+  HashInit(&h);
+  HashUpdate(&h, data, sizeof data);
+  HashFinalize(&h, &whole);
+
+  // Mixes buffered input with runs of whole blocks taken straight from the data.
+  const size_t pieces[] = { 1, 63, 64, 65, 130, 1000, 7, 2048 };
+  size_t       offset   = 0;
+  HashInit(&h);
+  for (size_t i = 0; offset < sizeof data; i = (i + 1) % (sizeof pieces / sizeof pieces[0]))
+  {
+    size_t size = pieces[i] < sizeof data - offset ? pieces[i] : sizeof data - offset;
+    HashUpdate(&h, data + offset, size);
+    offset += size;
+  }
+  HashFinalize(&h, &split);
+
+  ASSERT_EQ(whole, split);
+}
+
+TEST(HashTest, VectorKernelsMatchPortableKernel)
+{
+  // Enough stripes to cross several scrambles, fed in uneven runs.
+  const size_t stripe_count = 5 * kVectorHashStripesPerBlock + 3;
+  static uint8_t data[stripe_count * kVectorHashStripeSize];
+  for (size_t i = 0; i < sizeof data; ++i)
+    data[i] = uint8_t(i * 131 + (i >> 7));
+
+  uint64_t expected_acc[kVectorHashLanes];
+  uint32_t expected_index = 0;
+  VectorHashInit(expected_acc);
+  VectorHashGetKernel(0)->m_Accumulate(expected_acc, data, stripe_count, &expected_index);
+
+  uint64_t expected[2];
+  VectorHashFinalize(expected_acc, expected);
+
+  ASSERT_LE(1, VectorHashKernelCount());
+  for (int k = 0; k < VectorHashKernelCount(); ++k)
+  {
+    const VectorHashKernel* kernel = VectorHashGetKernel(k);
+
+    uint64_t acc[kVectorHashLanes];
+    uint32_t index = 0;
+    VectorHashInit(acc);
+
+    const size_t runs[] = { 1, 17, 2, 30, 33 };
+    size_t       done   = 0;
+    for (size_t run : runs)
+    {
+      kernel->m_Accumulate(acc, data + done * kVectorHashStripeSize, run, &index);
+      done += run;
+    }
+    ASSERT_EQ(stripe_count, done);
+    ASSERT_EQ(expected_index, index) << kernel->m_Name;
+
+    uint64_t result[2];
+    VectorHashFinalize(acc, result);
+    ASSERT_EQ(expected[0], result[0]) << kernel->m_Name;
+    ASSERT_EQ(expected[1], result[1]) << kernel->m_Name;
+  }
+}
+
+static void Sha1InitState(uint32_t state[5])
+{
+  state[0] = 0x67452301;
+  state[1] = 0xefcdab89;
+  state[2] = 0x98badcfe;
+  state[3] = 0x10325476;
+  state[4] = 0xc3d2e1f0;
+}
+
+TEST(HashTest, Sha1KernelsHashKnownBlock)
+{
+  // "abc", padded to one block.
+  uint8_t block[64] = { 'a', 'b', 'c', 0x80 };
+  block[63] = 24;
+
+  const uint32_t expected[5] = { 0xa9993e36, 0x4706816a, 0xba3e2571, 0x7850c26c, 0x9cd0d89d };
+
+  ASSERT_LE(1, Sha1KernelCount());
+  for (int k = 0; k < Sha1KernelCount(); ++k)
+  {
+    uint32_t state[5];
+    Sha1InitState(state);
+    Sha1GetKernel(k)->m_Compress(state, block, 1);
+    for (int i = 0; i < 5; ++i)
+      ASSERT_EQ(expected[i], state[i]) << Sha1GetKernel(k)->m_Name;
+  }
+}
+
+TEST(HashTest, Sha1KernelsMatchPortableKernel)
+{
+  const size_t block_count = 37;
+  static uint8_t data[block_count * 64];
+  for (size_t i = 0; i < sizeof data; ++i)
+    data[i] = uint8_t(i * 151 + (i >> 9));
+
+  uint32_t expected[5];
+  Sha1InitState(expected);
+  Sha1GetKernel(0)->m_Compress(expected, data, block_count);
+
+  for (int k = 0; k < Sha1KernelCount(); ++k)
+  {
+    const Sha1Kernel* kernel = Sha1GetKernel(k);
+
+    // Block at a time, then the rest in one go.
+    uint32_t state[5];
+    Sha1InitState(state);
+    for (size_t i = 0; i < 5; ++i)
+      kernel->m_Compress(state, data + i * 64, 1);
+    kernel->m_Compress(state, data + 5 * 64, block_count - 5);
+
+    for (int i = 0; i < 5; ++i)
+      ASSERT_EQ(expected[i], state[i]) << kernel->m_Name;
+  }
+}
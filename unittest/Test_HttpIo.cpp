@@ -0,0 +1,74 @@
+#include "TestHarness.hpp"
+#include "HttpIo.hpp"
+
+using namespace t2;
+
+TEST(HttpIo, ParseUnixSocketAddress)
+{
+  HttpAddress a;
+  ASSERT_TRUE(HttpParseAddress(&a, "unix:/tmp/cache.sock"));
+  ASSERT_TRUE(a.m_IsUnixSocket);
+  ASSERT_STREQ("/tmp/cache.sock", a.m_SocketPath);
+
+  ASSERT_FALSE(HttpParseAddress(&a, "unix:"));
+}
+
+TEST(HttpIo, ParseHttpAddress)
+{
+  HttpAddress a;
+  ASSERT_TRUE(HttpParseAddress(&a, "http://cache.example.com:8080/tundra/"));
+  ASSERT_FALSE(a.m_IsUnixSocket);
+  ASSERT_STREQ("cache.example.com", a.m_Host);
+  ASSERT_STREQ("8080", a.m_Port);
+  ASSERT_STREQ("/tundra", a.m_BasePath);
+
+  ASSERT_TRUE(HttpParseAddress(&a, "cache"));
+  ASSERT_STREQ("cache", a.m_Host);
+  ASSERT_STREQ("80", a.m_Port);
+  ASSERT_STREQ("", a.m_BasePath);
+
+  ASSERT_TRUE(HttpParseAddress(&a, ":9000"));
+  ASSERT_STREQ("", a.m_Host);
+  ASSERT_STREQ("9000", a.m_Port);
+
+  ASSERT_TRUE(HttpParseAddress(&a, "http://[::1]:9000"));
+  ASSERT_STREQ("::1", a.m_Host);
+  ASSERT_STREQ("9000", a.m_Port);
+}
+
+TEST(HttpIo, RejectBadAddress)
+{
+  HttpAddress a;
+  ASSERT_FALSE(HttpParseAddress(&a, "https://cache:443"));
+  ASSERT_FALSE(HttpParseAddress(&a, "cache:port"));
+  ASSERT_FALSE(HttpParseAddress(&a, "cache:80x"));
+}
+
+TEST(HttpIo, ParseStatus)
+{
+  ASSERT_EQ(200, HttpParseStatus("HTTP/1.1 200 OK\nContent-Length: 4"));
+  ASSERT_EQ(404, HttpParseStatus("HTTP/1.0 404 Not Found"));
+  ASSERT_EQ(-1, HttpParseStatus("GET /ac/00 HTTP/1.1"));
+  ASSERT_EQ(-1, HttpParseStatus("HTTP/1.1 OK"));
+}
+
+TEST(HttpIo, ParseRequest)
+{
+  char method[16];
+  char path[64];
+
+  ASSERT_TRUE(HttpParseRequest("PUT /cas/0123 HTTP/1.1\nHost: x", method, sizeof method, path, sizeof path));
+  ASSERT_STREQ("PUT", method);
+  ASSERT_STREQ("/cas/0123", path);
+
+  ASSERT_FALSE(HttpParseRequest("PUT /cas/0123", method, sizeof method, path, sizeof path));
+  ASSERT_FALSE(HttpParseRequest("VERYLONGMETHODNAME / HTTP/1.1", method, sizeof method, path, sizeof path));
+}
+
+TEST(HttpIo, ContentLength)
+{
+  ASSERT_EQ(1234, HttpGetContentLength("HTTP/1.1 200 OK\nServer: x\nContent-Length: 1234"));
+  ASSERT_EQ(17, HttpGetContentLength("HTTP/1.1 200 OK\ncontent-length:17\nServer: x"));
+  ASSERT_EQ(-1, HttpGetContentLength("HTTP/1.1 200 OK\nServer: x"));
+  ASSERT_EQ(-1, HttpGetContentLength("HTTP/1.1 200 OK\nContent-Length: nope"));
+}
@@ -1,8 +1,14 @@
 #include "IncludeScanner.hpp"
+#include "BinaryWriter.hpp"
+#include "DagData.hpp"
+#include "Hash.hpp"
 #include "MemAllocLinear.hpp"
 #include "MemAllocHeap.hpp"
+#include "MemoryMappedFile.hpp"
 #include "TestHarness.hpp"
 
+#include <stdio.h>
+
 using namespace t2;
 
 class IncludeScannerTest : public ::testing::Test
@@ -11,33 +17,71 @@ protected:
   MemAllocHeap heap;
   MemAllocLinear alloc;
 
+  MemoryMappedFile scanner_file;
+
+  const char* scanner_filename = "t2-test-scanner.tmp";
+
 protected:
   void SetUp() override
   {
     HeapInit(&heap);
     LinearAllocInit(&alloc, &heap, 10 * 1024 * 1024, "Test Allocator");
+    MmapFileInit(&scanner_file);
   }
 
   void TearDown() override
   {
+    MmapFileDestroy(&scanner_file);
+    remove(scanner_filename);
     LinearAllocDestroy(&alloc);
     HeapDestroy(&heap);
   }
 
+  // Freeze a generic scanner looking for "include", the way the DAG generator does.
+  const GenericScannerData* MakeGenericScanner(uint32_t flags)
+  {
+    BinaryWriter writer;
+    BinaryWriterInit(&writer, &heap);
+    BinarySegment* seg     = BinaryWriterAddSegment(&writer);
+    BinarySegment* kw_seg  = BinaryWriterAddSegment(&writer);
+    BinarySegment* str_seg = BinaryWriterAddSegment(&writer);
+
+    BinarySegmentWriteInt32(seg, ScannerType::kGeneric);
+    BinarySegmentWriteInt32(seg, 0);
+    BinarySegmentWriteNullPointer(seg);
+    BinarySegmentAlloc(seg, sizeof(HashDigest));
+    BinarySegmentWriteUint32(seg, flags);
+    BinarySegmentWriteInt32(seg, 1);
+    BinarySegmentWritePointer(seg, BinarySegmentPosition(kw_seg));
+
+    BinarySegmentWritePointer(kw_seg, BinarySegmentPosition(str_seg));
+    BinarySegmentWriteInt16(kw_seg, 7);
+    BinarySegmentWriteUint8(kw_seg, 1);
+    BinarySegmentWriteUint8(kw_seg, 0);
+    BinarySegmentWriteStringData(str_seg, "include");
+
+    EXPECT_TRUE(BinaryWriterFlush(&writer, scanner_filename));
+    BinaryWriterDestroy(&writer);
+
+    MmapFileMap(&scanner_file, scanner_filename);
+    EXPECT_TRUE(MmapFileValid(&scanner_file));
+    return static_cast<const GenericScannerData*>(scanner_file.m_Address);
+  }
+
 };
 
 
 TEST_F(IncludeScannerTest, EmptyFile)
 {
   char data[1] = { '\0' };
-  IncludeData* incs = ScanIncludesCpp(data, &alloc);
+  IncludeData* incs = ScanIncludesCpp(data, 0, &alloc);
   ASSERT_EQ(nullptr, incs);
 }
 
 TEST_F(IncludeScannerTest, SingleIncludeNewline)
 {
   char data[] = "#include \"foo.h\"\n";
-  IncludeData* incs = ScanIncludesCpp(data, &alloc);
+  IncludeData* incs = ScanIncludesCpp(data, strlen(data), &alloc);
   ASSERT_NE(nullptr, incs);
 
   ASSERT_STREQ("foo.h", incs->m_String);
@@ -50,7 +94,7 @@ TEST_F(IncludeScannerTest, SingleIncludeNewline)
 TEST_F(IncludeScannerTest, NoClosingTerminator)
 {
   char data[] = "#include <bar.h\n";
-  IncludeData* incs = ScanIncludesCpp(data, &alloc);
+  IncludeData* incs = ScanIncludesCpp(data, strlen(data), &alloc);
   ASSERT_EQ(nullptr, incs);
 }
 
@@ -58,7 +102,7 @@ TEST_F(IncludeScannerTest, SingleIncludeNoNewLine)
 {
   char data[] = "#include <bar.h>";
 
-  IncludeData* incs = ScanIncludesCpp(data, &alloc);
+  IncludeData* incs = ScanIncludesCpp(data, strlen(data), &alloc);
   ASSERT_NE(nullptr, data);
 
   ASSERT_STREQ("bar.h", incs->m_String);
@@ -72,7 +116,7 @@ TEST_F(IncludeScannerTest, MaxWhitespace)
 {
   char data[] = "\n\n   #      include     <bar.h>  \n\n";
 
-  IncludeData* incs = ScanIncludesCpp(data, &alloc);
+  IncludeData* incs = ScanIncludesCpp(data, strlen(data), &alloc);
   ASSERT_NE(nullptr, data);
 
   ASSERT_STREQ("bar.h", incs->m_String);
@@ -89,7 +133,7 @@ TEST_F(IncludeScannerTest, MultiIncludes)
     "#include \"a.h\"\n"
     "#include <foo/bar/baz.h>\n";
 
-  IncludeData* incs = ScanIncludesCpp(data, &alloc);
+  IncludeData* incs = ScanIncludesCpp(data, strlen(data), &alloc);
   ASSERT_NE(nullptr, data);
 
   ASSERT_STREQ("foo.h", incs->m_String);
@@ -114,3 +158,89 @@ TEST_F(IncludeScannerTest, MultiIncludes)
   ASSERT_EQ(true, incs->m_ShouldFollow);
   ASSERT_EQ(nullptr, incs->m_Next);
 }
+
+TEST_F(IncludeScannerTest, OnlyDirectivesAtLineStart)
+{
+  char data[] =
+    "int x = a ## b; #include <no1.h>\n"
+    "\t\r #include <a.h>\r\n"
+    "// #include <no2.h>\n"
+    "#define STR(x) #x\n"
+    "  \"#include <no3.h>\"\n"
+    "#include \"b.h\"";
+
+  IncludeData* incs = ScanIncludesCpp(data, strlen(data), &alloc);
+  ASSERT_NE(nullptr, incs);
+  ASSERT_STREQ("a.h", incs->m_String);
+  ASSERT_NE(nullptr, incs->m_Next);
+  ASSERT_STREQ("b.h", incs->m_Next->m_String);
+  ASSERT_EQ(nullptr, incs->m_Next->m_Next);
+}
+
+TEST_F(IncludeScannerTest, KernelsFindTheSameHashes)
+{
+  char data[200];
+  for (size_t i = 0; i < sizeof data; ++i)
+    data[i] = (i * 7919) % 23 == 0 ? '#' : char('a' + i % 26);
+
+  const char* end = data + sizeof data;
+
+  for (int k = 0; k < IncludeScannerKernelCount(); ++k)
+  {
+    const IncludeScannerKernel* kernel = IncludeScannerGetKernel(k);
+
+    // From every starting point, so hashes fall in every lane and in the tail.
+    for (const char* p = data; p <= end; ++p)
+    {
+      const char* expected = p;
+      while (expected < end && *expected != '#')
+        ++expected;
+
+      ASSERT_EQ(expected, kernel->m_FindHash(p, end)) << kernel->m_Name;
+    }
+
+    ASSERT_EQ(data + 23, kernel->m_FindHash(data + 1, data + 23)) << kernel->m_Name;
+  }
+}
+
+TEST_F(IncludeScannerTest, StopsAtTheEndOfTheBuffer)
+{
+  // No terminator; the include running off the end doesn't count.
+  const char data[] = "#include <a.h>\n#include <b.h";
+  IncludeData* incs = ScanIncludesCpp(data, sizeof data - 1, &alloc);
+  ASSERT_NE(nullptr, incs);
+  ASSERT_STREQ("a.h", incs->m_String);
+  ASSERT_EQ(nullptr, incs->m_Next);
+
+  // The last line counts without a newline, up to the end of the buffer.
+  incs = ScanIncludesCpp(data, 14, &alloc);
+  ASSERT_NE(nullptr, incs);
+  ASSERT_STREQ("a.h", incs->m_String);
+  ASSERT_EQ(nullptr, ScanIncludesCpp(data, 13, &alloc));
+}
+
+TEST_F(IncludeScannerTest, GenericStopsAfterPreamble)
+{
+  const char data[] =
+    "\n"
+    "include \"a.inc\"\n"
+    "  include <b.inc>\n"
+    "mov eax, 1\n"
+    "include \"c.inc\"";
+
+  IncludeData* incs = ScanIncludesGeneric(data, sizeof data - 1, &alloc, *MakeGenericScanner(GenericScannerData::kFlagUseSeparators));
+  int count = 0;
+  for (IncludeData* i = incs; i; i = i->m_Next)
+    ++count;
+  ASSERT_EQ(3, count);
+  ASSERT_STREQ("c.inc", incs->m_Next->m_Next->m_String);
+
+  const uint32_t flags = GenericScannerData::kFlagUseSeparators | GenericScannerData::kFlagStopAfterPreamble;
+  incs = ScanIncludesGeneric(data, sizeof data - 1, &alloc, *MakeGenericScanner(flags));
+  ASSERT_NE(nullptr, incs);
+  ASSERT_STREQ("a.inc", incs->m_String);
+  ASSERT_NE(nullptr, incs->m_Next);
+  ASSERT_STREQ("b.inc", incs->m_Next->m_String);
+  ASSERT_TRUE(incs->m_Next->m_IsSystemInclude);
+  ASSERT_EQ(nullptr, incs->m_Next->m_Next);
+}
@@ -0,0 +1,207 @@
+#include "TestHarness.hpp"
+#include "ScanCache.hpp"
+#include "StatCache.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemAllocLinear.hpp"
+#include "MemoryMappedFile.hpp"
+#include "ScanData.hpp"
+#include "Stats.hpp"
+
+#include <stdio.h>
+
+using namespace t2;
+
+class ScanCacheTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap   heap;
+  MemAllocLinear stat_alloc;
+  MemAllocLinear scan_alloc;
+  StatCache      stat_cache;
+  ScanCache      scan_cache;
+  HashDigest     scanner_guid;
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    LinearAllocInit(&stat_alloc, &heap, 1024*1024, "stat cache");
+    LinearAllocInit(&scan_alloc, &heap, 1024*1024, "scan cache");
+    StatCacheInit(&stat_cache, &stat_alloc, &heap);
+    ScanCacheInit(&scan_cache, &heap, &scan_alloc);
+    HashSingleString(&scanner_guid, "scanner");
+  }
+
+  void TearDown() override
+  {
+    ScanCacheDestroy(&scan_cache);
+    StatCacheDestroy(&stat_cache);
+    LinearAllocDestroy(&scan_alloc);
+    LinearAllocDestroy(&stat_alloc);
+    HeapDestroy(&heap);
+  }
+};
+
+TEST_F(ScanCacheTest, IncludeKeys)
+{
+  HashDigest a, b, c, d;
+  ComputeIncludeKey(&a, scanner_guid, nullptr, "foo.h");
+  ComputeIncludeKey(&b, scanner_guid, "src", "foo.h");
+  ComputeIncludeKey(&c, scanner_guid, "src/sub", "foo.h");
+  ComputeIncludeKey(&d, scanner_guid, nullptr, "foo.h");
+
+  ASSERT_NE(a, b);
+  ASSERT_NE(b, c);
+  ASSERT_EQ(a, d);
+}
+
+TEST_F(ScanCacheTest, RemembersResolutionsUntilSearchedPathsAreWritten)
+{
+  HashDigest key;
+  ComputeIncludeKey(&key, scanner_guid, nullptr, "gen.h");
+
+  FileAndHash result;
+  ASSERT_FALSE(ScanCacheLookupInclude(&scan_cache, &stat_cache, key, &result));
+
+  // Searching for the include finds it missing.
+  const char* dirs[] = { "t2-test-nowhere/a", "t2-test-nowhere/b" };
+  uint32_t generation = stat_cache.m_Generation;
+  ASSERT_FALSE(StatCacheStat(&stat_cache, "t2-test-nowhere/a/gen.h").Exists());
+  ASSERT_FALSE(StatCacheStat(&stat_cache, "t2-test-nowhere/b/gen.h").Exists());
+  ScanCacheInsertInclude(&scan_cache, key, generation, nullptr, dirs, 2);
+
+  ASSERT_TRUE(ScanCacheLookupInclude(&scan_cache, &stat_cache, key, &result));
+  ASSERT_EQ(nullptr, result.m_Filename);
+
+  // Writing somewhere else changes nothing.
+  StatCacheMarkDirty(&stat_cache, "t2-test-nowhere/c/gen.h", Djb2HashPath("t2-test-nowhere/c/gen.h"));
+  ASSERT_TRUE(ScanCacheLookupInclude(&scan_cache, &stat_cache, key, &result));
+
+  // Generating the file where it was looked for does.
+  StatCacheMarkDirty(&stat_cache, "t2-test-nowhere/b/gen.h", Djb2HashPath("t2-test-nowhere/b/gen.h"));
+  ASSERT_FALSE(ScanCacheLookupInclude(&scan_cache, &stat_cache, key, &result));
+
+  generation = stat_cache.m_Generation;
+  ScanCacheInsertInclude(&scan_cache, key, generation, "t2-test-nowhere/b/gen.h", dirs, 2);
+  ASSERT_TRUE(ScanCacheLookupInclude(&scan_cache, &stat_cache, key, &result));
+  ASSERT_STREQ("t2-test-nowhere/b/gen.h", result.m_Filename);
+  ASSERT_EQ(Djb2HashPath("t2-test-nowhere/b/gen.h"), result.m_FilenameHash);
+}
+
+TEST_F(ScanCacheTest, RemembersClosuresUntilFilesInThemChange)
+{
+  const char* header = "t2-test-closure.h";
+  remove(header);
+
+  HashDigest key;
+  ComputeScanCacheKey(&key, "t2-test-nowhere/a.h", scanner_guid);
+
+  ScanCacheClosure result;
+  ASSERT_FALSE(ScanCacheLookupClosure(&scan_cache, &stat_cache, key, 1, &result));
+
+  FileAndHash files[2];
+  files[0].m_Filename     = "t2-test-nowhere/b.h";
+  files[0].m_FilenameHash = Djb2HashPath(files[0].m_Filename);
+  files[1].m_Filename     = header;
+  files[1].m_FilenameHash = Djb2HashPath(header);
+
+  uint64_t         timestamps[2] = { kClosureMissing, kClosureMissing };
+  ScanCacheClosure closure       = { 2, files, timestamps };
+
+  ScanCacheInsertClosure(&scan_cache, key, 1, stat_cache.m_WriteCount, closure, &result);
+  ASSERT_NE(files, result.m_Files);
+
+  ASSERT_TRUE(ScanCacheLookupClosure(&scan_cache, &stat_cache, key, 1, &result));
+  ASSERT_EQ(2, result.m_FileCount);
+  ASSERT_STREQ(header, result.m_Files[1].m_Filename);
+
+  // Closures are for a particular version of the file.
+  ASSERT_FALSE(ScanCacheLookupClosure(&scan_cache, &stat_cache, key, 2, &result));
+
+  // Writing files that aren't in it changes nothing.
+  StatCacheMarkDirty(&stat_cache, "t2-test-nowhere/c.h", Djb2HashPath("t2-test-nowhere/c.h"));
+  ASSERT_TRUE(ScanCacheLookupClosure(&scan_cache, &stat_cache, key, 1, &result));
+
+  // Generating a file in it does.
+  FILE* f = fopen(header, "w");
+  ASSERT_NE(nullptr, f);
+  fclose(f);
+  StatCacheMarkDirty(&stat_cache, header, Djb2HashPath(header));
+  bool found = ScanCacheLookupClosure(&scan_cache, &stat_cache, key, 1, &result);
+  remove(header);
+  ASSERT_FALSE(found);
+}
+
+TEST_F(ScanCacheTest, FindsRecordsBeforeAndAfterSaving)
+{
+  const char* cache_file = "t2-test-scancache.tmp";
+  const int   count      = 1000;
+
+  HashDigest keys[count];
+  char       name[64];
+
+  for (int i = 0; i < count; ++i)
+  {
+    snprintf(name, sizeof name, "t2-test-nowhere/file%d.h", i);
+    ComputeScanCacheKey(&keys[i], name, scanner_guid);
+
+    const char*           include = name;
+    ScanCacheLookupResult result;
+    ScanCacheInsert(&scan_cache, keys[i], i, &include, 1, &result);
+    ASSERT_EQ(1, result.m_IncludedFileCount);
+  }
+
+  // A newer version of a file replaces the old one.
+  const char*           include = "t2-test-nowhere/new.h";
+  ScanCacheLookupResult result;
+  ScanCacheInsert(&scan_cache, keys[7], 1000007, &include, 1, &result);
+  ASSERT_EQ(uint32_t(count), scan_cache.m_RecordCount);
+
+  for (int i = 0; i < count; ++i)
+  {
+    uint64_t timestamp = i == 7 ? 1000007 : i;
+    ASSERT_TRUE(ScanCacheLookup(&scan_cache, keys[i], timestamp, &result, &scan_alloc));
+    ASSERT_FALSE(ScanCacheLookup(&scan_cache, keys[i], timestamp + 1, &result, &scan_alloc));
+  }
+
+  ASSERT_TRUE(ScanCacheSave(&scan_cache, &stat_cache, cache_file, &heap));
+
+  MemoryMappedFile mapping;
+  MmapFileInit(&mapping);
+  MmapFileMap(&mapping, cache_file);
+  ASSERT_TRUE(MmapFileValid(&mapping));
+
+  const ScanData* data = (const ScanData*) mapping.m_Address;
+  ASSERT_TRUE(ScanData::MagicNumber == data->m_MagicNumber);
+  ASSERT_EQ(count, data->m_EntryCount);
+  ASSERT_LE(2 * count, data->m_KeyIndex.GetCount());
+
+  ScanCacheDestroy(&scan_cache);
+  LinearAllocReset(&scan_alloc);
+  ScanCacheInit(&scan_cache, &heap, &scan_alloc);
+  ScanCacheSetCache(&scan_cache, data);
+
+  uint32_t old_hits = g_Stats.m_OldScanCacheHits;
+
+  for (int i = 0; i < count; ++i)
+  {
+    uint64_t timestamp = i == 7 ? 1000007 : i;
+    ASSERT_TRUE(ScanCacheLookup(&scan_cache, keys[i], timestamp, &result, &scan_alloc));
+    ASSERT_EQ(1, result.m_IncludedFileCount);
+  }
+
+  ASSERT_EQ(old_hits + count, g_Stats.m_OldScanCacheHits);
+
+  ASSERT_TRUE(ScanCacheLookup(&scan_cache, keys[7], 1000007, &result, &scan_alloc));
+  ASSERT_STREQ("t2-test-nowhere/new.h", result.m_IncludedFiles[0].m_Filename);
+
+  HashDigest missing;
+  ComputeScanCacheKey(&missing, "t2-test-nowhere/missing.h", scanner_guid);
+  ASSERT_FALSE(ScanCacheLookup(&scan_cache, missing, 0, &result, &scan_alloc));
+
+  ScanCacheDestroy(&scan_cache);
+  ScanCacheInit(&scan_cache, &heap, &scan_alloc);
+  MmapFileUnmap(&mapping);
+  MmapFileDestroy(&mapping);
+  remove(cache_file);
+}
@@ -0,0 +1,173 @@
+#include "TestHarness.hpp"
+#include "TestTempDir.hpp"
+#include "Scanner.hpp"
+#include "ScanCache.hpp"
+#include "StatCache.hpp"
+#include "BinaryWriter.hpp"
+#include "DagData.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemAllocLinear.hpp"
+#include "MemoryMappedFile.hpp"
+#include "Stats.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <string.h>
+#include <algorithm>
+
+using namespace t2;
+
+class ScannerTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap     heap;
+  MemAllocLinear   scratch;
+  MemAllocLinear   stat_alloc;
+  MemAllocLinear   scan_alloc;
+  StatCache        stat_cache;
+  ScanCache        scan_cache;
+  MemoryMappedFile scanner_file;
+  TestTempDir      dir;
+  char             result[256];
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    LinearAllocInit(&scratch, &heap, 1024*1024, "scratch");
+    LinearAllocInit(&stat_alloc, &heap, 1024*1024, "stat cache");
+    LinearAllocInit(&scan_alloc, &heap, 1024*1024, "scan cache");
+    StatCacheInit(&stat_cache, &stat_alloc, &heap);
+    ScanCacheInit(&scan_cache, &heap, &scan_alloc);
+    MmapFileInit(&scanner_file);
+    ASSERT_TRUE(dir.Create("t2-scanner"));
+  }
+
+  void TearDown() override
+  {
+    MmapFileDestroy(&scanner_file);
+    ScanCacheDestroy(&scan_cache);
+    StatCacheDestroy(&stat_cache);
+    LinearAllocDestroy(&scan_alloc);
+    LinearAllocDestroy(&stat_alloc);
+    LinearAllocDestroy(&scratch);
+    HeapDestroy(&heap);
+    ASSERT_TRUE(dir.Remove());
+  }
+
+  // Freeze a C++ scanner without include paths, the way the DAG generator does.
+  const ScannerData* MakeCppScanner()
+  {
+    BinaryWriter writer;
+    BinaryWriterInit(&writer, &heap);
+    BinarySegment* seg = BinaryWriterAddSegment(&writer);
+
+    BinarySegmentWriteInt32(seg, ScannerType::kCpp);
+    BinarySegmentWriteInt32(seg, 0);
+    BinarySegmentWriteNullPointer(seg);
+    HashSingleString((HashDigest*) BinarySegmentAlloc(seg, sizeof(HashDigest)), "cpp");
+
+    EXPECT_TRUE(BinaryWriterFlush(&writer, dir.Path("scanner")));
+    BinaryWriterDestroy(&writer);
+
+    MmapFileMap(&scanner_file, dir.Path("scanner"));
+    EXPECT_TRUE(MmapFileValid(&scanner_file));
+    return static_cast<const ScannerData*>(scanner_file.m_Address);
+  }
+
+  void WriteFile(const char* name, const char* data)
+  {
+    ASSERT_TRUE(dir.WriteFile(name, data));
+  }
+
+  // Names of the files `name` includes, directly or not, relative to the
+  // directory and sorted.
+  const char* Scan(const ScannerData* scanner, const char* name)
+  {
+    char path[256];
+    strcpy(path, dir.Path(name));
+
+    ScanInput input;
+    input.m_ScannerConfig = scanner;
+    input.m_ScratchAlloc  = &scratch;
+    input.m_ScratchHeap   = &heap;
+    input.m_FileName      = path;
+    input.m_ScanCache     = &scan_cache;
+
+    ScanOutput output;
+    EXPECT_TRUE(ScanImplicitDeps(&stat_cache, &input, &output));
+
+    const size_t prefix = strlen(dir.m_Dir) + 1;
+    const char*  names[16];
+    int          count  = output.m_IncludedFileCount;
+    EXPECT_GE(16, count);
+    for (int i = 0; i < count && i < 16; ++i)
+      names[i] = output.m_IncludedFiles[i].m_Filename + prefix;
+    std::sort(names, names + count, [](const char* l, const char* r) { return strcmp(l, r) < 0; });
+
+    result[0] = '\0';
+    for (int i = 0; i < count; ++i)
+    {
+      if (i > 0)
+        strcat(result, " ");
+      strcat(result, names[i]);
+    }
+    return result;
+  }
+};
+
+TEST_F(ScannerTest, ReusesClosuresOfNestedHeaders)
+{
+  const ScannerData* scanner = MakeCppScanner();
+
+  WriteFile("leaf.h", "int leaf;\n");
+  WriteFile("inner.h", "#include \"leaf.h\"\n");
+  WriteFile("outer.h", "#include \"inner.h\"\n");
+  WriteFile("a.c", "#include \"inner.h\"\n");
+  WriteFile("b.c", "#include \"outer.h\"\n");
+
+  // Puts together the closure of inner.h.
+  ASSERT_STREQ("inner.h leaf.h", Scan(scanner, "a.c"));
+
+  uint32_t closure_hits   = g_Stats.m_ClosureCacheHits;
+  uint32_t closure_misses = g_Stats.m_ClosureCacheMisses;
+  uint32_t scan_misses    = g_Stats.m_ScanCacheMisses;
+  uint32_t scan_hits      = g_Stats.m_NewScanCacheHits + g_Stats.m_OldScanCacheHits;
+
+  // The closure of outer.h takes in the one of inner.h rather than walking
+  // inner.h and leaf.h again.
+  ASSERT_STREQ("inner.h leaf.h outer.h", Scan(scanner, "b.c"));
+  ASSERT_EQ(closure_hits + 1, g_Stats.m_ClosureCacheHits);
+  ASSERT_EQ(closure_misses + 1, g_Stats.m_ClosureCacheMisses);
+  ASSERT_EQ(scan_misses + 2, g_Stats.m_ScanCacheMisses);
+  ASSERT_EQ(scan_hits, g_Stats.m_NewScanCacheHits + g_Stats.m_OldScanCacheHits);
+}
+
+TEST_F(ScannerTest, MergedClosuresCoverHeadersStillToBeWalked)
+{
+  const ScannerData* scanner = MakeCppScanner();
+
+  WriteFile("leaf.h", "int leaf;\n");
+  WriteFile("inner.h", "#include \"leaf.h\"\n");
+  WriteFile("outer.h", "#include \"leaf.h\"\n#include \"inner.h\"\n");
+  WriteFile("a.c", "#include \"inner.h\"\n");
+  WriteFile("b.c", "#include \"outer.h\"\n");
+
+  ASSERT_STREQ("inner.h leaf.h", Scan(scanner, "a.c"));
+
+  // leaf.h is reached from outer.h before the closure of inner.h brings it in.
+  ASSERT_STREQ("inner.h leaf.h outer.h", Scan(scanner, "b.c"));
+
+  // Every file in the closure got its timestamp, so it can be reused.
+  HashDigest       key;
+  ScanCacheClosure closure;
+  ComputeScanCacheKey(&key, dir.Path("outer.h"), scanner->m_ScannerGuid);
+  uint64_t timestamp = StatCacheStat(&stat_cache, dir.Path("outer.h")).m_Timestamp;
+  ASSERT_TRUE(ScanCacheLookupClosure(&scan_cache, &stat_cache, key, timestamp, &closure));
+  ASSERT_EQ(2, closure.m_FileCount);
+
+  for (int i = 0; i < closure.m_FileCount; ++i)
+    ASSERT_NE(kClosureMissing, closure.m_Timestamps[i]);
+}
+
+#endif
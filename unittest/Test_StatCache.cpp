@@ -0,0 +1,156 @@
+#include "TestHarness.hpp"
+#include "StatCache.hpp"
+#include "MemAllocHeap.hpp"
+#include "MemAllocLinear.hpp"
+#include "Stats.hpp"
+#include "TestTempDir.hpp"
+
+#if defined(TUNDRA_UNIX)
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace t2;
+
+class StatCacheTest : public ::testing::Test
+{
+protected:
+  MemAllocHeap   heap;
+  MemAllocLinear alloc;
+  StatCache      stat_cache;
+  TestTempDir    dir;
+  char           state_file[256];
+  char           tmp_file[256];
+
+protected:
+  void SetUp() override
+  {
+    HeapInit(&heap);
+    LinearAllocInit(&alloc, &heap, 1024*1024, "stat cache");
+    StatCacheInit(&stat_cache, &alloc, &heap);
+
+    ASSERT_TRUE(dir.Create("t2-statcache"));
+    ASSERT_EQ(0, mkdir(Path("sub"), 0777));
+    strcpy(state_file, Path("state"));
+    strcpy(tmp_file, Path("state.tmp"));
+  }
+
+  void TearDown() override
+  {
+    StatCacheDestroy(&stat_cache);
+    LinearAllocDestroy(&alloc);
+    HeapDestroy(&heap);
+
+    ASSERT_TRUE(dir.Remove());
+  }
+
+  const char* Path(const char* name)
+  {
+    return dir.Path(name);
+  }
+
+  void WriteFile(const char* name, const char* data)
+  {
+    ASSERT_TRUE(dir.WriteFile(name, data));
+  }
+
+  // Pretend the directory was last changed well before the build started.
+  void Backdate(const char* name)
+  {
+    struct timeval times[2];
+    times[0].tv_sec  = times[1].tv_sec  = time(nullptr) - 60;
+    times[0].tv_usec = times[1].tv_usec = 0;
+    ASSERT_EQ(0, utimes(Path(name), times));
+  }
+
+  bool Exists(const char* name)
+  {
+    return StatCacheStat(&stat_cache, Path(name)).Exists();
+  }
+
+  // Save, and start over like the next build would.
+  void NextBuild()
+  {
+    ASSERT_TRUE(StatCacheSave(&stat_cache, &heap, state_file, tmp_file));
+    StatCacheDestroy(&stat_cache);
+    LinearAllocReset(&alloc);
+    StatCacheInit(&stat_cache, &alloc, &heap);
+    StatCacheOpen(&stat_cache, state_file);
+    g_Stats.m_StatCacheKnownMissing = 0;
+  }
+};
+
+TEST_F(StatCacheTest, KeepsMissesInUnchangedDirectories)
+{
+  Backdate("sub");
+
+  ASSERT_FALSE(Exists("sub/a.h"));
+  ASSERT_FALSE(Exists("sub/b.h"));
+  NextBuild();
+
+  ASSERT_FALSE(Exists("sub/a.h"));
+  ASSERT_EQ(1u, g_Stats.m_StatCacheKnownMissing);
+
+  // Misses that weren't looked up by a build are kept too.
+  NextBuild();
+  ASSERT_FALSE(Exists("sub/b.h"));
+  ASSERT_FALSE(Exists("sub/a.h"));
+  ASSERT_EQ(2u, g_Stats.m_StatCacheKnownMissing);
+}
+
+TEST_F(StatCacheTest, ForgetsMissesInChangedDirectories)
+{
+  Backdate("sub");
+
+  ASSERT_FALSE(Exists("sub/a.h"));
+  NextBuild();
+
+  WriteFile("sub/a.h", "a");
+  ASSERT_TRUE(Exists("sub/a.h"));
+  ASSERT_EQ(0u, g_Stats.m_StatCacheKnownMissing);
+}
+
+TEST_F(StatCacheTest, SkipsRecentlyChangedDirectories)
+{
+  ASSERT_FALSE(Exists("sub/a.h"));
+  NextBuild();
+
+  ASSERT_FALSE(Exists("sub/a.h"));
+  ASSERT_EQ(0u, g_Stats.m_StatCacheKnownMissing);
+}
+
+TEST_F(StatCacheTest, KeepsMissesInMissingDirectories)
+{
+  ASSERT_FALSE(Exists("none/a.h"));
+  NextBuild();
+
+  ASSERT_FALSE(Exists("none/a.h"));
+  ASSERT_EQ(1u, g_Stats.m_StatCacheKnownMissing);
+  NextBuild();
+
+  ASSERT_EQ(0, mkdir(Path("none"), 0777));
+  WriteFile("none/a.h", "a");
+  ASSERT_TRUE(Exists("none/a.h"));
+}
+
+TEST_F(StatCacheTest, ProbesFromDirectoryListings)
+{
+  WriteFile("sub/a.h", "a");
+  g_Stats.m_StatCacheListedMisses = 0;
+
+  ASSERT_FALSE(StatCacheProbe(&stat_cache, Path("sub/x.h")).Exists());
+  ASSERT_FALSE(StatCacheProbe(&stat_cache, Path("sub/y.h")).Exists());
+  ASSERT_TRUE(StatCacheProbe(&stat_cache, Path("sub/a.h")).Exists());
+  ASSERT_FALSE(StatCacheProbe(&stat_cache, Path("none/x.h")).Exists());
+  ASSERT_EQ(3u, g_Stats.m_StatCacheListedMisses);
+
+  // Files written during the build show up.
+  WriteFile("sub/b.h", "b");
+  StatCacheMarkDirty(&stat_cache, Path("sub/b.h"), Djb2HashPath(Path("sub/b.h")));
+  ASSERT_TRUE(StatCacheProbe(&stat_cache, Path("sub/b.h")).Exists());
+  ASSERT_EQ(3u, g_Stats.m_StatCacheListedMisses);
+}
+
+#endif
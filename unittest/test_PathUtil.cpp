@@ -109,3 +109,28 @@ TEST(PathUtil, Concat)
     ASSERT_STREQ(test_data[i].expected_output, buffer);
   }
 }
+
+TEST(PathUtil, DirectoryOf)
+{
+  static const struct
+  {
+    const char* path;
+    const char* expected_output;
+  }
+  test_data[] =
+  {
+    { "foo.c",           "." },
+    { "a/foo.c",         "a" },
+    { "a/b/foo.c",       "a/b" },
+    { "/foo.c",          "/" },
+    { "/a/foo.c",        "/a" },
+    { "../foo.c",        ".." },
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(test_data); ++i)
+  {
+    char buffer[kMaxPathLength];
+    ASSERT_TRUE(PathDirectoryOf(buffer, test_data[i].path));
+    ASSERT_STREQ(test_data[i].expected_output, buffer);
+  }
+}